@@ -27,7 +27,23 @@ layout (std140) uniform lyricColors {
 
 const vec4 epsilon = vec4(1.96e-3);
 
-#ifdef ENABLE_TEXTURING
+#ifdef ENABLE_YUV_TEXTURING
+uniform sampler2D texY;
+uniform sampler2D texU;
+uniform sampler2D texV;
+uniform mat4 yuvToRgb;
+
+vec4 yuvTexture() {
+	vec4 yuv = vec4(texture(texY, fragIn.texCoord).r, texture(texU, fragIn.texCoord).r, texture(texV, fragIn.texCoord).r, 1.0);
+	vec3 rgb = clamp((yuvToRgb * yuv).rgb, 0.0, 1.0);
+#ifdef ENABLE_SRGB_DECODE
+	// Same as sampling an sRGB texture
+	rgb = mix(rgb / 12.92, pow((rgb + 0.055) / 1.055, vec3(2.4)), step(0.04045, rgb));
+#endif
+	return vec4(rgb, 1.0);
+}
+#define TEXFUNC yuvTexture()
+#elif defined(ENABLE_TEXTURING)
 uniform sampler2D tex;
 #define TEXFUNC texture(tex, fragIn.texCoord)
 #else
@@ -1,7 +1,10 @@
 #include "analyzer.hh"
 
 #include "util.hh"
-#include "libda/fft.hpp"
+#include "yinpitchdetector.hh"
+
+#include <algorithm>
+#include <cctype>
 #include <cmath>
 #include <iostream>
 #include <iomanip>
@@ -11,110 +14,178 @@
 static const double FFT_MINFREQ = 45.0;
 static const double FFT_MAXFREQ = 5000.0;
 
-Analyzer::Analyzer(double rate, std::string id, unsigned step):
+PitchMethod parsePitchMethod(std::string const& name) {
+	std::string lower = name;
+	std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	if (lower == "fft") return PitchMethod::FFT;
+	if (lower == "yin") return PitchMethod::YIN;
+	throw std::runtime_error("Unknown pitch detection method " + name);
+}
+
+AnalyzerTiming analyzerTiming(double rate, AnalyzerPreset preset) {
+	double window = 1024.0 / 48000.0;
+	double hop = 200.0 / 48000.0;
+	switch (preset) {
+		case AnalyzerPreset::LOW_LATENCY: window /= 2.0; hop = 0.0025; break;
+		case AnalyzerPreset::BALANCED: break;
+		case AnalyzerPreset::ACCURATE: window *= 2.0; break;
+	}
+	// The nearest power of two, in the supported range
+	double const p = std::round(std::log2(rate * window));
+	AnalyzerTiming timing;
+	timing.fftSize = std::size_t(1) << static_cast<unsigned>(clamp<double>(p, FFT_P_MIN, FFT_P_MAX));
+	timing.step = static_cast<unsigned>(clamp<double>(std::round(rate * hop), 1.0, static_cast<double>(timing.fftSize / 4)));
+	return timing;
+}
+
+namespace {
+	unsigned fftPower(std::size_t fftSize) {
+		for (unsigned p = FFT_P_MIN; p <= FFT_P_MAX; ++p) if (fftSize == std::size_t(1) << p) return p;
+		throw std::logic_error("Analyzer FFT size " + std::to_string(fftSize) + " is not a supported power of two.");
+	}
+}
+
+Analyzer::Analyzer(double rate, std::string id, unsigned step, PitchMethod method, std::size_t fftSize):
   m_step(step),
+  m_fftP(fftPower(fftSize)),
+  m_fftSize(fftSize),
+  m_kernel(makeFFTSizeVariant<AnalyzerKernel>(m_fftP)),
+  m_passthrough(std::visit([](auto& kernel) { return kernel->buffer.cursor(); }, m_kernel)),
+  m_resampleIn(std::visit([](auto& kernel) { return std::size_t(kernel->buffer.capacity); }, m_kernel)),
   m_resampleFactor(1.0),
-  m_resamplePos(),
+  m_resamplePos(PassthroughResampler::HISTORY),
   m_rate(rate),
   m_id(id),
-  m_window(FFT_N),
-  m_fftLastPhase(FFT_N / 2),
+  m_window(fftSize),
+  m_fft(fftSize / 2 + 1),
+  m_magnitude(fftSize / 2 + 1),
+  m_phase(fftSize / 2 + 1),
+  m_fftLastPhase(fftSize / 2 + 1),
   m_peak(0.0),
+  m_peaks(fftSize / 2 + 1),
+  m_insertAt(),
+  m_frame(fftSize),
   m_oldfreq(0.0)
 {
-	if (m_step > FFT_N) throw std::logic_error("Analyzer step is larger that FFT_N (ideally it should be less than a fourth of FFT_N).");
+	m_tones.reserve(MAXTONES);
+	m_newTones.reserve(MAXTONES);
+	if (m_step > m_fftSize) throw std::logic_error("Analyzer step is larger that the FFT size (ideally it should be less than a fourth of it).");
+	if (method == PitchMethod::YIN) {
+		m_detector = std::make_unique<YinPitchDetector>(rate);
+		m_frame.resize(m_detector->frameSize());
+		auto const capacity = std::visit([](auto& kernel) { return std::size_t(kernel->buffer.capacity); }, m_kernel);
+		if (m_frame.size() + m_step > capacity) throw std::logic_error("Analyzer input buffer is too small for YIN frames, use a larger FFT size.");
+	}
 	// Hamming window
-	for (size_t i=0; i < FFT_N; i++) {
-		m_window[i] = static_cast<float>(0.53836 - 0.46164 * std::cos(TAU * static_cast<double>(i) / (FFT_N - 1)));
+	for (size_t i=0; i < m_fftSize; i++) {
+		m_window[i] = static_cast<float>(0.53836 - 0.46164 * std::cos(TAU * static_cast<double>(i) / static_cast<double>(m_fftSize - 1)));
 	}
 }
 
 void Analyzer::output(float* begin, float* end, double rate) {
-	constexpr unsigned a = 2;
-	auto const size = m_passthrough.size();
-	auto const out = static_cast<unsigned>((end - begin) / 2) /* stereo */;
+	auto out = static_cast<std::size_t>((end - begin) / 2) /* stereo */;
 	if (out == 0) return;
-	const unsigned in = static_cast<unsigned>(m_resampleFactor * (m_rate / rate) * out + 2 * a) /* lanczos kernel */ + 5 /* safety margin for rounding errors */;
-	std::vector<float> pcm(m_passthrough.capacity);
-	m_passthrough.read(pcm.data(), pcm.data() + in + 4);
-	for (unsigned i = 0; i < out; ++i) {
-		double s = 0.0;
-		unsigned k = static_cast<unsigned>(m_resamplePos);
-		double x = m_resamplePos - k;
-		// Lanczos sampling of input at m_resamplePos
-		for (unsigned j = 0; j <= 2 * a; ++j) s += pcm[k + j] * da::lanc<a>(x - j + a);
-		s *= 5.0;
-		begin[i * 2] = static_cast<float>(begin[i * 2] + s);
-		begin[i * 2 + 1] = static_cast<float>(begin[i * 2 + 1] + s);
-		m_resamplePos += m_resampleFactor;
-	}
-	unsigned num = static_cast<unsigned>(m_resamplePos);
-	m_resamplePos -= num;
-	if (size > 3000) {
-		// Reset
-		m_passthrough.pop(m_passthrough.size() - 700);
-		m_resampleFactor = 1.0;
-	} else {
-		m_passthrough.pop(num);
-		m_resampleFactor = 0.99 * m_resampleFactor + 0.01 * (size > 700 ? 1.02 : 0.98);
-	}
-}
-
-
-namespace {
-	struct Peak {
-		double freq;
-		double db;
-		bool harm[Tone::MAXHARM];
-		Peak(double _freq = 0.0, double _db = -getInf()):
-		  freq(_freq), db(_db)
-		{
-			for (auto& h: harm) h = false;
+	// The pass-through reads the analysis input with a cursor of its own
+	std::visit([&](auto& kernel) {
+		auto& buffer = kernel->buffer;
+		auto const size = buffer.size(m_passthrough);
+		double const step = m_resampleFactor * m_rate / rate;
+		// Very large output buffers are only partially filled rather than reading past the scratch space
+		auto const room = static_cast<double>(m_resampleIn.size() - PassthroughResampler::TAPS) - m_resamplePos;
+		out = std::min(out, static_cast<std::size_t>(room / step) + 1);
+		auto const in = PassthroughResampler::inputSize(m_resamplePos, step, out);
+		// On underrun nothing is mixed and the position is kept, so that playback continues seamlessly
+		if (buffer.read(m_passthrough, m_resampleIn.begin(), m_resampleIn.begin() + static_cast<std::ptrdiff_t>(in))) {
+			m_resamplePos = m_resampler.process(m_resampleIn.data(), m_resamplePos, step, out, [begin](std::size_t i, float s) {
+				s *= 5.0f;
+				begin[i * 2] += s;
+				begin[i * 2 + 1] += s;
+			});
+			// Keep the samples before the position, which the next output still reads
+			auto const num = static_cast<std::ptrdiff_t>(m_resamplePos) - std::ptrdiff_t{ PassthroughResampler::HISTORY };
+			m_resamplePos -= static_cast<double>(num);
+			buffer.pop(m_passthrough, num);
 		}
-		void clear() {
-			freq = 0.0;
-			db = -getInf();
+		if (size > std::min<std::ptrdiff_t>(3000, buffer.capacity * 3 / 4)) {
+			// Reset
+			buffer.pop(m_passthrough, buffer.size(m_passthrough) - 700);
+			m_resampleFactor = 1.0;
+		} else {
+			// Speed up slightly when too much input is buffered, slow down when too little
+			m_resampleFactor = 0.99 * m_resampleFactor + 0.01 * (0.98 + 0.04 * (size > 700));
 		}
-	};
-
-	Peak& match(std::vector<Peak>& peaks, std::size_t pos) {
-		std::size_t best = pos;
-		if (peaks[pos - 1].db > peaks[best].db) best = pos - 1;
-		if (peaks[pos + 1].db > peaks[best].db) best = pos + 1;
-		return peaks[best];
-	}
+	}, m_kernel);
 }
 
-bool Analyzer::calcFFT() {
-	float pcm[FFT_N];
-	// Read FFT_N samples, move forward by m_step samples
-	if (!m_buf.read(pcm, pcm + FFT_N)) return false;
-	m_buf.pop(m_step);
+bool Analyzer::readFrame(float* pcm, std::size_t size) {
+	// Read size samples, move forward by m_step samples
+	bool const ok = std::visit([&](auto& kernel) {
+		if (!kernel->buffer.read(pcm, pcm + size)) return false;
+		kernel->buffer.pop(m_step);
+		return true;
+	}, m_kernel);
+	if (!ok) return false;
 	// Peak level calculation of the most recent m_step samples (the rest is overlap)
-	for (float const* ptr = pcm + FFT_N - m_step; ptr != pcm + FFT_N; ++ptr) {
+	for (float const* ptr = pcm + size - m_step; ptr != pcm + size; ++ptr) {
 		float s = *ptr;
 		float p = s * s;
 		if (p > m_peak) m_peak = p; else m_peak *= 0.999;
 	}
-	// Calculate FFT
-	m_fft = da::fft<FFT_P>(pcm, m_window);
 	return true;
 }
 
+bool Analyzer::calcFFT() {
+	float* pcm = m_frame.data();
+	if (!readFrame(pcm, m_fftSize)) return false;
+	// Calculate FFT with the kernel compiled for this size
+	std::visit([&](auto& kernel) {
+#ifdef USE_LEGACY_FFT
+		constexpr unsigned P = std::remove_reference_t<decltype(*kernel)>::POWER;
+		auto const fft = da::fft<P>(pcm, m_window);
+		std::copy(fft.begin(), fft.begin() + static_cast<std::ptrdiff_t>(m_fft.size()), m_fft.begin());
+#else
+		kernel->fft(pcm, m_window, m_fft.data());
+#endif
+	}, m_kernel);
+	calcSpectrum();
+	return true;
+}
+
+void Analyzer::calcSpectrum() {
+	for (std::size_t k = 1, kMax = maxBin(); k <= kMax; ++k) {
+		float const re = m_fft[k].real();
+		float const im = m_fft[k].imag();
+		m_magnitude[k] = std::sqrt(re * re + im * im);
+		m_phase[k] = std::atan2(im, re);
+	}
+}
+
+std::size_t Analyzer::maxBin() const {
+	return std::min(m_fftSize / 2, size_t(FFT_MAXFREQ / (m_rate / static_cast<double>(m_fftSize))));
+}
+
 void Analyzer::calcTones() {
 	// Precalculated constants
-	const double freqPerBin = m_rate / FFT_N;
+	const double fftSize = static_cast<double>(m_fftSize);
+	const double freqPerBin = m_rate / fftSize;
 	const double stepRate = m_rate / m_step;  // Steps per second
-	const double phaseStep = double(m_step) / FFT_N;
-	const double normCoeff = 1.0 / FFT_N;
+	const double phaseStep = double(m_step) / fftSize;
+	const double normCoeff = 1.0 / fftSize;
 	const double minMagnitude = pow(10, -80.0 / 20.0) / normCoeff; // -80 dB
 	// Limit frequency range of processing
 	const size_t kMin = std::max(size_t(1), size_t(FFT_MINFREQ / freqPerBin));
-	const size_t kMax = std::min(FFT_N / 2, size_t(FFT_MAXFREQ / freqPerBin));
-	std::vector<Peak> peaks(kMax + 1); // One extra to simplify loops
+	const size_t kMax = maxBin();
+	std::vector<Peak>& peaks = m_peaks;
+	for (size_t k = 0; k <= kMax; ++k) peaks[k].clear();  // kMax is one extra to simplify loops
+	auto match = [&peaks](std::size_t pos) -> Peak& {
+		std::size_t best = pos;
+		if (peaks[pos - 1].db > peaks[best].db) best = pos - 1;
+		if (peaks[pos + 1].db > peaks[best].db) best = pos + 1;
+		return peaks[best];
+	};
 	for (size_t k = 1; k <= kMax; ++k) {
-		double magnitude = std::abs(m_fft[k]);
-		double phase = std::arg(m_fft[k]) / TAU;
+		double magnitude = m_magnitude[k];
+		double phase = m_phase[k] / TAU;
 		double delta = phase - m_fftLastPhase[k];
 		m_fftLastPhase[k] = static_cast<float>(phase);
 		// Use phase difference over a step to calculate what the frequency must be
@@ -133,7 +204,8 @@ void Analyzer::calcTones() {
 		prevdb = db;
 	}
 	// Find the tones (collections of harmonics) from the array of peaks
-	tones_t tones;
+	std::vector<Tone>& tones = m_newTones;
+	tones.clear();
 	for (size_t k = kMax - 1; k >= kMin; --k) {
 		if (peaks[k].db < -60.0) continue;
 		// Find the best divider for getting the fundamental from peaks[k]
@@ -143,7 +215,7 @@ void Analyzer::calcTones() {
 			double freq = peaks[k].freq / static_cast<double>(div); // Fundamental
 			int score = 0;
 			for (std::size_t n = 1; n < div && n < 8; ++n) {
-				Peak& p = match(peaks, k * n / div);
+				Peak& p = match(k * n / div);
 				--score;
 				if (p.db < -80.0 || std::abs(p.freq / static_cast<double>(n) / freq - 1.0) > .03) continue;
 				if (n == 1) score += 4; // Extra for fundamental
@@ -161,7 +233,7 @@ void Analyzer::calcTones() {
 		t.db = peaks[k].db;
 		for (std::size_t n = 1; n <= bestDiv; ++n) {
 			// Find the peak for n'th harmonic
-			Peak& p = match(peaks, k * n / bestDiv);
+			Peak& p = match(k * n / bestDiv);
 			if (std::abs(p.freq / static_cast<double>(n) / freq - 1.0) > .03) continue; // Does it match the fundamental freq?
 			if (p.db > t.db - 10.0) {
 				t.db = std::max(t.db, p.db);
@@ -175,36 +247,78 @@ void Analyzer::calcTones() {
 		// If the tone seems strong enough, add it (-3 dB compensation for each harmonic)
 		if (t.db > -40.0 - 3.0 * static_cast<double>(count)) {
 			t.stabledb = t.db;
-			tones.push_back(t);
+			addStrongest(tones, t, MAXTONES);  // On overflow, the weakest tones go, not the lowest ones found last
 		}
 	}
-	mergeWithOld(tones);
-	m_tones.swap(tones);
+	mergeWithOld();
+}
+
+void addStrongest(std::vector<Tone>& tones, Tone const& tone, std::size_t max) {
+	if (tones.size() < max) {
+		tones.push_back(tone);
+		return;
+	}
+	auto const weakest = std::min_element(tones.begin(), tones.end(), [](Tone const& a, Tone const& b) { return a.db < b.db; });
+	if (weakest != tones.end() && weakest->db < tone.db) *weakest = tone;
 }
 
-void Analyzer::mergeWithOld(tones_t& tones) const {
-	tones.sort();
-	auto it = tones.begin();
-	// Iterate over old tones
-	for (auto const& old: m_tones) {
+void Analyzer::mergeWithOld() {
+	std::vector<Tone>& tones = m_newTones;
+	// Sort by frequency; tones were found from the highest bin down, so reversing leaves little to do (unless
+	// addStrongest replaced some)
+	std::reverse(tones.begin(), tones.end());
+	for (std::size_t i = 1; i < tones.size(); ++i) {
+		if (tones[i - 1].freq <= tones[i].freq) continue;
+		Tone const t = tones[i];
+		std::size_t j = i;
+		for (; j > 0 && tones[j - 1].freq > t.freq; --j) tones[j] = tones[j - 1];
+		tones[j] = t;
+	}
+	// Iterate over old tones, merging matches right away and remembering where the others go
+	std::size_t const count = tones.size();
+	std::size_t inserts = 0;
+	std::size_t pos = 0;
+	for (std::size_t i = 0; i < m_tones.size(); ++i) {
+		Tone const& old = m_tones[i];
+		m_insertAt[i] = count + 1;  // Not inserted
 		// Try to find a matching new tone
-		while (it != tones.end() && *it < old) ++it;
+		while (pos < count && tones[pos] < old) ++pos;
 		// If match found
-		if (it != tones.end() && *it == old) {
+		if (pos < count && tones[pos] == old) {
 			// Merge the old tone into the new tone
-			it->age = old.age + 1;
-			it->stabledb = 0.8 * old.stabledb + 0.2 * it->db;
-			it->freq = 0.5 * old.freq + 0.5 * it->freq;
-		} else if (old.db > -70.0) {
-			// Insert a decayed version of the old tone into new tones
-			Tone& t = *tones.insert(it, old);
-			t.db -= 5.0;
-			t.stabledb -= 0.1;
+			Tone& t = tones[pos];
+			t.age = old.age + 1;
+			t.stabledb = 0.8 * old.stabledb + 0.2 * t.db;
+			t.freq = 0.5 * old.freq + 0.5 * t.freq;
+		} else if (old.db > -70.0 && count + inserts < MAXTONES) {
+			// A decayed version of the old tone goes in front of tones[pos]
+			m_insertAt[i] = pos;
+			++inserts;
 		}
 	}
+	// Make room and fill in the decayed old tones, working from the end so that nothing is overwritten
+	tones.resize(count + inserts);
+	std::size_t src = count;
+	std::size_t dst = count + inserts;
+	for (std::size_t i = m_tones.size(); i-- > 0 && dst != src;) {
+		if (m_insertAt[i] > count) continue;
+		while (src > m_insertAt[i]) tones[--dst] = tones[--src];
+		Tone& t = tones[--dst] = m_tones[i];
+		t.db -= 5.0;
+		t.stabledb -= 0.1;
+	}
+	m_tones.swap(tones);
 }
 
 void Analyzer::process() {
+	if (m_detector) {
+		while (readFrame(m_frame.data(), m_frame.size())) {
+			m_newTones.clear();
+			m_detector->analyze(m_frame.data(), m_newTones);
+			mergeWithOld();
+		}
+		return;
+	}
 	// Try calculating FFT and calculate tones until no more data in input buffer
 	while (calcFFT()) calcTones();
 }
@@ -217,7 +331,7 @@ Tone const* Analyzer::findTone(double minfreq, double maxfreq) const {
 	double db = std::max_element(m_tones.begin(), m_tones.end(), Tone::dbCompare)->db;
 	Tone const* best = nullptr;
 	double bestscore = 0;
-	for (tones_t::const_iterator it = m_tones.begin(); it != m_tones.end(); ++it) {
+	for (auto it = m_tones.begin(); it != m_tones.end(); ++it) {
 		if (it->db < db - 20.0 || it->freq < minfreq || it->age < Tone::MINAGE)
 			continue;
 		if (it->freq > maxfreq)
@@ -233,3 +347,63 @@ Tone const* Analyzer::findTone(double minfreq, double maxfreq) const {
 	m_oldfreq = (best ? best->freq : 0.0);
 	return best;
 }
+
+AnalyzerBatch::AnalyzerBatch(std::vector<Analyzer*> analyzers):
+  m_analyzers(std::move(analyzers)),
+  m_fftSize(m_analyzers.empty() ? FFT_N : m_analyzers.front()->m_fftSize),
+  m_fft(makeFFTSizeVariant<BatchFFT>(m_analyzers.empty() ? FFT_P : m_analyzers.front()->m_fftP)),
+  m_pcm(LANES * m_fftSize),
+  m_re(LANES * (m_fftSize / 2 + 1)),
+  m_im(LANES * (m_fftSize / 2 + 1)),
+  m_magnitude(LANES * (m_fftSize / 2 + 1)),
+  m_phase(LANES * (m_fftSize / 2 + 1))
+{}
+
+bool AnalyzerBatch::batched(Analyzer const& a) const {
+	return !a.m_detector && a.m_fftSize == m_fftSize;
+}
+
+void AnalyzerBatch::process() {
+#ifdef USE_LEGACY_FFT
+	for (Analyzer* a: m_analyzers) a->process();
+#else
+	for (Analyzer* a: m_analyzers) if (!batched(*a)) a->process();
+	// Take one frame from every channel that has one, in groups of LANES, until all input is consumed
+	for (bool more = true; more;) {
+		more = false;
+		std::size_t lanes = 0;
+		for (Analyzer* a: m_analyzers) {
+			if (!batched(*a) || !a->readFrame(&m_pcm[lanes * m_fftSize], m_fftSize)) continue;
+			m_group[lanes++] = a;
+			more = true;
+			if (lanes == LANES) {
+				analyze(lanes);
+				lanes = 0;
+			}
+		}
+		if (lanes > 0) analyze(lanes);
+	}
+#endif
+}
+
+void AnalyzerBatch::analyze(std::size_t lanes) {
+	std::size_t const bins = m_fftSize / 2 + 1;
+	std::vector<float> const& window = m_group[0]->m_window;
+	std::visit([&](auto& fft) { (*fft)(m_pcm.data(), m_fftSize, window, m_re.data(), m_im.data()); }, m_fft);
+	std::size_t kMax = 0;
+	for (std::size_t l = 0; l < lanes; ++l) kMax = std::max(kMax, m_group[l]->maxBin());
+	std::size_t const end = (kMax + 1) * LANES;
+	for (std::size_t i = LANES; i < end; ++i) m_magnitude[i] = std::sqrt(m_re[i] * m_re[i] + m_im[i] * m_im[i]);
+	for (std::size_t k = 1; k <= kMax; ++k) {
+		for (std::size_t i = k * LANES, iend = i + lanes; i < iend; ++i) m_phase[i] = std::atan2(m_im[i], m_re[i]);
+	}
+	for (std::size_t l = 0; l < lanes; ++l) {
+		Analyzer& a = *m_group[l];
+		for (std::size_t k = 0; k < bins; ++k) a.m_fft[k] = std::complex<float>(m_re[k * LANES + l], m_im[k * LANES + l]);
+		for (std::size_t k = 1; k <= kMax; ++k) {
+			a.m_magnitude[k] = m_magnitude[k * LANES + l];
+			a.m_phase[k] = m_phase[k * LANES + l];
+		}
+		a.calcTones();
+	}
+}
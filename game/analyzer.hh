@@ -1,17 +1,105 @@
 #pragma once
 
+#include "ipitchdetector.hh"
 #include "ringbuffer.hh"
 #include "tone.hh"
+#include "util.hh"
+#include "libda/fft.hpp"
+#include "libda/resample.hpp"
 
+#include <array>
 #include <cstdint>
 #include <complex>
 #include <vector>
-#include <list>
 #include <algorithm>
 #include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <variant>
 
+/// Default analysis window: 2^FFT_P samples (21 ms at 48 kHz)
 static const unsigned FFT_P = 10;
 static const std::size_t FFT_N = 1 << FFT_P;
+/// Supported analysis windows are 2^FFT_P_MIN ... 2^FFT_P_MAX samples
+static const unsigned FFT_P_MIN = 9;
+static const unsigned FFT_P_MAX = 12;
+
+/// One T<P> for a window size chosen at runtime; each alternative is compiled with its size as a constant
+template <template <unsigned> class T> using FFTSizeVariant = std::variant<
+  std::unique_ptr<T<9>>, std::unique_ptr<T<10>>, std::unique_ptr<T<11>>, std::unique_ptr<T<12>>>;
+
+/// Construct the alternative of FFTSizeVariant for windows of 2^p samples
+template <template <unsigned> class T> FFTSizeVariant<T> makeFFTSizeVariant(unsigned p) {
+	static_assert(FFT_P_MIN == 9 && FFT_P_MAX == 12, "Update FFTSizeVariant for the supported sizes");
+	switch (p) {
+		case 9: return std::make_unique<T<9>>();
+		case 10: return std::make_unique<T<10>>();
+		case 11: return std::make_unique<T<11>>();
+		case 12: return std::make_unique<T<12>>();
+	}
+	throw std::logic_error("Unsupported analyzer FFT size 2^" + std::to_string(p));
+}
+
+/// Input buffer and transform of an Analyzer with windows of 2^P samples
+template <unsigned P> struct AnalyzerKernel {
+	static constexpr unsigned POWER = P;
+	static constexpr std::size_t N = std::size_t(1) << P;
+	RingBuffer<4 * N> buffer;  ///< Room for the sliding window (or a longer YIN frame), engine delays and mic pass-through
+	da::RealFFT<P> fft;
+};
+
+/// Latency/accuracy trade-off for choosing the analysis window
+enum class AnalyzerPreset {
+	LOW_LATENCY,  ///< About 11 ms windows with a 2.5 ms hop
+	BALANCED,  ///< About 21 ms windows with a 4 ms hop (1024 / 200 samples at 48 kHz)
+	ACCURATE  ///< About 43 ms windows with a 4 ms hop, for better resolution of low voices
+};
+
+/// Analysis window and hop in samples
+struct AnalyzerTiming {
+	std::size_t fftSize;
+	unsigned step;
+};
+
+/** Pick the window (a supported power of two) and hop for the sample rate so that they last about as long at any rate. **/
+AnalyzerTiming analyzerTiming(double rate, AnalyzerPreset preset);
+
+/** Read-only view of tones stored contiguously, sorted by frequency **/
+class ToneSpan {
+  public:
+	using value_type = Tone;
+	using size_type = std::size_t;
+	using const_reference = Tone const&;
+	using reference = const_reference;
+	using const_iterator = Tone const*;
+	using iterator = const_iterator;
+	ToneSpan() = default;
+	ToneSpan(Tone const* begin, Tone const* end): m_begin(begin), m_end(end) {}
+	const_iterator begin() const { return m_begin; }
+	const_iterator end() const { return m_end; }
+	size_type size() const { return static_cast<size_type>(m_end - m_begin); }
+	bool empty() const { return m_begin == m_end; }
+	Tone const& operator[](size_type i) const { return m_begin[i]; }
+	Tone const& front() const { return *m_begin; }
+	Tone const& back() const { return *(m_end - 1); }
+
+  private:
+	Tone const* m_begin = nullptr;
+	Tone const* m_end = nullptr;
+};
+
+/** Add a tone to tones of at most max tones; once full, a stronger tone replaces the weakest one (order is not kept). **/
+void addStrongest(std::vector<Tone>& tones, Tone const& tone, std::size_t max);
+
+/// Pitch detection methods available for Analyzer
+enum class PitchMethod {
+	FFT,  ///< Spectral peaks with phase vocoder refinement; finds multiple tones
+	YIN  ///< Time-domain YIN on shorter frames; finds the fundamental only
+};
+
+/** Parse a pitch method name as used in config (fft or yin, case-insensitive); throws std::runtime_error on others. **/
+PitchMethod parsePitchMethod(std::string const& name);
 
  /** class to analyze input audio and transform it to frequency domain to get tone data */
 class Analyzer {
@@ -20,46 +108,116 @@ class Analyzer {
 	const Analyzer& operator=(const Analyzer&) = delete;
 	/// fast fourier transform vector
 	using fft_t = std::vector<std::complex<float>>;
-	/// list of tones
-	using tones_t = std::list<Tone>;
-	/// constructor
-	Analyzer(double rate, std::string id, unsigned step = 200);
+	/// view of the detected tones
+	using tones_t = ToneSpan;
+	/// The maximum number of tones tracked; weaker leftovers from earlier frames are dropped beyond this
+	static const std::size_t MAXTONES = 64;
+	/// constructor; fftSize must be a power of two between 2^FFT_P_MIN and 2^FFT_P_MAX
+	Analyzer(double rate, std::string id, unsigned step = 200, PitchMethod method = PitchMethod::FFT, std::size_t fftSize = FFT_N);
+	/// constructor with window and hop from analyzerTiming()
+	Analyzer(double rate, std::string id, AnalyzerTiming timing, PitchMethod method = PitchMethod::FFT):
+	  Analyzer(rate, std::move(id), timing.step, method, timing.fftSize) {}
 	/** Add input data to buffer. This is thread-safe (against other functions). **/
 	template <typename InIt> void input(InIt begin, InIt end) {
-		m_buf.insert(begin, end);
-		m_passthrough.insert(begin, end);
+		std::visit([&](auto& kernel) { kernel->buffer.insert(begin, end); }, m_kernel);
 	}
 	/** Call this to process all data input so far. **/
 	void process();
-	/** Get the raw FFT. **/
+	/** Get the raw FFT (bins from DC to Nyquist). **/
 	fft_t const& getFFT() const { return m_fft; }
 	/** Get the peak level in dB (negative value, 0.0 = clipping). **/
 	double getPeak() const { return 10.0 * log10(m_peak); }
-	/** Get a list of all tones detected. **/
-	tones_t const& getTones() const { return m_tones; }
+	/** Get all tones detected, sorted by frequency. Valid until the next process(). **/
+	tones_t getTones() const { return tones_t(m_tones.data(), m_tones.data() + m_tones.size()); }
 	/** Find a tone within the singing range; prefers strong tones around 200-400 Hz. **/
 	Tone const* findTone(double minfreq = 65.0, double maxfreq = 1000.0) const;
-	/** Give data away for mic pass-through */
+	/** Mix the input into interleaved stereo output at the given rate for mic pass-through. Realtime-safe: does not allocate. **/
 	void output(float* begin, float* end, double rate);
 	/** Returns the id (color name) of the mic */
 	std::string const& getId() const { return m_id; }
+	/** Returns the analysis window size in samples */
+	std::size_t getFFTSize() const { return m_fftSize; }
+	/** Returns the hop between analysis frames in samples */
+	unsigned getStep() const { return m_step; }
+	/** Returns the pitch detection method in use */
+	PitchMethod getPitchMethod() const { return m_detector ? PitchMethod::YIN : PitchMethod::FFT; }
 
   private:
+	friend class AnalyzerBatch;
+	struct Peak {
+		double freq = 0.0;
+		double db = -getInf();
+		void clear() {
+			freq = 0.0;
+			db = -getInf();
+		}
+	};
+	/// Read the next frame of size samples into pcm and advance by one step; false if not enough input yet.
+	bool readFrame(float* pcm, std::size_t size);
 	bool calcFFT();
+	void calcSpectrum();
 	void calcTones();
-	void mergeWithOld(tones_t& tones) const;
+	void mergeWithOld();
+	/// The highest FFT bin used for tone detection
+	std::size_t maxBin() const;
 
 	const unsigned m_step;
-	RingBuffer<2 * FFT_N> m_buf;  // Twice the FFT size should give enough room for sliding window and for engine delays
-	RingBuffer<4096> m_passthrough;
-	double m_resampleFactor;
-	double m_resamplePos;
+	const unsigned m_fftP;
+	const std::size_t m_fftSize;
+	FFTSizeVariant<AnalyzerKernel> m_kernel;
+	using PassthroughResampler = da::LanczosResampler<>;
+	RingBufferCursor m_passthrough;  ///< Pass-through read position within the input buffer of m_kernel
+	PassthroughResampler m_resampler;
+	std::vector<float> m_resampleIn;  ///< Scratch for the pass-through input, as large as the input buffer
+	double m_resampleFactor;  ///< Adjusts playback speed to keep the pass-through latency steady despite clock drift
+	double m_resamplePos;  ///< Fractional position after m_passthrough (preceded by the resampler's history)
 	double m_rate;
 	std::string m_id;
 	std::vector<float> m_window;
 	fft_t m_fft;
+	std::vector<float> m_magnitude;
+	std::vector<float> m_phase;
 	std::vector<float> m_fftLastPhase;
 	double m_peak;
-	tones_t m_tones;
+	// All tone storage is allocated up front so that the analysis does not touch the heap
+	std::vector<Peak> m_peaks;  ///< Scratch for calcTones, one per FFT bin
+	std::vector<Tone> m_tones;  ///< Current tones, sorted by frequency, at most MAXTONES
+	std::vector<Tone> m_newTones;  ///< Tones being detected, swapped with m_tones once merged
+	std::array<std::size_t, MAXTONES> m_insertAt;  ///< Scratch for mergeWithOld
+	PitchDetectorPtr m_detector;  ///< Replaces the FFT tone detection when set
+	std::vector<float> m_frame;  ///< Input frame for the FFT or m_detector
 	mutable double m_oldfreq;
 };
+
+/**
+* Analyzes the microphones of one capture device together.
+* Frames of up to LANES channels are windowed and transformed in one pass, with the channels interleaved in
+* SIMD lanes, and magnitudes and phases are computed the same way before each Analyzer detects its tones.
+* The resulting tones are the same as with Analyzer::process() on each channel separately.
+* Channels with a different window size than the first one, or with their own pitch detector, are processed alone.
+**/
+class AnalyzerBatch {
+  public:
+#if defined(__AVX__)
+	static constexpr std::size_t LANES = 8;
+#else
+	static constexpr std::size_t LANES = 4;
+#endif
+	explicit AnalyzerBatch(std::vector<Analyzer*> analyzers);
+	/** Process all data input so far on all channels. **/
+	void process();
+	std::vector<Analyzer*> const& analyzers() const { return m_analyzers; }
+
+  private:
+	template <unsigned P> using BatchFFT = da::RealFFTBatch<P, LANES>;
+	bool batched(Analyzer const& a) const;
+	void analyze(std::size_t lanes);
+
+	std::vector<Analyzer*> m_analyzers;
+	Analyzer* m_group[LANES] = {};
+	std::size_t m_fftSize;  ///< Window size of the batched channels
+	FFTSizeVariant<BatchFFT> m_fft;
+	std::vector<float> m_pcm;  ///< LANES frames of m_fftSize samples, one after another
+	std::vector<float> m_re, m_im;  ///< Spectra of all lanes, bin-major
+	std::vector<float> m_magnitude, m_phase;
+};
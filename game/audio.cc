@@ -4,18 +4,22 @@
 #include "configuration.hh"
 #include "libda/portaudio.hpp"
 #include "log.hh"
+#include "realtime.hh"
 #include "screen_songs.hh"
 #include "game.hh"
 #include "analyzer.hh"
 #include "songs.hh"
+#include "spscqueue.hh"
+#include "synth.hh"
 #include "util.hh"
 
-#include "aubio/aubio.h"
-
+#include <array>
 #include <cmath>
 #include <future>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <string_view>
 #include <unordered_map>
 
 int PaHostApiNameToHostApiTypeId (const std::string& name) {
@@ -84,84 +88,36 @@ namespace {
 	}
 }
 
-void AudioClock::timeSync(Seconds audioPos, Seconds length) {
-	constexpr Seconds maxError = 100ms;  // Step the clock instead of skewing if over 100 ms off
-	// Full correction requires locking, but we can update max without lock too
-	std::unique_lock<std::mutex> l(m_mutex, std::defer_lock);
-	Seconds max = audioPos + length;
-	if (!l.try_lock()) {
-		if (max > m_max.load()) m_max = max; // Allow increasing m_max
-		return;
-	}
-	// Mutex locked - do a full update
-	auto now = Clock::now();
-	const Seconds sys = pos_internal(now);  // Current position (based on system clock + corrections)
-	const Seconds audio = audioPos;  // Audio time
-	const Seconds diff = audio - sys;
-	// Skew-based correction only if going forward and relatively well synced
-	if (max > m_max.load() && std::abs(diff.count()) < maxError.count()) {
-		constexpr double fudgeFactor = 0.001;  // Adjustment ratio
-		// Update base position (this should not affect the clock)
-		m_baseTime = now;
-		m_basePos = sys;
-		// Apply a VERY ARTIFICIAL correction for clock!
-		const Seconds valadj = length * 0.1 * rand() / RAND_MAX;  // Dither
-		m_skew += (diff < valadj ? -1.0 : 1.0) * fudgeFactor;
-		// Limits to keep things sane in abnormal situations
-		m_skew = clamp(m_skew, -0.01, 0.01);
-	} else {
-		// Off too much, step to correct time
-		m_baseTime = now;
-		m_basePos = audio;
-		m_skew = 0.0;
-	}
-	m_max = max;
-}
-
-Seconds AudioClock::pos_internal(Time now) const {
-	Seconds t = m_basePos + (1.0 + m_skew) * (now - m_baseTime);
-	return std::min<Seconds>(t, m_max);
-}
-
-Seconds AudioClock::pos() const {
-	std::lock_guard<std::mutex> l(m_mutex);
-	return pos_internal(Clock::now());
-}
-
-Music::Music(Game& game, Audio::Files const& files, unsigned int sr, bool preview)
-: srate(sr), m_preview(preview), m_game(game) {
+Music::Music(Audio::Files const& files, unsigned int sr, bool preview, Audio::Listeners const& listeners)
+: srate(sr), m_preview(preview) {
 	for (auto const& tf /* trackname-filename pair */: files) {
 		if (tf.second.empty()) continue; // Skip tracks with no filenames; FIXME: Why do we even have those here, shouldn't they be eliminated earlier?
-		tracks.emplace(tf.first, std::make_unique<Track>(tf.second, sr));
+		auto const listener = listeners.find(tf.first);
+		// Previews start in the middle, not worth caching
+		tracks.emplace(tf.first, std::make_unique<Track>(tf.second, sr, !preview, listener != listeners.end() ? listener->second : AudioBuffer::Listener()));
 	}
+	m_stems.resize(tracks.size());
+	m_gains.resize(tracks.size());
 	suppressCenterChannel = config["audio/suppress_center_channel"].b();
 }
 
-unsigned Audio::aubio_win_size = 1536;
-unsigned Audio::aubio_hop_size = 768;
-
-std::unique_ptr<aubio_tempo_t, void(*)(aubio_tempo_t*)> Audio::aubioTempo =
-					std::unique_ptr<aubio_tempo_t, void(*)(aubio_tempo_t*)>(
-						new_aubio_tempo(
-							"default",
-							Audio::aubio_win_size,
-							Audio::aubio_hop_size,
-							static_cast<uint_t>(Audio::getSR())),[](aubio_tempo_t* p) {
-							if (p != nullptr) {
-								del_aubio_tempo(p);
-								}
-							}
-					);
-
-std::recursive_mutex Audio::aubio_mutex;
-
-bool Music::operator()(float* begin, float* end) {
+bool Music::operator()(float* begin, float* end, float volume, Time when) {
 	std::int64_t samples = end - begin;
-	m_clock.timeSync(durationOf(m_pos), durationOf(samples)); // Keep the clock synced
+	m_clock.timeSync(durationOf(m_pos), durationOf(samples), when); // Keep the clock synced
 	bool eof = true;
-	Buffer mixbuf(static_cast<size_t>(samples));
-	for (auto& kv: tracks) {
-		Track& t = *kv.second;
+	bool fadedOut = false;
+	// Mix in parts that fit the stem buffers, ramping the gains of the tracks from the previous part to this one
+	for (std::int64_t done = 0; done < samples && !fadedOut;) {
+		std::int64_t const n = std::min(samples - done, static_cast<std::int64_t>(2 * stemFrames));
+		std::size_t const frames = static_cast<std::size_t>(n / 2);
+		float const levelBegin = static_cast<float>(fadeLevel) * volume;
+		fadeLevel += fadeRate * static_cast<double>(frames);
+		if (fadeLevel <= 0.0) { fadeLevel = 0.0; fadedOut = true; }
+		if (fadeLevel > 1.0) { fadeLevel = 1.0; fadeRate = 0.0; }
+		float const levelEnd = static_cast<float>(fadeLevel) * volume;
+		std::size_t count = 0;
+		for (auto& kv: tracks) {
+			Track& t = *kv.second;
 // #if 0 // FIXME: Include this code bit once there is a sane pitch shifting algorithm
 // //            if (it->first == "guitar") std::cout << t.pitchFactor << std::endl;
 //             if (t.pitchFactor != 0) { // Pitch shift
@@ -178,22 +134,23 @@ bool Music::operator()(float* begin, float* end) {
 //             // Otherwise just get the audio and mix it straight away
 //             } else
 // #endif
-		if (t.audioBuffer.read(mixbuf.data(), static_cast<std::int64_t>(mixbuf.size()), m_pos, static_cast<float>(t.fadeLevel))) eof = false;
-	}
-	m_pos += samples;
-	const float volume = static_cast<float>(m_preview ? config["audio/preview_volume"].ui() : config["audio/music_volume"].ui()) / 100.0f;
-	for (size_t i = 0, iend = mixbuf.size(); i != iend; ++i) {
-		if (i % 2 == 0) {
-			fadeLevel += fadeRate;
-			if (fadeLevel <= 0.0f) return false;
-			if (fadeLevel > 1.0f) { fadeLevel = 1.0f; fadeRate = 0.0f; }
+			std::fill(t.stem.begin(), t.stem.begin() + n, 0.0f);
+			if (t.audioBuffer.read(t.stem.data(), n, m_pos + done)) eof = false;
+			float const gain = static_cast<float>(t.fadeLevel);
+			m_stems[count] = t.stem.data();
+			m_gains[count] = { t.gain * levelBegin, gain * levelEnd };
+			t.gain = gain;
+			++count;
 		}
-		begin[i] += static_cast<float>(mixbuf[i] * fadeLevel * volume);
+		da::mix_stems(begin + done, m_stems.data(), m_gains.data(), count, frames);
+		done += n;
 	}
+	if (fadedOut) return false;
+	m_pos += samples;
 	// suppress center channel vocals
 	if(suppressCenterChannel && !m_preview) {
 		float diffLR;
-		for (size_t i=0; i<mixbuf.size(); i+=2) {
+		for (std::int64_t i = 0; i < samples; i += 2) {
 			diffLR = begin[i] - begin[i+1];
 			begin[i] = diffLR;
 			begin[i+1] = diffLR;
@@ -209,65 +166,18 @@ double Music::duration() const {
 }
 
 bool Music::prepare() {
-	bool ready = true;
 	for (auto& kv: tracks) {
-		auto& audioBuffer = kv.second->audioBuffer;
-		if (audioBuffer.prepare(m_pos)) {
-			if (kv.first == "background" && m_preview && m_pos > 0) {
-				auto previewSamples = audioBuffer.makePreviewBuffer();
-				fvec_t* previewBeats = ScreenSongs::previewBeatsBuffer.get();
-				intptr_t readptr = 0;
-				fvec_t* tempoSamplePtr = new_fvec(Audio::aubio_hop_size);
-				std::lock_guard<std::recursive_mutex> l(Audio::aubio_mutex);
-				ScreenSongs* sSongs = dynamic_cast<ScreenSongs*>(m_game.getScreen("Songs"));
-				if (!sSongs->getSongs().currentPtr()) return false;
-				double pstart = sSongs->getSongs().currentPtr()->getPreviewStart();
-				pstart = (std::isnan(pstart) ? 0.0 : pstart);
-				double first_period = 0.0, first_beat = 0.0;
-				std::vector<double> extra_beats;
-				Song::Beats& beats = sSongs->getSongs().currentPtr()->beats;
-				if (!sSongs->getSongs().currentPtr()->hasControllers()) {
-				while ((readptr + Audio::aubio_hop_size) <= previewSamples->length) {
-					tempoSamplePtr->data = &previewSamples->data[readptr];
-					aubio_tempo_do(Audio::aubioTempo.get(),tempoSamplePtr,previewBeats);
-					if (previewBeats->data[0] != 0) {
-						double beatSecs = aubio_tempo_get_last_s(Audio::aubioTempo.get());
-							if (beats.empty()) { // Store time and period of first detected beat.
-								first_beat = beatSecs;
-								first_period = aubio_tempo_get_period_s(Audio::aubioTempo.get());
-							}
-						beats.push_back(beatSecs + pstart);
-					}
-					readptr += Audio::aubio_hop_size;
-				}
-					if (!beats.empty()) {
-						double newBeat = first_beat - first_period;
-						while (newBeat > 0.02) {
-							extra_beats.push_back(newBeat + pstart);
-							newBeat -= first_period;
-						}
-						beats.insert(beats.begin(),extra_beats.rbegin(),extra_beats.rend());
-					}
-				}
-			}
-		continue;  // Buffering done
-		}
-		ready = false;  // Need to wait for buffering
-		break;
+		if (!kv.second->audioBuffer.prepare(m_pos)) return false;  // Need to wait for buffering
 	}
-	return ready;
+	return true;
 }
 
-void Music::trackFade(std::string const& name, double fadeLevel) {
-	auto it = tracks.find(name);
-	if (it == tracks.end()) return;
-	it->second->fadeLevel = fadeLevel;
+void Music::trackFade(std::string_view name, double fadeLevel) {
+	for (auto& kv: tracks) if (kv.first == name) kv.second->fadeLevel = fadeLevel;
 }
 
-void Music::trackPitchBend(std::string const& name, double pitchFactor) {
-	auto it = tracks.find(name);
-	if (it == tracks.end()) return;
-	it->second->pitchFactor = pitchFactor;
+void Music::trackPitchBend(std::string_view name, double pitchFactor) {
+	for (auto& kv: tracks) if (kv.first == name) kv.second->pitchFactor = pitchFactor;
 }
 
 struct Sample {
@@ -277,7 +187,8 @@ struct Sample {
 	bool eof;
   public:
 	Sample(fs::path const& filename, unsigned sr) : m_pos(), audioBuffer(filename, sr), eof(true) { }
-	void operator()(float* begin, float* end) {
+	/// Mix into the range using mixbuf (of at least the same size) as scratch space
+	void operator()(float* begin, float* end, float* mixbuf, float volume) {
 		if(eof) {
 			// No more data to play in this sample
 			return;
@@ -287,13 +198,12 @@ struct Sample {
 			return;
 		}
 		std::int64_t size = end - begin;
-		std::vector<float> mixbuf(static_cast<size_t>(size));
-		if(!audioBuffer.read(mixbuf.data(), size, m_pos, 1.0)) {
+		std::fill(mixbuf, mixbuf + size, 0.0f);
+		if(!audioBuffer.read(mixbuf, size, m_pos, 1.0)) {
 			eof = true;
 		}
-		const auto failVolume = static_cast<float>(config["audio/fail_volume"].ui()) / 100.0f;
-		for (size_t i = 0, iend = mixbuf.size(); i != iend; ++i) {
-			begin[i] += mixbuf[i] * failVolume;
+		for (std::int64_t i = 0; i != size; ++i) {
+			begin[i] += mixbuf[i] * volume;
 		}
 		m_pos += end - begin;
 	}
@@ -303,45 +213,86 @@ struct Sample {
 	}
 };
 
-struct Synth {
-  private:
-	Notes m_notes;
-	double srate; ///< Sample rate
+struct Command {
+	enum class Type { TRACK_FADE, TRACK_PITCHBEND, SAMPLE_RESET } type;
+	std::array<char, 32> name;  ///< Track or sample name, of fixed size so that passing commands never allocates
+	double factor;
+	std::int64_t pos;  ///< Output position (in frames) at which the command takes effect
+	unsigned generation;  ///< Output::generation when issued
+	std::string_view track() const { return name.data(); }
+};
+
+/**
+* Output position of the latest playback callback and the time when it was called, for scheduling commands.
+* The values are published with a sequence counter so that other threads never read a half-updated set.
+**/
+class OutputPosition {
+	std::atomic<unsigned> m_seq{ 0 };
+	std::atomic<std::int64_t> m_pos{ 0 };  ///< Frames output before the latest block
+	std::atomic<std::int64_t> m_frames{ 0 };  ///< Size of the latest block
+	std::atomic<Clock::rep> m_time{ 0 };
   public:
-	Synth(Notes const& notes, unsigned int sr) : m_notes(notes), srate(sr) {}
-	void operator()(float* begin, float* end, double position) {
-		static double phase = 0.0;
-		for (float *i = begin; i < end; ++i) *i *= 0.3f; // Decrease music volume
-		std::int64_t size = end - begin;
-		if (end <= begin) return;
-		std::vector<float> mixbuf(static_cast<size_t>(size));
-		Notes::const_iterator it = m_notes.begin();
-
-		while (it != m_notes.end() && it->end < position) ++it;
-		if (it == m_notes.end() || it->type == Note::Type::SLEEP || it->begin > position) { phase = 0.0; return; }
-		float note = std::fmod(it->note, 12.0f);
-		double d = (note + 1.0) / 13.0;
-		double freq = MusicalScale().setNote(note + 4.0 * 12.0).getFreq();
-		double value = 0.0;
-		// Synthesize tones
-		for (size_t i = 0, iend = mixbuf.size(); i != iend; ++i) {
-			if (i % 2 == 0) {
-				value = d * 0.2 * std::sin(phase) + 0.2 * std::sin(2 * phase) + (1.0 - d) * 0.2 * std::sin(4 * phase);
-				phase += TAU * freq / srate;
-			}
-			begin[i] += static_cast<float>(value);
-		}
+	/// Called by the callback at the start of each block
+	void update(std::int64_t pos, std::int64_t frames, Time now) {
+		unsigned const seq = m_seq.load(std::memory_order_relaxed);
+		m_seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_pos.store(pos, std::memory_order_relaxed);
+		m_frames.store(frames, std::memory_order_relaxed);
+		m_time.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+		m_seq.store(seq + 2, std::memory_order_release);
+	}
+	/**
+	* The position where a command issued now should take effect.
+	* The block following the latest one is the first that can still be changed. Within it the command is offset by
+	* the time elapsed since the latest callback, so that commands keep their relative timing instead of all
+	* snapping to block boundaries.
+	**/
+	std::int64_t target(double rate) const {
+		unsigned seq;
+		std::int64_t pos, frames;
+		Clock::rep time;
+		do {
+			seq = m_seq.load(std::memory_order_acquire);
+			pos = m_pos.load(std::memory_order_relaxed);
+			frames = m_frames.load(std::memory_order_relaxed);
+			time = m_time.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while (seq % 2 != 0 || seq != m_seq.load(std::memory_order_relaxed));
+		if (seq == 0) return 0;  // No callbacks yet, apply as soon as possible
+		Seconds const elapsed = Clock::now() - Time(Clock::duration(time));
+		auto const offset = static_cast<std::int64_t>(elapsed.count() * rate);
+		return pos + frames + clamp<std::int64_t>(offset, 0, std::max<std::int64_t>(frames - 1, 0));
 	}
 };
 
-struct Command {
-	enum class Type { TRACK_FADE, TRACK_PITCHBEND, SAMPLE_RESET } type;
-	std::string track;
-	double factor;
+/// Config values used by the playback callback, mirrored into atomics so that the audio thread never looks them up
+struct OutputSettings {
+	std::atomic<float> musicVolume{ 1.0f };
+	std::atomic<float> previewVolume{ 1.0f };
+	std::atomic<float> failVolume{ 1.0f };
+	std::atomic<bool> passThrough{ false };
+	std::atomic<float> passThroughAmp{ 1.0f };  ///< Music amplification when pass-through is enabled
+
+	/// Copy the current values from config (not to be called from the audio thread)
+	void update() {
+		static ConfigItem& music = config["audio/music_volume"];
+		static ConfigItem& preview = config["audio/preview_volume"];
+		static ConfigItem& fail = config["audio/fail_volume"];
+		static ConfigItem& pass = config["audio/pass-through"];
+		static ConfigItem& passRatio = config["audio/pass-through_ratio"];
+		musicVolume = static_cast<float>(music.ui()) / 100.0f;
+		previewVolume = static_cast<float>(preview.ui()) / 100.0f;
+		failVolume = static_cast<float>(fail.ui()) / 100.0f;
+		passThrough = pass.b();
+		passThroughAmp = 1.0f / passRatio.f();
+	}
 };
 
 /// Audio output callback wrapper. The playback Device calls this when it needs samples.
 struct Output {
+	/// Streams that may be playing at once (kept preallocated so that the callback never grows the containers)
+	static constexpr std::size_t maxStreams = 16;
 	std::mutex mutex;
 	std::mutex samples_mutex;
 	std::mutex synth_mutex;
@@ -350,48 +301,155 @@ struct Output {
 	std::vector<std::unique_ptr<Music>> playing, disposing;
 	std::vector<Analyzer*> mics;  // Used for audio pass-through
 	std::unordered_map<std::string, std::unique_ptr<Sample>> samples;
-	std::vector<Command> commands;
+	std::mutex command_mutex;  ///< Serializes the senders of commands (never locked by the callback)
+	SpscQueue<Command, 256> commands;
+	std::atomic<unsigned> generation{ 0 };  ///< Incremented by new music; older track commands are dropped
+	std::atomic<std::uint64_t> lateCommands{ 0 };  ///< Commands applied after the position they were scheduled for
+	std::atomic<void const*> started{ nullptr };  ///< Music that the callback started playing, not logged yet (see logStarted)
+	AudioClock clock;  ///< Follows the clock of the current music (NaN if none), so that the position can be read without locking
+	std::atomic<double> length{ getNaN() };  ///< Duration of the current music (NaN if none)
+	std::atomic<bool> active{ false };  ///< Whether any music is playing (including fading out)
+	std::atomic<unsigned> clockGeneration{ 0 };  ///< The generation of the music that clock, length and active refer to
+	unsigned m_startedGeneration = 0;  ///< The generation of the latest music started (only accessed by the callback)
+	OutputPosition position;
+	std::int64_t m_pos = 0;  ///< Frames output so far (only accessed by the callback)
+	Time m_lastCallback;  ///< When the previous block was requested (only accessed by the callback)
+	std::int64_t m_lastFrames = 0;  ///< Size of the previous block (only accessed by the callback)
+	DurationHistogram jitter;  ///< Deviation of the callback intervals from the durations of the previous blocks
+	LatencyProbe probe;
 	std::atomic<bool> paused{ false };
-	Output(): paused(false) {}
+	OutputSettings settings;
+	std::vector<float> mixbuf;  ///< Scratch space for mixing the streams, see prepare()
+	double sampleRate = 48000.0;  ///< Of the playback device
+	Output(): paused(false) {
+		playing.reserve(maxStreams);
+		disposing.reserve(maxStreams);
+		settings.update();
+		clock.clear();
+	}
 
-	void callbackUpdate() {
-		std::unique_lock<std::mutex> l(mutex, std::try_to_lock);
-		if (!l.owns_lock()) return;  // No update now, try again later (cannot stop and wait for mutex to be released)
-		// Move from preloading to playing, if ready
-		if (preloading && preloading->prepare()) {
-			SpdLogger::debug(LogSystem::AUDIO, "preload done -> playing: {}", fmt::ptr(preloading.get()));
-			if (!playing.empty()) playing[0]->fadeRate = -preloading->fadeRate;  // Fade out the old music
-			playing.insert(playing.begin(), std::move(preloading));
+	/// Allocate the scratch space for callbacks of up to maxFrames frames (must be called before the device starts)
+	void prepare(std::size_t maxFrames, double rate) {
+		mixbuf.assign(2 * maxFrames, 0.0f);
+		sampleRate = rate;
+	}
+
+	/// Queue a command for the callback, to take effect at the current position (called from the game thread)
+	void command(Command::Type type, std::string const& name, double factor) {
+		Command cmd{};
+		if (name.size() >= cmd.name.size()) {
+			SpdLogger::warn(LogSystem::AUDIO, "Audio command ignored, name too long: {}", name);
+			return;
 		}
-		// Process commands
-		for (auto const& cmd: commands) {
-			switch (cmd.type) {
+		cmd.type = type;
+		std::copy(name.begin(), name.end(), cmd.name.begin());
+		cmd.factor = factor;
+		std::lock_guard<std::mutex> l(command_mutex);
+		cmd.pos = position.target(sampleRate);
+		cmd.generation = generation.load(std::memory_order_relaxed);
+		if (!commands.push(cmd)) SpdLogger::warn(LogSystem::AUDIO, "Audio command queue full, command for {} dropped.", name);
+	}
+
+	/// Apply the queued commands due at position pos (in frames), return the position of the next one still pending
+	std::int64_t applyCommands(std::int64_t pos, bool samplesLocked) {
+		for (Command const* cmd; (cmd = commands.front()) != nullptr; commands.pop()) {
+			if (cmd->pos > pos) return cmd->pos;
+			// Track commands meant for earlier music are dropped, samples are not affected by the music
+			if (cmd->type != Command::Type::SAMPLE_RESET && cmd->generation != generation.load(std::memory_order_acquire)) continue;
+			switch (cmd->type) {
 			case Command::Type::TRACK_FADE:
-				if (!playing.empty()) playing[0]->trackFade(cmd.track, cmd.factor);
+				if (!playing.empty()) playing[0]->trackFade(cmd->track(), cmd->factor);
 				break;
 			case Command::Type::TRACK_PITCHBEND:
-				if (!playing.empty()) playing[0]->trackPitchBend(cmd.track, cmd.factor);
+				if (!playing.empty()) playing[0]->trackPitchBend(cmd->track(), cmd->factor);
 				break;
 			case Command::Type::SAMPLE_RESET:
-				auto it = samples.find(cmd.track);
-				if (it != samples.end())
-					it->second->reset();
+				if (!samplesLocked) return std::numeric_limits<std::int64_t>::max();  // Samples being (un)loaded, retry in the next callback
+				for (auto& kv: samples) if (kv.first == cmd->track()) kv.second->reset();
 				break;
 			}
+			if (cmd->pos < m_pos) lateCommands.fetch_add(1, std::memory_order_relaxed);
+		}
+		return std::numeric_limits<std::int64_t>::max();
+	}
+
+	void callbackUpdate() {
+		std::unique_lock<std::mutex> l(mutex, std::try_to_lock);
+		if (!l.owns_lock()) return;  // No update now, try again later (cannot stop and wait for mutex to be released)
+		// Move from preloading to playing, if ready (and there is room without allocating)
+		if (preloading && playing.size() < playing.capacity()) {
+			if (preloading->prepare()) {
+				started.store(preloading.get(), std::memory_order_relaxed);  // Logging would allocate here
+				if (!playing.empty()) playing[0]->fadeRate = -preloading->fadeRate;  // Fade out the old music
+				playing.insert(playing.begin(), std::move(preloading));
+				m_startedGeneration = generation.load(std::memory_order_relaxed);  // Only changed with the mutex held
+			}
 		}
-		commands.clear();
+	}
+
+	/// Log the music started by the callback since the previous call (outside of the callback)
+	void logStarted() {
+		if (void const* music = started.exchange(nullptr, std::memory_order_relaxed)) SpdLogger::debug(LogSystem::AUDIO, "preload done -> playing: {}", music);
 	}
 
 	void callback(float* begin, float* end, double rate) {
+		std::int64_t const frames = (end - begin) / 2;
+		Time const now = Clock::now();
+		if (m_lastFrames > 0) jitter.record(now - m_lastCallback - Seconds(static_cast<double>(m_lastFrames) / rate));
+		m_lastCallback = now;
+		m_lastFrames = frames;
+		position.update(m_pos, frames, now);
 		callbackUpdate();
 		std::fill(begin, end, 0.0f);
-		if (paused) return;
+		if (mixbuf.empty()) {
+			publishMusic();
+			return;
+		}
+		// samples should not be created/destroyed on the fly
+		std::unique_lock<std::mutex> samplesLock(samples_mutex, std::try_to_lock);
+		// Mix in parts that fit the scratch space (in case the host asks for more than it announced) and split
+		// where commands take effect, so that they apply at the exact sample
+		auto const part = static_cast<std::ptrdiff_t>(mixbuf.size());
+		for (float* b = begin; b != end;) {
+			std::int64_t const pos = m_pos + (b - begin) / 2;
+			std::int64_t const next = applyCommands(pos, samplesLock.owns_lock());
+			std::ptrdiff_t n = std::min(part, end - b);
+			if (next - pos < n / 2) n = static_cast<std::ptrdiff_t>(2 * (next - pos));
+			if (!paused) mix(b, b + n, rate, samplesLock.owns_lock(), now + clockDur(Seconds(static_cast<double>((b - begin) / 2) / rate)));
+			b += n;
+		}
+		probe.output(begin, end, rate, now);
+		m_pos += frames;
+		publishMusic();
+	}
+
+	/// Publish the state of the current music for the readers of position, length and isPlaying (called from the callback)
+	void publishMusic() {
+		if (playing.empty()) {
+			clock.clear();
+			length.store(getNaN(), std::memory_order_relaxed);
+		} else {
+			clock.follow(playing[0]->m_clock);
+			length.store(playing[0]->duration(), std::memory_order_relaxed);
+		}
+		active.store(!playing.empty(), std::memory_order_relaxed);
+		clockGeneration.store(m_startedGeneration, std::memory_order_release);
+	}
+
+	/// Whether the published state is for the latest music requested (not still preloading)
+	bool published() const {
+		return clockGeneration.load(std::memory_order_acquire) == generation.load(std::memory_order_acquire);
+	}
+
+	/// Mix a part of the block that starts playing at the given time
+	void mix(float* begin, float* end, double rate, bool samplesLocked, Time when) {
 		// Mix in from the streams currently playing
 		auto arrayEnd = playing.end();
 		for (auto i = playing.begin(); i != arrayEnd;) {
-			bool keep = (*i->get())(begin, end);  // Do the actual mixing
+			Music& music = **i;
+			bool keep = music(begin, end, music.m_preview ? settings.previewVolume : settings.musicVolume, when);  // Do the actual mixing
 			std::unique_lock<std::mutex> l(mutex, std::defer_lock);
-			if (!keep && l.try_lock()) {
+			if (!keep && disposing.size() < disposing.capacity() && l.try_lock()) {
 				// Dispose streams no longer needed by moving them to another container (that will be cleared by another thread).
 				disposing.push_back(std::move(*i));
 				i = playing.erase(i);
@@ -400,9 +458,9 @@ struct Output {
 			else { ++i; }
 		}
 		// Mix in microphones (if pass-through is enabled)
-		if (mics.size() > 0 && config["audio/pass-through"].b()) {
+		if (mics.size() > 0 && settings.passThrough) {
 			// Decrease music volume
-			float amp = 1.0f / config["audio/pass-through_ratio"].f();
+			float amp = settings.passThroughAmp;
 			if (amp != 1.0f) 
 				for (auto& s : make_iterator_range(begin, end)) 
 					s *= amp;
@@ -410,13 +468,10 @@ struct Output {
 			for (auto& m: mics) if (m) m->output(begin, end, rate);
 		}
 		// Mix in the samples currently playing
-		{
-			// samples should not be created/destroyed on the fly
-			std::unique_lock<std::mutex> l(samples_mutex, std::defer_lock);
-			if(l.try_lock()) {
-				for(auto it = samples.begin() ; it != samples.end() ; ++it) {
-					(*it->second)(begin, end);
-				}
+		if (samplesLocked) {
+			float const volume = settings.failVolume;
+			for(auto it = samples.begin() ; it != samples.end() ; ++it) {
+				(*it->second)(begin, end, mixbuf.data(), volume);
 			}
 		}
 		// Mix synth if available (should be done at the end)
@@ -431,21 +486,37 @@ struct Output {
 
 
 Device::Device(int in, int out, double rate, PaDeviceIndex dev):
-  in(in), out(out), rate(rate), dev(dev),
-  stream(*this,
+  in(in), out(out), dev(dev),
+  stream(std::make_unique<portaudio::Stream>(*this,
   portaudio::Params().channelCount(in).device(dev).suggestedLatency(config["audio/latency"].f()),
-  portaudio::Params().channelCount(out).device(dev).suggestedLatency(config["audio/latency"].f()), rate),
+  portaudio::Params().channelCount(out).device(dev).suggestedLatency(config["audio/latency"].f()), rate)),
+  rate(stream->sampleRate()),
+  mics(static_cast<size_t>(in), nullptr),
+  outptr()
+{}
+
+Device::Device(da::VirtualStream::Params const& params):
+  in(params.in), out(params.out), dev(paNoDevice),
+  stream(std::make_unique<da::VirtualStream>([this](float const* input, float* output, std::int64_t frames) {
+	return (*this)(input, output, frames);
+  }, params)),
+  rate(stream->sampleRate()),
   mics(static_cast<size_t>(in), nullptr),
   outptr()
 {}
 
 void Device::start() {
-	PaError err = Pa_StartStream(stream);
-	if (err != paNoError) throw std::runtime_error(std::string("Pa_StartStream: ") + Pa_GetErrorText(err));
+	stream->start();
 }
 
 void Device::stop() {
-	PORTAUDIO_CHECKED(Pa_AbortStream, (stream));
+	stream->stop();
+}
+
+std::size_t Device::maxFrames() {
+	// The host chooses the buffer size by itself; callbacks are not expected to exceed the output latency
+	constexpr std::size_t minFrames = 4096;
+	return std::max(minFrames, static_cast<std::size_t>(std::ceil(stream->outputLatency() * rate)));
 }
 
 bool Device::isChannel(std::string const& name) const {
@@ -458,10 +529,14 @@ bool Device::isChannel(std::string const& name) const {
 }
 
 int Device::operator()(float const* inbuf, float* outbuf, std::ptrdiff_t frames) try {
+	RealtimeScope realtime;  // Debug builds assert that nothing here uses the heap
+	Time const now = Clock::now();
+	Analyzer const* probeMic = probe ? probe->mic() : nullptr;
 	for (std::size_t i = 0; i < mics.size(); ++i) {
 		if (!mics[i]) continue;  // No analyzer? -> Channel not used
 		da::sample_const_iterator it = da::sample_const_iterator(inbuf + i, in);
 		mics[i]->input(it, it + frames);
+		if (mics[i] == probeMic) probe->input(it, it + frames, now);
 	}
 	if (outptr) outptr->callback(outbuf, outbuf + 2 * frames, rate);
 	return paContinue;
@@ -488,10 +563,13 @@ struct Audio::Impl {
 					unsigned int rate;
 					std::string dev;
 					std::vector<std::string> mics;
+					std::vector<std::string> pitch;
+					std::string input, record;  ///< WAV files for a virtual device
+					bool manualClock;
 				} params = Params();
 				params.out = 0;
 				params.in = 0;
-				params.rate = 48000u;
+				params.rate = 0u;  // The native rate of the device, so that the host does not resample
 				// Break into tokens:
 				for (auto& kv: parseKeyValuePairs(*it)) {
 					// Handle keys
@@ -501,17 +579,43 @@ struct Audio::Impl {
 					else if (key == "in") iss >> params.in;
 					else if (key == "rate") iss >> params.rate;
 					else if (key == "dev") std::getline(iss, params.dev);
+					else if (key == "input") std::getline(iss, params.input);
+					else if (key == "record") std::getline(iss, params.record);
+					else if (key == "clock") {
+						std::string clock;
+						iss >> clock;
+						if (clock != "manual" && clock != "realtime") throw std::runtime_error("Unknown clock " + clock);
+						params.manualClock = clock == "manual";
+					}
 					else if (key == "mics") {
 						// Parse a comma-separated list of mics
 						for (std::string mic; std::getline(iss, mic, ','); params.mics.push_back(mic)) {
 							++params.in;
 						}
 					}
+					else if (key == "pitch") {
+						// Pitch detection method for each mic, in the same order (empty for the default)
+						for (std::string method; std::getline(iss, method, ','); params.pitch.push_back(method)) {}
+					}
 					else throw std::runtime_error("Unknown device parameter " + key);
 					if (!iss.eof()) throw std::runtime_error("Syntax error parsing device parameter " + key);
 				}
 				if (params.mics.size() < static_cast<size_t>(params.in)) { params.mics.resize(static_cast<size_t>(params.in)); }
-				portaudio::AudioDevices ad(PaHostApiTypeId(PaHostApiNameToHostApiTypeId(selectedBackend)));
+				std::string desc;
+				if (params.dev == "virtual" || !params.input.empty() || !params.record.empty()) {
+					// Stand-in for a sound card, playing from and recording to files
+					da::VirtualStream::Params vparams;
+					vparams.in = params.in;
+					vparams.out = params.out;
+					vparams.rate = params.rate;
+					vparams.manualClock = params.manualClock;
+					vparams.inputFile = params.input;
+					vparams.outputFile = params.record;
+					devices.emplace_back(vparams);
+					desc = fmt::format("virtual ({}{}{} clock)", params.input.empty() ? "" : "input from " + params.input + ", ",
+					  params.record.empty() ? "" : "recording to " + params.record + ", ", params.manualClock ? "manual" : "realtime");
+				} else {
+					portaudio::AudioDevices ad(PaHostApiTypeId(PaHostApiNameToHostApiTypeId(selectedBackend)));
 					bool wantOutput = (params.in == 0) ? true : false;
 					int num;
 					std::string msg{"Device string empty; will look for a device with at least "};
@@ -529,11 +633,16 @@ struct Audio::Impl {
 					else { SpdLogger::info(LogSystem::AUDIO, msg); }
 					portaudio::DeviceInfo const& info = ad.find(params.dev, wantOutput, num);
 					SpdLogger::info(LogSystem::AUDIO, "Found: {}, in: {}, out: {}.", info.name, info.in, info.out);
-				if (info.in < static_cast<int>(params.mics.size())) throw std::runtime_error("Device doesn't have enough input channels");
-				if (info.out < params.out) throw std::runtime_error("Device doesn't have enough output channels");
-				// Match found if we got here, construct a device
-				devices.emplace_back(params.in, params.out, params.rate, info.index);
+					if (info.in < static_cast<int>(params.mics.size())) throw std::runtime_error("Device doesn't have enough input channels");
+					if (info.out < params.out) throw std::runtime_error("Device doesn't have enough output channels");
+					// Match found if we got here, construct a device
+					double rate = params.rate;
+					if (rate <= 0.0) rate = info.rate > 0.0 ? info.rate : 48000.0;
+					devices.emplace_back(params.in, params.out, rate, info.index);
+					desc = info.desc();
+				}
 				Device& d = devices.back();
+				d.probe = &output.probe;
 				// Assign mics for all channels of the device
 				int assigned_mics = 0;
 				for (unsigned j = 0; j < static_cast<unsigned>(params.in); ++j) {
@@ -547,13 +656,20 @@ struct Audio::Impl {
 					}
 					if (mic_used) continue;
 					// Add the new analyzer
-					analyzers.emplace_back(d.rate, m);
+					PitchMethod method = config["audio/pitch_detector"].ui() == 1 ? PitchMethod::YIN : PitchMethod::FFT;
+					if (j < params.pitch.size() && !params.pitch[j].empty()) method = parsePitchMethod(params.pitch[j]);
+					auto const preset = static_cast<AnalyzerPreset>(config["audio/analyzer_preset"].ui());
+					analyzers.emplace_back(d.rate, m, analyzerTiming(d.rate, preset), method);
 					d.mics[j] = &analyzers.back();
 					++assigned_mics;
 				}
 				// Assign playback output for the first available stereo output
-				if (!playback && d.out == 2) { d.outptr = &output; playback = true; }
-				msg = fmt::format("Using audio device: {}; channels assigned:", info.desc());
+				if (!playback && d.out == 2) {
+					output.prepare(d.maxFrames(), d.rate);
+					d.outptr = &output;
+					playback = true;
+				}
+				std::string msg = fmt::format("Using audio device: {} at {} Hz; channels assigned:", desc, d.rate);
 				if (assigned_mics > 0) fmt::format_to(std::back_inserter(msg), " input={}", assigned_mics);
 				if (assigned_mics > 0 && params.out > 0) msg.append(",");
 				if (params.out > 0) fmt::format_to(std::back_inserter(msg), " output={}", params.out);
@@ -587,14 +703,13 @@ struct Audio::Impl {
 				SpdLogger::error(LogSystem::AUDIO, "Error stopping audio device={}, exception={}", device.dev, e.what());
 			}
 		}
+		if (auto late = output.lateCommands.load()) SpdLogger::info(LogSystem::AUDIO, "{} audio commands were applied late.", late);
 	}
 };
 
 portaudio::Init Audio::init;
 
 Audio::Audio() {
-	aubio_tempo_set_silence(Audio::aubioTempo.get(), -50.0f);
-	aubio_tempo_set_threshold(Audio::aubioTempo.get(), 0.4f);
 	populateBackends(portaudio::AudioBackends().getBackends());
 	self = std::make_unique<Impl>();
 }
@@ -617,6 +732,17 @@ void Audio::close() {
 	self.reset();
 }
 
+void Audio::runManualDevices(double seconds) {
+	for (auto& d: self->devices) {
+		auto* stream = dynamic_cast<da::VirtualStream*>(d.stream.get());
+		if (stream && stream->manualClock()) stream->run(std::llround(seconds * d.rate));
+	}
+}
+
+unsigned Audio::getSR() const {
+	return static_cast<unsigned>(std::lround(self ? self->output.sampleRate : 48000.0));
+}
+
 bool Audio::isOpen() const {
 	return !self->devices.empty();
 }
@@ -629,14 +755,11 @@ bool Audio::hasPlayback() const {
 
 void Audio::loadSample(std::string const& streamId, fs::path const& filename) {
 	std::lock_guard<std::mutex> l(self->output.samples_mutex);
-	self->output.samples.emplace(streamId, std::unique_ptr<Sample>(new Sample(filename, static_cast<unsigned>(getSR()))));
+	self->output.samples.emplace(streamId, std::unique_ptr<Sample>(new Sample(filename, getSR())));
 }
 
 void Audio::playSample(std::string const& streamId) {
-	Output& o = self->output;
-	std::lock_guard<std::mutex> l(o.mutex);
-	Command cmd = { Command::Type::SAMPLE_RESET, streamId, 0.0 };
-	o.commands.push_back(cmd);
+	self->output.command(Command::Type::SAMPLE_RESET, streamId, 0.0);
 }
 
 void Audio::unloadSample(std::string const& streamId) {
@@ -644,9 +767,9 @@ void Audio::unloadSample(std::string const& streamId) {
 	self->output.samples.erase(streamId);
 }
 
-void Audio::playMusic(Game& game, Audio::Files const& filenames, bool preview, double fadeTime, double startPos) {
+void Audio::playMusic(Audio::Files const& filenames, bool preview, double fadeTime, double startPos, Listeners const& listeners) {
 	Output& o = self->output;
-	auto m = std::make_unique<Music>(game, filenames, getSR(), preview);
+	auto m = std::make_unique<Music>(filenames, getSR(), preview, listeners);
 	m->seek(startPos);
 	m->fadeRate = 1.0 / getSR() / fadeTime;
 	// Format debug message
@@ -655,21 +778,22 @@ void Audio::playMusic(Game& game, Audio::Files const& filenames, bool preview, d
 	fmt::format_to(std::back_inserter(logmsg), ") -> {}", fmt::ptr(m.get()));
 	SpdLogger::debug(LogSystem::AUDIO, logmsg);
 	// Send to audio playback thread
+	o.logStarted();
 	std::lock_guard<std::mutex> l(o.mutex);
 	if (o.preloading) SpdLogger::debug(LogSystem::AUDIO, "earlier music still preloading, disposing {}", fmt::ptr(o.preloading.get()));
 	o.preloading = std::move(m);
 	o.disposing.clear();  // Delete disposed streams
-	o.commands.clear();  // Remove old unprocessed commands (they should not apply to the new music)
+	++o.generation;  // Drop old unprocessed track commands (they should not apply to the new music)
 }
 
-void Audio::playMusic(Game& game, fs::path const& filename, bool preview, double fadeTime, double startPos) {
+void Audio::playMusic(fs::path const& filename, bool preview, double fadeTime, double startPos) {
 	Audio::Files m;
 	m["MAIN"] = filename;
-	playMusic(game, m, preview, fadeTime, startPos);
+	playMusic(m, preview, fadeTime, startPos);
 }
 
-void Audio::stopMusic(Game& game) {
-	playMusic(game, Audio::Files(), false, 0.0);
+void Audio::stopMusic() {
+	playMusic(Audio::Files(), false, 0.0);
 	{
 		Output& o = self->output;
 		// stop synth when music is stopped
@@ -678,8 +802,8 @@ void Audio::stopMusic(Game& game) {
 	}
 }
 
-void Audio::fadeout(Game& game, double fadeTime) {
-	playMusic(game, Audio::Files(), false, fadeTime);
+void Audio::fadeout(double fadeTime) {
+	playMusic(Audio::Files(), false, fadeTime);
 	{
 		Output& o = self->output;
 		// stop synth when music is stopped
@@ -690,20 +814,17 @@ void Audio::fadeout(Game& game, double fadeTime) {
 
 double Audio::getPosition() const {
 	Output& o = self->output;
-	std::lock_guard<std::mutex> l(o.mutex);
-	return (o.playing.empty() || o.preloading.get()) ? getNaN() : o.playing[0]->pos();
+	return o.published() ? o.clock.pos().count() : getNaN();
 }
 
 double Audio::getLength() const {
 	Output& o = self->output;
-	std::lock_guard<std::mutex> l(o.mutex);
-	return (o.playing.empty() || o.preloading.get()) ? getNaN() : o.playing[0]->duration();
+	return o.published() ? o.length.load(std::memory_order_relaxed) : getNaN();
 }
 
 bool Audio::isPlaying() const {
 	Output& o = self->output;
-	std::lock_guard<std::mutex> l(o.mutex);
-	return o.preloading || !o.playing.empty();
+	return !o.published() || o.active.load(std::memory_order_relaxed);
 }
 
 void Audio::seek(double offset) {
@@ -720,21 +841,56 @@ void Audio::seekPos(double pos) {
 	pause(false);
 }
 
+void Audio::updateSettings() {
+	self->output.settings.update();
+	self->output.logStarted();
+}
+
 void Audio::pause(bool state) { self->output.paused = state; }
 bool Audio::isPaused() const { return self->output.paused; }
 
 void Audio::streamFade(std::string track, double fadeLevel) {
-	Output& o = self->output;
-	std::lock_guard<std::mutex> l(o.mutex);
-	Command cmd = { Command::Type::TRACK_FADE, track, fadeLevel };
-	o.commands.push_back(cmd);
+	self->output.command(Command::Type::TRACK_FADE, track, fadeLevel);
 }
 
 void Audio::streamBend(std::string track, double pitchFactor) {
+	self->output.command(Command::Type::TRACK_PITCHBEND, track, pitchFactor);
+}
+
+std::uint64_t Audio::lateCommands() const { return self->output.lateCommands.load(std::memory_order_relaxed); }
+
+Audio::ClockStats Audio::clockStats() {
 	Output& o = self->output;
+	ClockStats stats;
+	stats.callbackJitter = o.jitter.take();
 	std::lock_guard<std::mutex> l(o.mutex);
-	Command cmd = { Command::Type::TRACK_PITCHBEND, track, pitchFactor };
-	o.commands.push_back(cmd);
+	if (!o.playing.empty()) stats.clockCorrection = o.playing[0]->m_clock.corrections().take();
+	return stats;
+}
+
+bool Audio::startLatencyProbe(std::string const& micId) {
+	Output& o = self->output;
+	if (!hasPlayback()) return false;
+	for (auto& d: self->devices) {
+		for (Analyzer const* mic: d.mics) {
+			if (!mic || mic->getId() != micId) continue;
+			if (!o.probe.start(mic, d.rate)) return false;
+			SpdLogger::info(LogSystem::AUDIO, "Measuring round-trip latency with mic {} (device reports {:.0f} ms input latency).", micId, 1e3 * d.stream->inputLatency());
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Audio::latencyProbeDone() const { return self->output.probe.done(); }
+
+void Audio::cancelLatencyProbe() { self->output.probe.cancel(); }
+
+std::optional<LatencyProbe::Result> Audio::latencyProbeResult() const {
+	auto const result = self->output.probe.result();
+	if (result) SpdLogger::info(LogSystem::AUDIO, "Measured round-trip latency {:.1f} ms (match {:.2f}).", 1e3 * result->roundTrip.count(), result->score);
+	else SpdLogger::warn(LogSystem::AUDIO, "Round-trip latency measurement failed, the chirp was not heard.");
+	return result;
 }
 
 void Audio::toggleSynth(Notes const& notes) {
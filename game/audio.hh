@@ -1,17 +1,21 @@
 #pragma once
 
+#include "audioclock.hh"
 #include "configuration.hh"
 #include "ffmpeg.hh"
+#include "latencyprobe.hh"
 #include "notes.hh"
 #include "libda/portaudio.hpp"
-#include "aubio/aubio.h"
+#include "libda/stemmix.hpp"
 #include <cstddef>
 #include <cstdint>
 #include <deque>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -21,47 +25,28 @@ int PaHostApiNameToHostApiTypeId (const std::string& name);
 
 struct Output;
 
-/**
-* Advanced audio sync code.
-* Produces precise monotonic clock synced to audio output callback (which may suffer of major jitter).
-* Uses system clock as timebase but the clock is skewed (made slower or faster) depending on whether
-* it is late or early. The clock is also stopped if audio output pauses.
-**/
-class AudioClock {
-	mutable std::mutex m_mutex;
-	Time m_baseTime; ///< A reference time (corresponds to m_basePos)
-	Seconds m_basePos = 0.0s; ///< A reference position in song
-	double m_skew = 0.0; ///< The skew ratio applied to system time (since baseTime)
-	std::atomic<Seconds> m_max{ 0.0s }; ///< Maximum output value for the clock (end of the current audio block)
-	/// Get the current position (current time via parameter, no locking)
-	Seconds pos_internal(Time now) const;
-  public:
-	/**
-	* Called from audio callback to keep the clock synced.
-	* @param audioPos the current position in the song
-	* @param length the duration of the current audio block
-	*/
-	void timeSync(Seconds audioPos, Seconds length);
-	/// Get the current position in seconds
-	Seconds pos() const;
-};
-
 class Analyzer;
 
 struct Device {
 	// Init
 	const int in, out;
-	const double rate;
-	const PaDeviceIndex dev;
-	portaudio::Stream stream;
+	const PaDeviceIndex dev;  ///< PortAudio device, paNoDevice for a virtual one
+	std::unique_ptr<da::AudioStream> stream;
+	const double rate;  ///< As negotiated with the device
 	std::vector<Analyzer*> mics;
 	Output* outptr;
+	LatencyProbe* probe = nullptr;  ///< Receives the input of the mic being measured, if any
 
+	/// A sound card opened through PortAudio
 	Device(int in, int out, double rate, PaDeviceIndex dev);
+	/// A stand-in that needs no sound card (see da::VirtualStream)
+	explicit Device(da::VirtualStream::Params const& params);
 	/// Start
 	void start();
 	/// Stop
 	void stop();
+	/// The largest callback size to prepare for, in frames
+	std::size_t maxFrames();
 	/// Callback
 	int operator()(float const* input, float* output, std::ptrdiff_t frames);
 	/// Returns true if this device is opened for output
@@ -82,9 +67,10 @@ class Audio {
 	std::unique_ptr<Impl> self;
 	friend class ScreenSongs;
 	friend class Music;
-	static std::recursive_mutex aubio_mutex;
   public:
 	typedef std::map<std::string, fs::path> Files;
+	/// Listeners of the samples decoded for some of the tracks, by track name (see AudioBuffer::Listener)
+	using Listeners = std::map<std::string, AudioBuffer::Listener>;
 	static ConfigItem& backendConfig();
 	Audio();
 	~Audio();
@@ -100,17 +86,17 @@ class Audio {
 	 * @param fadeTime time to fade
 	 * @param startPos starting position
 	 */
-	void playMusic(Game&, fs::path const& filename, bool preview = false, double fadeTime = 0.5, double startPos = 0.0);
-	/** Plays a list of songs **/
-	void playMusic(Game&, Files const& filenames, bool preview = false, double fadeTime = 0.5, double startPos = 0.0);
+	void playMusic(fs::path const& filename, bool preview = false, double fadeTime = 0.5, double startPos = 0.0);
+	/** Plays a list of songs, passing the samples of the tracks in listeners to them as they are decoded **/
+	void playMusic(Files const& filenames, bool preview = false, double fadeTime = 0.5, double startPos = 0.0, Listeners const& listeners = {});
 	/** Loads/plays/unloads a sample **/
 	void loadSample(std::string const& streamId, fs::path const& filename);
 	void playSample(std::string const& streamId);
 	void unloadSample(std::string const& streamId);
 	/** Stops music **/
-	void stopMusic(Game&);
+	void stopMusic();
 	/** Fades music out **/
-	void fadeout(Game&, double time = 1.0);
+	void fadeout(double time = 1.0);
 	/** Get the length of the currently playing song, in seconds. **/
 	double getLength() const;
 	/**
@@ -125,6 +111,8 @@ class Audio {
 	bool isPlaying() const;
 	/** Get the current position. If not known or nothing is playing, NaN is returned. **/
 	double getPosition() const;
+	/** Pass changed audio settings (volumes, pass-through) to the playback thread and log music it started. Call periodically from the main thread. **/
+	void updateSettings();
 	void togglePause() { pause(!isPaused()); }
 	void pause(bool state = true);
 	bool isPaused() const;
@@ -136,18 +124,36 @@ class Audio {
 	void streamFade(std::string track, double volume);
 	/** Do a pitch shift - used for guitar whammy bar */
 	void streamBend(std::string track, double pitchFactor);
-	/** Get sample rate */
-	static float getSR() { return 48000.0f; }
-	static unsigned aubio_hop_size;
-	static unsigned aubio_win_size;
-	static std::unique_ptr<aubio_tempo_t, void(*)(aubio_tempo_t*)> aubioTempo;
+	/** Number of fades and sample triggers that took effect later than scheduled (audio callback too late) */
+	std::uint64_t lateCommands() const;
+	/** Get the sample rate of the playback device (that everything played is decoded at) */
+	unsigned getSR() const;
+	/** Run the virtual devices with a manual clock (clock=manual in audio/devices) for the given time, as fast as possible. The devices run one after another, so keep the steps short if they depend on each other. **/
+	void runManualDevices(double seconds);
+	/** Timing of the audio output since the previous call **/
+	struct ClockStats {
+		DurationHistogram::Snapshot callbackJitter;  ///< Deviation of the callback intervals from the durations of the blocks
+		DurationHistogram::Snapshot clockCorrection;  ///< Error of the music clock found by the callback, before correcting it
+	};
+	ClockStats clockStats();
+	/** Start measuring the round-trip latency with the given mic (see LatencyProbe); false if the mic is not open or already measuring **/
+	bool startLatencyProbe(std::string const& micId);
+	/** Returns true when no latency measurement is running **/
+	bool latencyProbeDone() const;
+	/** Give up the running latency measurement (e.g. on timeout), so that another one can be started **/
+	void cancelLatencyProbe();
+	/** The latency measured, empty if the chirp was not heard **/
+	std::optional<LatencyProbe::Result> latencyProbeResult() const;
 };
 
 class Music {
+	static constexpr std::size_t stemFrames = 512;  ///< Frames mixed at a time
 	struct Track {
 		AudioBuffer audioBuffer;
 		double fadeLevel = 1.0;
 		double pitchFactor = 0.0;
+		float gain = 1.0f;  ///< Fade level reached by the previous part mixed, the next one ramps from it to fadeLevel
+		std::vector<float> stem = std::vector<float>(2 * stemFrames);  ///< Scratch space for reading the track
 		template <typename... Args> Track(Args&&... args): audioBuffer(std::forward<Args>(args)...) {}
 	};
 	friend class ScreenSongs;
@@ -156,27 +162,30 @@ class Music {
 	double srate; ///< Sample rate
 	std::int64_t m_pos = 0; ///< Current sample position
 	bool m_preview;
-	class AudioClock m_clock;
+	AudioClock m_clock;
 	Seconds durationOf(std::int64_t samples) const { return 1.0s * samples / srate / 2.0; }
 	float* sampleStartPtr = nullptr;
 	float* sampleEndPtr = nullptr;
+	std::vector<float const*> m_stems;  ///< Arguments of da::mix_stems, allocated by the constructor
+	std::vector<da::gain_ramp> m_gains;
   public:
 	bool suppressCenterChannel = false;
 	double fadeLevel = 0.0;
 	double fadeRate = 0.0;
 	using Buffer = std::vector<float>;
-	Music(Game&, Audio::Files const& files, unsigned int sr, bool preview);
-	/// Sums the stream to output sample range, returns true if the stream still has audio left afterwards.
-	bool operator()(float* begin, float* end);
+	Music(Audio::Files const& files, unsigned int sr, bool preview, Audio::Listeners const& listeners = {});
+	/**
+	* Sums the stream to output sample range, returns true if the stream still has audio left afterwards.
+	* @param volume the music volume (0.0 to 1.0)
+	* @param when the time at which the range starts playing, for syncing the clock
+	*/
+	bool operator()(float* begin, float* end, float volume, Time when);
 	void seek(double time) { m_pos = static_cast<std::int64_t>(time * srate * 2.0); }
 	/// Get the current position in seconds
 	double pos() const { return m_clock.pos().count(); }
 	double duration() const;
 	/// Prepare (seek) all tracks to current position, return true when done (nonblocking)
 	bool prepare();
-	void trackFade(std::string const& name, double fadeLevel);
-	void trackPitchBend(std::string const& name, double pitchFactor);
-
-  private:
-	Game& m_game;
+	void trackFade(std::string_view name, double fadeLevel);
+	void trackPitchBend(std::string_view name, double pitchFactor);
 };
@@ -0,0 +1,117 @@
+#include "audioclock.hh"
+
+#include "util.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void DurationHistogram::record(Seconds value) {
+	double const v = std::abs(value.count());
+	std::size_t const bin = static_cast<std::size_t>(std::upper_bound(limits.begin(), limits.end(), v) - limits.begin());
+	m_counts[bin].fetch_add(1, std::memory_order_relaxed);
+	double max = m_max.load(std::memory_order_relaxed);
+	while (v > max && !m_max.compare_exchange_weak(max, v, std::memory_order_relaxed)) {}
+}
+
+DurationHistogram::Snapshot DurationHistogram::take() {
+	Snapshot snapshot;
+	for (std::size_t i = 0; i < bins; ++i) snapshot.counts[i] = m_counts[i].exchange(0, std::memory_order_relaxed);
+	snapshot.max = Seconds(m_max.exchange(0.0, std::memory_order_relaxed));
+	return snapshot;
+}
+
+std::uint64_t DurationHistogram::Snapshot::total() const {
+	std::uint64_t sum = 0;
+	for (auto c: counts) sum += c;
+	return sum;
+}
+
+Seconds DurationHistogram::Snapshot::percentile(double fraction) const {
+	auto const n = total();
+	if (n == 0) return 0.0s;
+	auto const target = static_cast<std::uint64_t>(std::ceil(fraction * static_cast<double>(n)));
+	std::uint64_t sum = 0;
+	for (std::size_t i = 0; i < limits.size(); ++i) {
+		sum += counts[i];
+		if (sum >= target && sum > 0) return std::min(Seconds(limits[i]), max);
+	}
+	return max;
+}
+
+void AudioClock::timeSync(Seconds audioPos, Seconds length, Time now) {
+	constexpr Seconds maxError = 100ms;  // Step the clock instead of skewing if over 100 ms off
+	State state = m_state;
+	Seconds const max = audioPos + length;
+	const Seconds sys = pos(state, now);  // Current position (based on system clock + corrections)
+	const Seconds audio = audioPos;  // Audio time
+	const Seconds diff = audio - sys;
+	if (!std::isnan(diff.count())) m_corrections.record(diff);  // Not after clear()
+	// Skew-based correction only if going forward and relatively well synced
+	if (max.count() > state.max && std::abs(diff.count()) < maxError.count()) {
+		constexpr double fudgeFactor = 0.001;  // Adjustment ratio
+		// Update base position (this should not affect the clock)
+		state.baseTime = now.time_since_epoch().count();
+		state.basePos = sys.count();
+		// Apply a VERY ARTIFICIAL correction for clock!
+		m_dither ^= m_dither << 13;  // xorshift32, as rand() is neither thread-safe nor realtime-safe
+		m_dither ^= m_dither >> 17;
+		m_dither ^= m_dither << 5;
+		const Seconds valadj = length * 0.1 * (m_dither / 4294967295.0);  // Dither
+		state.skew += (diff < valadj ? -1.0 : 1.0) * fudgeFactor;
+		// Limits to keep things sane in abnormal situations
+		state.skew = clamp(state.skew, -0.01, 0.01);
+	} else {
+		// Off too much, step to correct time
+		state.baseTime = now.time_since_epoch().count();
+		state.basePos = audio.count();
+		state.skew = 0.0;
+	}
+	state.max = max.count();
+	publish(state);
+}
+
+void AudioClock::clear() {
+	State state;
+	state.basePos = state.max = std::numeric_limits<double>::quiet_NaN();
+	publish(state);
+}
+
+void AudioClock::follow(AudioClock const& source) {
+	publish(source.m_state);
+}
+
+Seconds AudioClock::pos(State const& state, Time now) {
+	Seconds t = Seconds(state.basePos) + (1.0 + state.skew) * (now - Time(Clock::duration(state.baseTime)));
+	return std::min<Seconds>(t, Seconds(state.max));
+}
+
+Seconds AudioClock::pos(Time now) const {
+	return pos(load(), now);
+}
+
+void AudioClock::publish(State const& state) {
+	m_state = state;
+	unsigned const seq = m_seq.load(std::memory_order_relaxed);
+	m_seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_baseTime.store(state.baseTime, std::memory_order_relaxed);
+	m_basePos.store(state.basePos, std::memory_order_relaxed);
+	m_skew.store(state.skew, std::memory_order_relaxed);
+	m_max.store(state.max, std::memory_order_relaxed);
+	m_seq.store(seq + 2, std::memory_order_release);
+}
+
+AudioClock::State AudioClock::load() const {
+	State state;
+	unsigned seq;
+	do {
+		seq = m_seq.load(std::memory_order_acquire);
+		state.baseTime = m_baseTime.load(std::memory_order_relaxed);
+		state.basePos = m_basePos.load(std::memory_order_relaxed);
+		state.skew = m_skew.load(std::memory_order_relaxed);
+		state.max = m_max.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while (seq % 2 != 0 || seq != m_seq.load(std::memory_order_relaxed));
+	return state;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "chrono.hh"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+* Counts of durations in logarithmic bins, for timing telemetry of the audio callback.
+* Recording is realtime-safe (relaxed atomics only); another thread takes the counts, which starts a new window.
+**/
+class DurationHistogram {
+  public:
+	static constexpr std::size_t bins = 12;
+	/// Upper limits of the bins in seconds (the last bin has none)
+	static constexpr std::array<double, bins - 1> limits{ 50e-6, 100e-6, 200e-6, 500e-6, 1e-3, 2e-3, 5e-3, 10e-3, 20e-3, 50e-3, 100e-3 };
+
+	struct Snapshot {
+		std::array<std::uint32_t, bins> counts{};
+		Seconds max = 0.0s;
+		std::uint64_t total() const;
+		/// Upper limit of the bin that the given fraction (0 to 1) of the values falls within (at most max)
+		Seconds percentile(double fraction) const;
+	};
+
+	void record(Seconds value);
+	/// The values recorded since the previous call
+	Snapshot take();
+
+  private:
+	std::array<std::atomic<std::uint32_t>, bins> m_counts{};
+	std::atomic<double> m_max{ 0.0 };
+};
+
+/**
+* Advanced audio sync code.
+* Produces precise monotonic clock synced to audio output callback (which may suffer of major jitter).
+* Uses system clock as timebase but the clock is skewed (made slower or faster) depending on whether
+* it is late or early. The clock is also stopped if audio output pauses.
+* The audio callback is the only writer; it publishes the clock parameters with a sequence counter, so that
+* readers on any thread get a consistent set without locking and without ever making the callback wait.
+**/
+class AudioClock {
+  public:
+	/**
+	* Called from audio callback to keep the clock synced.
+	* @param audioPos the current position in the song
+	* @param length the duration of the current audio block
+	* @param now when the block starts playing
+	*/
+	void timeSync(Seconds audioPos, Seconds length, Time now = Clock::now());
+	/// Stop the clock, so that pos() returns NaN until the next sync (writer side, like timeSync)
+	void clear();
+	/// Publish the latest state of another clock, whose writer must be the calling thread
+	void follow(AudioClock const& source);
+	/// Get the current position in seconds
+	Seconds pos(Time now = Clock::now()) const;
+	/// Differences between the audio position and the clock found by timeSync, before correcting them
+	DurationHistogram& corrections() { return m_corrections; }
+
+  private:
+	struct State {
+		Clock::rep baseTime = 0; ///< A reference time (corresponds to basePos)
+		double basePos = 0.0; ///< A reference position in song, in seconds
+		double skew = 0.0; ///< The skew ratio applied to system time (since baseTime)
+		double max = 0.0; ///< Maximum output value for the clock (end of the current audio block)
+	};
+	static Seconds pos(State const& state, Time now);
+	State load() const;
+	void publish(State const& state);
+
+	std::atomic<unsigned> m_seq{ 0 };
+	std::atomic<Clock::rep> m_baseTime{ 0 };
+	std::atomic<double> m_basePos{ 0.0 };
+	std::atomic<double> m_skew{ 0.0 };
+	std::atomic<double> m_max{ 0.0 };
+	State m_state;  ///< The latest state published (only used by the writer)
+	std::uint32_t m_dither = 0x9e3779b9u;  ///< Random state for dithering the corrections (only used by the writer)
+	DurationHistogram m_corrections;
+};
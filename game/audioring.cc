@@ -0,0 +1,138 @@
+#include "audioring.hh"
+
+#include "libda/sample.hpp"
+
+#include <algorithm>
+
+namespace {
+	void mix(float* out, std::int16_t const* in, std::int64_t n, float scale) {
+		for (std::int64_t i = 0; i < n; ++i) out[i] += scale * static_cast<float>(in[i]);
+	}
+}
+
+std::vector<std::int16_t> AudioRing::Pool::acquire(std::size_t size) {
+	{
+		std::lock_guard<std::mutex> l(m_mutex);
+		auto it = std::find_if(m_idle.begin(), m_idle.end(), [size](auto const& data) { return data.size() == size; });
+		if (it != m_idle.end()) {
+			auto data = std::move(*it);
+			m_idle.erase(it);
+			return data;
+		}
+	}
+	return std::vector<std::int16_t>(size);
+}
+
+void AudioRing::Pool::release(std::vector<std::int16_t>&& data) {
+	if (data.empty()) return;
+	std::fill(data.begin(), data.end(), std::int16_t{});  // Reading never goes beyond what was written, but data() does
+	std::lock_guard<std::mutex> l(m_mutex);
+	if (m_idle.size() < m_maxIdle) m_idle.push_back(std::move(data));
+}
+
+std::size_t AudioRing::Pool::idle() const {
+	std::lock_guard<std::mutex> l(m_mutex);
+	return m_idle.size();
+}
+
+AudioRing::Pool& AudioRing::Pool::global() {
+	// Enough for the stems of a song fading out while the next one starts in the song browser
+	static Pool pool(8);
+	return pool;
+}
+
+AudioRing::AudioRing(std::size_t size, Pool* pool): m_pool(pool), m_data(pool ? pool->acquire(size) : std::vector<std::int16_t>(size)) {}
+
+AudioRing::~AudioRing() {
+	if (m_pool) m_pool->release(std::move(m_data));
+}
+
+bool AudioRing::locate(std::int64_t pos) {
+	if (m_seekDone.load(std::memory_order_acquire) != m_seekRequest.load(std::memory_order_relaxed)) return false;  // Still seeking
+	// Older history may already be overwritten by the writer; far ahead is quicker to reach by seeking than decoding
+	std::int64_t const low = std::max(m_base.load(std::memory_order_relaxed), m_read.load(std::memory_order_relaxed) - size() / 4);
+	std::int64_t const high = m_write.load(std::memory_order_acquire) + size() / 64;
+	if (pos >= low && pos <= high) return true;
+	m_seekTarget.store(pos, std::memory_order_relaxed);
+	m_seekRequest.store(m_seekRequest.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	return false;
+}
+
+void AudioRing::read(float* out, std::int64_t samples, std::int64_t pos, float volume) {
+	if (locate(pos)) {
+		std::int64_t const avail = std::clamp<std::int64_t>(m_write.load(std::memory_order_acquire) - pos, 0, samples);
+		float const scale = volume / da::max_s16;  // Conversion from s16 folded into the gain
+		std::int64_t const idx = pos % size();
+		std::int64_t const first = std::min(avail, size() - idx);
+		mix(out, m_data.data() + idx, first, scale);
+		mix(out + first, m_data.data(), avail - first, scale);
+		if (avail < samples) m_underruns.fetch_add(1, std::memory_order_relaxed);
+	}
+	m_read.store(pos + samples, std::memory_order_release);
+}
+
+std::int64_t AudioRing::buffered(std::int64_t pos) {
+	std::int64_t avail = 0;
+	if (locate(pos)) avail = std::max<std::int64_t>(m_write.load(std::memory_order_acquire) - pos, 0);
+	m_read.store(pos, std::memory_order_release);
+	return avail;
+}
+
+bool AudioRing::takeSeek(std::int64_t& pos) {
+	unsigned const request = m_seekRequest.load(std::memory_order_acquire);
+	if (request == m_writerSeek) return false;
+	m_writerSeek = request;
+	pos = m_seekTarget.load(std::memory_order_relaxed);
+	m_base.store(pos, std::memory_order_relaxed);
+	m_write.store(pos, std::memory_order_relaxed);
+	m_seekDone.store(request, std::memory_order_release);
+	return true;
+}
+
+bool AudioRing::wantMore() const {
+	return m_write.load(std::memory_order_relaxed) < m_read.load(std::memory_order_acquire) + size() / 2;
+}
+
+bool AudioRing::write(std::int16_t const* data, std::int64_t count, std::int64_t pos) {
+	if (seekPending()) return false;
+	std::int64_t w = m_write.load(std::memory_order_relaxed);
+	if (pos < w) {
+		// Already written, or decoded from before the seek target
+		std::int64_t const skip = std::min(count, w - pos);
+		data += skip;
+		count -= skip;
+		pos += skip;
+	}
+	if (count <= 0) return true;
+	if (count > size()) {
+		// Only the most recent samples fit
+		data += count - size();
+		pos += count - size();
+		count = size();
+	}
+	// A gap in the stream is played as silence
+	w = std::max(w, pos - size());
+	for (; w < pos; ++w) m_data[static_cast<std::size_t>(w % size())] = 0;
+	std::int64_t const idx = pos % size();
+	std::int64_t const first = std::min(count, size() - idx);
+	std::copy(data, data + first, m_data.begin() + idx);
+	std::copy(data + first, data + count, m_data.begin());
+	m_write.store(pos + count, std::memory_order_release);
+	return true;
+}
+
+AudioRing::Span AudioRing::reserve(std::int64_t count) {
+	Span span;
+	if (seekPending()) return span;
+	count = std::clamp<std::int64_t>(count, 0, size());
+	std::int64_t const idx = m_write.load(std::memory_order_relaxed) % size();
+	span.first = m_data.data() + idx;
+	span.firstSize = std::min(count, size() - idx);
+	span.second = m_data.data();
+	span.secondSize = count - span.firstSize;
+	return span;
+}
+
+void AudioRing::commit(std::int64_t count) {
+	m_write.store(m_write.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
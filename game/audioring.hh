@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+* Ring of decoded 16-bit samples between a decoder thread (the writer) and the audio callback (the reader).
+* Positions are absolute sample positions in the stream. The reader never blocks: missing data is played as
+* silence and counted as an underrun, and reading a position that is not buffered asks the writer to seek there.
+* Seeks are passed with generation counters, so the reader never mixes data decoded for an earlier position.
+* The writer must keep within half the ring of the reader (see wantMore()), which leaves the other half of the
+* ring as history that can be read again without seeking.
+**/
+class AudioRing {
+  public:
+	/// Recycles ring storage, so that starting a stream does not allocate megabytes (once enough rings have been used)
+	class Pool {
+	  public:
+		explicit Pool(std::size_t maxIdle): m_maxIdle(maxIdle) {}
+		/// Zeroed storage of the given size, reused if possible
+		std::vector<std::int16_t> acquire(std::size_t size);
+		/// Keep storage for reuse (or free it if enough is kept already)
+		void release(std::vector<std::int16_t>&& data);
+		/// The number of rings kept for reuse
+		std::size_t idle() const;
+		/// The pool used by AudioBuffer
+		static Pool& global();
+	  private:
+		std::size_t const m_maxIdle;
+		mutable std::mutex m_mutex;
+		std::vector<std::vector<std::int16_t>> m_idle;
+	};
+
+	/// A ring of the given size, with storage from pool (if any) that is returned to it on destruction
+	explicit AudioRing(std::size_t size, Pool* pool = nullptr);
+	~AudioRing();
+	AudioRing(AudioRing const&) = delete;
+	AudioRing& operator=(AudioRing const&) = delete;
+
+	// Reader side (the audio callback)
+
+	/// Mix samples from position pos (>= 0) scaled by volume into out; requests a seek if pos is not buffered
+	void read(float* out, std::int64_t samples, std::int64_t pos, float volume);
+	/// The number of samples available from pos without seeking (requests a seek if pos is not buffered)
+	std::int64_t buffered(std::int64_t pos);
+	/// The number of reads that could not be served completely
+	std::uint64_t underruns() const { return m_underruns.load(std::memory_order_relaxed); }
+
+	// Writer side (the decoder thread)
+
+	/// Has the reader asked for a seek that the writer has not taken yet?
+	bool seekPending() const { return m_seekRequest.load(std::memory_order_acquire) != m_writerSeek; }
+	/// Take a pending seek: returns true and the position to continue decoding from, or false if none is pending
+	bool takeSeek(std::int64_t& pos);
+	/// Is there room to write more (the writer stays within half the ring from the reader)?
+	bool wantMore() const;
+	/// Store count samples starting at position pos, skipping anything before writePos(). False if a seek is pending.
+	bool write(std::int16_t const* data, std::int64_t count, std::int64_t pos);
+	/// Writable space from writePos() on, in one or two segments (the second one continues at the start of the ring)
+	struct Span {
+		std::int16_t* first = nullptr;
+		std::int64_t firstSize = 0;
+		std::int16_t* second = nullptr;
+		std::int64_t secondSize = 0;
+		std::int64_t size() const { return firstSize + secondSize; }
+	};
+	/// Space for up to count samples, for a writer that produces them in place instead of calling write(). Empty if a seek is pending.
+	Span reserve(std::int64_t count);
+	/// Make the first count samples of the space from reserve() available to the reader
+	void commit(std::int64_t count);
+	/// The position following the last sample written
+	std::int64_t writePos() const { return m_write.load(std::memory_order_acquire); }
+	/// Pass the samples written from pos to writePos() to f(data, count, pos), in one or two parts (as far as still in the ring)
+	template <typename F> void written(std::int64_t pos, F&& f) const {
+		std::int64_t const end = m_write.load(std::memory_order_relaxed);
+		pos = std::max(pos, end - size());
+		if (pos >= end) return;
+		std::int64_t const idx = pos % size();
+		std::int64_t const first = std::min(end - pos, size() - idx);
+		f(m_data.data() + idx, first, pos);
+		if (pos + first < end) f(m_data.data(), end - pos - first, pos + first);
+	}
+
+	/// Raw storage in ring order (not synchronized with the writer)
+	std::vector<std::int16_t> const& data() const { return m_data; }
+
+  private:
+	std::int64_t size() const { return static_cast<std::int64_t>(m_data.size()); }
+	/// Check that pos can be read from the ring, request a seek otherwise
+	bool locate(std::int64_t pos);
+
+	Pool* m_pool;
+	std::vector<std::int16_t> m_data;
+	std::atomic<std::int64_t> m_base{ 0 };  ///< Where the writer started after the latest seek
+	std::atomic<std::int64_t> m_write{ 0 };  ///< Written by the writer
+	std::atomic<std::int64_t> m_read{ 0 };  ///< Next position expected by the reader
+	std::atomic<std::int64_t> m_seekTarget{ 0 };
+	std::atomic<unsigned> m_seekRequest{ 0 };  ///< Incremented by the reader for each seek
+	std::atomic<unsigned> m_seekDone{ 0 };  ///< The request that the current data was written for
+	unsigned m_writerSeek = 0;  ///< The latest request taken by the writer (writer only)
+	std::atomic<std::uint64_t> m_underruns{ 0 };
+};
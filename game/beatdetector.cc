@@ -0,0 +1,131 @@
+#include "beatdetector.hh"
+
+#include "log.hh"
+
+#include "aubio/aubio.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+	unsigned const winSize = 1536;
+	unsigned const hopSize = 768;
+	double const analysisLength = 30.0;  ///< Seconds of music analysed
+}
+
+struct BeatDetector::Analysis {
+	fs::path const file;
+	double const start;
+	unsigned const rate;
+	std::atomic<bool> cancelled{ false };  ///< Set when the BeatDetector is gone
+	std::unique_ptr<aubio_tempo_t, void(*)(aubio_tempo_t*)> tempo{ nullptr, del_aubio_tempo };
+	std::unique_ptr<fvec_t, void(*)(fvec_t*)> hop{ nullptr, del_fvec };
+	std::unique_ptr<fvec_t, void(*)(fvec_t*)> beat{ nullptr, del_fvec };
+	std::vector<float> mono;  ///< Decoded audio waiting for analysis (mixed to mono)
+	std::int64_t next = -1;  ///< Position of the sample expected next, -1 before the first
+	std::int64_t analysed = 0;  ///< Frames analysed so far
+	Song::Beats beats;
+	double firstPeriod = 0.0;
+	bool done = false;
+	std::shared_ptr<Song::Beats const> result;
+
+	Analysis(fs::path const& file, double start, unsigned rate): file(file), start(start), rate(rate) {}
+
+	/// Receives the decoded audio (see AudioBuffer::Listener)
+	void receive(std::int16_t const* data, std::int64_t count, std::int64_t pos) {
+		if (done || cancelled.load(std::memory_order_relaxed)) return;
+		try {
+			if (count == 0) return finish();  // End of the file
+			std::int64_t const first = 2 * std::llround(start * rate);
+			if (next != -1 && pos != next) {
+				// Seeked; the playback may seek to the start after decoding from the beginning (up to a hop off
+				// due to rounding), other seeks end the analysis
+				if (pos > first + 2 * hopSize) return finish();
+				reset();
+			}
+			next = pos + count;
+			if (!tempo) setup();
+			// Skip anything decoded from before the start (seeking goes to an earlier keyframe)
+			for (std::int64_t i = std::max<std::int64_t>(0, first - pos) & ~std::int64_t{ 1 }; i + 1 < count; i += 2) {
+				mono.push_back(0.5f * (da::conv_from_s16(data[i]) + da::conv_from_s16(data[i + 1])));
+			}
+			analyse();
+			if (static_cast<double>(analysed) >= analysisLength * rate) finish();
+		} catch (std::exception const& e) {
+			SpdLogger::error(LogSystem::AUDIO, "Beat detection failed for file={}, exception={}", file, e.what());
+			beats.clear();
+			finish();
+		}
+	}
+
+	void setup() {
+		tempo.reset(new_aubio_tempo("default", winSize, hopSize, rate));
+		if (!tempo) throw std::runtime_error("Cannot create aubio tempo detection");
+		aubio_tempo_set_silence(tempo.get(), -50.0f);
+		aubio_tempo_set_threshold(tempo.get(), 0.4f);
+		hop.reset(new_fvec(hopSize));
+		beat.reset(new_fvec(1));
+		if (!hop || !beat) throw std::runtime_error("Cannot allocate aubio vectors");
+	}
+
+	/// Start over, for samples from an earlier position
+	void reset() {
+		tempo.reset();
+		mono.clear();
+		analysed = 0;
+		beats.clear();
+		firstPeriod = 0.0;
+	}
+
+	/// Analyse the complete hops of decoded audio
+	void analyse() {
+		std::size_t pos = 0;
+		for (; pos + hopSize <= mono.size(); pos += hopSize) {
+			std::copy(mono.begin() + static_cast<std::ptrdiff_t>(pos), mono.begin() + static_cast<std::ptrdiff_t>(pos + hopSize), hop->data);
+			aubio_tempo_do(tempo.get(), hop.get(), beat.get());
+			if (beat->data[0] != 0) {
+				// Time since the start of the analysis
+				double const time = aubio_tempo_get_last_s(tempo.get());
+				if (beats.empty()) firstPeriod = aubio_tempo_get_period_s(tempo.get());
+				beats.push_back(time + start);
+			}
+			analysed += hopSize;
+		}
+		mono.erase(mono.begin(), mono.begin() + static_cast<std::ptrdiff_t>(pos));
+	}
+
+	void finish() {
+		if (!beats.empty() && firstPeriod > 0.0) {
+			// Extend the beats back to the start of the analysis at the tempo of the first beat
+			Song::Beats earlier;
+			for (double time = beats.front() - firstPeriod; time > start + 0.02; time -= firstPeriod) earlier.push_back(time);
+			beats.insert(beats.begin(), earlier.rbegin(), earlier.rend());
+		}
+		done = true;
+		tempo.reset();
+		hop.reset();
+		beat.reset();
+		mono = {};
+		std::atomic_store(&result, std::make_shared<Song::Beats const>(std::move(beats)));
+	}
+};
+
+BeatDetector::BeatDetector(fs::path const& file, double start, unsigned rate):
+  m_analysis(std::make_shared<Analysis>(file, start, rate)) {}
+
+BeatDetector::~BeatDetector() {
+	m_analysis->cancelled = true;
+}
+
+AudioBuffer::Listener BeatDetector::listener() const {
+	return [analysis = m_analysis](std::int16_t const* data, std::int64_t count, std::int64_t pos) {
+		analysis->receive(data, count, pos);
+	};
+}
+
+std::shared_ptr<Song::Beats const> BeatDetector::beats() const {
+	return std::atomic_load(&m_analysis->result);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ffmpeg.hh"
+#include "fs.hh"
+#include "song.hh"
+
+#include <memory>
+
+/**
+* Detects the beats of a song from its music, for songs that have no beats from their notes (used by the song
+* browser to pulse the covers). Analyses the samples decoded for playing the preview (see listener()), so that the
+* file is not decoded twice: runs aubio tempo detection on a while of music from the preview start, on the decoder
+* thread as the samples come. The result is published with an atomic pointer swap when done.
+**/
+class BeatDetector {
+  public:
+	/// Detect the beats of file from start (in seconds), from the samples at rate passed to listener()
+	BeatDetector(fs::path const& file, double start, unsigned rate);
+	~BeatDetector();
+	BeatDetector(BeatDetector const&) = delete;
+	BeatDetector& operator=(BeatDetector const&) = delete;
+
+	/// For playing the file with Audio::playMusic; does nothing once the detector is gone
+	AudioBuffer::Listener listener() const;
+	/// The beats in song time, nullptr while the detection is running (empty if no beats were found)
+	std::shared_ptr<Song::Beats const> beats() const;
+
+  private:
+	/// The state of the detection, shared with the listener (which is called as long as the music plays)
+	struct Analysis;
+	std::shared_ptr<Analysis> m_analysis;
+};
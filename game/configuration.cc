@@ -238,7 +238,7 @@ void writeConfig(Game& game, bool system) {
 				auto& audio = game.getAudio();
 
 				audio.restart();
-				audio.playMusic(game, findFile("menu.ogg"), true); // Start music again
+				audio.playMusic(findFile("menu.ogg"), true); // Start music again
 			}
 			else {
 				entryNode->set_attribute("value", std::to_string(oldValue));
@@ -401,12 +401,16 @@ unsigned short LanguageToLanguageId(const std::string& name) {
 	return 1337; // if no name matched return "Auto" which translates to computer language OR English.
 }
 
+void readConfigSchema(fs::path const& schemaFile) {
+	readConfigXML(schemaFile, 0);  // Read schema and defaults
+}
+
 void readConfig() {
 	// Find config schema
 	fs::path schemaFile = PathCache::getSchemaFilename();
 	systemConfFile = PathCache::getSysConfigDir() / "config.xml";
 	userConfFile = PathCache::getConfigDir() / "config.xml";
-	readConfigXML(schemaFile, 0);  // Read schema and defaults
+	readConfigSchema(schemaFile);
 	readConfigXML(systemConfFile, 1);  // Update defaults with system config
 	readConfigXML(userConfFile, 2);  // Read user settings
 	PathCache::pathInit();
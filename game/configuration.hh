@@ -1,6 +1,7 @@
 #pragma once
 
 #include "configitem.hh"
+#include "fs.hh"
 
 #include <cstdint>
 #include <map>
@@ -15,6 +16,8 @@ extern Config config; ///< A global variable that contains all config items
 
 /** Read config schema and configuration from XML files **/
 void readConfig();
+/** Read only the config schema and its defaults, without system or user settings (for tests) **/
+void readConfigSchema(fs::path const& schemaFile);
 void populateBackends(const std::list<std::string>& backendList);
 void populateLanguages(const std::map<std::string, std::string>& languages);
 
@@ -0,0 +1,32 @@
+#include "decodepacer.hh"
+
+#include <cmath>
+
+void DecodePacer::seek(double time) {
+	m_seekTime = time;
+	m_lastPassed = -1e9;
+	m_lag = 0.0;
+	m_lastChange = -1e9;
+	if (m_skip == Skip::NONKEY) m_skip = Skip::NONREF;
+}
+
+bool DecodePacer::frame(double timestamp, double position) {
+	if (timestamp < m_seekTime) return false;  // Only decoded to get to the seek position
+	m_seekTime = -1e9;
+	if (std::isnan(position)) m_lag = 0.0;
+	else {
+		m_lag = position - timestamp;
+		Skip skip = m_skip;
+		if (m_lag > farBehind) skip = Skip::NONKEY;
+		else if (m_lag > behind && skip == Skip::NONE) skip = Skip::NONREF;
+		else if (m_lag < -ahead && skip != Skip::NONE && timestamp - m_lastChange >= holdTime) skip = static_cast<Skip>(static_cast<int>(skip) - 1);
+		if (skip != m_skip) {
+			m_skip = skip;
+			m_lastChange = timestamp;
+		}
+	}
+	// A late frame is only shown if no newer one arrives first, which is unlikely if the previous one is recent
+	if (m_lag > 0.0 && timestamp - m_lastPassed < minInterval) return false;
+	m_lastPassed = timestamp;
+	return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+/**
+* Keeps video decoding up with playback on machines that are too slow for it.
+* For each decoded frame, it compares the timestamp with the playback position: when the frames come out late, the
+* decoder should skip more work (skip()) and frames that will not be seen are not passed on (frame() returns false).
+* Once the frames are ahead of playback again, skipping is reduced step by step.
+**/
+class DecodePacer {
+  public:
+	/// Work that the decoder may skip, from none to all frames but keyframes (AVDISCARD_NONREF and AVDISCARD_NONKEY)
+	enum class Skip { NONE, NONREF, NONKEY };
+	static constexpr double behind = 0.1;  ///< Lag in seconds at which non-reference frames are skipped
+	static constexpr double farBehind = 0.5;  ///< Lag in seconds at which only keyframes are decoded
+	static constexpr double ahead = 0.1;  ///< Lead in seconds at which skipping is reduced
+	static constexpr double holdTime = 1.0;  ///< Skipping is reduced at most once per this many seconds of video
+	static constexpr double minInterval = 0.25;  ///< Even late frames are passed on if the previous one is this much older
+
+	/// Decoding restarts before time (at a keyframe): frames until then are dropped, without counting as late.
+	/// Only keyframes could be too far apart to get there, so non-reference frames are skipped at most.
+	void seek(double time);
+	/**
+	* Account for a frame decoded while playback is at the given position (NaN if playback has not started).
+	* @return true if the frame should be passed on
+	**/
+	bool frame(double timestamp, double position);
+	Skip skip() const { return m_skip; }
+	/// How late the latest frame was, in seconds (negative if ahead of playback)
+	double lag() const { return m_lag; }
+
+  private:
+	Skip m_skip = Skip::NONE;
+	double m_lag = 0.0;
+	double m_seekTime = -1e9;
+	double m_lastPassed = -1e9;
+	double m_lastChange = -1e9;
+};
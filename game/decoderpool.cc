@@ -0,0 +1,94 @@
+#include "decoderpool.hh"
+
+#include "log.hh"
+
+#include <algorithm>
+#include <exception>
+
+DecoderPool::DecoderPool(unsigned threads, std::chrono::milliseconds idlePoll): m_idlePoll(idlePoll) {
+	for (unsigned i = 0; i < threads; ++i) m_threads.emplace_back(&DecoderPool::run, this);
+}
+
+DecoderPool::~DecoderPool() {
+	{
+		std::lock_guard<std::mutex> l(m_mutex);
+		m_quit = true;
+	}
+	m_cond.notify_all();
+	for (auto& thread: m_threads) thread.join();
+}
+
+DecoderPool::Id DecoderPool::add(Job job) {
+	std::lock_guard<std::mutex> l(m_mutex);
+	auto entry = std::make_unique<Entry>();
+	entry->id = ++m_lastId;
+	entry->job = std::move(job);
+	m_jobs.push_back(std::move(entry));
+	m_cond.notify_one();
+	return m_lastId;
+}
+
+void DecoderPool::remove(Id id) {
+	std::unique_ptr<Entry> removed;
+	{
+		std::unique_lock<std::mutex> l(m_mutex);
+		auto it = std::find_if(m_jobs.begin(), m_jobs.end(), [id](auto const& entry) { return entry->id == id; });
+		if (it == m_jobs.end()) return;
+		Entry& entry = **it;
+		entry.removing = true;
+		m_removed.wait(l, [&entry] { return !entry.running; });
+		it = std::find_if(m_jobs.begin(), m_jobs.end(), [id](auto const& e) { return e->id == id; });  // Others may have been removed meanwhile
+		removed = std::move(*it);
+		m_jobs.erase(it);
+	}
+	// The job is destroyed here, outside of the lock (it may close files etc.)
+}
+
+std::size_t DecoderPool::size() const {
+	std::lock_guard<std::mutex> l(m_mutex);
+	return m_jobs.size();
+}
+
+DecoderPool::Entry* DecoderPool::next(Clock::time_point now) {
+	for (std::size_t i = 0; i < m_jobs.size(); ++i) {
+		std::size_t const idx = (m_next + i) % m_jobs.size();
+		Entry& entry = *m_jobs[idx];
+		if (entry.running || entry.removing || entry.idleUntil > now) continue;
+		m_next = idx + 1;
+		return &entry;
+	}
+	return nullptr;
+}
+
+void DecoderPool::run() {
+	std::unique_lock<std::mutex> l(m_mutex);
+	while (!m_quit) {
+		auto const now = Clock::now();
+		Entry* entry = next(now);
+		if (!entry) {
+			// Sleep until an idle job is due to be polled again (or a job is added)
+			auto wake = Clock::time_point::max();
+			for (auto const& e: m_jobs) if (!e->running && !e->removing) wake = std::min(wake, e->idleUntil);
+			if (wake == Clock::time_point::max()) m_cond.wait(l);
+			else m_cond.wait_until(l, wake);
+			continue;
+		}
+		entry->running = true;
+		l.unlock();
+		bool more = false;
+		try {
+			more = entry->job();
+		} catch (std::exception const& e) {
+			SpdLogger::error(LogSystem::FFMPEG, "Decoder job failed, exception={}", e.what());
+		}
+		l.lock();
+		entry->running = false;
+		if (!more) entry->idleUntil = Clock::now() + m_idlePoll;
+		if (entry->removing) m_removed.notify_all();
+	}
+}
+
+DecoderPool& DecoderPool::global() {
+	static DecoderPool pool(std::clamp(std::thread::hardware_concurrency() / 2, 2u, 4u));
+	return pool;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* A fixed set of threads shared by all audio decoders, so that starting a stream never creates a thread.
+* Each job does a small piece of work at a time (e.g. decoding one frame) and is called again while it reports
+* that it has more work ready, round-robin with the other jobs. Jobs that are idle (e.g. their buffer is full)
+* are polled again after a short while, as the audio callback consuming their data cannot notify anyone.
+**/
+class DecoderPool {
+  public:
+	/// Do a piece of work, returning true if more work is ready right away
+	using Job = std::function<bool()>;
+	using Id = std::uint64_t;
+
+	explicit DecoderPool(unsigned threads, std::chrono::milliseconds idlePoll = std::chrono::milliseconds(5));
+	~DecoderPool();
+
+	/// Start running a job
+	Id add(Job job);
+	/// Stop running a job, waiting if it is running right now; the job is destroyed before returning
+	void remove(Id id);
+	/// The number of jobs
+	std::size_t size() const;
+
+	/// The pool used by AudioBuffer
+	static DecoderPool& global();
+
+  private:
+	using Clock = std::chrono::steady_clock;
+	struct Entry {
+		Id id;
+		Job job;
+		Clock::time_point idleUntil;
+		bool running = false;
+		bool removing = false;
+	};
+	void run();
+	Entry* next(Clock::time_point now);
+
+	std::chrono::milliseconds const m_idlePoll;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;  ///< Wakes the workers
+	std::condition_variable m_removed;  ///< Wakes remove() when a job it waits for has stopped running
+	std::vector<std::unique_ptr<Entry>> m_jobs;  ///< Pointers stay valid while a worker runs the job unlocked
+	std::size_t m_next = 0;  ///< Where to continue the round
+	Id m_lastId = 0;
+	bool m_quit = false;
+	std::vector<std::thread> m_threads;
+};
@@ -7,6 +7,7 @@
 #include "configuration.hh"
 #include <iostream>
 #include <list>
+#include <set>
 
 const double Engine::TIMESTEP = 0.01;
 
@@ -19,18 +20,26 @@ Engine::Engine(Audio& audio, VocalTrackPtrs vocals, Database& database):
 	m_database.cur.clear();
 	m_database.scores.clear();
 	unsigned i = 0;
+	std::set<Analyzer const*> players;
 	for (Analyzer& a: analyzers) {
 		// Calculate the space required for pitch frames
 		size_t frames = static_cast<size_t>(vocals[i]->endTime / Engine::TIMESTEP);
 		m_database.cur.push_back(Player(*vocals[i], a, frames));
+		players.insert(&a);
 		++i;
 	}
+	// Analyze the channels of each capture device together, only those of the players
+	for (Device& d: m_audio.devices()) {
+		std::vector<Analyzer*> mics;
+		for (Analyzer* a: d.mics) if (a && players.count(a)) mics.push_back(a);
+		if (!mics.empty()) m_batches.emplace_back(std::move(mics));
+	}
 	m_thread.reset(new std::thread(std::ref(*this)));
 }
 
 void Engine::operator()() {
 	while (!m_quit) {
-		for (Player& player: m_database.cur) player.prepare();
+		for (AnalyzerBatch& batch: m_batches) batch.process();
 		double t = m_audio.getPosition() - config["audio/round-trip"].f();
 		double timeLeft = m_time - t;
 		if (timeLeft != timeLeft || timeLeft > 1.0) timeLeft = 1.0;  // FIXME: Workaround for NaN values and other weirdness (should fix the weirdness instead)
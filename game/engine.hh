@@ -1,5 +1,7 @@
 #pragma once
 
+#include "analyzer.hh"
+
 #include <atomic>
 #include <memory>
 #include <thread>
@@ -15,6 +17,7 @@ class Engine {
 	double m_time;
 	std::atomic<bool> m_quit{ false };
 	Database& m_database;
+	std::vector<AnalyzerBatch> m_batches;  ///< Analyzers grouped by capture device
 	std::unique_ptr<std::thread> m_thread;
 
   public:
@@ -3,11 +3,12 @@
 #include "chrono.hh"
 #include "config.hh"
 #include "log.hh"
+#include "pcmcache.hh"
 #include "screen_songs.hh"
 #include "util.hh"
 
-#include "aubio/aubio.h"
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
@@ -43,27 +44,50 @@ namespace {
 		unsigned micro = ver & 0xFF;
 		return fmt::format("{}.{}.{}", major, minor, micro);
 	}
-}
 
-AudioBuffer::uFvec AudioBuffer::makePreviewBuffer() {
-	uFvec fvec(new_fvec(static_cast<uint_t>(m_data.size() / 2)));
-	float previewVol = float(config["audio/preview_volume"].ui()) / 100.0f;
-	{
-		std::lock_guard<std::mutex> l(m_mutex);
-		for (size_t rpos = 0, bpos = 0; rpos < m_data.size(); rpos += 2, bpos ++) {
-			fvec->data[bpos] = (((da::conv_from_s16(m_data.at(rpos)) + da::conv_from_s16(m_data.at(rpos + 1))) / 2) / previewVol);
-		}
+	/// Threads for decoding videos: as configured, or by default half of the CPUs (at most 4), leaving the others for audio and drawing
+	int videoThreads() {
+		unsigned threads = config["graphic/video_threads"].ui();
+		if (threads == 0) threads = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+		return static_cast<int>(threads);
 	}
-	return fvec;
-}
 
-bool AudioBuffer::wantMore() {
-	return m_write_pos < m_read_pos + static_cast<std::int64_t>(m_data.size() / 2);
-}
+	/**
+	* Containers that are slow to seek by time (there is no index to find the position, so it is searched for) and
+	* where demuxing continues correctly after seeking to the byte position of a packet
+	**/
+	bool byteSeekable(AVInputFormat const* format) {
+		if (format->flags & AVFMT_NO_BYTE_SEEK) return false;
+		std::string const name = format->name;
+		return name == "mpegts" || name == "mpeg" || name == "flv";
+	}
 
-/// Should the input stop waiting?
-bool AudioBuffer::condition() {
-	return m_quit || m_seek_asked || wantMore();
+	/// Read through a file (without decoding) for the keyframes of its best stream of the media type
+	std::optional<KeyframeIndex> indexKeyframes(fs::path const& file, AVMediaType type, std::atomic<bool> const& cancel) {
+		AVFormatContext* context = nullptr;
+		if (avformat_open_input(&context, file.string().c_str(), nullptr, nullptr) < 0) return std::nullopt;
+		std::unique_ptr<AVFormatContext, void(*)(AVFormatContext*)> format(context, [](AVFormatContext* c) { ::avformat_close_input(&c); });
+		if (avformat_find_stream_info(context, nullptr) < 0) return std::nullopt;
+		int const streamId = av_find_best_stream(context, type, -1, -1, nullptr, 0);
+		if (streamId < 0) return std::nullopt;
+		AVStream const* stream = context->streams[streamId];
+		double const timeBase = av_q2d(stream->time_base);
+		std::int64_t const start = stream->start_time == std::int64_t(AV_NOPTS_VALUE) ? 0 : stream->start_time;
+		std::unique_ptr<AVPacket, void(*)(AVPacket*)> packet(av_packet_alloc(), [](AVPacket* p) { av_packet_free(&p); });
+		if (!packet) return std::nullopt;
+		KeyframeIndex index;
+		while (!cancel) {
+			int const ret = av_read_frame(context, packet.get());
+			// The keyframes up to a broken part of the file are still good for seeking there
+			if (ret < 0) return ret == AVERROR_EOF || !index.keyframes().empty() ? std::optional<KeyframeIndex>(std::move(index)) : std::nullopt;
+			if (packet->stream_index == streamId && (packet->flags & AV_PKT_FLAG_KEY)) {
+				std::int64_t const ts = packet->pts != std::int64_t(AV_NOPTS_VALUE) ? packet->pts : packet->dts;
+				if (ts != std::int64_t(AV_NOPTS_VALUE)) index.add(double(ts - start) * timeBase, packet->pos);
+			}
+			av_packet_unref(packet.get());
+		}
+		return std::nullopt;
+	}
 }
 
 void AudioBuffer::operator()(const std::int16_t *data, std::int64_t count, std::int64_t sample_position) {
@@ -71,38 +95,21 @@ void AudioBuffer::operator()(const std::int16_t *data, std::int64_t count, std::
 		SpdLogger::warn(LogSystem::FFMPEG, "Negative audio sample_position={} seconds, frame ignored.", sample_position);
 		return;
 	}
-
-	std::unique_lock<std::mutex> l(m_mutex);
-	if (sample_position < m_read_pos) {
-		// frame to be dropped as being before read... arrived too last or due to a seek.
-		return;
-	}
-
-	m_cond.wait(l, [this]{ return  condition(); });
-	if (m_quit || m_seek_asked) return;
-
-	if (m_write_pos != sample_position) {
-		SpdLogger::debug(LogSystem::FFMPEG, "Audio gap: expected={}, received={}.", m_write_pos, sample_position);
+	if (m_ring.seekPending()) return;  // Drop the frame
+	auto const write_pos = m_ring.writePos();
+	if (sample_position > write_pos) {
+		SpdLogger::debug(LogSystem::FFMPEG, "Audio gap: expected={}, received={}.", write_pos, sample_position);
 	}
-
-	m_write_pos = sample_position;
-	std::int64_t write_pos_in_ring = m_write_pos % static_cast<std::int64_t>(m_data.size());
-	auto first_hunk_size = std::min(count, static_cast<std::int64_t>(m_data.size()) - write_pos_in_ring);
-	std::copy(data, data + first_hunk_size, m_data.begin() + write_pos_in_ring);
-	// second part is when data wrapped in the ring buffer
-	std::copy(data + first_hunk_size, data + count, m_data.begin());
-	m_write_pos += count;
-	m_cond.notify_all();
+	m_ring.write(data, count, sample_position);
 }
 
 bool AudioBuffer::prepare(std::int64_t pos) {
-	// perform fake read to trigger any potential seek
-	if (!read(nullptr, 0, pos, 1)) return true;
-
-	std::unique_lock<std::mutex> l(m_mutex);
-	// Has enough been prebuffered already and is the requested position still within buffer
-	auto ring_size = static_cast<std::int64_t>(m_data.size());
-	return m_write_pos > m_read_pos + ring_size / 16 && m_write_pos <= m_read_pos + ring_size;
+	if (pos < 0) pos = 0;
+	if (eof(pos)) return true;
+	// Has enough been prebuffered already (or all of the rest of the file)?
+	auto const available = m_ring.buffered(pos);
+	auto const eof_pos = m_eof_pos.load();
+	return available > static_cast<std::int64_t>(m_ring.data().size()) / 16 || (eof_pos != -1 && pos + available >= eof_pos);
 }
 
 // pos may be negative because upper layer may request 'extra time' before
@@ -120,97 +127,149 @@ bool AudioBuffer::read(float* begin, std::int64_t samples, std::int64_t pos, flo
 		if (negative_samples == samples) return true;
 
 		// if there are remaining samples to read in positive land, do the 'normal' read
+		begin += negative_samples;
 		pos = 0;
 		samples -= negative_samples;
 	}
 
-	std::unique_lock<std::mutex> l(m_mutex);
-	if (eof(pos + samples) || m_quit)
+	if (eof(pos + samples))
 		return false;
 
+	volume *= m_gain;
+	// Never blocks; plays silence while seeking or if the decoder falls behind
+	m_ring.read(begin, samples, pos, volume);
+	return true;
+}
 
-	if ( m_replayGainDecibels != 0.0 )  // If Replay Gain is defined at all
-	{
-		// A replay gain was defined, apply the linear gain factor and the volume to the samples
-		volume *= static_cast<float>(m_replayGainFactor);
-	}
+double AudioBuffer::duration() { return m_duration; }
 
-	// one cannot read more data than the size of buffer
-	std::int64_t size = static_cast<std::int64_t>(m_data.size());
-	samples = std::min(samples, size);
-	if (pos >= m_read_pos + size - samples || pos < m_read_pos) {
-		// in case request position is not in the current possible range, we trigger a seek
-		// Note: m_write_pos is not checked on purpose: if pos is after
-		// m_write_pos, zeros present in buffer will be returned
-		std::fill(begin, begin + samples, 0);
-		m_read_pos = pos + samples;
-		m_seek_asked = true;
-		std::fill(m_data.begin(), m_data.end(), 0);
-		m_cond.notify_all();
-		return true;
-	}
+void AudioBuffer::logUnderruns() {
+	auto const underruns = m_ring.underruns();
+	if (underruns == m_underruns_logged) return;
+	SpdLogger::warn(LogSystem::FFMPEG, "Audio underrun: decoding fell behind playback {} times (total {}).", underruns - m_underruns_logged, underruns);
+	m_underruns_logged = underruns;
+}
 
-	for (std::int64_t s = 0; s < samples; ++s) {
-		begin[s] += volume * da::conv_from_s16(m_data[static_cast<size_t>((m_read_pos + s)) % m_data.size()]);
-	}
+void AudioBuffer::logReady(char const* source) {
+	if (m_ready) return;
+	m_ready = true;
+	SpdLogger::debug(LogSystem::FFMPEG, "Audio ready after {:.1f} ms ({}).", std::chrono::duration<double, std::milli>(Clock::now() - m_created).count(), source);
+}
 
-	m_read_pos = pos + samples;
-	m_cond.notify_all();
-	return true;
+std::string AudioBuffer::cacheFormat(unsigned rate) {
+	// The replay gain is applied when mixing, so it does not change the samples
+	return fmt::format("s16 stereo {} Hz", rate);
 }
 
-double AudioBuffer::duration() { return m_duration; }
+PcmCache::Job AudioBuffer::cacheJob(fs::path const& file, unsigned rate) {
+	return [file, rate](PcmCache::Writer& writer) {
+		AudioFFmpeg decoder(file, static_cast<int>(rate), std::ref(writer));
+		try {
+			while (!writer.cancelled()) decoder.handleOneFrame();
+		} catch (FFmpeg::Eof const&) {}
+		return PcmInfo{ decoder.duration(), decoder.getReplayGainInDecibels(), decoder.getReplayGainVolumeFactor() };
+	};
+}
 
-AudioBuffer::AudioBuffer(fs::path const& file, unsigned rate, size_t size):
-	m_data(size), m_sps(rate * AUDIO_CHANNELS) {
-		auto ffmpeg = std::make_unique<AudioFFmpeg>(file, rate, std::ref(*this));
-		m_duration = ffmpeg->duration();
-		m_replayGainDecibels = ffmpeg->getReplayGainInDecibels();
-		m_replayGainFactor = ffmpeg->getReplayGainVolumeFactor();
-		reader_thread = std::async(std::launch::async, [this, ffmpeg = std::move(ffmpeg)] {
-			auto errors = 0u;
-			std::unique_lock<std::mutex> l(m_mutex);
-			while (!m_quit) {
-				if (m_seek_asked) {
-					m_seek_asked = false;
-					m_write_pos = m_read_pos;
-					auto seek_pos = static_cast<double>(m_read_pos) / double(AV_TIME_BASE);
-
-					UnlockGuard<decltype(l)> unlocked(l); // release lock during seek
-					ffmpeg->seek(seek_pos);
-					continue;
-				}
+void AudioBuffer::record(std::int64_t from) {
+	if (m_listener) m_ring.written(from, m_listener);
+	if (!m_recorder) return;
+	m_ring.written(from, std::ref(*m_recorder));
+	if (m_recorder->done()) m_recorder.reset();  // Seeked
+}
 
-				try {
-					UnlockGuard<decltype(l)> unlocked(l); // release lock during possibly blocking ffmpeg stuff
+void AudioBuffer::setReplayGain(double decibels, double factor) {
+	m_replayGainDecibels = decibels;
+	m_replayGainFactor = factor;
+	// 0 dB if the file has no replay gain; the setting is read here to keep config lookups out of the audio callback
+	m_gain = decibels != 0.0 && config["audio/normalize_songs"].b() ? static_cast<float>(factor) : 1.0f;
+}
 
-					ffmpeg->handleOneFrame();
-					errors = 0;
-				} catch (const FFmpeg::Eof&) {
-					// now we know exact eof_pos
-					m_eof_pos = m_write_pos;
-					// Wait here on eof: either quit is asked, either a new seek
-					// was asked and return back reading frames
-					m_cond.wait(l, [this]{ return m_quit || m_seek_asked; });
+AudioBuffer::AudioBuffer(fs::path const& file, unsigned rate, bool cache, Listener listener, size_t size):
+	m_ring(size, &AudioRing::Pool::global()), m_sps(rate * AUDIO_CHANNELS), m_listener(std::move(listener)) {
+		PcmCache* pcmCache = PcmCache::global();
+		std::string const format = cacheFormat(rate);
+		if (std::shared_ptr<PcmCache::Entry> cached = pcmCache ? pcmCache->load(file, format) : nullptr) {
+			m_duration = cached->info().duration;
+			setReplayGain(cached->info().replayGainDecibels, cached->info().replayGainFactor);
+			m_eof_pos = cached->size();
+			// Copy from the mapped file to the ring, so that the audio callback never waits for the disk
+			m_job = DecoderPool::global().add([this, cached, pos = std::int64_t{ 0 }]() mutable {
+				std::int64_t seek_pos;
+				if (m_ring.takeSeek(seek_pos)) pos = std::clamp<std::int64_t>(seek_pos, 0, cached->size());
+				logUnderruns();
+				if (pos >= cached->size() || !m_ring.wantMore()) return false;
+				std::int64_t const count = std::min<std::int64_t>(cached->size() - pos, 4096);
+				if (m_ring.write(cached->data() + pos, count, pos)) {
+					if (m_listener) m_listener(cached->data() + pos, count, pos);
+					pos += count;
+					if (m_listener && pos == cached->size()) m_listener(nullptr, 0, pos);
+					logReady("cached");
+				}
+				return true;
+			});
+			return;
+		}
+		// Frames that continue the ring are resampled straight into it, the others come through operator()
+		auto ffmpeg = std::make_shared<AudioFFmpeg>(file, static_cast<int>(rate), std::ref(*this), &m_ring);
+		m_duration = ffmpeg->duration();
+		setReplayGain(ffmpeg->getReplayGainInDecibels(), ffmpeg->getReplayGainVolumeFactor());
+		// Played through from the start, the decoded samples are cached as well
+		if (pcmCache && cache) m_recorder = pcmCache->record(file, format);
+		m_job = DecoderPool::global().add([this, ffmpeg, errors = 0u, seekTo = std::int64_t{ -1 }]() mutable {
+			std::int64_t seek_pos;
+			if (m_ring.takeSeek(seek_pos)) seekTo = seek_pos;  // Also replaces a seek that failed
+			if (seekTo != -1) {
+				m_eof_pos = -1;
+				try {
+					ffmpeg->seek(static_cast<double>(seekTo) / m_sps);
 				} catch (const std::exception& e) {
-					UnlockGuard<decltype(l)> unlocked(l); // unlock while doing IOs
-					SpdLogger::error(LogSystem::FFMPEG, "Error={}.", e.what());
-					if (++errors > 2) SpdLogger::error(LogSystem::FFMPEG, "Terminating due to multiple errors.");
+					// The ring has taken the seek already, so keep it here and try again when polled next
+					SpdLogger::error(LogSystem::FFMPEG, "Seek failed, position={}, error={}.", seekTo, e.what());
+					if (++errors > 2) {
+						SpdLogger::error(LogSystem::FFMPEG, "Terminating due to multiple errors.");
+						m_eof_pos = m_ring.writePos();
+						seekTo = -1;
+						errors = 0;
+					}
+					return false;
 				}
+				seekTo = -1;
+				errors = 0;
+				return true;
 			}
+			logUnderruns();
+			// Nothing to do at the end of the file (until the next seek) or while the ring is full
+			if (m_eof_pos != -1 || !m_ring.wantMore()) return false;
+			auto const written = m_ring.writePos();
+			try {
+				ffmpeg->handleOneFrame();
+				record(written);
+				if (m_ring.writePos() != written) logReady("decoded");
+				errors = 0;
+			} catch (const FFmpeg::Eof&) {
+				// now we know exact eof_pos
+				m_eof_pos = m_ring.writePos();
+				record(written);
+				if (m_listener) m_listener(nullptr, 0, m_eof_pos);
+				if (m_recorder) m_recorder->finish(PcmInfo{ m_duration, m_replayGainDecibels, m_replayGainFactor });
+				m_recorder.reset();
+			} catch (const std::exception& e) {
+				m_recorder.reset();  // The track is not cached with the samples missing
+				SpdLogger::error(LogSystem::FFMPEG, "Error={}.", e.what());
+				if (++errors > 2) {
+					SpdLogger::error(LogSystem::FFMPEG, "Terminating due to multiple errors.");
+					m_eof_pos = m_ring.writePos();
+					errors = 0;
+				}
+			}
+			return true;
 		});
 }
 
 AudioBuffer::~AudioBuffer() {
-	{
-		std::unique_lock<std::mutex> l(m_mutex);
-		m_read_pos = 0;
-		m_write_pos = 0;
-		std::fill(m_data.begin(), m_data.end(), 0);
-		m_quit = true;
-	}
-	m_cond.notify_all();
-	reader_thread.get();
+	DecoderPool::global().remove(m_job);
+	logUnderruns();
 }
 
 static void printFFmpegInfo() {
@@ -259,7 +318,7 @@ std::string FFmpeg::Error::msgFmt(const FFmpeg &self, int errorValue, const char
 		return fmt::format("Error processing file={}, error={}({}), in function={}.", self.m_filename, errorValue, message, func);
 }
 
-FFmpeg::FFmpeg(fs::path const& _filename, int mediaType) : m_filename(_filename) {
+FFmpeg::FFmpeg(fs::path const& _filename, int mediaType, int threads) : m_filename(_filename) {
 	static std::once_flag static_infos;
 	std::call_once(static_infos, &printFFmpegInfo);
 
@@ -287,6 +346,11 @@ FFmpeg::FFmpeg(fs::path const& _filename, int mediaType) : m_filename(_filename)
 
 	decltype(m_codecContext) pCodecCtx{avcodec_alloc_context3(codec), avcodec_free_context};
 	avcodec_parameters_to_context(pCodecCtx.get(), m_formatContext->streams[m_streamId]->codecpar);
+	if (threads != 1) {
+		// Frame threading decodes several frames at once (delaying the output by a frame per thread), slice threading parts of a frame
+		pCodecCtx->thread_count = threads;
+		pCodecCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	}
 	{
 		static std::mutex s_avcodec_mutex;
 		// ffmpeg documentation is clear on the fact that avcodec_open2 is not thread safe.
@@ -295,6 +359,9 @@ FFmpeg::FFmpeg(fs::path const& _filename, int mediaType) : m_filename(_filename)
 	}
 	pCodecCtx->workaround_bugs = FF_BUG_AUTODETECT;
 	m_codecContext = std::move(pCodecCtx);
+	m_packet.reset(av_packet_alloc());
+	m_frame.reset(av_frame_alloc());
+	if (!m_packet || !m_frame) throw std::runtime_error("Cannot allocate decoding buffers");
 }
 
 
@@ -321,8 +388,8 @@ bool FFmpeg::readReplayGain(const AVStream *stream)
 	m_replayGainDecibels = 0.0;  // 0.0 indicates not defined
 	m_replayGainFactor   = 1.0;
 
-	// Only use Replay Gain if the option for normalisation is enabled
-	if (stream != nullptr && config["audio/normalize_songs"].b() == true) {
+	// Read even if normalisation is disabled, AudioBuffer decides whether to apply it
+	if (stream != nullptr) {
 #if (LIBAVFORMAT_VERSION_MAJOR) < 61 // arrived at experimentally with the pipeline
 #if (LIBAVFORMAT_VERSION_MAJOR) <= 58
 		int replay_gain_size;
@@ -373,8 +440,8 @@ bool FFmpeg::readR128Gain(const AVStream *stream)
 	m_replayGainDecibels = 0.0;  // 0.0 indicates not defined
 	m_replayGainFactor   = 1.0;
 
-	// Only use Replay Gain if the option for normalisation is enabled
-	if (stream != nullptr && config["audio/normalize_songs"].b() == true) {
+	// Read even if normalisation is disabled, AudioBuffer decides whether to apply it
+	if (stream != nullptr) {
 		const AVDictionaryEntry *r128Tag = av_dict_get(stream->metadata, R128_GAIN_TAG, nullptr, 0);
 		if (r128Tag != nullptr) {
 			double r128Gain = strtod(r128Tag->value, nullptr);
@@ -408,16 +475,35 @@ double FFmpeg::calculateLinearGain(double gainInDB) const {
 		return pow(10.0, gainInDB / 20.0);
 }
 
-VideoFFmpeg::VideoFFmpeg(fs::path const& filename, VideoCb videoCb) : FFmpeg(filename, AVMEDIA_TYPE_VIDEO), handleVideoData(videoCb) {
-	// Setup software scaling context for YUV to RGB conversion
+VideoFFmpeg::VideoFFmpeg(fs::path const& filename, VideoCb videoCb, Params params) :
+	FFmpeg(filename, AVMEDIA_TYPE_VIDEO, videoThreads()), handleVideoData(videoCb), m_params(std::move(params)) {
+	SpdLogger::debug(LogSystem::FFMPEG, "File={}, decoding video with {} thread(s).", filename, m_codecContext->thread_count);
+	// Otherwise only known once the first frame is decoded
+	if (m_codecContext->width > 0 && m_codecContext->height > 0 && m_codecContext->pix_fmt != AV_PIX_FMT_NONE) {
+		setupScaling(m_codecContext->width, m_codecContext->height, m_codecContext->pix_fmt);
+	}
+}
+
+void VideoFFmpeg::setupScaling(int width, int height, AVPixelFormat format) {
+	m_sourceWidth = width;
+	m_sourceHeight = height;
+	m_sourceFormat = format;
+	m_swsContext.reset();
+	yuv::Planes420 const source{ static_cast<unsigned>(width), static_cast<unsigned>(height) };
+	m_size = yuv::scaleToCover(source, m_params.coverWidth, m_params.coverHeight);
+	bool const scaled = m_size.width != source.width || m_size.height != source.height;
+	// Most videos are YUV 4:2:0 already and are passed on as is; the others need software scaling into it
+	if (!scaled && (format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P)) return;
+	if (scaled) SpdLogger::debug(LogSystem::FFMPEG, "File={}, scaling video from {}x{} to {}x{}.", m_filename, source.width, source.height, m_size.width, m_size.height);
 	m_swsContext.reset(sws_getContext(
-				m_codecContext->width, m_codecContext->height, m_codecContext->pix_fmt,
-				m_codecContext->width, m_codecContext->height, AV_PIX_FMT_RGB24,
-				SWS_POINT, nullptr, nullptr, nullptr));
+				width, height, format,
+				static_cast<int>(m_size.width), static_cast<int>(m_size.height), AV_PIX_FMT_YUV420P,
+				scaled ? SWS_BILINEAR : SWS_POINT, nullptr, nullptr, nullptr));
+	if (!m_swsContext) throw std::runtime_error(fmt::format("Cannot convert {}x{} video frames of format {} in {}", width, height, static_cast<int>(format), m_filename));
 }
 
-AudioFFmpeg::AudioFFmpeg(fs::path const& filename, int rate, AudioCb audioCb) :
-	FFmpeg(filename, AVMEDIA_TYPE_AUDIO), m_rate(rate), handleAudioData(audioCb) {
+AudioFFmpeg::AudioFFmpeg(fs::path const& filename, int rate, AudioCb audioCb, AudioRing* ring) :
+	FFmpeg(filename, AVMEDIA_TYPE_AUDIO), m_rate(rate), handleAudioData(audioCb), m_ring(ring) {
 		// setup resampler
 		m_resampleContext.reset(swr_alloc());
 		if (!m_resampleContext) throw std::runtime_error("Cannot create resampling context");
@@ -461,9 +547,10 @@ void FFmpeg::avcodec_free_context(AVCodecContext *avctx) {
 
 void FFmpeg::handleOneFrame() {
 	bool read_one = false;
+	AVPacket* pkt = m_packet.get();
 	do {
-				std::unique_ptr<AVPacket, std::function<void(AVPacket*)>> pkt(av_packet_alloc(), [] (auto *pkt) { av_packet_free(&pkt); });
-		auto ret = av_read_frame(m_formatContext.get(), pkt.get());
+		av_packet_unref(pkt);  // Release the previous packet (also if it was skipped or failed to decode)
+		auto ret = av_read_frame(m_formatContext.get(), pkt);
 		if(ret == AVERROR_EOF) {
 			// End of file: no more data to read.
 			throw Eof();
@@ -473,7 +560,7 @@ void FFmpeg::handleOneFrame() {
 
 		if (pkt->stream_index != m_streamId) continue;
 
-				ret = avcodec_send_packet(m_codecContext.get(), pkt.get());
+				ret = avcodec_send_packet(m_codecContext.get(), pkt);
 				if(ret == AVERROR_EOF) {
 						// End of file: no more data to read.
 						throw Eof();
@@ -488,24 +575,49 @@ void FFmpeg::handleOneFrame() {
 	} while (!read_one);
 }
 
+void FFmpeg::loadIndex() {
+	KeyframeIndexCache* cache = KeyframeIndexCache::global();
+	if (m_index || !cache || !byteSeekable(m_formatContext->iformat)) return;
+	auto const type = m_formatContext->streams[m_streamId]->codecpar->codec_type;
+	std::string const stream = av_get_media_type_string(type);
+	m_index = cache->load(m_filename, stream);
+	if (m_index) return;
+	// Only needed once something seeks in the file, for the next seeks (also when it is played again)
+	cache->build(m_filename, stream, [file = m_filename, type](std::atomic<bool> const& cancel) { return indexKeyframes(file, type, cancel); });
+}
+
 void FFmpeg::seek(double time) {
+	loadIndex();
+	if (KeyframeIndex::Keyframe const* keyframe = m_index ? m_index->before(time) : nullptr) {
+		// Decoding goes on from the keyframe to the requested time, as with the seek below
+		if (av_seek_frame(m_formatContext.get(), m_streamId, keyframe->pos, AVSEEK_FLAG_BYTE) >= 0) {
+			seeked();
+			return;
+		}
+	}
 	// AVSEEK_FLAG_BACKWARD makes sure we always get a keyframe BEFORE the
 	// request time, thus it allows us to drop some frames to reach the
 	// exact point where asked to seek
 	int flags = AVSEEK_FLAG_BACKWARD;
-	av_seek_frame(m_formatContext.get(), -1, static_cast<std::int64_t>(time * AV_TIME_BASE), flags);
+	if (av_seek_frame(m_formatContext.get(), -1, static_cast<std::int64_t>(time * AV_TIME_BASE), flags) >= 0) seeked();
+}
+
+void FFmpeg::seeked() {
+	// Frames the codec (and its other threads with frame threading) still holds are from before the seek
+	avcodec_flush_buffers(m_codecContext.get());
+	m_position = 0.0;  // As when opened, until a frame decoded after the seek tells its position
 }
 
 void AudioFFmpeg::seek(double time) {
 	FFmpeg::seek(time);
-	m_position_in_48k_frames = -1; //kill previous position
+	m_position_in_frames = -1; //kill previous position
 }
 
 void FFmpeg::handleSomeFrames() {
 		int ret;
+		AVFrame& frame = *m_frame;
 		do {
-		uFrame frame{av_frame_alloc()};
-		ret = avcodec_receive_frame(m_codecContext.get(), frame.get());
+		ret = avcodec_receive_frame(m_codecContext.get(), &frame);  // Releases the previous frame first
 		if (ret == AVERROR_EOF) {
 			// End of file: no more data.
 			throw Eof();
@@ -516,48 +628,115 @@ void FFmpeg::handleSomeFrames() {
 			throw Error(*this, ret, __PRETTY_FUNCTION__);
 		}
 		// frame is available here
-		if (frame->pts != std::int64_t(AV_NOPTS_VALUE)) {
-			auto new_position = double(frame->pts) * av_q2d(m_formatContext->streams[m_streamId]->time_base);
+		if (frame.pts != std::int64_t(AV_NOPTS_VALUE)) {
+			auto new_position = double(frame.pts) * av_q2d(m_formatContext->streams[m_streamId]->time_base);
 			if (m_formatContext->streams[m_streamId]->start_time != std::int64_t(AV_NOPTS_VALUE))
 				new_position -= double(m_formatContext->streams[m_streamId]->start_time) * av_q2d(m_formatContext->streams[m_streamId]->time_base);
 			m_position = new_position;
 		}
-		processFrame(std::move(frame));
+		processFrame(frame);
+		av_frame_unref(&frame);  // Give the buffers back to the decoder
 	} while (ret >= 0);
 }
 
-void VideoFFmpeg::processFrame(uFrame frame) {
-	// Convert into RGB and scale the data
-	auto w = static_cast<unsigned>((m_codecContext->width + 15) & ~15);
-	auto h = static_cast<unsigned>(m_codecContext->height);
-	Bitmap f;
+void VideoFFmpeg::seek(double time) {
+	FFmpeg::seek(time);
+	m_pacer.seek(time);
+	updateSkip();
+	m_profiler();  // Not counted as decoding time
+}
+
+void VideoFFmpeg::updateSkip() {
+	auto const skip = m_pacer.skip();
+	if (skip == m_skip) return;
+	SpdLogger::debug(LogSystem::FFMPEG, "File={}, decoding {} at lag={:.3f} s.", m_filename, skip == DecodePacer::Skip::NONKEY ? "keyframes only" : skip == DecodePacer::Skip::NONREF ? "without non-reference frames" : "all frames", m_pacer.lag());
+	// Takes effect with the next packet sent (also in the other threads of frame threading)
+	m_codecContext->skip_frame = skip == DecodePacer::Skip::NONKEY ? AVDISCARD_NONKEY : skip == DecodePacer::Skip::NONREF ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	m_codecContext->skip_loop_filter = skip == DecodePacer::Skip::NONE ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+	m_profiler.count(skip == DecodePacer::Skip::NONE ? "skip off" : "skip on");
+	m_skip = skip;
+}
+
+void VideoFFmpeg::processFrame(AVFrame& frame) {
+	m_profiler("decode");
+	bool const pass = m_pacer.frame(m_position, m_params.clock ? m_params.clock() : std::nan(""));
+	if (m_pacer.lag() > 0.0) m_profiler.add("lag", m_pacer.lag());
+	updateSkip();
+	if (!pass) {
+		m_profiler.count(m_pacer.lag() > 0.0 ? "dropped" : "seeking");
+		return;
+	}
+	auto const format = static_cast<AVPixelFormat>(frame.format);
+	if (frame.width != m_sourceWidth || frame.height != m_sourceHeight || format != m_sourceFormat) {
+		SpdLogger::debug(LogSystem::FFMPEG, "File={}, video frames changed to {}x{} format={}.", m_filename, frame.width, frame.height, frame.format);
+		setupScaling(frame.width, frame.height, format);
+	}
+	// The planes are copied without padding, the "video" shader converts them to RGB
+	auto const w = m_size.width;
+	auto const h = m_size.height;
+	yuv::Planes420 const planes = m_size;
+	Bitmap f = m_params.frameAlloc ? m_params.frameAlloc(planes.size()) : Bitmap();
 	f.timestamp = m_position;
-	f.fmt = pix::Format::RGB;
+	f.fmt = pix::Format::YUV420P;
 	f.resize(w, h);
-	{
-		std::uint8_t* data = f.data();
-		int linesize = static_cast<int>(w * 3);
-		sws_scale(m_swsContext.get(), frame->data, frame->linesize, 0, static_cast<int>(h), &data, &linesize);
+	// Videos that do not say are mostly BT.601 in SD and BT.709 in HD
+	bool const hd = frame.colorspace == AVCOL_SPC_BT709 || (frame.colorspace == AVCOL_SPC_UNSPECIFIED && frame.height > 576);
+	f.yuvEncoding.matrix = hd ? yuv::Matrix::BT709 : yuv::Matrix::BT601;
+	if (m_swsContext) {
+		std::uint8_t* data[4] = { f.data() + planes.offset(0), f.data() + planes.offset(1), f.data() + planes.offset(2), nullptr };
+		int linesize[4] = { static_cast<int>(planes.planeWidth(0)), static_cast<int>(planes.planeWidth(1)), static_cast<int>(planes.planeWidth(2)), 0 };
+		sws_scale(m_swsContext.get(), frame.data, frame.linesize, 0, frame.height, data, linesize);
+		// Scaling from the (deprecated) full range JPEG formats gives TV range, other formats keep their range
+		bool const jpeg = format == AV_PIX_FMT_YUVJ420P || format == AV_PIX_FMT_YUVJ422P || format == AV_PIX_FMT_YUVJ444P || format == AV_PIX_FMT_YUVJ440P || format == AV_PIX_FMT_YUVJ411P;
+		f.yuvEncoding.fullRange = frame.color_range == AVCOL_RANGE_JPEG && !jpeg;
+	} else {
+		for (unsigned i = 0; i < 3; ++i) yuv::copyPlane(f.data() + planes.offset(i), frame.data[i], frame.linesize[i], planes.planeWidth(i), planes.planeHeight(i));
+		f.yuvEncoding.fullRange = frame.color_range == AVCOL_RANGE_JPEG || frame.format == AV_PIX_FMT_YUVJ420P;
 	}
+	m_profiler("convert");
 	handleVideoData(std::move(f));  // Takes ownership and may block until there is space
+	m_profiler();  // Waiting is not decoding time
+}
+
+void AudioFFmpeg::processFrame(AVFrame& frame) {
+	if (m_position_in_frames == -1) {
+		m_position_in_frames = static_cast<std::int64_t>(m_position * m_rate + 0.5f);
+	}
+	int const max_samples = swr_get_out_samples(m_resampleContext.get(), frame.nb_samples);
+	int out_samples = -1;
+	if (m_ring && m_position_in_frames * AUDIO_CHANNELS == m_ring->writePos()) out_samples = resampleIntoRing(frame, max_samples);
+	if (out_samples == -1) {
+		// resample to output, an interleaved array of 16-bit samples
+		auto const size = static_cast<std::size_t>(std::max(max_samples, 0) * AUDIO_CHANNELS);
+		if (m_output.size() < size) m_output.resize(size);
+		auto output = reinterpret_cast<std::uint8_t*>(m_output.data());
+		out_samples = swr_convert(m_resampleContext.get(), &output, max_samples,
+				(const std::uint8_t**)&frame.data[0], frame.nb_samples);
+		if (out_samples < 0) throw Error(*this, out_samples, __PRETTY_FUNCTION__);
+		handleAudioData(m_output.data(), out_samples * AUDIO_CHANNELS, m_position_in_frames * AUDIO_CHANNELS /* pass in samples */);
+	}
+	m_position_in_frames += out_samples;
+	m_position += frame.nb_samples * av_q2d(m_formatContext->streams[m_streamId]->time_base);
 }
 
-void AudioFFmpeg::processFrame(uFrame frame) {
-	// resample to output
-	std::int16_t *output;
-	int out_samples = swr_get_out_samples(m_resampleContext.get(), frame->nb_samples);
-	av_samples_alloc((std::uint8_t**)&output, nullptr, AUDIO_CHANNELS, out_samples,
-			AV_SAMPLE_FMT_S16, 0);
-	out_samples = swr_convert(m_resampleContext.get(), (std::uint8_t**)&output, out_samples,
-			(const std::uint8_t**)&frame->data[0], frame->nb_samples);
-	// The output is now an interleaved array of 16-bit samples
-	if (m_position_in_48k_frames == -1) {
-		m_position_in_48k_frames = static_cast<std::int64_t>(m_position * m_rate + 0.5f);
+int AudioFFmpeg::resampleIntoRing(AVFrame& frame, int maxSamples) {
+	auto const span = m_ring->reserve(std::int64_t{maxSamples} * AUDIO_CHANNELS);
+	// All output must fit (whatever does not is kept in the resampler), in whole frames on both sides of the wrap
+	if (maxSamples < 0 || span.size() < std::int64_t{maxSamples} * AUDIO_CHANNELS || span.firstSize % AUDIO_CHANNELS) return -1;
+	auto const input = (const std::uint8_t**)&frame.data[0];
+	auto output = reinterpret_cast<std::uint8_t*>(span.first);
+	auto const first = static_cast<int>(span.firstSize / AUDIO_CHANNELS);
+	int out_samples = swr_convert(m_resampleContext.get(), &output, first, input, frame.nb_samples);
+	if (out_samples == first && span.secondSize > 0) {
+		// The rest is buffered in the resampler; take it without new input (a null input would flush the stream)
+		output = reinterpret_cast<std::uint8_t*>(span.second);
+		int const more = swr_convert(m_resampleContext.get(), &output, static_cast<int>(span.secondSize / AUDIO_CHANNELS), input, 0);
+		if (more < 0) throw Error(*this, more, __PRETTY_FUNCTION__);
+		out_samples += more;
 	}
-	handleAudioData(output, out_samples * AUDIO_CHANNELS, m_position_in_48k_frames * AUDIO_CHANNELS /* pass in samples */);
-	av_freep(&output);
-	m_position_in_48k_frames += out_samples;
-	m_position += frame->nb_samples * av_q2d(m_formatContext->streams[m_streamId]->time_base);
+	if (out_samples < 0) throw Error(*this, out_samples, __PRETTY_FUNCTION__);
+	m_ring->commit(std::int64_t{out_samples} * AUDIO_CHANNELS);
+	return out_samples;
 }
 
 
@@ -1,12 +1,16 @@
 #pragma once
 
+#include "audioring.hh"
 #include "chrono.hh"
+#include "decodepacer.hh"
+#include "decoderpool.hh"
+#include "keyframeindex.hh"
+#include "pcmcache.hh"
+#include "profiler.hh"
 #include "texture.hh"
 #include "util.hh"
 #include "libda/sample.hpp"
 
-#include "aubio/aubio.h"
-
 #include <fmt/format.h>
 
 #include <atomic>
@@ -18,6 +22,7 @@
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -29,8 +34,10 @@ extern "C" {
   struct AVCodecContext;
   struct AVFormatContext;
   struct AVFrame;
+  struct AVPacket;
   struct AVStream;
   void av_frame_free(AVFrame **);
+  void av_packet_free(AVPacket **);
   struct SwrContext;
   void swr_free(struct SwrContext **);
   void swr_close(struct SwrContext *);
@@ -55,12 +62,12 @@ class FFmpeg {
 	void inline check(int errorCode, const char* func = "") {
 		if (errorCode < 0) throw Error(*this, errorCode, func);
 	};
-	/// Decode file, depending on media type audio.
-	FFmpeg(fs::path const& filename, int mediaType);
+	/// Decode file, depending on media type audio. Threads other than 1 enable frame and slice threading (0 for as many as there are CPUs).
+	FFmpeg(fs::path const& filename, int mediaType, int threads = 1);
 
 	void handleOneFrame();
 
-	/** Seek to the chosen time. **/
+	/** Seek to the chosen time, straight to the keyframe before it if the file has been indexed (see KeyframeIndexCache). **/
 	virtual void seek(double time);
 
 	/// duration
@@ -75,13 +82,20 @@ class FFmpeg {
 
   protected:
 	static void frameDeleter(AVFrame *f) { if (f) av_frame_free(&f); }
+	static void packetDeleter(AVPacket *p) { if (p) av_packet_free(&p); }
 	bool readReplayGain(const AVStream *stream);
 	bool readR128Gain(const AVStream *stream);
 	using uFrame = std::unique_ptr<AVFrame, std::integral_constant<decltype(&frameDeleter), &frameDeleter>>;
+	using uPacket = std::unique_ptr<AVPacket, std::integral_constant<decltype(&packetDeleter), &packetDeleter>>;
 
-	virtual void processFrame(uFrame frame) = 0;
+	/// Handle a decoded frame; its data is only valid during the call (the frame is reused for the next one)
+	virtual void processFrame(AVFrame& frame) = 0;
 
 	void handleSomeFrames();
+	/// Drop what was decoded before a successful seek
+	void seeked();
+	/// Load the keyframe index of the stream for seeking, or have it built for later seeks
+	void loadIndex();
 
 	static void avformat_close_input(AVFormatContext *fctx);
 	static void avcodec_free_context(AVCodecContext *avctx);
@@ -95,6 +109,9 @@ class FFmpeg {
 	int m_streamId = -1;
 	std::unique_ptr<AVFormatContext, decltype(&avformat_close_input)> m_formatContext{nullptr, avformat_close_input};
 	std::unique_ptr<AVCodecContext, decltype(&avcodec_free_context)> m_codecContext{nullptr, avcodec_free_context};
+	uPacket m_packet;  ///< Reused for every packet read
+	uFrame m_frame;  ///< Reused for every frame decoded
+	std::shared_ptr<KeyframeIndex const> m_index;
 };
 
 #if !defined(__PRETTY_FUNCTION__) && defined(_MSC_VER)
@@ -106,75 +123,125 @@ class FFmpeg {
 class DurationFFmpeg : public FFmpeg {
   public:public:
 	DurationFFmpeg(fs::path const& file) : FFmpeg(file, AVMEDIA_TYPE_AUDIO) {};
-	void processFrame(uFrame) override { return; };
+	void processFrame(AVFrame&) override { return; };
 };
 
 class AudioFFmpeg : public FFmpeg {
   public:
 	using AudioCb = std::function<void(const std::int16_t *data, std::int64_t count, std::int64_t sample_position)>;
-	AudioFFmpeg(fs::path const& file, int rate, AudioCb audioCb);
+	/// With a ring, frames that continue where its writer left off are resampled directly into it; the others
+	/// (and all of them without a ring) are passed to audioCb. The ring must only be written by this decoder.
+	AudioFFmpeg(fs::path const& file, int rate, AudioCb audioCb, AudioRing* ring = nullptr);
 
 	void seek(double time) override;
   protected:
-	void processFrame(uFrame frame) override;
+	void processFrame(AVFrame& frame) override;
   private:
-	std::int64_t m_position_in_48k_frames = -1;
+	/// Resample frame into the writable space of m_ring, return the number of frames output or -1 if it does not fit
+	int resampleIntoRing(AVFrame& frame, int maxSamples);
+
+	std::int64_t m_position_in_frames = -1;
 	int m_rate = 0;
 	AudioCb handleAudioData;
+	AudioRing* m_ring = nullptr;
+	std::vector<std::int16_t> m_output;  ///< Resampled samples for handleAudioData (reused for every frame)
 	std::unique_ptr<SwrContext, void(*)(SwrContext*)> m_resampleContext{nullptr, [] (auto p) { swr_close(p); swr_free(&p); }};
 };
 
+/// Decodes the video of a file into pix::Format::YUV420P bitmaps
 class VideoFFmpeg : public FFmpeg {
   public:
 	using VideoCb = std::function<void(Bitmap)>;
-	VideoFFmpeg(fs::path const& file, VideoCb videoCb);
+	/// Provides the bitmap for a frame of size bytes, e.g. in a pixel buffer or in recycled memory
+	using FrameAlloc = std::function<Bitmap(std::size_t size)>;
+	struct Params {
+		FrameAlloc frameAlloc;  ///< Default-constructed bitmaps are used if not set
+		/// Frames larger than needed to cover coverWidth x coverHeight pixels are scaled down while decoding (zero to keep their size)
+		unsigned coverWidth = 0;
+		unsigned coverHeight = 0;
+		/// The playback position in seconds (NaN if not playing); if set, decoding skips frames to keep up with it
+		std::function<double()> clock;
+	};
+	/// Decodes with the number of threads configured in graphic/video_threads
+	VideoFFmpeg(fs::path const& file, VideoCb videoCb, Params params);
 
+	void seek(double time) override;
   protected:
-	void processFrame(uFrame frame) override;
+	void processFrame(AVFrame& frame) override;
   private:
-	std::unique_ptr<SwsContext, void(*)(SwsContext*)> m_swsContext{nullptr, sws_freeContext};
+	/// Let the decoder skip work as m_pacer says
+	void updateSkip();
+	/// Set up passing on decoded frames of the given size and format (again if they change mid-stream)
+	void setupScaling(int width, int height, AVPixelFormat format);
+
+	std::unique_ptr<SwsContext, void(*)(SwsContext*)> m_swsContext{nullptr, sws_freeContext};  ///< Only for scaling and for formats other than YUV 4:2:0
+	yuv::Planes420 m_size;  ///< Size of the frames passed on
+	/// Size and format of the decoded frames that m_swsContext and m_size are set up for
+	int m_sourceWidth = 0;
+	int m_sourceHeight = 0;
+	AVPixelFormat m_sourceFormat = AV_PIX_FMT_NONE;
 		VideoCb handleVideoData;
-
+	Params m_params;
+	DecodePacer m_pacer;
+	DecodePacer::Skip m_skip = DecodePacer::Skip::NONE;  ///< Currently set in the codec context
+	Profiler m_profiler{ "video" };  ///< Decoding times, lag and dropped frames, logged when done
 };
 
+/**
+* Decodes an audio file for playback, as a job of the shared DecoderPool.
+* read() is called from the audio callback and never waits for the decoder: the samples are passed through a
+* lock-free AudioRing, with silence played while seeking or if decoding falls behind (logged as underruns).
+* Tracks in the PcmCache are fed to the ring from the memory-mapped cache file instead of being decoded, the others
+* are recorded into it from the ring while decoded.
+**/
 class AudioBuffer {
   public:
-	using uFvec = std::unique_ptr<fvec_t, std::integral_constant<decltype(&del_fvec), &del_fvec>>;
+	/// Gets the samples as they are decoded or read from the cache, with their position in the track (jumping on
+	/// seeks), and no samples at the end of the file. Called by the decoder job, so it must not take long.
+	using Listener = std::function<void(const std::int16_t *data, std::int64_t count, std::int64_t sample_position)>;
 
-	AudioBuffer(fs::path const& file, unsigned rate, size_t size = 4320256);
+	/// @param cache store the track in the PcmCache if it is played through from the start (not for previews)
+	/// @param listener also passed the samples for playback, e.g. for analysing them without decoding the file again
+	AudioBuffer(fs::path const& file, unsigned rate, bool cache = true, Listener listener = {}, size_t size = 4320256);
 	~AudioBuffer();
 
-	uFvec makePreviewBuffer();
+	/// The PcmCache format of tracks played at rate
+	static std::string cacheFormat(unsigned rate);
+	/// Decode all of file for PcmCache::store, the same samples as a playback records (for benchmarks)
+	static PcmCache::Job cacheJob(fs::path const& file, unsigned rate);
+
 	void operator()(const std::int16_t *data, std::int64_t count, std::int64_t sample_position);
 	bool prepare(std::int64_t pos);
 	bool read(float* begin, std::int64_t samples, std::int64_t pos, float volume = 1.0f);
-	bool terminating();
 	double duration();
 
   private:
-	// must be called holding the mutex
 	bool eof(std::int64_t pos) const {
-		return (m_eof_pos != -1 && pos >= m_eof_pos) || (double(pos) / m_sps >= m_duration);
+		auto const eof_pos = m_eof_pos.load();
+		return (eof_pos != -1 && pos >= eof_pos) || (double(pos) / m_sps >= m_duration);
 	}
-
-	bool wantSeek();
-	bool wantMore();
-	/// Should the input stop waiting?
-	bool condition();
-
-	mutable std::mutex m_mutex;
-	std::condition_variable m_cond;
-
-	std::vector<std::int16_t> m_data;
-	std::int64_t m_write_pos = 0;
-	std::int64_t m_read_pos = 0;
-	std::int64_t m_eof_pos = -1; // -1 until we get the read end from ffmpeg
+	/// Report underruns since the previous call (decoder job)
+	void logUnderruns();
+	/// Report the time to the first sample once (decoder job)
+	void logReady(char const* source);
+	/// Set the replay gain of the file, applied when reading if normalisation is enabled
+	void setReplayGain(double decibels, double factor);
+	/// Pass the samples written to the ring from position from on to the recorder, if still recording, and to the
+	/// listener (decoder job)
+	void record(std::int64_t from);
+
+	AudioRing m_ring;
+	std::atomic<std::int64_t> m_eof_pos{ -1 }; // -1 until we get the read end from ffmpeg
+	std::uint64_t m_underruns_logged = 0;
+	Time const m_created = Clock::now();
+	bool m_ready = false;
 
 	const unsigned m_sps;
 	double m_duration{ 0 };
 	double m_replayGainDecibels{ 0.0 };
 	double m_replayGainFactor{ 0.0 };
-	bool m_seek_asked { false };
-	bool m_quit{ false };
-	std::future<void> reader_thread;
+	float m_gain = 1.0f;  ///< Applied by read()
+	std::unique_ptr<PcmCache::Recorder> m_recorder;  ///< Used by the decoder job
+	Listener const m_listener;  ///< Called by the decoder job
+	DecoderPool::Id m_job = 0;
 };
@@ -0,0 +1,172 @@
+#include "filecache.hh"
+
+#include "log.hh"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// The background thread of the FileCaches alive, running their tasks one at a time in the order queued
+class FileCache::Worker {
+  public:
+	/// The worker of the caches alive, started with the first of them
+	static std::shared_ptr<Worker> get() {
+		static std::mutex mutex;
+		static std::weak_ptr<Worker> shared;
+		std::lock_guard<std::mutex> l(mutex);
+		auto worker = shared.lock();
+		if (!worker) shared = worker = std::make_shared<Worker>();
+		return worker;
+	}
+
+	Worker(): m_thread(&Worker::run, this) {}
+	~Worker() {
+		{
+			std::lock_guard<std::mutex> l(mutex);
+			m_quit = true;
+		}
+		m_cond.notify_all();
+		m_thread.join();
+	}
+
+	void add(FileCache& cache) {
+		{
+			std::lock_guard<std::mutex> l(mutex);
+			m_caches.push_back(&cache);
+		}
+		m_cond.notify_all();
+	}
+
+	/// Drop the tasks of cache and wait for the one running, if any (it is cancelled)
+	void remove(FileCache& cache) {
+		std::unique_lock<std::mutex> l(mutex);
+		cache.m_quit = true;
+		m_tasks.erase(std::remove_if(m_tasks.begin(), m_tasks.end(), [&cache](Pending const& p) { return p.cache == &cache; }), m_tasks.end());
+		m_cond.wait(l, [this, &cache] { return m_busy != &cache; });
+		m_caches.erase(std::find(m_caches.begin(), m_caches.end(), &cache));
+	}
+
+	void queue(FileCache& cache, Key key, Task task) {
+		std::lock_guard<std::mutex> l(mutex);
+		if (key.cacheFile == cache.m_running || cache.m_failed.count(key.cacheFile)) return;
+		std::size_t pending = 0;
+		for (auto const& p: m_tasks) {
+			if (p.cache != &cache) continue;
+			if (p.key.cacheFile == key.cacheFile) return;
+			++pending;
+		}
+		m_tasks.push_back(Pending{ &cache, std::move(key), std::move(task) });
+		// Drop the oldest task of this cache (not of the others)
+		if (pending >= cache.m_maxPending) m_tasks.erase(std::find_if(m_tasks.begin(), m_tasks.end(), [&cache](Pending const& p) { return p.cache == &cache; }));
+		m_cond.notify_all();
+	}
+
+	void flush(FileCache& cache) {
+		std::unique_lock<std::mutex> l(mutex);
+		m_cond.wait(l, [this, &cache] {
+			return m_busy != &cache && !cache.m_tidyPending && std::none_of(m_tasks.begin(), m_tasks.end(), [&cache](Pending const& p) { return p.cache == &cache; });
+		});
+	}
+
+	mutable std::mutex mutex;
+
+  private:
+	struct Pending {
+		FileCache* cache;
+		Key key;
+		Task task;
+	};
+
+	void run() {
+		std::unique_lock<std::mutex> l(mutex);
+		while (true) {
+			auto const tidy = [this] { return std::find_if(m_caches.begin(), m_caches.end(), [](FileCache* c) { return c->m_tidyPending; }); };
+			m_cond.wait(l, [&] { return m_quit || !m_tasks.empty() || tidy() != m_caches.end(); });
+			if (m_quit) return;
+			if (auto it = tidy(); it != m_caches.end()) {
+				FileCache& cache = **it;
+				cache.m_tidyPending = false;
+				m_busy = &cache;
+				l.unlock();
+				cache.m_tidy();
+				l.lock();
+			} else {
+				Pending pending = std::move(m_tasks.front());
+				m_tasks.pop_front();
+				FileCache& cache = *pending.cache;
+				cache.m_running = pending.key.cacheFile;
+				m_busy = &cache;
+				l.unlock();
+				bool const done = cache.write(pending.key, pending.task);
+				l.lock();
+				if (!done && !cache.m_quit) cache.m_failed.insert(cache.m_running);
+				cache.m_running.clear();
+				if (done && cache.m_tidy) cache.m_tidyPending = true;
+			}
+			m_busy = nullptr;
+			m_cond.notify_all();
+		}
+	}
+
+	std::condition_variable m_cond;
+	std::deque<Pending> m_tasks;
+	std::vector<FileCache*> m_caches;
+	FileCache* m_busy = nullptr;  ///< The cache whose task or tidy is running
+	bool m_quit = false;
+	std::thread m_thread;  ///< Last, as it uses the others
+};
+
+FileCache::FileCache(fs::path const& dir, std::string const& extension, std::size_t maxPending, std::function<void()> tidy):
+  m_dir(dir), m_extension(extension), m_maxPending(maxPending), m_tidy(std::move(tidy)), m_tidyPending(bool(m_tidy)), m_worker(Worker::get()) {
+	m_worker->add(*this);
+}
+
+FileCache::~FileCache() { m_worker->remove(*this); }
+
+std::optional<FileCache::Key> FileCache::makeKey(fs::path const& file, std::string const& what) const {
+	std::string const identity = fileIdentity(file);
+	if (identity.empty()) return std::nullopt;
+	Key key;
+	key.id = identity + "\n" + what;
+	key.cacheFile = m_dir / fmt::format("{:016x}{}", stableHash(key.id), m_extension);
+	return key;
+}
+
+void FileCache::queue(Key key, Task task) {
+	std::error_code ec;
+	if (fs::exists(key.cacheFile, ec)) return;
+	m_worker->queue(*this, std::move(key), std::move(task));
+}
+
+void FileCache::flush() { m_worker->flush(*this); }
+
+fs::path FileCache::running() const {
+	std::lock_guard<std::mutex> l(m_worker->mutex);
+	if (m_running.empty()) return {};
+	auto part = m_running;
+	part += ".part";
+	return part;
+}
+
+bool FileCache::write(Key const& key, Task const& task) {
+	auto part = key.cacheFile;
+	part += ".part";
+	std::error_code ec;
+	try {
+		fs::create_directories(m_dir);
+		if (task(key, part, m_quit) && !m_quit) {
+			fs::rename(part, key.cacheFile);
+			return true;
+		}
+	} catch (std::exception const& e) {
+		SpdLogger::warn(LogSystem::FFMPEG, "Cannot write cache file={}, exception={}", key.cacheFile, e.what());
+	}
+	fs::remove(part, ec);
+	return false;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "fs.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+
+/**
+* A directory of cache files derived from source files, written one at a time by a background worker that all
+* FileCaches alive share (so that only one file is written at a time, whichever cache it belongs to).
+* The files are named by a hash of an id made of the identity of the source file (see fileIdentity) and what is
+* derived from it, so edited files simply get new cache files. Each file is first written with a .part suffix and
+* renamed when complete, so that readers never see partial files.
+* This class only handles the scheduling and naming; the owners (PcmCache, KeyframeIndexCache) define the formats.
+**/
+class FileCache {
+  public:
+	struct Key {
+		fs::path cacheFile;
+		std::string id;  ///< Identifies the source file and what is cached, should also be stored in the cache file
+	};
+	/// Writes the cache file for key into part; returns false if there is nothing to cache (the source is not supported).
+	/// Should stop early if cancel is set (the cache is shutting down). Exceptions abandon the file.
+	using Task = std::function<bool(Key const& key, fs::path const& part, std::atomic<bool> const& cancel)>;
+
+	/**
+	* @param dir the cache directory (created when the first file is written)
+	* @param extension of the cache files, such as ".pcm"
+	* @param maxPending the number of tasks queued at most, older ones are dropped (e.g. while browsing song previews)
+	* @param tidy called by the worker before the first task of this cache and after each file written (e.g. to evict
+	* old files), may be empty
+	**/
+	FileCache(fs::path const& dir, std::string const& extension, std::size_t maxPending, std::function<void()> tidy = {});
+	~FileCache();
+
+	fs::path const& dir() const { return m_dir; }
+	/// The key of what (such as an output format) derived from file, or nullopt if the file cannot be accessed
+	std::optional<Key> makeKey(fs::path const& file, std::string const& what) const;
+	/// Run the task in the background, unless the file is already cached, queued, being written or failed before
+	void queue(Key key, Task task);
+	/// Wait until all queued tasks are done (for tests)
+	void flush();
+	/// The .part file being written, or an empty path
+	fs::path running() const;
+
+  private:
+	class Worker;
+	bool write(Key const& key, Task const& task);
+
+	fs::path const m_dir;
+	std::string const m_extension;
+	std::size_t const m_maxPending;
+	std::function<void()> const m_tidy;
+	// Guarded by the mutex of the worker
+	bool m_tidyPending;  ///< Should the worker call m_tidy before the next task?
+	fs::path m_running;  ///< The cache file being written
+	std::set<fs::path> m_failed;  ///< Cache files that could not be written, not tried again
+	std::atomic<bool> m_quit{ false };
+	std::shared_ptr<Worker> const m_worker;
+};
+
+/// A RAII wrapper for the global instance of a cache, living in mainLoop
+template <typename Cache> class GlobalCache {
+  public:
+	GlobalCache(GlobalCache const&) = delete;
+	GlobalCache& operator=(GlobalCache const&) = delete;
+	~GlobalCache() { instance().reset(); }
+	/// The global instance, or nullptr if there is none
+	static Cache* get() { return instance().get(); }
+
+  protected:
+	explicit GlobalCache(std::unique_ptr<Cache> cache) { instance() = std::move(cache); }
+
+  private:
+	static std::unique_ptr<Cache>& instance() {
+		static std::unique_ptr<Cache> cache;
+		return cache;
+	}
+};
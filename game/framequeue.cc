@@ -0,0 +1,40 @@
+#include "framequeue.hh"
+
+#include <utility>
+
+bool FrameQueue::hasRoom(Bitmap const& f) const {
+	if (m_frames.empty()) return true;
+	return m_frames.size() < m_maxFrames && m_bytes + f.byteSize() <= m_maxBytes;
+}
+
+void FrameQueue::push(Bitmap&& f) {
+	m_bytes += f.byteSize();
+	m_frames.push_back(std::move(f));
+}
+
+Bitmap FrameQueue::pop() {
+	Bitmap f = std::move(m_frames.front());
+	m_frames.pop_front();
+	m_bytes -= f.byteSize();
+	return f;
+}
+
+void FrameQueue::clear() {
+	while (!m_frames.empty()) recycle(pop());
+}
+
+void FrameQueue::recycle(Bitmap&& f) {
+	// The pool is as bounded as the queue, a frame can only be in either one or in use by the decoder or renderer
+	std::size_t const capacity = f.buf.capacity();
+	if (f.ptr || capacity == 0 || m_pool.size() >= m_maxFrames || m_poolBytes + capacity > m_maxBytes) return;
+	m_poolBytes += capacity;
+	m_pool.push_back(std::move(f.buf));
+}
+
+std::vector<unsigned char> FrameQueue::take() {
+	if (m_pool.empty()) return {};
+	std::vector<unsigned char> buf = std::move(m_pool.back());
+	m_pool.pop_back();
+	m_poolBytes -= buf.capacity();
+	return buf;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "image.hh"
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+/**
+* Decoded video frames waiting to be shown, bounded by the memory that they take rather than by their number, with a
+* pool of the memory of frames that are done with, so that decoding allocates nothing once a video plays.
+* Not thread-safe: Video uses it under its mutex.
+**/
+class FrameQueue {
+  public:
+	/// Holds at most maxBytes of frames (but always at least one frame) and at most maxFrames frames
+	FrameQueue(std::size_t maxBytes, std::size_t maxFrames): m_maxBytes(maxBytes), m_maxFrames(maxFrames) {}
+
+	bool empty() const { return m_frames.empty(); }
+	std::size_t size() const { return m_frames.size(); }
+	/// Bytes of the frames in the queue
+	std::size_t bytes() const { return m_bytes; }
+	/// Would the frame fit in?
+	bool hasRoom(Bitmap const& f) const;
+	void push(Bitmap&& f);
+	Bitmap const& operator[](std::size_t i) const { return m_frames[i]; }
+	Bitmap const& front() const { return m_frames.front(); }
+	Bitmap const& back() const { return m_frames.back(); }
+	/// Remove the first frame and return it
+	Bitmap pop();
+	/// Recycle all frames
+	void clear();
+
+	/// Keep the memory of a frame that is no longer needed (frames in pixel buffers release them instead)
+	void recycle(Bitmap&& f);
+	/// Memory of a recycled frame (empty if there is none), to be used for a new one
+	std::vector<unsigned char> take();
+	/// Number of recycled buffers available
+	std::size_t pooled() const { return m_pool.size(); }
+
+  private:
+	std::deque<Bitmap> m_frames;
+	std::vector<std::vector<unsigned char>> m_pool;
+	std::size_t const m_maxBytes;
+	std::size_t const m_maxFrames;
+	std::size_t m_bytes = 0;
+	std::size_t m_poolBytes = 0;
+};
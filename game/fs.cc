@@ -308,6 +308,22 @@ std::string formatPath(const fs::path& target) {
 	}
 }
 
+std::string fileIdentity(fs::path const& file) {
+	std::error_code ec;
+	auto const path = fs::absolute(file, ec);
+	auto const size = fs::file_size(path, ec);
+	if (ec) return {};
+	auto const mtime = fs::last_write_time(path, ec);
+	if (ec) return {};
+	return fmt::format("{}\n{}\n{}", path.string(), mtime.time_since_epoch().count(), size);
+}
+
+std::uint64_t stableHash(std::string_view str) {
+	std::uint64_t h = 14695981039346656037ull;
+	for (unsigned char c: str) h = (h ^ c) * 1099511628211ull;
+	return h;
+}
+
 const fs::path PathCache::getLogFilename() { Lock l(m_mutex); return cache / "infolog.txt"; }
 const fs::path PathCache::getProfilerLogFilename() {
 	Lock l(m_mutex);
@@ -66,6 +66,11 @@ Paths getThemePaths();  ///< Get the data/theme file search path (includes curre
 
 std::string formatPath(const fs::path& target);
 
+/// Identifies the current contents of a file by its absolute path, modification time and size (empty if it cannot be read)
+std::string fileIdentity(fs::path const& file);
+/// A hash that is the same across runs and platforms (FNV-1a), for naming cache files
+std::uint64_t stableHash(std::string_view str);
+
 // Make std::filesystem::path formattable.
 template <>
 struct fmt::formatter<std::filesystem::path>: formatter<std::string_view>
@@ -0,0 +1,123 @@
+#include "upload_ring.hh"
+
+#include "glutil.hh"
+#include "../image.hh"
+#include "../log.hh"
+
+#include <cstdint>
+#include <stdexcept>
+
+UploadRing::UploadRing(unsigned slots) {
+	for (unsigned i = 0; i < slots; ++i) m_slots.emplace_back(new UploadSlot(*this));
+}
+
+UploadRing::~UploadRing() {
+	for (auto& slot: m_slots) {
+		if (slot->m_fence) glDeleteSync(slot->m_fence);
+		if (slot->m_buffer) glDeleteBuffers(1, &slot->m_buffer);  // Also unmaps
+	}
+}
+
+std::shared_ptr<UploadSlot> UploadRing::acquire(std::size_t size) {
+	for (auto& slot: m_slots) {
+		if (slot->m_capacity.load(std::memory_order_relaxed) < size) continue;
+		unsigned expected = UploadSlot::MAPPED;
+		if (!slot->m_state.compare_exchange_strong(expected, UploadSlot::MAPPED | UploadSlot::HELD, std::memory_order_acquire)) continue;
+		// Slots only grow, so it is still large enough
+		return std::shared_ptr<UploadSlot>(slot.get(), [](UploadSlot* s) {
+			s->m_state.fetch_and(~unsigned{ UploadSlot::HELD }, std::memory_order_release);
+		});
+	}
+	// Have update() make slots of this size
+	std::size_t wanted = m_wanted.load(std::memory_order_relaxed);
+	while (wanted < size && !m_wanted.compare_exchange_weak(wanted, size, std::memory_order_relaxed)) {}
+	return nullptr;
+}
+
+void UploadRing::update() {
+	if (!m_initialized) {
+		m_initialized = true;
+		m_persistent = epoxy_gl_version() >= 44 || epoxy_has_gl_extension("GL_ARB_buffer_storage");
+		SpdLogger::debug(LogSystem::OPENGL, "Streaming texture uploads through {} pixel buffers ({}).", m_slots.size(), m_persistent ? "persistent mapping" : "orphaning");
+	}
+	std::size_t const wanted = m_wanted.load(std::memory_order_relaxed);
+	for (auto& ptr: m_slots) {
+		UploadSlot& slot = *ptr;
+		if (slot.m_fence) {
+			if (glClientWaitSync(slot.m_fence, 0, 0) == GL_TIMEOUT_EXPIRED) continue;  // The GPU still reads the buffer
+			glDeleteSync(slot.m_fence);
+			slot.m_fence = nullptr;
+			slot.m_state.fetch_and(~unsigned{ UploadSlot::PENDING }, std::memory_order_release);
+		}
+		if (m_failed || slot.m_capacity.load(std::memory_order_relaxed) >= wanted) continue;
+		// Take a slot that is not in use from the producers while it is reallocated
+		unsigned expected = slot.m_state.load(std::memory_order_relaxed);
+		if (expected & (UploadSlot::HELD | UploadSlot::PENDING)) continue;
+		if (!slot.m_state.compare_exchange_strong(expected, UploadSlot::HELD, std::memory_order_acquire)) continue;
+		allocate(slot, wanted);
+	}
+}
+
+void UploadRing::allocate(UploadSlot& slot, std::size_t size) {
+	glutil::GLErrorChecker glerror("UploadRing::allocate");
+	// Persistent storage cannot be resized, so always start over with a new buffer
+	if (slot.m_buffer) glDeleteBuffers(1, &slot.m_buffer);
+	glGenBuffers(1, &slot.m_buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.m_buffer);
+	if (m_persistent) glBufferStorage(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(size), nullptr, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+	slot.m_capacity.store(size, std::memory_order_relaxed);
+	bool const mapped = map(slot);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glerror.check("map");
+	if (!mapped) {
+		SpdLogger::warn(LogSystem::OPENGL, "Cannot map pixel buffers, uploading textures from client memory.");
+		m_failed = true;
+		glDeleteBuffers(1, &slot.m_buffer);
+		slot.m_buffer = 0;
+	}
+	slot.m_state.store(mapped ? UploadSlot::MAPPED : 0u, std::memory_order_release);
+}
+
+bool UploadRing::map(UploadSlot& slot) {
+	auto const size = static_cast<GLsizeiptr>(slot.m_capacity.load(std::memory_order_relaxed));
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	if (!m_persistent) {
+		// New storage for writing, while the old one stays with the GPU until it has been read
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+	}
+	slot.m_data = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+	if (!slot.m_data) slot.m_capacity.store(0, std::memory_order_relaxed);  // Reallocated by update() once released
+	return slot.m_data != nullptr;
+}
+
+UploadTransfer::UploadTransfer(Bitmap const& bitmap): m_slot(bitmap.staged.get()) {
+	if (!m_slot) return;
+	if (bitmap.data() != m_slot->m_data) throw std::logic_error("UploadTransfer: the staged bitmap has been uploaded already");
+	m_base = m_slot->m_data;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_slot->m_buffer);
+	if (!m_slot->m_ring.persistent()) {
+		// The buffer cannot be read while it is mapped
+		m_slot->m_state.fetch_and(~unsigned{ UploadSlot::MAPPED }, std::memory_order_relaxed);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		m_slot->m_data = nullptr;
+	}
+}
+
+UploadTransfer::~UploadTransfer() {
+	if (!m_slot) return;
+	if (m_slot->m_ring.persistent()) {
+		// Producers may write again once the GPU has read the buffer (checked by update())
+		if (m_slot->m_fence) glDeleteSync(m_slot->m_fence);
+		m_slot->m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_slot->m_state.fetch_or(UploadSlot::PENDING, std::memory_order_relaxed);
+	} else if (m_slot->m_ring.map(*m_slot)) {
+		m_slot->m_state.fetch_or(UploadSlot::MAPPED, std::memory_order_release);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void const* UploadTransfer::source(unsigned char const* p) const {
+	if (!m_slot) return p;
+	return reinterpret_cast<void const*>(static_cast<std::uintptr_t>(p - m_base));  // Offset into the bound buffer
+}
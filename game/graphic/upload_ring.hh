@@ -0,0 +1,85 @@
+#pragma once
+
+#include <epoxy/gl.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+struct Bitmap;
+class UploadRing;
+
+/// A pixel buffer object of an UploadRing, mapped for a producer to write a frame into
+class UploadSlot {
+  public:
+	unsigned char* data() const { return m_data; }
+  private:
+	friend class UploadRing;
+	friend class UploadTransfer;
+	enum State: unsigned { MAPPED = 1, HELD = 2, PENDING = 4 };
+	UploadRing& m_ring;
+	GLuint m_buffer = 0;
+	GLsync m_fence = nullptr;  ///< Set while the GPU may still read the buffer (persistent mapping only)
+	unsigned char* m_data = nullptr;
+	std::atomic<std::size_t> m_capacity{ 0 };
+	std::atomic<unsigned> m_state{ 0 };
+	explicit UploadSlot(UploadRing& ring): m_ring(ring) {}
+};
+
+/**
+* Streams frames (video, webcam) to textures through a ring of pixel buffer objects.
+* A producer thread writes each frame straight into the mapped memory of a slot from acquire() and passes it on as
+* a Bitmap (with the slot in Bitmap::staged); the render thread then only issues the transfer, as Texture::load()
+* does through UploadTransfer. Buffers stay mapped all the time if GL_ARB_buffer_storage is available (OpenGL 4.4),
+* with fences to keep producers off buffers that the GPU still reads. Otherwise the storage of a buffer is orphaned
+* and mapped again after each transfer.
+* The ring itself and all the GL calls belong to the render thread: buffers are only allocated by update(), in the
+* size asked for by producers. Until then, and whenever all slots are in use, producers get no slot and keep
+* using client memory.
+**/
+class UploadRing {
+  public:
+	explicit UploadRing(unsigned slots);
+	/// All slots must have been released
+	~UploadRing();
+	UploadRing(UploadRing const&) = delete;
+	UploadRing& operator=(UploadRing const&) = delete;
+
+	/// A slot of at least size bytes (any thread), released once the last copy is gone; null if none is free
+	std::shared_ptr<UploadSlot> acquire(std::size_t size);
+
+	/// Recycle the slots that the GPU is done with and allocate slots of the size asked for (render thread)
+	void update();
+	/// Are the buffers mapped persistently? Known after the first update().
+	bool persistent() const { return m_persistent; }
+
+  private:
+	friend class UploadTransfer;
+	void allocate(UploadSlot& slot, std::size_t size);
+	/// Map the bound buffer of the slot for writing (with new storage, unless it is persistent)
+	bool map(UploadSlot& slot);
+
+	std::vector<std::unique_ptr<UploadSlot>> m_slots;
+	std::atomic<std::size_t> m_wanted{ 0 };  ///< The largest size asked for by producers
+	bool m_initialized = false;
+	bool m_persistent = false;
+	bool m_failed = false;  ///< Mapping is not supported, producers keep using client memory
+};
+
+/**
+* RAII binding of the pixel buffer of a staged Bitmap as the source of texture uploads (render thread).
+* Pass source(p) instead of pointers p to pixel data of the bitmap. Does nothing for bitmaps in client memory.
+* Each staged bitmap can only be uploaded once (its memory is unmapped or reused afterwards).
+**/
+class UploadTransfer {
+  public:
+	explicit UploadTransfer(Bitmap const& bitmap);
+	~UploadTransfer();
+	UploadTransfer(UploadTransfer const&) = delete;
+	UploadTransfer& operator=(UploadTransfer const&) = delete;
+	void const* source(unsigned char const* p) const;
+  private:
+	UploadSlot* m_slot;
+	unsigned char const* m_base = nullptr;
+};
@@ -226,6 +226,7 @@ void Window::createShaders() {
 			shader("texture").compileFile(findFile("shaders/stereo3d.geom"));
 			shader("3dobject").compileFile(findFile("shaders/stereo3d.geom"));
 			shader("dancenote").compileFile(findFile("shaders/stereo3d.geom"));
+			shader("video").compileFile(findFile("shaders/stereo3d.geom"));
 		}
 		else {
 			SpdLogger::warning(LogSystem::OPENGL, "Stereo3D was enabled but the 'GL_ARB_viewport_array' extension is unsupported; will now disable Stereo3D.");
@@ -246,6 +247,15 @@ void Window::createShaders() {
 	  .compileFile(findFile("shaders/core.frag"))
 	  .link()
 	  .bindUniformBlocks();
+	// Video frames in YUV planes, converted to RGB (and linearized like sRGB textures) by the shader
+	shader("video")
+	  .addDefines("#define ENABLE_YUV_TEXTURING\n")
+	  .addDefines(GL_EXT_framebuffer_sRGB ? "#define ENABLE_SRGB_DECODE\n" : "")
+	  .addDefines("#define ENABLE_VERTEX_COLOR\n")
+	  .compileFile(findFile("shaders/core.vert"))
+	  .compileFile(findFile("shaders/core.frag"))
+	  .link()
+	  .bindUniformBlocks();
 	shader("3dobject")
 	  .addDefines("#define ENABLE_LIGHTING\n")
 	  .compileFile(findFile("shaders/core.vert"))
@@ -1,11 +1,13 @@
 #pragma once
 
 #include "fs.hh"
+#include "yuv.hh"
 #include <cairo/cairo.h>
 
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <stdexcept>
 #include <vector>
 
@@ -14,10 +16,13 @@ namespace pix {
 		INT_ARGB,  // Cairo's pixel format (SVG, text): premultiplied linear RGB (BGRA byte order)
 		CHAR_RGBA,  // libpng w/ alpha: non-premul sRGB (RGBA byte order)
 		RGB,  // libpng w/o alpha, libjpeg, ffmpeg: sRGB (RGB byte order, no padding)
-		BGR  // OpenCV/webcam: sRGB (BGR byte order, no padding)
+		BGR,  // OpenCV/webcam: sRGB (BGR byte order, no padding)
+		YUV420P  // ffmpeg video: 8-bit planar YUV 4:2:0 (see yuv::Planes420 for the layout)
 	}; 
 }
 
+class UploadSlot;
+
 struct Bitmap {
 	std::vector<unsigned char> buf;  // Pixel data if owned by Bitmap
 	unsigned char* ptr;  // Pixel data if owned by someone else
@@ -27,13 +32,19 @@ struct Bitmap {
 	pix::Format fmt;
 	bool linearPremul;  // Is the data linear RGB and premultiplied (as opposed to sRGB and non-premultiplied)
 	bool bottomFirst;  // Upside-down (only used for taking screenshots)
+	yuv::Encoding yuvEncoding;  // Color encoding of YUV420P data
+	std::shared_ptr<UploadSlot> staged;  // Set if ptr points to a pixel buffer of an UploadRing (see Texture::load)
 	Bitmap(unsigned char* ptr = nullptr): ptr(ptr), width(), height(), ar(), timestamp(), fmt(pix::Format::CHAR_RGBA), linearPremul(), bottomFirst() {}
 	void resize(unsigned w, unsigned h) {
-		if (!ptr) buf.resize(w * h * 4); else buf.clear();
 		width = w;
 		height = h;
+		if (!ptr) buf.resize(byteSize()); else buf.clear();
 		ar = float(w) / float(h);
 	}
+	/// Bytes of pixel data for the size and format (as allocated by resize)
+	std::size_t byteSize() const {
+		return fmt == pix::Format::YUV420P ? yuv::Planes420{ width, height }.size() : std::size_t{ width } * height * 4;
+	}
 	void swap(Bitmap& b) {
 		if (ptr || b.ptr) throw std::logic_error("Cannot Bitmap::swap foreign pointers.");
 		buf.swap(b.buf);
@@ -42,6 +53,7 @@ struct Bitmap {
 		std::swap(ar, b.ar);
 		std::swap(timestamp, b.timestamp);
 		std::swap(fmt, b.fmt);
+		std::swap(yuvEncoding, b.yuvEncoding);
 	}
 	unsigned char const* data() const { return ptr ? ptr : buf.data(); }
 	unsigned char* data() { return ptr ? ptr : buf.data(); }
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "tone.hh"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/// Time-domain alternative to the analyzer's built-in FFT tone detection
+struct IPitchDetector {
+	virtual ~IPitchDetector() = default;
+
+	/// Number of samples in each analysis frame
+	virtual std::size_t frameSize() const = 0;
+	/// Analyze one frame of frameSize() samples, appending the detected tones to tones (which has room for them)
+	virtual void analyze(float const* pcm, std::vector<Tone>& tones) = 0;
+};
+
+using PitchDetectorPtr = std::unique_ptr<IPitchDetector>;
@@ -0,0 +1,93 @@
+#include "keyframeindex.hh"
+
+#include "log.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+	/// Cache file layout: Header, the id string, Keyframes
+	struct Header {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t idLength;
+		std::uint64_t count;
+	};
+	char const magic[8] = { 'P', 'E', 'R', 'F', 'K', 'E', 'Y', '\0' };
+	std::uint32_t const version = 1;
+	std::size_t const maxPending = 8;  ///< Older jobs are dropped
+}
+
+void KeyframeIndex::add(double time, std::int64_t pos) {
+	if (pos < 0 || (!m_keyframes.empty() && time < m_keyframes.back().time + minSpacing)) return;
+	m_keyframes.push_back(Keyframe{ time, pos });
+}
+
+KeyframeIndex::Keyframe const* KeyframeIndex::before(double time) const {
+	auto it = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), time, [](double t, Keyframe const& k) { return t < k.time; });
+	return it == m_keyframes.begin() ? nullptr : &*std::prev(it);
+}
+
+void KeyframeIndex::save(fs::path const& file, std::string const& id) const {
+	Header header{};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.idLength = static_cast<std::uint32_t>(id.size());
+	header.count = m_keyframes.size();
+	fs::ofstream out(file, std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+	out.write(id.data(), static_cast<std::streamsize>(id.size()));
+	out.write(reinterpret_cast<char const*>(m_keyframes.data()), static_cast<std::streamsize>(m_keyframes.size() * sizeof(Keyframe)));
+	out.close();
+	if (out.fail()) throw std::runtime_error("Cannot write " + file.string());
+}
+
+std::optional<KeyframeIndex> KeyframeIndex::load(fs::path const& file, std::string const& id) {
+	fs::ifstream in(file, std::ios::binary);
+	Header header;
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) return std::nullopt;
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version || header.idLength != id.size()) return std::nullopt;
+	std::string storedId(header.idLength, '\0');
+	if (!in.read(storedId.data(), static_cast<std::streamsize>(storedId.size())) || storedId != id) return std::nullopt;  // Hash collision
+	KeyframeIndex index;
+	// Bounded by the size of the file, in case it is corrupt
+	std::error_code ec;
+	auto const size = fs::file_size(file, ec);
+	if (ec || header.count > size / sizeof(Keyframe)) return std::nullopt;
+	index.m_keyframes.resize(static_cast<std::size_t>(header.count));
+	if (!in.read(reinterpret_cast<char*>(index.m_keyframes.data()), static_cast<std::streamsize>(index.m_keyframes.size() * sizeof(Keyframe)))) return std::nullopt;
+	return index;
+}
+
+KeyframeIndexCache::KeyframeIndexCache(fs::path const& dir): m_files(dir, ".keys", maxPending) {}
+
+KeyframeIndexCache::~KeyframeIndexCache() = default;
+
+std::shared_ptr<KeyframeIndex const> KeyframeIndexCache::load(fs::path const& file, std::string const& stream) {
+	auto const key = m_files.makeKey(file, stream);
+	std::error_code ec;
+	if (!key || !fs::is_regular_file(key->cacheFile, ec)) return nullptr;
+	auto index = KeyframeIndex::load(key->cacheFile, key->id);
+	if (!index) return nullptr;
+	return std::make_shared<KeyframeIndex const>(std::move(*index));
+}
+
+void KeyframeIndexCache::build(fs::path const& file, std::string const& stream, Builder builder) {
+	auto key = m_files.makeKey(file, stream);
+	if (!key) return;
+	m_files.queue(std::move(*key), [builder = std::move(builder)](FileCache::Key const& key, fs::path const& part, std::atomic<bool> const& cancel) {
+		auto const index = builder(cancel);
+		if (!index || cancel) return false;
+		index->save(part, key.id);
+		SpdLogger::debug(LogSystem::FFMPEG, "Indexed {} keyframes of {}.", index->keyframes().size(), key.id.substr(0, key.id.find('\n')));
+		return true;
+	});
+}
+
+void KeyframeIndexCache::flush() { m_files.flush(); }
+
+KeyframeIndexCache* KeyframeIndexCache::global() { return Global::get(); }
+
+KeyframeIndexCache::Global::Global(): GlobalCache(std::make_unique<KeyframeIndexCache>(PathCache::getCacheDir() / "keyframes")) {}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "filecache.hh"
+#include "fs.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+/// Byte positions of keyframes of a stream, for seeking straight to the one before a given time
+class KeyframeIndex {
+  public:
+	struct Keyframe {
+		double time;  ///< Seconds from the start of the stream
+		std::int64_t pos;  ///< Byte position of the packet in the file
+	};
+	static constexpr double minSpacing = 0.5;  ///< Keyframes closer to the previous one are not stored (e.g. all audio packets)
+
+	/// Add a keyframe; out of order and too close ones are ignored
+	void add(double time, std::int64_t pos);
+	/// The last keyframe at or before time, or nullptr if there is none
+	Keyframe const* before(double time) const;
+	std::vector<Keyframe> const& keyframes() const { return m_keyframes; }
+
+	/// Write to file along with the id, throws on errors
+	void save(fs::path const& file, std::string const& id) const;
+	/// Read from file, if it is an index with the given id
+	static std::optional<KeyframeIndex> load(fs::path const& file, std::string const& id);
+
+  private:
+	std::vector<Keyframe> m_keyframes;
+};
+
+/**
+* On-disk cache of the keyframe indexes of media files, one small file per stream, keyed by the identity of the
+* source file (see fileIdentity) so that edited files simply get a new index.
+* Indexes are built by a background worker (see FileCache), as that reads through the whole file.
+**/
+class KeyframeIndexCache {
+  public:
+	/// Reads the keyframes of a stream; returns nullopt if that fails or cancel is set (the cache is shutting down)
+	using Builder = std::function<std::optional<KeyframeIndex>(std::atomic<bool> const& cancel)>;
+
+	explicit KeyframeIndexCache(fs::path const& dir);
+	~KeyframeIndexCache();
+
+	/// The index of a stream (such as "video") of file, or nullptr if it is not cached (yet)
+	std::shared_ptr<KeyframeIndex const> load(fs::path const& file, std::string const& stream);
+	/// Build the index in the background, unless it is already cached, queued or failed before
+	void build(fs::path const& file, std::string const& stream, Builder builder);
+	/// Wait until all queued indexes are built (for tests)
+	void flush();
+
+	/// The cache instance used by FFmpeg, or nullptr if there is none
+	static KeyframeIndexCache* global();
+	/// The global instance, living in mainLoop
+	class Global: public GlobalCache<KeyframeIndexCache> {
+	  public:
+		Global();
+	};
+
+  private:
+	FileCache m_files;
+};
@@ -0,0 +1,112 @@
+#include "latencyprobe.hh"
+
+#include "util.hh"
+#include "libda/fft.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <thread>
+
+SignalMatch findSignal(std::vector<float> const& signal, std::vector<float> const& reference) {
+	constexpr unsigned P = 18;
+	constexpr std::size_t N = std::size_t(1) << P;
+	std::size_t const size = std::min(signal.size(), N);
+	if (reference.empty() || reference.size() > size) return {};
+	// Correlation of the signal with the reference at each lag is the inverse transform of S * conj(R)
+	std::vector<std::complex<double>> s(N), r(N);
+	std::copy(signal.begin(), signal.begin() + static_cast<std::ptrdiff_t>(size), s.begin());
+	std::copy(reference.begin(), reference.end(), r.begin());
+	da::fft<P>(s.data());
+	da::fft<P>(r.data());
+	for (std::size_t i = 0; i < N; ++i) s[i] *= std::conj(r[i]);
+	da::ifft<P>(s.data());
+	// Only the lags where the reference fits entirely within the signal are valid (the others wrap around)
+	std::size_t const lags = size - reference.size() + 1;
+	std::size_t best = 0;
+	for (std::size_t k = 1; k < lags; ++k) if (std::abs(s[k].real()) > std::abs(s[best].real())) best = k;
+	SignalMatch match;
+	match.lag = static_cast<double>(best);
+	// Parabolic interpolation of the peak for sub-sample precision
+	if (best > 0 && best + 1 < lags) {
+		double const a = std::abs(s[best - 1].real()), b = std::abs(s[best].real()), c = std::abs(s[best + 1].real());
+		double const denominator = a - 2.0 * b + c;
+		if (denominator < 0.0) match.lag += 0.5 * (a - c) / denominator;
+	}
+	// Normalize by the energies of the reference and of the part of the signal that it matched
+	double referenceEnergy = 0.0, signalEnergy = 0.0;
+	for (float x: reference) referenceEnergy += double(x) * x;
+	for (std::size_t i = best; i < best + reference.size(); ++i) signalEnergy += double(signal[i]) * signal[i];
+	if (referenceEnergy > 0.0 && signalEnergy > 0.0) match.score = std::abs(s[best].real()) / std::sqrt(referenceEnergy * signalEnergy);
+	return match;
+}
+
+bool LatencyProbe::start(Analyzer const* mic, double inputRate) {
+	unsigned const state = m_state.load(std::memory_order_acquire);
+	if (!finished(state)) return false;
+	if (state & CANCELLED) {
+		// Callbacks of the cancelled measurement may still be writing: turn new ones away and wait for the rest
+		m_state.store(0);
+		while (m_busy.load() != 0) std::this_thread::yield();
+	}
+	m_inputRate = inputRate;
+	m_capture.assign(static_cast<std::size_t>(std::ceil((chirpDuration + maxRoundTrip).count() * inputRate)), 0.0f);
+	m_captured = 0;
+	m_played = 0;
+	m_mic.store(mic, std::memory_order_relaxed);
+	m_state.store(RUNNING, std::memory_order_release);
+	return true;
+}
+
+bool LatencyProbe::finished(unsigned state) {
+	return state == 0 || (state & CANCELLED) || (state & (OUTPUT_DONE | INPUT_DONE)) == (OUTPUT_DONE | INPUT_DONE);
+}
+
+bool LatencyProbe::done() const { return finished(m_state.load(std::memory_order_acquire)); }
+
+void LatencyProbe::cancel() {
+	unsigned state = m_state.load(std::memory_order_acquire);
+	while (!finished(state) && !m_state.compare_exchange_weak(state, state | CANCELLED, std::memory_order_acq_rel)) {}
+}
+
+Analyzer const* LatencyProbe::mic() const {
+	return done() ? nullptr : m_mic.load(std::memory_order_relaxed);
+}
+
+std::optional<LatencyProbe::Result> LatencyProbe::result() const {
+	unsigned const state = m_state.load(std::memory_order_acquire);
+	if (state == 0 || (state & CANCELLED) || !finished(state)) return std::nullopt;
+	std::vector<float> reference(static_cast<std::size_t>(chirpDuration.count() * m_inputRate));
+	for (std::size_t i = 0; i < reference.size(); ++i) reference[i] = chirp(Seconds(static_cast<double>(i) / m_inputRate));
+	SignalMatch const match = findSignal(m_capture, reference);
+	if (match.score < minScore) return std::nullopt;
+	Seconds const roundTrip = m_inTime + clockDur(Seconds(match.lag / m_inputRate)) - m_outTime;
+	if (roundTrip < 0.0s) return std::nullopt;  // Heard before it was played, so not the chirp after all
+	return Result{ roundTrip, match.score };
+}
+
+void LatencyProbe::output(float* begin, float* end, double rate, Time when) {
+	Busy busy(m_busy);
+	unsigned const state = m_state.load();  // Ordered after taking m_busy
+	// Wait for the capture to begin, so that the whole chirp ends up in it
+	if ((state & (RUNNING | CAPTURING | OUTPUT_DONE | CANCELLED)) != (RUNNING | CAPTURING)) return;
+	if (m_played == 0) m_outTime = when;
+	auto const frames = static_cast<std::size_t>(chirpDuration.count() * rate);
+	for (float* s = begin; s + 1 < end && m_played < frames; s += 2, ++m_played) {
+		float const value = chirp(Seconds(static_cast<double>(m_played) / rate));
+		s[0] += value;
+		s[1] += value;
+	}
+	if (m_played == frames) m_state.fetch_or(OUTPUT_DONE, std::memory_order_release);
+}
+
+float LatencyProbe::chirp(Seconds t) {
+	constexpr double f0 = 300.0, f1 = 6000.0;  // Sweep range in Hz, within what speakers and mics handle well
+	constexpr double fade = 0.01;  // Length of the fade in/out in seconds
+	double const length = chirpDuration.count();
+	double const x = t.count();
+	if (x < 0.0 || x >= length) return 0.0f;
+	double const phase = TAU * (f0 * x + 0.5 * (f1 - f0) / length * x * x);
+	double const envelope = smoothstep(0.0, fade, x) * smoothstep(0.0, fade, length - x);
+	return static_cast<float>(0.5 * envelope * std::sin(phase));
+}
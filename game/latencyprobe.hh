@@ -0,0 +1,105 @@
+#pragma once
+
+#include "chrono.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+class Analyzer;
+
+/// Where a reference signal best matches within a longer signal
+struct SignalMatch {
+	double lag = 0.0;  ///< Offset of the reference within the signal, in samples (with sub-sample precision)
+	double score = 0.0;  ///< Normalized correlation from 0 (no match) to 1 (exact copy, possibly scaled or inverted)
+};
+
+/**
+* Find the reference within the signal by cross-correlation (computed with FFT).
+* Only the first 2^18 samples of the signal are searched, which covers over a second at any common rate.
+**/
+SignalMatch findSignal(std::vector<float> const& signal, std::vector<float> const& reference);
+
+/**
+* Measures the audio round-trip latency: plays a chirp through the playback callback and finds it in the input of a mic.
+* The round trip is from when the chirp is handed to the playback device to when it is captured by the mic, both
+* timed the same way as AudioClock does, so that the result is what audio/round-trip needs to be.
+*
+* The measurement is armed from the game thread by start(). The playback and capture callbacks then only use the
+* buffers allocated by start() and each marks its own side done with a state bit, so that neither ever waits for the
+* other or for the game thread. start() only touches the buffers when no measurement is running.
+* A measurement that does not finish (e.g. because the devices stopped) is given up with cancel().
+**/
+class LatencyProbe {
+  public:
+	static constexpr Seconds chirpDuration = 0.2s;
+	static constexpr Seconds maxRoundTrip = 1.0s;  ///< Longest round trip that can be measured
+	static constexpr double minScore = 0.25;  ///< Weaker matches are considered the chirp not being heard
+
+	struct Result {
+		Seconds roundTrip;
+		double score;  ///< How clearly the chirp was heard, see SignalMatch
+	};
+
+	/**
+	* Start a measurement (not realtime-safe).
+	* @param mic the analyzer whose input is captured (for Device to route it here)
+	* @param inputRate the sample rate of the mic
+	* @return false if a measurement is still running
+	**/
+	bool start(Analyzer const* mic, double inputRate);
+	/// Returns true if the measurement has finished or was cancelled (or none was started)
+	bool done() const;
+	/// Give up a running measurement, so that done() returns true, result() is empty and start() can be called again
+	void cancel();
+	/// The analyzer to capture, if measuring (realtime-safe)
+	Analyzer const* mic() const;
+	/**
+	* Compute the round trip of a finished measurement (not realtime-safe).
+	* @return empty if no measurement has finished or the chirp could not be found in the capture
+	**/
+	std::optional<Result> result() const;
+
+	/// Called by the playback callback: mix the chirp into interleaved stereo output that starts playing at when
+	void output(float* begin, float* end, double rate, Time when);
+	/// Called by the capture callback with the samples of the mic, captured starting at when
+	template <typename InIt> void input(InIt begin, InIt end, Time when) {
+		Busy busy(m_busy);
+		unsigned const state = m_state.load();  // Ordered after taking m_busy
+		if ((state & (RUNNING | INPUT_DONE | CANCELLED)) != RUNNING) return;
+		if (m_captured == 0) {
+			m_inTime = when;
+			m_state.fetch_or(CAPTURING, std::memory_order_release);  // The chirp may be played now
+		}
+		for (; begin != end && m_captured < m_capture.size(); ++begin) m_capture[m_captured++] = *begin;
+		if (m_captured == m_capture.size()) m_state.fetch_or(INPUT_DONE, std::memory_order_release);
+	}
+
+	/// The chirp (a sine sweep with faded ends) at time t from its start
+	static float chirp(Seconds t);
+
+  private:
+	enum : unsigned { RUNNING = 1, CAPTURING = 2, OUTPUT_DONE = 4, INPUT_DONE = 8, CANCELLED = 16 };
+	static bool finished(unsigned state);
+	/// Counts a callback as using the buffers for its lifetime; taken before the state is checked, see start()
+	class Busy {
+	  public:
+		explicit Busy(std::atomic<unsigned>& count): m_count(count) { m_count.fetch_add(1); }
+		~Busy() { m_count.fetch_sub(1, std::memory_order_release); }
+		Busy(Busy const&) = delete;
+		Busy& operator=(Busy const&) = delete;
+
+	  private:
+		std::atomic<unsigned>& m_count;
+	};
+	std::atomic<unsigned> m_state{ 0 };
+	std::atomic<unsigned> m_busy{ 0 };  ///< Callbacks in progress, which a cancelled measurement may still have
+	std::atomic<Analyzer const*> m_mic{ nullptr };
+	double m_inputRate = 48000.0;
+	std::vector<float> m_capture;  ///< Input of the mic, allocated by start()
+	std::size_t m_captured = 0;  ///< Samples in m_capture (only accessed by the capture callback while running)
+	std::size_t m_played = 0;  ///< Frames of the chirp played (only accessed by the playback callback while running)
+	Time m_inTime;  ///< When the first captured sample was captured
+	Time m_outTime;  ///< When the first frame of the chirp was played
+};
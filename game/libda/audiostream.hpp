@@ -0,0 +1,139 @@
+#pragma once
+
+/**
+ * @file audiostream.hpp Audio stream interface and a stand-in stream that needs no sound card.
+ */
+
+#include "wavfile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace da {
+
+	/// A running source of audio callbacks, such as a sound card (portaudio::Stream) or a VirtualStream
+	class AudioStream {
+	  public:
+		virtual ~AudioStream() = default;
+		virtual void start() = 0;
+		virtual void stop() = 0;
+		/// The sample rate the stream runs at
+		virtual double sampleRate() const = 0;
+		/// Input latency reported by the host, in seconds (zero if not known)
+		virtual double inputLatency() const { return 0.0; }
+		/// Output latency reported by the host, in seconds (zero if not known)
+		virtual double outputLatency() const { return 0.0; }
+	};
+
+	/**
+	* Calls the callback like a sound card would, but on a virtual clock: either by its own thread at wall clock speed,
+	* or only when run() is called (as fast as the CPU allows, for tests and profiling).
+	* The input is silence or a WAV file (one channel of the file per input channel, silence after its end) and the
+	* output is discarded or written to a WAV file.
+	* With files, the callbacks do file I/O, so this is not meant to replace a sound card in the game itself.
+	**/
+	class VirtualStream: public AudioStream {
+	  public:
+		/// Same as PortAudio callbacks: interleaved input and output of frames frames, returns paContinue (zero) to go on
+		using Callback = std::function<int(float const* input, float* output, std::int64_t frames)>;
+		struct Params {
+			int in = 0;  ///< Input channels
+			int out = 0;  ///< Output channels
+			double rate = 0.0;  ///< Sample rate, zero for the rate of the input file (or 48000 without one)
+			std::int64_t blockFrames = 256;  ///< Frames per callback
+			bool manualClock = false;  ///< Only run() calls the callback (start() does not start a thread)
+			std::string inputFile;  ///< WAV file to read the input from (empty for silence)
+			std::string outputFile;  ///< WAV file to write the output to (empty to discard it)
+		};
+
+		VirtualStream(Callback callback, Params const& params): m_callback(std::move(callback)), m_params(params) {
+			if (m_params.blockFrames <= 0) throw std::invalid_argument("VirtualStream needs a positive block size");
+			if (!m_params.inputFile.empty()) {
+				m_source = std::make_unique<WavReader>(m_params.inputFile);
+				if (m_params.rate <= 0.0) m_params.rate = m_source->rate();
+			}
+			if (m_params.rate <= 0.0) m_params.rate = 48000.0;
+			if (!m_params.outputFile.empty()) {
+				m_sink = std::make_unique<WavWriter>(m_params.outputFile, static_cast<unsigned>(m_params.out), m_params.rate);
+			}
+			auto const block = static_cast<std::size_t>(m_params.blockFrames);
+			m_input.resize(block * static_cast<std::size_t>(m_params.in));
+			m_output.resize(block * static_cast<std::size_t>(m_params.out));
+		}
+		~VirtualStream() override { stop(); }
+
+		void start() override {
+			if (m_params.manualClock || m_thread.joinable()) return;
+			m_running = true;
+			m_thread = std::thread([this] {
+				auto const begin = std::chrono::steady_clock::now();
+				for (std::int64_t blocks = 0; m_running; ++blocks) {
+					auto const due = std::chrono::duration<double>(static_cast<double>(blocks * m_params.blockFrames) / m_params.rate);
+					std::this_thread::sleep_until(begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(due));
+					if (!m_running || !run(m_params.blockFrames)) break;
+				}
+			});
+		}
+		void stop() override {
+			m_running = false;
+			if (m_thread.joinable()) m_thread.join();
+			if (m_sink) m_sink->flush();  // Readable now, and still recording if started again (closed when destroyed)
+		}
+		double sampleRate() const override { return m_params.rate; }
+
+		/**
+		* Call the callback for the given number of frames, in blocks of at most blockFrames, without waiting.
+		* Must not be called while the thread started by start() is running.
+		* @return false if the callback asked to stop
+		**/
+		bool run(std::int64_t frames) {
+			while (frames > 0) {
+				std::int64_t const n = std::min(frames, m_params.blockFrames);
+				readInput(n);
+				std::fill(m_output.begin(), m_output.end(), 0.0f);
+				int const result = m_callback(m_input.data(), m_output.data(), n);
+				if (m_sink) m_sink->write(m_output.data(), static_cast<std::size_t>(n));
+				m_position.fetch_add(n, std::memory_order_relaxed);
+				frames -= n;
+				if (result != 0) return false;
+			}
+			return true;
+		}
+		/// Frames run so far
+		std::int64_t position() const { return m_position.load(std::memory_order_relaxed); }
+		/// Returns true if the input comes from a file and all of it has been read
+		bool inputDone() const { return m_source && static_cast<std::size_t>(position()) >= m_source->frames(); }
+		bool manualClock() const { return m_params.manualClock; }
+
+	  private:
+		void readInput(std::int64_t frames) {
+			std::fill(m_input.begin(), m_input.end(), 0.0f);
+			if (!m_source) return;
+			auto const in = static_cast<std::size_t>(m_params.in);
+			std::size_t const channels = std::min<std::size_t>(in, m_source->channels());
+			auto const& samples = m_source->samples();
+			for (std::size_t f = 0; f < static_cast<std::size_t>(frames); ++f) {
+				std::size_t const frame = static_cast<std::size_t>(position()) + f;
+				if (frame >= m_source->frames()) break;
+				for (std::size_t c = 0; c < channels; ++c) m_input[f * in + c] = samples[frame * m_source->channels() + c];
+			}
+		}
+		Callback m_callback;
+		Params m_params;
+		std::unique_ptr<WavReader> m_source;
+		std::unique_ptr<WavWriter> m_sink;
+		std::vector<float> m_input, m_output;
+		std::atomic<std::int64_t> m_position{ 0 };
+		std::atomic<bool> m_running{ false };
+		std::thread m_thread;
+	};
+}
@@ -9,6 +9,17 @@
 #include <cstddef>
 #include <vector>
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DA_FFT_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DA_FFT_NEON
+#include <arm_neon.h>
+#endif
+
 
 namespace da {
 
@@ -78,4 +89,323 @@ namespace da {
 		for (std::size_t i = 0; i < N; ++i) data[i] = scale * std::conj(data[i]);  // Invert back, and apply IFFT scaling
 	}
 	
+	namespace internal {
+		/**
+		* Radix-2 butterflies over split-complex arrays: (a, b) <- (a + w * b, a - w * b) for n consecutive elements.
+		* The data and the twiddles are contiguous, so the loop maps directly to SIMD lanes.
+		**/
+		inline void butterflies(float* are, float* aim, float* bre, float* bim, float const* wre, float const* wim, std::size_t n) {
+			std::size_t i = 0;
+#if defined(__AVX__)
+			for (; i + 8 <= n; i += 8) {
+				__m256 const br = _mm256_loadu_ps(bre + i), bi = _mm256_loadu_ps(bim + i);
+				__m256 const wr = _mm256_loadu_ps(wre + i), wi = _mm256_loadu_ps(wim + i);
+				__m256 const tr = _mm256_sub_ps(_mm256_mul_ps(br, wr), _mm256_mul_ps(bi, wi));
+				__m256 const ti = _mm256_add_ps(_mm256_mul_ps(br, wi), _mm256_mul_ps(bi, wr));
+				__m256 const ar = _mm256_loadu_ps(are + i), ai = _mm256_loadu_ps(aim + i);
+				_mm256_storeu_ps(bre + i, _mm256_sub_ps(ar, tr));
+				_mm256_storeu_ps(bim + i, _mm256_sub_ps(ai, ti));
+				_mm256_storeu_ps(are + i, _mm256_add_ps(ar, tr));
+				_mm256_storeu_ps(aim + i, _mm256_add_ps(ai, ti));
+			}
+#endif
+#if defined(DA_FFT_SSE)
+			for (; i + 4 <= n; i += 4) {
+				__m128 const br = _mm_loadu_ps(bre + i), bi = _mm_loadu_ps(bim + i);
+				__m128 const wr = _mm_loadu_ps(wre + i), wi = _mm_loadu_ps(wim + i);
+				__m128 const tr = _mm_sub_ps(_mm_mul_ps(br, wr), _mm_mul_ps(bi, wi));
+				__m128 const ti = _mm_add_ps(_mm_mul_ps(br, wi), _mm_mul_ps(bi, wr));
+				__m128 const ar = _mm_loadu_ps(are + i), ai = _mm_loadu_ps(aim + i);
+				_mm_storeu_ps(bre + i, _mm_sub_ps(ar, tr));
+				_mm_storeu_ps(bim + i, _mm_sub_ps(ai, ti));
+				_mm_storeu_ps(are + i, _mm_add_ps(ar, tr));
+				_mm_storeu_ps(aim + i, _mm_add_ps(ai, ti));
+			}
+#elif defined(DA_FFT_NEON)
+			for (; i + 4 <= n; i += 4) {
+				float32x4_t const br = vld1q_f32(bre + i), bi = vld1q_f32(bim + i);
+				float32x4_t const wr = vld1q_f32(wre + i), wi = vld1q_f32(wim + i);
+				float32x4_t const tr = vmlsq_f32(vmulq_f32(br, wr), bi, wi);
+				float32x4_t const ti = vmlaq_f32(vmulq_f32(br, wi), bi, wr);
+				float32x4_t const ar = vld1q_f32(are + i), ai = vld1q_f32(aim + i);
+				vst1q_f32(bre + i, vsubq_f32(ar, tr));
+				vst1q_f32(bim + i, vsubq_f32(ai, ti));
+				vst1q_f32(are + i, vaddq_f32(ar, tr));
+				vst1q_f32(aim + i, vaddq_f32(ai, ti));
+			}
+#endif
+			for (; i < n; ++i) {
+				float const tr = bre[i] * wre[i] - bim[i] * wim[i];
+				float const ti = bre[i] * wim[i] + bim[i] * wre[i];
+				bre[i] = are[i] - tr;
+				bim[i] = aim[i] - ti;
+				are[i] += tr;
+				aim[i] += ti;
+			}
+		}
+	}
+
+	namespace internal {
+		/// Butterflies for L channels in SIMD lanes, all sharing the twiddle w = (wr, wi).
+		template <std::size_t L> inline void laneButterflies(float* are, float* aim, float* bre, float* bim, float wr, float wi) {
+#if defined(__AVX__)
+			if constexpr (L % 8 == 0) {
+				__m256 const wr8 = _mm256_set1_ps(wr), wi8 = _mm256_set1_ps(wi);
+				for (std::size_t i = 0; i < L; i += 8) {
+					__m256 const br = _mm256_loadu_ps(bre + i), bi = _mm256_loadu_ps(bim + i);
+					__m256 const tr = _mm256_sub_ps(_mm256_mul_ps(br, wr8), _mm256_mul_ps(bi, wi8));
+					__m256 const ti = _mm256_add_ps(_mm256_mul_ps(br, wi8), _mm256_mul_ps(bi, wr8));
+					__m256 const ar = _mm256_loadu_ps(are + i), ai = _mm256_loadu_ps(aim + i);
+					_mm256_storeu_ps(bre + i, _mm256_sub_ps(ar, tr));
+					_mm256_storeu_ps(bim + i, _mm256_sub_ps(ai, ti));
+					_mm256_storeu_ps(are + i, _mm256_add_ps(ar, tr));
+					_mm256_storeu_ps(aim + i, _mm256_add_ps(ai, ti));
+				}
+				return;
+			}
+#endif
+#if defined(DA_FFT_SSE)
+			if constexpr (L % 4 == 0) {
+				__m128 const wr4 = _mm_set1_ps(wr), wi4 = _mm_set1_ps(wi);
+				for (std::size_t i = 0; i < L; i += 4) {
+					__m128 const br = _mm_loadu_ps(bre + i), bi = _mm_loadu_ps(bim + i);
+					__m128 const tr = _mm_sub_ps(_mm_mul_ps(br, wr4), _mm_mul_ps(bi, wi4));
+					__m128 const ti = _mm_add_ps(_mm_mul_ps(br, wi4), _mm_mul_ps(bi, wr4));
+					__m128 const ar = _mm_loadu_ps(are + i), ai = _mm_loadu_ps(aim + i);
+					_mm_storeu_ps(bre + i, _mm_sub_ps(ar, tr));
+					_mm_storeu_ps(bim + i, _mm_sub_ps(ai, ti));
+					_mm_storeu_ps(are + i, _mm_add_ps(ar, tr));
+					_mm_storeu_ps(aim + i, _mm_add_ps(ai, ti));
+				}
+				return;
+			}
+#elif defined(DA_FFT_NEON)
+			if constexpr (L % 4 == 0) {
+				float32x4_t const wr4 = vdupq_n_f32(wr), wi4 = vdupq_n_f32(wi);
+				for (std::size_t i = 0; i < L; i += 4) {
+					float32x4_t const br = vld1q_f32(bre + i), bi = vld1q_f32(bim + i);
+					float32x4_t const tr = vmlsq_f32(vmulq_f32(br, wr4), bi, wi4);
+					float32x4_t const ti = vmlaq_f32(vmulq_f32(br, wi4), bi, wr4);
+					float32x4_t const ar = vld1q_f32(are + i), ai = vld1q_f32(aim + i);
+					vst1q_f32(bre + i, vsubq_f32(ar, tr));
+					vst1q_f32(bim + i, vsubq_f32(ai, ti));
+					vst1q_f32(are + i, vaddq_f32(ar, tr));
+					vst1q_f32(aim + i, vaddq_f32(ai, ti));
+				}
+				return;
+			}
+#endif
+			for (std::size_t i = 0; i < L; ++i) {
+				float const tr = bre[i] * wr - bim[i] * wi;
+				float const ti = bre[i] * wi + bim[i] * wr;
+				bre[i] = are[i] - tr;
+				bim[i] = aim[i] - ti;
+				are[i] += tr;
+				aim[i] += ti;
+			}
+		}
+
+		/// Precomputed tables shared by the real-input transforms of size 2^P
+		template <unsigned P> struct RealFFTTables {
+			static constexpr std::size_t N = std::size_t(1) << P;
+			static constexpr std::size_t H = N / 2;
+			std::vector<std::size_t> bitrev;  ///< Bit-reversal permutation for the half-size transform
+			std::vector<float> twre, twim;  ///< Butterfly twiddles, stage of length len starts at offset len / 2 - 1
+			std::vector<float> postre, postim;  ///< Twiddles for unpacking the half-size transform into the real spectrum
+
+			RealFFTTables(): bitrev(H), twre(H), twim(H), postre(H / 2 + 1), postim(H / 2 + 1) {
+				for (std::size_t i = 0, j = 0; i < H; ++i) {
+					bitrev[i] = j;
+					std::size_t m = H / 2;
+					while (m >= 1 && m <= j) { j -= m; m >>= 1; }
+					j += m;
+				}
+				for (std::size_t len = 2; len <= H; len *= 2) {
+					for (std::size_t k = 0; k < len / 2; ++k) {
+						double const a = -TAU * static_cast<double>(k) / static_cast<double>(len);
+						twre[len / 2 - 1 + k] = static_cast<float>(std::cos(a));
+						twim[len / 2 - 1 + k] = static_cast<float>(std::sin(a));
+					}
+				}
+				for (std::size_t k = 0; k <= H / 2; ++k) {
+					double const a = -TAU * static_cast<double>(k) / static_cast<double>(N);
+					postre[k] = static_cast<float>(std::cos(a));
+					postim[k] = static_cast<float>(std::sin(a));
+				}
+			}
+		};
+	}
+
+	/**
+	* Forward FFT of 2^P real samples with precomputed tables.
+	*
+	* The real input is packed into a complex FFT of half the size (even samples as real part, odd samples as
+	* imaginary part), which is computed in split-complex form with SIMD butterflies and then unpacked into the
+	* N / 2 + 1 non-redundant bins of the full spectrum. Results match da::fft<P> within float rounding.
+	* All memory is allocated on construction; operator() does no allocation and no trigonometry.
+	**/
+	template <unsigned P> class RealFFT {
+		static_assert(P >= 2, "RealFFT requires at least four samples");
+	  public:
+		static constexpr std::size_t N = std::size_t(1) << P;  ///< Number of real input samples
+		static constexpr std::size_t H = N / 2;  ///< Size of the internal complex transform
+		static constexpr std::size_t BINS = H + 1;  ///< Number of output bins (DC to Nyquist)
+
+		RealFFT(): m_re(H), m_im(H) {}
+
+		/** Window the N samples starting at in and write BINS complex values to out (caller-owned). **/
+		template <typename InIt, typename Window> void operator()(InIt in, Window const& window, std::complex<float>* out) {
+			float* re = m_re.data();
+			float* im = m_im.data();
+			// Pack pairs of real samples into complex values, in bit-reversed order
+			for (std::size_t n = 0; n < H; ++n) {
+				std::size_t const j = m_tables.bitrev[n];
+				re[j] = static_cast<float>(*in++ * window[2 * n]);
+				im[j] = static_cast<float>(*in++ * window[2 * n + 1]);
+			}
+			// Iterative radix-2 decimation in time
+			for (std::size_t len = 2; len <= H; len *= 2) {
+				std::size_t const half = len / 2;
+				float const* wre = m_tables.twre.data() + half - 1;
+				float const* wim = m_tables.twim.data() + half - 1;
+				for (std::size_t i = 0; i < H; i += len) {
+					internal::butterflies(re + i, im + i, re + i + half, im + i + half, wre, wim, half);
+				}
+			}
+			// Split the packed spectrum Z into the spectrum X of the real input:
+			// X[k] = (Z[k] + conj(Z[H - k])) / 2 - i / 2 * W^k * (Z[k] - conj(Z[H - k]))
+			out[0] = std::complex<float>(re[0] + im[0], 0.0f);
+			out[H] = std::complex<float>(re[0] - im[0], 0.0f);
+			for (std::size_t k = 1; k <= H / 2; ++k) {
+				std::size_t const nk = H - k;
+				float const evenRe = 0.5f * (re[k] + re[nk]);
+				float const evenIm = 0.5f * (im[k] - im[nk]);
+				float const oddRe = 0.5f * (im[k] + im[nk]);
+				float const oddIm = -0.5f * (re[k] - re[nk]);
+				float const tr = oddRe * m_tables.postre[k] - oddIm * m_tables.postim[k];
+				float const ti = oddRe * m_tables.postim[k] + oddIm * m_tables.postre[k];
+				out[k] = std::complex<float>(evenRe + tr, evenIm + ti);
+				out[nk] = std::complex<float>(evenRe - tr, ti - evenIm);
+			}
+		}
+
+		/** Inverse transform of BINS complex values (the spectrum of a real signal) into N real samples at out. **/
+		void inverse(std::complex<float> const* in, float* out) {
+			float* re = m_re.data();
+			float* im = m_im.data();
+			// Pack the spectrum back into the half-size transform, conjugated so that the forward stages invert it:
+			// Z[k] = (X[k] + conj(X[H - k])) / 2 + i / 2 * conj(W^k) * (X[k] - conj(X[H - k]))
+			for (std::size_t k = 0; k < H; ++k) {
+				std::size_t const nk = H - k;
+				float const wr = k <= H / 2 ? m_tables.postre[k] : -m_tables.postre[nk];
+				float const wi = k <= H / 2 ? m_tables.postim[k] : m_tables.postim[nk];
+				float const evenRe = 0.5f * (in[k].real() + in[nk].real());
+				float const evenIm = 0.5f * (in[k].imag() - in[nk].imag());
+				float const dRe = 0.5f * (in[k].real() - in[nk].real());
+				float const dIm = 0.5f * (in[k].imag() + in[nk].imag());
+				float const oddRe = dRe * wr + dIm * wi;
+				float const oddIm = dIm * wr - dRe * wi;
+				std::size_t const j = m_tables.bitrev[k];
+				re[j] = evenRe - oddIm;
+				im[j] = -(evenIm + oddRe);
+			}
+			for (std::size_t len = 2; len <= H; len *= 2) {
+				std::size_t const half = len / 2;
+				float const* wre = m_tables.twre.data() + half - 1;
+				float const* wim = m_tables.twim.data() + half - 1;
+				for (std::size_t i = 0; i < H; i += len) {
+					internal::butterflies(re + i, im + i, re + i + half, im + i + half, wre, wim, half);
+				}
+			}
+			// Undo the conjugation and scale; even samples come out as real parts and odd samples as imaginary parts
+			float const scale = 1.0f / static_cast<float>(H);
+			for (std::size_t n = 0; n < H; ++n) {
+				out[2 * n] = re[n] * scale;
+				out[2 * n + 1] = -im[n] * scale;
+			}
+		}
+
+	  private:
+		internal::RealFFTTables<P> m_tables;
+		std::vector<float> m_re, m_im;  ///< Split-complex work area
+	};
+
+	/**
+	* The same transform as RealFFT, computed for L independent channels at once.
+	*
+	* Data is kept structure-of-arrays with the channel as the innermost index (element n of channel l is at
+	* n * L + l), so every butterfly and every unpacking step is an L-wide operation on contiguous floats
+	* with a broadcast twiddle. With L = 4 or 8 the lane loops map onto SSE/NEON or AVX registers.
+	**/
+	template <unsigned P, std::size_t L> class RealFFTBatch {
+		static_assert(P >= 2, "RealFFTBatch requires at least four samples");
+	  public:
+		static constexpr std::size_t N = std::size_t(1) << P;
+		static constexpr std::size_t H = N / 2;
+		static constexpr std::size_t BINS = H + 1;
+		static constexpr std::size_t LANES = L;
+
+		RealFFTBatch(): m_re(H * L), m_im(H * L) {}
+
+		/**
+		* Window L channels of N samples (channel l starts at in + l * stride) and write BINS * L values
+		* of split-complex output to outre and outim, laid out bin-major (bin k of channel l at k * L + l).
+		**/
+		template <typename Window> void operator()(float const* in, std::size_t stride, Window const& window, float* outre, float* outim) {
+			float* re = m_re.data();
+			float* im = m_im.data();
+			for (std::size_t n = 0; n < H; ++n) {
+				std::size_t const j = m_tables.bitrev[n] * L;
+				float const w0 = window[2 * n];
+				float const w1 = window[2 * n + 1];
+				for (std::size_t l = 0; l < L; ++l) {
+					re[j + l] = in[l * stride + 2 * n] * w0;
+					im[j + l] = in[l * stride + 2 * n + 1] * w1;
+				}
+			}
+			for (std::size_t len = 2; len <= H; len *= 2) {
+				std::size_t const half = len / 2;
+				float const* wre = m_tables.twre.data() + half - 1;
+				float const* wim = m_tables.twim.data() + half - 1;
+				for (std::size_t i = 0; i < H; i += len) {
+					for (std::size_t k = 0; k < half; ++k) {
+						std::size_t const a = (i + k) * L;
+						std::size_t const b = (i + k + half) * L;
+						internal::laneButterflies<L>(re + a, im + a, re + b, im + b, wre[k], wim[k]);
+					}
+				}
+			}
+			for (std::size_t l = 0; l < L; ++l) {
+				outre[l] = re[l] + im[l];
+				outim[l] = 0.0f;
+				outre[H * L + l] = re[l] - im[l];
+				outim[H * L + l] = 0.0f;
+			}
+			for (std::size_t k = 1; k <= H / 2; ++k) {
+				std::size_t const nk = H - k;
+				float const wr = m_tables.postre[k];
+				float const wi = m_tables.postim[k];
+				float const* zre = re + k * L;
+				float const* zim = im + k * L;
+				float const* nre = re + nk * L;
+				float const* nim = im + nk * L;
+				for (std::size_t l = 0; l < L; ++l) {
+					float const evenRe = 0.5f * (zre[l] + nre[l]);
+					float const evenIm = 0.5f * (zim[l] - nim[l]);
+					float const oddRe = 0.5f * (zim[l] + nim[l]);
+					float const oddIm = -0.5f * (zre[l] - nre[l]);
+					float const tr = oddRe * wr - oddIm * wi;
+					float const ti = oddRe * wi + oddIm * wr;
+					outre[k * L + l] = evenRe + tr;
+					outim[k * L + l] = evenIm + ti;
+					outre[nk * L + l] = evenRe - tr;
+					outim[nk * L + l] = ti - evenIm;
+				}
+			}
+		}
+
+	  private:
+		internal::RealFFTTables<P> m_tables;
+		std::vector<float> m_re, m_im;
+	};
 }
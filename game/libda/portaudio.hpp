@@ -7,6 +7,7 @@
 #include "../log.hh"
 #include "../platform.hh"
 #include "../unicode.hh"
+#include "audiostream.hpp"
 
 #include <fmt/format.h>
 #include <portaudio.h>
@@ -60,7 +61,7 @@ namespace portaudio {
 	}
 
 	struct DeviceInfo {
-		DeviceInfo(int id, std::string n = std::string(), int i = 0, int o = 0, int index = 0): name(n), flex(n), idx(id), in(i), out(o), index(index) {}
+		DeviceInfo(int id, std::string n = std::string(), int i = 0, int o = 0, int index = 0, double rate = 0.0): name(n), flex(n), idx(id), in(i), out(o), index(index), rate(rate) {}
 		std::string desc() const {
 			std::string desc;
 			fmt::format_to(std::back_inserter(desc), "{} (", name);
@@ -74,6 +75,7 @@ namespace portaudio {
 		int idx;
 		int in, out;
 		int index;
+		double rate;  ///< Native (default) sample rate of the device
 	};
 	typedef std::vector<DeviceInfo> DeviceInfos;
 	struct AudioDevices {
@@ -104,7 +106,7 @@ namespace portaudio {
 				rename:
 					n = fmt::format("{} #{}", name, ++num);
 				};
-				devices.push_back(DeviceInfo(i, name, info->maxInputChannels, info->maxOutputChannels, Pa_HostApiDeviceIndexToDeviceIndex(backendIndex, i)));
+				devices.push_back(DeviceInfo(i, name, info->maxInputChannels, info->maxOutputChannels, Pa_HostApiDeviceIndexToDeviceIndex(backendIndex, i), info->defaultSampleRate));
 			}
 			for (auto& dev: devices) {
 				// Array of regex - replacement pairs
@@ -244,7 +246,7 @@ namespace portaudio {
 		return callback(reinterpret_cast<float const*>(input), reinterpret_cast<float*>(output), static_cast<std::int64_t>(frameCount));
 	}
 
-	class Stream {
+	class Stream: public da::AudioStream {
 		static void shutdownPaStream(PaStream *s) {
 			try { PORTAUDIO_CHECKED(Pa_CloseStream, (s)); }
 			catch(const std::exception &e) {
@@ -262,7 +264,7 @@ namespace portaudio {
 		  double sampleRate,
 		  unsigned long framesPerBuffer = paFramesPerBufferUnspecified,
 		  PaStreamFlags flags = paNoFlag
-		) {
+		): m_requestedRate(sampleRate) {
 			if (output != nullptr) {
 				if (output->channelCount > 0) { flags = paPrimeOutputBuffersUsingStreamCallback; }
 			}
@@ -272,6 +274,26 @@ namespace portaudio {
 
 		}
 		operator PaStream*() { return m_handle.get(); }
+		void start() override {
+			PaError err = Pa_StartStream(m_handle.get());
+			if (err != paNoError) throw std::runtime_error(std::string("Pa_StartStream: ") + Pa_GetErrorText(err));
+		}
+		void stop() override { PORTAUDIO_CHECKED(Pa_AbortStream, (m_handle.get())); }
+		/// The sample rate the device actually runs at (the host may settle for a slightly different one than requested)
+		double sampleRate() const override {
+			PaStreamInfo const* info = Pa_GetStreamInfo(m_handle.get());
+			return info && info->sampleRate > 0.0 ? info->sampleRate : m_requestedRate;
+		}
+		double inputLatency() const override {
+			PaStreamInfo const* info = Pa_GetStreamInfo(m_handle.get());
+			return info ? info->inputLatency : 0.0;
+		}
+		double outputLatency() const override {
+			PaStreamInfo const* info = Pa_GetStreamInfo(m_handle.get());
+			return info ? info->outputLatency : 0.0;
+		}
+	  private:
+		double m_requestedRate;
 	};
 
 }
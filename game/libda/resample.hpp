@@ -0,0 +1,102 @@
+#pragma once
+
+/**
+ * @file resample.hpp Realtime-safe sample rate conversion.
+ */
+
+#include "sample.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DA_RESAMPLE_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DA_RESAMPLE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace da {
+
+	/**
+	* Lanczos interpolation with the kernel precomputed for PHASES fractional positions (polyphase table).
+	* Weights between two tabulated phases are interpolated linearly, so no transcendental functions are evaluated
+	* after construction and resampling neither allocates nor locks, as required in audio callbacks.
+	* The kernel is centred on the position: the value at fractional position x of in is computed from
+	* in[x - A + 1] ... in[x + A], so that integer positions return the input as is and nothing is delayed. Positions
+	* must be at least HISTORY, for the samples before them. The taps are processed in groups of four SIMD lanes.
+	**/
+	template <unsigned A = 2, unsigned PHASES = 256> class LanczosResampler {
+	  public:
+		static constexpr unsigned TAPS = 2 * A;  ///< Input samples used per output sample
+		static constexpr unsigned HISTORY = A - 1;  ///< Input samples used before the position
+		static_assert(TAPS % 4 == 0, "The taps are processed four at a time");
+
+		LanczosResampler(): m_table((PHASES + 1) * TAPS) {
+			for (unsigned p = 0; p <= PHASES; ++p) {
+				double const frac = double(p) / PHASES;
+				float* row = &m_table[p * TAPS];
+				double sum = 0.0;
+				for (unsigned j = 0; j < TAPS; ++j) sum += lanc<A>(frac + A - 1 - j);
+				// Normalize for unity gain at DC (the plain kernel ripples slightly between integer positions)
+				for (unsigned j = 0; j < TAPS; ++j) row[j] = static_cast<float>(lanc<A>(frac + A - 1 - j) / sum);
+			}
+		}
+
+		/**
+		* Interpolate n output samples starting at position pos (>= HISTORY) of in, advancing by step input samples
+		* per output. Calls sink(i, value) for each output sample i and returns the position following the last one.
+		* in must hold inputSize(pos, step, n) samples.
+		**/
+		template <typename Sink> double process(float const* in, double pos, double step, std::size_t n, Sink&& sink) const {
+			for (std::size_t i = 0; i < n; ++i, pos += step) {
+				auto const k = static_cast<std::size_t>(pos);
+				double const phase = (pos - static_cast<double>(k)) * PHASES;
+				// The last row only serves as the next one of row PHASES - 1, also when phase rounds up to PHASES
+				auto const p = std::min(static_cast<unsigned>(phase), PHASES - 1);
+				sink(i, interpolate(in + k - HISTORY, &m_table[p * TAPS], static_cast<float>(phase - p)));
+			}
+			return pos;
+		}
+
+		/// The number of input samples that process() reads
+		static std::size_t inputSize(double pos, double step, std::size_t n) {
+			if (n == 0) return 0;
+			return static_cast<std::size_t>(pos + step * static_cast<double>(n - 1)) + TAPS - HISTORY;
+		}
+
+	  private:
+		/// Dot product of TAPS input samples with the weights interpolated between row and the next row by t
+		static float interpolate(float const* in, float const* row, float t) {
+			float const* next = row + TAPS;
+#if defined(DA_RESAMPLE_SSE)
+			__m128 const tt = _mm_set1_ps(t);
+			__m128 acc = _mm_setzero_ps();
+			for (unsigned j = 0; j < TAPS; j += 4) {
+				__m128 const r = _mm_loadu_ps(row + j);
+				__m128 const w = _mm_add_ps(r, _mm_mul_ps(tt, _mm_sub_ps(_mm_loadu_ps(next + j), r)));
+				acc = _mm_add_ps(acc, _mm_mul_ps(w, _mm_loadu_ps(in + j)));
+			}
+			acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+			acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+			return _mm_cvtss_f32(acc);
+#elif defined(DA_RESAMPLE_NEON)
+			float32x4_t acc = vdupq_n_f32(0.0f);
+			for (unsigned j = 0; j < TAPS; j += 4) {
+				float32x4_t const r = vld1q_f32(row + j);
+				float32x4_t const w = vmlaq_n_f32(r, vsubq_f32(vld1q_f32(next + j), r), t);
+				acc = vmlaq_f32(acc, w, vld1q_f32(in + j));
+			}
+			float32x2_t const half = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+			return vget_lane_f32(vpadd_f32(half, half), 0);
+#else
+			float s = 0.0f;
+			for (unsigned j = 0; j < TAPS; ++j) s += (row[j] + t * (next[j] - row[j])) * in[j];
+			return s;
+#endif
+		}
+
+		std::vector<float> m_table;  ///< PHASES + 1 rows of TAPS weights
+	};
+}
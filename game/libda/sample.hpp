@@ -77,15 +77,17 @@ namespace da {
 	public:
 		using iterator_category = std::random_access_iterator_tag;
 		using value_type = ValueType;
-		using difference_type = ValueType;
+		using difference_type = std::ptrdiff_t;
 		using pointer = ValueType*;
 		using reference = ValueType&;
 
 		step_iterator(ValueType* pos, std::ptrdiff_t step): m_pos(pos), m_step(step) {}
 		ValueType& operator*() { return *m_pos; }
 		step_iterator operator+(std::ptrdiff_t rhs) { return step_iterator(m_pos + m_step * rhs, m_step); }
+		step_iterator& operator+=(std::ptrdiff_t rhs) { m_pos += m_step * rhs; return *this; }
 		step_iterator& operator++() { m_pos += m_step; return *this; }
 		step_iterator operator++(int) { step_iterator ret = *this; ++*this; return ret; }
+		step_iterator& operator--() { m_pos -= m_step; return *this; }
 		bool operator!=(step_iterator const& rhs) const { return m_pos != rhs.m_pos; }
 		std::ptrdiff_t operator-(step_iterator const& rhs) const { return (m_pos - rhs.m_pos) / m_step; }
 		// TODO: more operators
@@ -0,0 +1,98 @@
+#pragma once
+
+/**
+ * @file stemmix.hpp Realtime-safe mixing of several stereo streams (stems) with gain ramps.
+ */
+
+#include <cstddef>
+
+#if defined(__AVX__)
+#define DA_STEMMIX_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DA_STEMMIX_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DA_STEMMIX_NEON
+#include <arm_neon.h>
+#endif
+
+namespace da {
+
+	/// Gain of a stem over a block: start applies to the first frame and end to the frame after the block, linear in between
+	struct gain_ramp {
+		float start;
+		float end;
+	};
+
+	namespace detail {
+		/// Mix frames [first, last) of a block one at a time, inv being 1 / frames of the whole block
+		inline void mix_stems_frames(float* out, float const* const* stems, gain_ramp const* gains, std::size_t count, std::size_t first, std::size_t last, float inv) {
+			for (std::size_t f = first; f < last; ++f) {
+				float const t = static_cast<float>(f) * inv;
+				float left = 0.0f;
+				float right = 0.0f;
+				for (std::size_t s = 0; s < count; ++s) {
+					float const g = gains[s].start + (gains[s].end - gains[s].start) * t;
+					left += stems[s][2 * f] * g;
+					right += stems[s][2 * f + 1] * g;
+				}
+				out[2 * f] += left;
+				out[2 * f + 1] += right;
+			}
+		}
+	}
+
+	/// Reference implementation of mix_stems, one frame at a time
+	inline void mix_stems_scalar(float* out, float const* const* stems, gain_ramp const* gains, std::size_t count, std::size_t frames) {
+		if (frames == 0) return;
+		detail::mix_stems_frames(out, stems, gains, count, 0, frames, 1.0f / static_cast<float>(frames));
+	}
+
+	/**
+	* Add count interleaved stereo stems of the given number of frames to out, each with its gain ramp.
+	* The stems are summed in registers and out is only read and written once per sample; the ramps are computed
+	* from the frame index rather than accumulated, so that the result matches mix_stems_scalar.
+	**/
+	inline void mix_stems(float* out, float const* const* stems, gain_ramp const* gains, std::size_t count, std::size_t frames) {
+		if (frames == 0) return;
+		float const inv = 1.0f / static_cast<float>(frames);
+		std::size_t f = 0;
+#if defined(DA_STEMMIX_AVX)
+		__m256 const lanes = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+		for (std::size_t const vectorFrames = frames & ~std::size_t{ 3 }; f < vectorFrames; f += 4) {
+			__m256 const t = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(static_cast<float>(f)), lanes), _mm256_set1_ps(inv));
+			__m256 acc = _mm256_setzero_ps();
+			for (std::size_t s = 0; s < count; ++s) {
+				__m256 const g = _mm256_add_ps(_mm256_set1_ps(gains[s].start), _mm256_mul_ps(_mm256_set1_ps(gains[s].end - gains[s].start), t));
+				acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(stems[s] + 2 * f), g));
+			}
+			_mm256_storeu_ps(out + 2 * f, _mm256_add_ps(_mm256_loadu_ps(out + 2 * f), acc));
+		}
+#elif defined(DA_STEMMIX_SSE)
+		__m128 const lanes = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+		for (std::size_t const vectorFrames = frames & ~std::size_t{ 1 }; f < vectorFrames; f += 2) {
+			__m128 const t = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(f)), lanes), _mm_set1_ps(inv));
+			__m128 acc = _mm_setzero_ps();
+			for (std::size_t s = 0; s < count; ++s) {
+				__m128 const g = _mm_add_ps(_mm_set1_ps(gains[s].start), _mm_mul_ps(_mm_set1_ps(gains[s].end - gains[s].start), t));
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(stems[s] + 2 * f), g));
+			}
+			_mm_storeu_ps(out + 2 * f, _mm_add_ps(_mm_loadu_ps(out + 2 * f), acc));
+		}
+#elif defined(DA_STEMMIX_NEON)
+		float const laneValues[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+		float32x4_t const lanes = vld1q_f32(laneValues);
+		for (std::size_t const vectorFrames = frames & ~std::size_t{ 1 }; f < vectorFrames; f += 2) {
+			float32x4_t const t = vmulq_n_f32(vaddq_f32(vdupq_n_f32(static_cast<float>(f)), lanes), inv);
+			float32x4_t acc = vdupq_n_f32(0.0f);
+			for (std::size_t s = 0; s < count; ++s) {
+				float32x4_t const g = vaddq_f32(vdupq_n_f32(gains[s].start), vmulq_n_f32(t, gains[s].end - gains[s].start));
+				acc = vaddq_f32(acc, vmulq_f32(vld1q_f32(stems[s] + 2 * f), g));
+			}
+			vst1q_f32(out + 2 * f, vaddq_f32(vld1q_f32(out + 2 * f), acc));
+		}
+#endif
+		detail::mix_stems_frames(out, stems, gains, count, f, frames, inv);  // The frames left over
+	}
+}
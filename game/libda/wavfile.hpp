@@ -0,0 +1,148 @@
+#pragma once
+
+/**
+ * @file wavfile.hpp Minimal WAV (RIFF) file reading and writing, for audio stand-ins that need no sound card.
+ */
+
+#include "sample.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace da {
+
+	/// Loads a whole WAV file of 16, 24 or 32 bit integer or 32 bit float PCM into interleaved float samples
+	class WavReader {
+	  public:
+		explicit WavReader(std::string const& filename) {
+			std::ifstream file(filename, std::ios::binary);
+			if (!file) throw std::runtime_error("Cannot open " + filename);
+			std::vector<unsigned char> const data{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+			if (data.size() < 12 || std::memcmp(data.data(), "RIFF", 4) != 0 || std::memcmp(data.data() + 8, "WAVE", 4) != 0) {
+				throw std::runtime_error(filename + " is not a WAV file");
+			}
+			unsigned format = 0, bits = 0;
+			bool formatFound = false;
+			for (std::size_t pos = 12; pos + 8 <= data.size();) {
+				std::size_t const size = read(data, pos + 4, 4);
+				std::size_t const body = pos + 8;
+				if (body + size > data.size()) throw std::runtime_error(filename + " is truncated");
+				if (std::memcmp(data.data() + pos, "fmt ", 4) == 0 && size >= 16) {
+					format = static_cast<unsigned>(read(data, body, 2));
+					m_channels = static_cast<unsigned>(read(data, body + 2, 2));
+					m_rate = static_cast<double>(read(data, body + 4, 4));
+					bits = static_cast<unsigned>(read(data, body + 14, 2));
+					if (format == 0xFFFE && size >= 26) format = static_cast<unsigned>(read(data, body + 24, 2));  // WAVE_FORMAT_EXTENSIBLE
+					formatFound = true;
+				} else if (std::memcmp(data.data() + pos, "data", 4) == 0) {
+					if (!formatFound || m_channels == 0) throw std::runtime_error(filename + " has no format before the data");
+					decode(data, body, size, format, bits, filename);
+					return;
+				}
+				pos = body + size + (size & 1);  // Chunks are padded to even sizes
+			}
+			throw std::runtime_error(filename + " has no data");
+		}
+		unsigned channels() const { return m_channels; }
+		double rate() const { return m_rate; }
+		std::size_t frames() const { return m_samples.size() / m_channels; }
+		/// Interleaved samples of all channels
+		std::vector<float> const& samples() const { return m_samples; }
+
+	  private:
+		static std::uint32_t read(std::vector<unsigned char> const& data, std::size_t pos, unsigned bytes) {
+			std::uint32_t value = 0;
+			for (unsigned i = 0; i < bytes; ++i) value |= std::uint32_t{ data[pos + i] } << (8 * i);
+			return value;
+		}
+		void decode(std::vector<unsigned char> const& data, std::size_t pos, std::size_t size, unsigned format, unsigned bits, std::string const& filename) {
+			unsigned const bytes = bits / 8;
+			if (!((format == 1 && (bits == 16 || bits == 24 || bits == 32)) || (format == 3 && bits == 32))) {
+				throw std::runtime_error(filename + ": unsupported sample format " + std::to_string(format) + "/" + std::to_string(bits) + " bits");
+			}
+			std::size_t const count = size / bytes / m_channels * m_channels;
+			m_samples.resize(count);
+			for (std::size_t i = 0; i < count; ++i) {
+				std::uint32_t const raw = read(data, pos + i * bytes, bytes);
+				if (format == 3) {
+					std::memcpy(&m_samples[i], &raw, sizeof(float));
+					continue;
+				}
+				// Sign extend to 32 bits
+				auto const value = static_cast<std::int32_t>(raw << (32 - bits)) >> (32 - bits);
+				m_samples[i] = bits == 16 ? conv_from_s16(value) : bits == 24 ? conv_from_s24(value) : conv_from_s32(value);
+			}
+		}
+		unsigned m_channels = 0;
+		double m_rate = 0.0;
+		std::vector<float> m_samples;
+	};
+
+	/// Writes interleaved float samples into a 32 bit float WAV file as they come; the sizes are filled in by close()
+	class WavWriter {
+	  public:
+		WavWriter(std::string const& filename, unsigned channels, double rate): m_file(filename, std::ios::binary), m_channels(channels) {
+			if (!m_file) throw std::runtime_error("Cannot write " + filename);
+			auto const sampleRate = static_cast<std::uint32_t>(rate);
+			m_file.write("RIFF\0\0\0\0WAVEfmt ", 16);
+			write(16, 4);  // Size of the fmt chunk
+			write(3, 2);  // IEEE float
+			write(channels, 2);
+			write(sampleRate, 4);
+			write(sampleRate * channels * 4, 4);  // Bytes per second
+			write(channels * 4, 2);  // Bytes per frame
+			write(32, 2);  // Bits per sample
+			m_file.write("data\0\0\0\0", 8);
+		}
+		~WavWriter() { close(); }
+		WavWriter(WavWriter const&) = delete;
+		WavWriter& operator=(WavWriter const&) = delete;
+		/// Append frames of interleaved samples
+		void write(float const* samples, std::size_t frames) {
+			for (std::size_t i = 0, n = frames * m_channels; i < n; ++i) {
+				std::uint32_t raw;
+				std::memcpy(&raw, &samples[i], sizeof(float));
+				write(raw, 4);
+			}
+			m_frames += frames;
+		}
+		/// Fill in the sizes of what has been written so far, so that the file can be read while more is appended
+		void flush() {
+			if (!m_file.is_open()) return;
+			auto const end = m_file.tellp();
+			writeSizes();
+			m_file.seekp(end);
+			m_file.flush();
+		}
+		/// Finish the file (further writes are ignored)
+		void close() {
+			if (!m_file.is_open()) return;
+			writeSizes();
+			m_file.close();
+		}
+
+	  private:
+		void writeSizes() {
+			auto const dataSize = static_cast<std::uint32_t>(m_frames * m_channels * 4);
+			m_file.seekp(4);
+			write(36 + dataSize, 4);
+			m_file.seekp(40);
+			write(dataSize, 4);
+		}
+		void write(std::uint32_t value, unsigned bytes) {
+			if (!m_file.is_open()) return;
+			char buf[4];
+			for (unsigned i = 0; i < bytes; ++i) buf[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+			m_file.write(buf, bytes);
+		}
+		std::ofstream m_file;
+		unsigned m_channels;
+		std::size_t m_frames = 0;
+	};
+}
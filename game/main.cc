@@ -7,7 +7,9 @@
 #include "fs.hh"
 #include "graphic/glutil.hh"
 #include "i18n.hh"
+#include "keyframeindex.hh"
 #include "log.hh"
+#include "pcmcache.hh"
 #include "platform.hh"
 #include "profiler.hh"
 #include "screen.hh"
@@ -104,6 +106,8 @@ void mainLoop(std::string const& songlist) {
 	SpdLogger::info(LogSystem::LOGGER, "Loading assets...");
 	TranslationEngine localization;
 	TextureLoader m_loader;
+	PcmCache::Global pcmCache(std::uintmax_t{ config["audio/pcm_cache_size"].ui() } * 1000000);
+	KeyframeIndexCache::Global keyframeIndex;
 	Backgrounds backgrounds;
 	Database database(PathCache::getConfigDir() / "database.xml");
 	Songs songs(database, songlist);
@@ -181,7 +185,11 @@ void mainLoop(std::string const& songlist) {
 			if (benchmarking) {
 				++frames;
 				if (Clock::now() - time > 1s) {
-					gm.flashMessage(fmt::format("{} FPS", frames));
+					auto const stats = audio.clockStats();
+					double const jitter = 1e3 * stats.callbackJitter.percentile(0.99).count();
+					double const correction = 1e3 * stats.clockCorrection.percentile(0.99).count();
+					gm.flashMessage(fmt::format("{} FPS, audio jitter {:.1f} ms, clock error {:.1f} ms", frames, jitter, correction));
+					SpdLogger::debug(LogSystem::AUDIO, "Callback jitter p99={:.2f} ms max={:.2f} ms, clock error p99={:.2f} ms max={:.2f} ms ({} syncs).", jitter, 1e3 * stats.callbackJitter.max.count(), correction, 1e3 * stats.clockCorrection.max.count(), stats.clockCorrection.total());
 					time += 1s;
 					frames = 0;
 				}
@@ -195,6 +203,7 @@ void mainLoop(std::string const& songlist) {
 			auto eventTime = Clock::now();
 			gm.controllers.process(eventTime);
 			checkEvents(gm, eventTime);
+			audio.updateSettings();  // Volume etc. may have been changed
 			if (benchmarking) prof("events");
 			} catch (RUNTIME_ERROR& e) {
 				SpdLogger::error(LogSystem::LOGGER, "Caught error, exception={}", e.what());
@@ -352,6 +361,10 @@ int main(int argc, char** argv) {
 			std::cout << "  --audio \"dev=1 out=2\"   # Pick device id 1 and assign stereo playback" << std::endl;
 			std::cout << "  --audio 'dev=\"HDA Intel\" mics=blue,red'   # HDA Intel with two mics" << std::endl;
 			std::cout << "  --audio 'dev=pulse out=2 mics=blue'       # PulseAudio with input and output" << std::endl;
+			std::cout << "  --audio 'mics=blue,red pitch=yin,fft'     # YIN pitch detection on the blue mic only" << std::endl;
+			std::cout << "  --audio 'dev=virtual out=2'               # No sound card, output discarded" << std::endl;
+			std::cout << "  --audio 'mics=blue input=take.wav'        # Blue mic read from a WAV file instead of a sound card" << std::endl;
+			std::cout << "  --audio 'out=2 record=out.wav'            # Playback written to a WAV file" << std::endl;
 			return EXIT_SUCCESS;
 		}
 		// Override XML config for options that were specified from commandline or performous.conf
@@ -0,0 +1,225 @@
+#include "pcmcache.hh"
+
+#include "log.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+namespace {
+	/// Cache file layout: Header, the id string, padding up to Header::offset, samples
+	struct Header {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t idLength;
+		std::int64_t samples;
+		double duration;
+		double replayGainDecibels;
+		double replayGainFactor;
+
+		/// Where the samples begin
+		std::size_t offset() const { return (sizeof(Header) + idLength + 63) / 64 * 64; }
+	};
+	char const magic[8] = { 'P', 'E', 'R', 'F', 'P', 'C', 'M', '\0' };
+	std::uint32_t const version = 2;  ///< 2: replay gain stored also if normalisation was disabled
+	std::size_t const maxPending = 4;  ///< Older jobs are dropped (e.g. while browsing song previews)
+
+	Header makeHeader(std::string const& id, std::int64_t samples, PcmInfo const& info) {
+		Header header{};
+		std::memcpy(header.magic, magic, sizeof(magic));
+		header.version = version;
+		header.idLength = static_cast<std::uint32_t>(id.size());
+		header.samples = samples;
+		header.duration = info.duration;
+		header.replayGainDecibels = info.replayGainDecibels;
+		header.replayGainFactor = info.replayGainFactor;
+		return header;
+	}
+}
+
+PcmCache::Writer::Writer(fs::path const& filename, std::string const& id, std::atomic<bool> const& cancel):
+  m_out(filename, std::ios::binary | std::ios::trunc), m_id(id), m_cancel(cancel) {
+	// Reserve the space of the header (written by finish), followed by the id and padding
+	Header const header = makeHeader(m_id, 0, PcmInfo());
+	std::vector<char> head(header.offset());
+	std::memcpy(head.data(), &header, sizeof(header));
+	std::copy(m_id.begin(), m_id.end(), head.begin() + sizeof(header));
+	m_out.write(head.data(), static_cast<std::streamsize>(head.size()));
+	if (!m_out) throw std::runtime_error("Cannot write " + filename.string());
+}
+
+void PcmCache::Writer::operator()(std::int16_t const* data, std::int64_t count, std::int64_t pos) {
+	if (pos < m_pos) {
+		// Already written
+		std::int64_t const skip = std::min(count, m_pos - pos);
+		data += skip;
+		count -= skip;
+		pos += skip;
+	}
+	if (count <= 0) return;
+	// A gap in the stream is stored as silence
+	std::int16_t const silence[256] = {};
+	while (m_pos < pos) {
+		std::int64_t const n = std::min<std::int64_t>(pos - m_pos, 256);
+		m_out.write(reinterpret_cast<char const*>(silence), static_cast<std::streamsize>(n * 2));
+		m_pos += n;
+	}
+	m_out.write(reinterpret_cast<char const*>(data), static_cast<std::streamsize>(count * 2));
+	m_pos += count;
+}
+
+void PcmCache::Writer::finish(PcmInfo const& info) {
+	Header const header = makeHeader(m_id, m_pos, info);
+	m_out.seekp(0);
+	m_out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+	m_out.close();
+	if (m_out.fail()) throw std::runtime_error("Writing failed");
+}
+
+PcmCache::PcmCache(fs::path const& dir, std::uintmax_t maxBytes):
+  m_maxBytes(maxBytes), m_files(dir, ".pcm", maxPending, [this] { evict(); }) {}  // The size limit may have been lowered
+
+PcmCache::~PcmCache() = default;
+
+std::unique_ptr<PcmCache::Entry> PcmCache::load(fs::path const& file, std::string const& format) {
+	auto const key = m_files.makeKey(file, format);
+	std::error_code ec;
+	if (!key || !fs::is_regular_file(key->cacheFile, ec)) return nullptr;
+	auto entry = std::make_unique<Entry>();
+	try {
+		entry->m_file.open(key->cacheFile.string());
+	} catch (std::exception const& e) {
+		SpdLogger::warn(LogSystem::FFMPEG, "Cannot map cached audio={}, exception={}", key->cacheFile, e.what());
+		return nullptr;
+	}
+	Header header;
+	if (entry->m_file.size() < sizeof(header)) return nullptr;
+	std::memcpy(&header, entry->m_file.data(), sizeof(header));
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version) return nullptr;
+	if (header.samples < 0 || entry->m_file.size() < header.offset() + static_cast<std::size_t>(header.samples) * 2) return nullptr;
+	if (std::string_view(entry->m_file.data() + sizeof(header), header.idLength) != key->id) return nullptr;  // Hash collision
+	entry->m_offset = header.offset();
+	entry->m_size = header.samples;
+	entry->m_info.duration = header.duration;
+	entry->m_info.replayGainDecibels = header.replayGainDecibels;
+	entry->m_info.replayGainFactor = header.replayGainFactor;
+	fs::last_write_time(key->cacheFile, fs::file_time_type::clock::now(), ec);  // Recently used
+	return entry;
+}
+
+void PcmCache::store(fs::path const& file, std::string const& format, Job job) {
+	auto key = m_files.makeKey(file, format);
+	if (!key) return;
+	m_files.queue(std::move(*key), [this, job = std::move(job)](FileCache::Key const& key, fs::path const& part, std::atomic<bool> const& cancel) {
+		return write(key, part, cancel, job);
+	});
+}
+
+void PcmCache::flush() { m_files.flush(); }
+
+std::unique_ptr<PcmCache::Recorder> PcmCache::record(fs::path const& file, std::string const& format) {
+	auto key = m_files.makeKey(file, format);
+	std::error_code ec;
+	if (!key || fs::exists(key->cacheFile, ec)) return nullptr;
+	std::lock_guard<std::mutex> l(m_mutex);
+	if (!m_recording.insert(key->cacheFile).second) return nullptr;
+	return std::unique_ptr<Recorder>(new Recorder(*this, std::move(*key)));
+}
+
+PcmCache::Recorder::Recorder(PcmCache& cache, FileCache::Key key):
+  m_cache(cache), m_key(std::move(key)), m_part(fs::path(m_key.cacheFile) += ".rec") {}
+
+PcmCache::Recorder::~Recorder() {
+	abandon();
+	std::lock_guard<std::mutex> l(m_cache.m_mutex);
+	m_cache.m_recording.erase(m_key.cacheFile);
+}
+
+void PcmCache::Recorder::operator()(std::int16_t const* data, std::int64_t count, std::int64_t pos) {
+	if (m_done || count <= 0) return;
+	if (pos != (m_writer ? m_writer->m_pos : 0)) {
+		abandon();
+		return;
+	}
+	try {
+		if (!m_writer) {
+			fs::create_directories(m_cache.m_files.dir());
+			m_writer.reset(new Writer(m_part, m_key.id, m_cancel));
+		}
+		(*m_writer)(data, count, pos);
+	} catch (std::exception const& e) {
+		SpdLogger::warn(LogSystem::FFMPEG, "Cannot write cache file={}, exception={}", m_part, e.what());
+		abandon();
+	}
+}
+
+void PcmCache::Recorder::finish(PcmInfo const& info) {
+	if (m_done || !m_writer) {
+		abandon();
+		return;
+	}
+	try {
+		m_writer->finish(info);
+		fs::rename(m_part, m_key.cacheFile);
+		SpdLogger::info(LogSystem::FFMPEG, "Cached decoded audio={} ({} MB).", m_key.id.substr(0, m_key.id.find('\n')), m_writer->m_pos * 2 / 1000000);
+		m_writer.reset();
+		m_done = true;
+		m_cache.evict();
+	} catch (std::exception const& e) {
+		SpdLogger::warn(LogSystem::FFMPEG, "Cannot write cache file={}, exception={}", m_key.cacheFile, e.what());
+		abandon();
+	}
+}
+
+void PcmCache::Recorder::abandon() {
+	m_done = true;
+	if (!m_writer) return;
+	m_writer.reset();  // Closes the file
+	std::error_code ec;
+	fs::remove(m_part, ec);
+}
+
+bool PcmCache::write(FileCache::Key const& key, fs::path const& part, std::atomic<bool> const& cancel, Job const& job) {
+	Writer writer(part, key.id, cancel);
+	PcmInfo const info = job(writer);
+	if (cancel) return false;
+	writer.finish(info);
+	SpdLogger::info(LogSystem::FFMPEG, "Cached decoded audio={} ({} MB).", key.id.substr(0, key.id.find('\n')), writer.m_pos * 2 / 1000000);
+	return true;
+}
+
+void PcmCache::evict() {
+	fs::path const running = m_files.running();
+	auto const recording = [this](fs::path const& cacheFile) {
+		std::lock_guard<std::mutex> l(m_mutex);
+		return m_recording.count(cacheFile) > 0;
+	};
+	std::error_code ec;
+	std::vector<std::tuple<fs::file_time_type, std::uintmax_t, fs::path>> files;
+	std::uintmax_t total = 0;
+	for (auto it = fs::directory_iterator(m_files.dir(), ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+		auto const& path = it->path();
+		if (path.extension() == ".part" && path != running) fs::remove(path, ec);  // Left by a crash
+		if (path.extension() == ".rec" && !recording(fs::path(path).replace_extension())) fs::remove(path, ec);
+		if (path.extension() != ".pcm") continue;
+		auto const size = it->file_size(ec);
+		auto const time = it->last_write_time(ec);
+		if (ec) continue;
+		files.emplace_back(time, size, path);
+		total += size;
+	}
+	std::sort(files.begin(), files.end());
+	for (auto const& [time, size, path]: files) {
+		if (total <= m_maxBytes) break;
+		if (!fs::remove(path, ec)) continue;  // Still mapped by a player on some platforms
+		SpdLogger::debug(LogSystem::FFMPEG, "Evicted cached audio={}.", path);
+		total -= size;
+	}
+}
+
+PcmCache* PcmCache::global() { return Global::get(); }
+
+PcmCache::Global::Global(std::uintmax_t maxBytes):
+  GlobalCache(maxBytes > 0 ? std::make_unique<PcmCache>(PathCache::getCacheDir() / "pcm", maxBytes) : nullptr) {}
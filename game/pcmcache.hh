@@ -0,0 +1,127 @@
+#pragma once
+
+#include "filecache.hh"
+#include "fs.hh"
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+/// Track information stored along with the decoded samples, so that a cached track can be played without FFmpeg
+struct PcmInfo {
+	double duration = 0.0;
+	double replayGainDecibels = 0.0;
+	double replayGainFactor = 0.0;
+};
+
+/**
+* On-disk cache of decoded 16-bit PCM, one file per track and output format, keyed by the path, modification time
+* and size of the source file (so edited files are simply not found and eventually evicted).
+* Tracks are recorded from the decoding for their first complete playback (see Recorder), or written by a background
+* worker (see FileCache) that decodes them, and memory-mapped afterwards.
+* The least recently used files are removed when the cache grows beyond its size limit.
+**/
+class PcmCache {
+  public:
+	/// A cached track mapped into memory (interleaved samples)
+	class Entry {
+	  public:
+		std::int16_t const* data() const { return reinterpret_cast<std::int16_t const*>(m_file.data() + m_offset); }
+		/// The number of samples (not frames)
+		std::int64_t size() const { return m_size; }
+		PcmInfo const& info() const { return m_info; }
+	  private:
+		friend class PcmCache;
+		boost::iostreams::mapped_file_source m_file;
+		std::size_t m_offset = 0;
+		std::int64_t m_size = 0;
+		PcmInfo m_info;
+	};
+
+	class Recorder;
+
+	/// Receives the samples of a track being cached, in the same way as AudioBuffer does from AudioFFmpeg
+	class Writer {
+	  public:
+		/// Store count samples at position pos; gaps are filled with silence, overlap with earlier data is skipped
+		void operator()(std::int16_t const* data, std::int64_t count, std::int64_t pos);
+		/// Should the job stop early (the cache is shutting down)?
+		bool cancelled() const { return m_cancel; }
+	  private:
+		friend class PcmCache;
+		friend class Recorder;
+		Writer(fs::path const& filename, std::string const& id, std::atomic<bool> const& cancel);
+		/// Complete the file with the final header
+		void finish(PcmInfo const& info);
+		fs::ofstream m_out;
+		std::string const& m_id;
+		std::int64_t m_pos = 0;
+		std::atomic<bool> const& m_cancel;
+	};
+	/// Decodes a complete track into the writer and returns its info; exceptions or cancellation abandon the file
+	using Job = std::function<PcmInfo(Writer&)>;
+
+	/// Caches a track from the samples decoded for playing it, rather than decoding it again (see record)
+	class Recorder {
+	  public:
+		~Recorder();
+		Recorder(Recorder const&) = delete;
+		Recorder& operator=(Recorder const&) = delete;
+		/// Store count samples at position pos. Only a continuation of the previous samples from the start of the
+		/// track is recorded, anything else (a seek) abandons the recording.
+		void operator()(std::int16_t const* data, std::int64_t count, std::int64_t pos);
+		/// Store the recording in the cache (at the end of the track), unless it was abandoned
+		void finish(PcmInfo const& info);
+		/// Has the recording been stored or abandoned (so that it can be dropped)?
+		bool done() const { return m_done; }
+	  private:
+		friend class PcmCache;
+		Recorder(PcmCache& cache, FileCache::Key key);
+		void abandon();
+		PcmCache& m_cache;
+		FileCache::Key const m_key;
+		fs::path const m_part;
+		std::atomic<bool> const m_cancel{ false };
+		std::unique_ptr<Writer> m_writer;  ///< Created with the first samples
+		bool m_done = false;
+	};
+
+	/// Use dir for the cache files, limited to maxBytes in total
+	PcmCache(fs::path const& dir, std::uintmax_t maxBytes);
+	~PcmCache();
+
+	/// Map the cached samples of file, or nullptr if the track is not cached (yet).
+	/// The format describes how the samples were produced (e.g. the rate), different formats are cached separately.
+	std::unique_ptr<Entry> load(fs::path const& file, std::string const& format);
+	/// Cache file in the background, unless it is already cached, queued or failed before
+	void store(fs::path const& file, std::string const& format, Job job);
+	/// Cache file while it is played, or nullptr if it is cached or being recorded already. Only a recording from the
+	/// start to the end of the track is stored (so not previews, nor songs that are quit or seeked in).
+	std::unique_ptr<Recorder> record(fs::path const& file, std::string const& format);
+	/// Wait until all queued jobs are done (for tests)
+	void flush();
+	/// Remove the least recently used files until the cache fits its size limit
+	void evict();
+
+	/// The cache instance used for playback, or nullptr if caching is disabled
+	static PcmCache* global();
+	/// The global instance, living in mainLoop. Caching is disabled if maxBytes is zero.
+	class Global: public GlobalCache<PcmCache> {
+	  public:
+		explicit Global(std::uintmax_t maxBytes);
+	};
+
+  private:
+	bool write(FileCache::Key const& key, fs::path const& part, std::atomic<bool> const& cancel, Job const& job);
+
+	std::uintmax_t const m_maxBytes;
+	std::mutex m_mutex;
+	std::set<fs::path> m_recording;  ///< The cache files of the Recorders alive
+	FileCache m_files;  ///< Last, as its worker calls evict
+};
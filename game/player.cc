@@ -17,10 +17,6 @@ Player::Player(VocalTrack& vocal, Analyzer& analyzer, size_t frames):
 	m_color = getMicrophoneColor(m_analyzer.getId());
 }
 
-void Player::prepare() {
-	m_analyzer.process();
-}
-
 void Player::update() {
 	if (m_pos == m_pitch.size()) return; // End of song already
 	double beginTime = Engine::TIMESTEP * static_cast<double>(m_pos);
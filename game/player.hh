@@ -44,8 +44,6 @@ struct Player {
 	Notes::const_iterator m_scoreIt;
 	/// constructor
 	Player(VocalTrack& vocal, Analyzer& analyzer, size_t frames);
-	/// prepares analyzer
-	void prepare();
 	/// updates player stats
 	void update();
 	/// calculate how well last lyrics row went
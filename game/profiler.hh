@@ -44,6 +44,7 @@ class Profiler {
 	typedef std::map<std::string, ProfCP> Checkpoints;
 	typedef std::pair<std::string, ProfCP> Pair;
 	Checkpoints m_checkpoints;
+	std::map<std::string, unsigned long> m_counters;
 	std::string m_name;
 	Time m_time;
 	static bool cmpFunc(Pair const& a, Pair const& b) { return a.second.total > b.second.total; }
@@ -57,11 +58,15 @@ class Profiler {
 		auto n = Clock::now();
 		std::swap(n, m_time);
 		double t = Seconds(m_time - n).count();
-		m_checkpoints[tag].add(t);
+		if (!tag.empty()) m_checkpoints[tag].add(t);
 	}
+	/// Record a duration measured otherwise (such as a delay) under the given tag
+	void add(std::string const& tag, double seconds) { m_checkpoints[tag].add(seconds); }
+	/// Count an event (such as a dropped frame)
+	void count(std::string const& tag, unsigned long n = 1) { m_counters[tag] += n; }
 	/// Dump current stats to log and reset
 	void dump() {
-		if (m_checkpoints.empty()) return;
+		if (m_checkpoints.empty() && m_counters.empty()) return;
 		std::vector<Pair> cps(m_checkpoints.begin(), m_checkpoints.end());
 		m_checkpoints.clear();
 		std::sort(cps.begin(), cps.end(), cmpFunc);
@@ -69,6 +74,8 @@ class Profiler {
 		for (std::vector<Pair>::const_iterator it = cps.begin(); it != cps.end(); ++it) {
 			fmt::format_to(std::back_inserter(prof), "{}: ({}). ", it->first, it->second);
 		}
+		for (auto const& counter: m_counters) fmt::format_to(std::back_inserter(prof), "{}: {}. ", counter.first, counter.second);
+		m_counters.clear();
 		
 		SpdLogger::debug(LogSystem::PROFILER, prof);
 	}
@@ -0,0 +1,76 @@
+#include "realtime.hh"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace {
+	thread_local bool realtime = false;
+}
+
+RealtimeScope::RealtimeScope(): m_previous(realtime) { realtime = true; }
+RealtimeScope::~RealtimeScope() { realtime = m_previous; }
+bool RealtimeScope::active() { return realtime; }
+
+#ifndef NDEBUG
+namespace {
+	void checkHeapUse(char const* what) {
+		if (!realtime) return;
+		realtime = false;  // Let the assertion machinery allocate if it needs to
+		// No logger here: it would allocate as well
+		std::fprintf(stderr, "Heap use (%s) in realtime code, e.g. the audio callback.\n", what);
+		assert(!"Heap use in realtime code");
+		realtime = true;
+	}
+
+	void* allocate(std::size_t size) {
+		checkHeapUse("operator new");
+		if (void* ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+		throw std::bad_alloc();
+	}
+
+	void deallocate(void* ptr) {
+		if (ptr) checkHeapUse("operator delete");
+		std::free(ptr);
+	}
+
+	void* allocate(std::size_t size, std::align_val_t alignment) {
+		checkHeapUse("operator new");
+		auto const align = static_cast<std::size_t>(alignment);
+		size = (size == 0 ? align : size + align - 1) / align * align;  // aligned_alloc wants a multiple of the alignment
+#ifdef _WIN32
+		if (void* ptr = _aligned_malloc(size, align)) return ptr;
+#else
+		if (void* ptr = std::aligned_alloc(align, size)) return ptr;
+#endif
+		throw std::bad_alloc();
+	}
+
+	void deallocate(void* ptr, std::align_val_t) {
+		if (ptr) checkHeapUse("operator delete");
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		std::free(ptr);
+#endif
+	}
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void* ptr) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { deallocate(ptr); }
+void* operator new(std::size_t size, std::align_val_t align) { return allocate(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align) { return allocate(size, align); }
+void operator delete(void* ptr, std::align_val_t align) noexcept { deallocate(ptr, align); }
+void operator delete[](void* ptr, std::align_val_t align) noexcept { deallocate(ptr, align); }
+void operator delete(void* ptr, std::size_t, std::align_val_t align) noexcept { deallocate(ptr, align); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t align) noexcept { deallocate(ptr, align); }
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+
+/**
+* Marks the calling thread as running realtime code (such as an audio callback) for the lifetime of the object.
+* In debug builds (NDEBUG not defined) the global operator new and delete are replaced in realtime.cc and any heap
+* use within such a scope, including over-aligned (std::align_val_t) allocations, is reported on stderr and fails an
+* assertion. Release builds only keep the flag.
+**/
+class RealtimeScope {
+  public:
+	RealtimeScope();
+	~RealtimeScope();
+	RealtimeScope(RealtimeScope const&) = delete;
+	RealtimeScope& operator=(RealtimeScope const&) = delete;
+	/// Is the calling thread inside a RealtimeScope?
+	static bool active();
+
+  private:
+	bool m_previous;
+};
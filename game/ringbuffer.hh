@@ -1,69 +1,150 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
 
-/// Lock-free ring buffer. Discards oldest data on overflow (not strictly thread-safe).
+/// Read position of an additional reader of a RingBuffer (see RingBuffer::cursor())
+class RingBufferCursor {
+	template <std::ptrdiff_t SIZE> friend class RingBuffer;
+	std::int64_t m_pos = 0;
+};
+
+/**
+* Lock-free single-producer ring buffer of samples.
+* The writer never waits: on overflow the oldest data is overwritten. Readers notice this by themselves and skip
+* ahead to the oldest data still available, counting what they lost in dropped().
+* Samples are copied as (at most) two contiguous segments. The positions count all samples ever written or
+* consumed, so they never need wrapping, and the capacity must be a power of two.
+* There is one consumer that uses read()/pop() and any number of extra readers with their own RingBufferCursor
+* (e.g. for monitoring the same input) that see the same data without copying it into another buffer.
+* Each reader must only be used from one thread at a time.
+**/
 template <std::ptrdiff_t SIZE> class RingBuffer {
+	static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "RingBuffer capacity must be a power of two");
   public:
 	constexpr static std::ptrdiff_t capacity = SIZE;
 
 	template <typename InIt> void insert(InIt begin, InIt end);
 	/// Read data from current position if there is enough data to fill the range (otherwise return false). Does not move read pointer.
-	template <typename OutIt> bool read(OutIt begin, OutIt end);
-	void pop(std::ptrdiff_t n); ///< Move reading pointer forward.
-	std::ptrdiff_t size() const;
+	template <typename OutIt> bool read(OutIt begin, OutIt end) { return read(m_read, begin, end); }
+	void pop(std::ptrdiff_t n) { pop(m_read, n); }  ///< Move reading pointer forward.
+	std::ptrdiff_t size() const { return size(m_read); }
+	/// The number of samples lost by the consumer of read() because the writer overwrote them
+	std::int64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+	/// Create an additional reader that starts at the current write position
+	RingBufferCursor cursor() const;
+	/// Like read() for the additional reader c
+	template <typename OutIt> bool read(RingBufferCursor& c, OutIt begin, OutIt end) const;
+	/// Like pop() for the additional reader c
+	void pop(RingBufferCursor& c, std::ptrdiff_t n) const { c.m_pos += n; }
+	/// Like size() for the additional reader c
+	std::ptrdiff_t size(RingBufferCursor const& c) const;
 
   private:
-	static std::ptrdiff_t modulo(std::ptrdiff_t idx);  ///< Modulo operation with proper rounding (handles slightly "negative" idx as well)
+	constexpr static std::int64_t MASK = SIZE - 1;
+	template <typename OutIt> bool read(std::atomic<std::int64_t>& pos, OutIt begin, OutIt end);
+	void pop(std::atomic<std::int64_t>& pos, std::ptrdiff_t n) { pos.store(pos.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+	std::ptrdiff_t size(std::atomic<std::int64_t> const& pos) const { return available(pos.load(std::memory_order_acquire)); }
+	std::ptrdiff_t available(std::int64_t pos) const;
+	/// Copy n samples from position pos, or return false if the writer had already overwritten pos (pos is then moved to the oldest sample left)
+	template <typename OutIt> bool copyOut(std::int64_t& pos, OutIt out, std::ptrdiff_t n) const;
 
-	constexpr static std::ptrdiff_t buffersize = SIZE + 1;
-	float m_buf[buffersize];
-	// The indices of the next read/write operations. read == write implies that buffer is empty.
-	std::atomic<std::ptrdiff_t> m_read{ 0 };
-	std::atomic<std::ptrdiff_t> m_write{ 0 };
+	float m_buf[SIZE];
+	std::atomic<std::int64_t> m_write{ 0 };  ///< Samples completely written
+	std::atomic<std::int64_t> m_dirty{ 0 };  ///< Samples written or being written (ahead of m_write during insert)
+	std::atomic<std::int64_t> m_read{ 0 };  ///< Samples consumed by the main reader
+	std::atomic<std::int64_t> m_dropped{ 0 };
 };
 
 template <std::ptrdiff_t SIZE>
 template <typename InIt>
 void RingBuffer<SIZE>::insert(InIt begin, InIt end) {
-	std::ptrdiff_t r = m_read;  // The read position
-	std::ptrdiff_t w = m_write;  // The write position
-	bool overflow = false;
-	while (begin != end) {
-		m_buf[w] = *begin++;  // Copy sample
-		w = modulo(w + 1);  // Update cursor
-		if (w == r)
-			overflow = true;
+	std::int64_t w = m_write.load(std::memory_order_relaxed);
+	std::ptrdiff_t n = std::distance(begin, end);
+	if (n > SIZE) {
+		// Only the most recent samples fit
+		std::advance(begin, n - SIZE);
+		w += n - SIZE;
+		n = SIZE;
 	}
-	m_write = w;
-	if (overflow)
-		m_read = modulo(w + 1);  // Reset read pointer on overflow
+	// Announce the overwrite before touching the data so that readers can tell if their copy got corrupted
+	m_dirty.store(w + n, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	std::ptrdiff_t const idx = static_cast<std::ptrdiff_t>(w & MASK);
+	std::ptrdiff_t const first = std::min(n, SIZE - idx);
+	std::copy_n(begin, first, m_buf + idx);
+	std::advance(begin, first);
+	std::copy_n(begin, n - first, m_buf);
+	m_write.store(w + n, std::memory_order_release);
+}
+
+template <std::ptrdiff_t SIZE>
+template <typename OutIt>
+bool RingBuffer<SIZE>::copyOut(std::int64_t& pos, OutIt out, std::ptrdiff_t n) const {
+	std::ptrdiff_t const idx = static_cast<std::ptrdiff_t>(pos & MASK);
+	std::ptrdiff_t const first = std::min(n, SIZE - idx);
+	out = std::copy_n(m_buf + idx, first, out);
+	std::copy_n(m_buf, n - first, out);
+	// Validate after copying (as with a seqlock): data at pos is overwritten once the writer gets to pos + SIZE
+	std::atomic_thread_fence(std::memory_order_acquire);
+	std::int64_t const dirty = m_dirty.load(std::memory_order_relaxed);
+	if (dirty <= pos + SIZE) return true;
+	pos = dirty - SIZE;
+	return false;
 }
 
 template <std::ptrdiff_t SIZE>
 template <typename OutIt>
-bool RingBuffer<SIZE>::read(OutIt begin, OutIt end) {
-	std::ptrdiff_t requestedELements = end - begin;
-	if (size() < requestedELements) // Not enough audio available
-		return false;
-	std::ptrdiff_t r = m_read;
-	while (begin != end)  // Copy audio to output iterator
-		*begin++ = m_buf[r++ % buffersize];
-	return true;
+bool RingBuffer<SIZE>::read(std::atomic<std::int64_t>& pos, OutIt begin, OutIt end) {
+	std::int64_t p = pos.load(std::memory_order_relaxed);
+	std::int64_t const start = p;
+	std::ptrdiff_t const n = std::distance(begin, end);
+	bool ok = false;
+	// A retry is only needed if the writer got around the buffer during the copy; give up if it keeps doing so
+	for (int attempt = 0; attempt < 3 && !ok; ++attempt) {
+		std::int64_t const w = m_write.load(std::memory_order_acquire);
+		if (w - p > SIZE) p = w - SIZE;  // Overflow: the oldest data is gone
+		if (w - p < n) break;  // Not enough audio available
+		ok = copyOut(p, begin, n);
+	}
+	if (p != start) {
+		m_dropped.fetch_add(p - start, std::memory_order_relaxed);
+		pos.store(p, std::memory_order_release);
+	}
+	return ok;
 }
 
 template <std::ptrdiff_t SIZE>
-void RingBuffer<SIZE>::pop(std::ptrdiff_t n) {
-	m_read = modulo(m_read + n);
+RingBufferCursor RingBuffer<SIZE>::cursor() const {
+	RingBufferCursor c;
+	c.m_pos = m_write.load(std::memory_order_acquire);
+	return c;
+}
+
+template <std::ptrdiff_t SIZE>
+template <typename OutIt>
+bool RingBuffer<SIZE>::read(RingBufferCursor& c, OutIt begin, OutIt end) const {
+	std::ptrdiff_t const n = std::distance(begin, end);
+	for (int attempt = 0; attempt < 3; ++attempt) {
+		std::int64_t const w = m_write.load(std::memory_order_acquire);
+		if (w - c.m_pos > SIZE) c.m_pos = w - SIZE;
+		if (w - c.m_pos < n) return false;
+		if (copyOut(c.m_pos, begin, n)) return true;
+	}
+	return false;
 }
 
 template <std::ptrdiff_t SIZE>
-std::ptrdiff_t RingBuffer<SIZE>::size() const {
-	return modulo(m_write - m_read);
+std::ptrdiff_t RingBuffer<SIZE>::size(RingBufferCursor const& c) const {
+	return available(c.m_pos);
 }
 
 template <std::ptrdiff_t SIZE>
-std::ptrdiff_t RingBuffer<SIZE>::modulo(std::ptrdiff_t idx) {
-	return (buffersize + idx) % buffersize;
+std::ptrdiff_t RingBuffer<SIZE>::available(std::int64_t pos) const {
+	std::int64_t const n = m_write.load(std::memory_order_acquire) - pos;
+	return static_cast<std::ptrdiff_t>(std::clamp<std::int64_t>(n, 0, SIZE));
 }
@@ -11,7 +11,9 @@
 #include "game.hh"
 #include "graphic/color_trans.hh"
 
+#include <algorithm>
 #include <map>
+#include <variant>
 
 namespace {
 	static const float yoff = 0.18f; // Offset from center where to place top row
@@ -144,9 +146,48 @@ void ScreenAudioDevices::manageEvent(SDL_Event event) {
 			config["audio/devices"].reset(modifier & KMOD_ALT);
 			save(true); // Save to disk, reload audio & reload UI to keep stuff consistent
 		}
+		else if (key == SDL_SCANCODE_L && modifier & Platform::shortcutModifier()) measureLatency();
 	}
 }
 
+void ScreenAudioDevices::measureLatency() {
+	if (m_latencyProbeStarted) return;
+	auto const& analyzers = m_audio.analyzers();
+	if (analyzers.empty() || !m_audio.startLatencyProbe(analyzers.front().getId())) {
+		getGame().flashMessage(_("Latency measurement needs an open microphone and playback device."));
+		return;
+	}
+	m_latencyProbeStarted = Clock::now();
+	getGame().flashMessage(_("Measuring latency, hold the microphone near the speakers..."));
+}
+
+void ScreenAudioDevices::prepare() {
+	if (!m_latencyProbeStarted) return;
+	if (!m_audio.latencyProbeDone()) {
+		if (Clock::now() - *m_latencyProbeStarted < 5s) return;
+		m_latencyProbeStarted.reset();
+		m_audio.cancelLatencyProbe();  // The devices stopped running, allow trying again
+		getGame().flashMessage(_("Latency measurement failed, the audio devices are not running."));
+		return;
+	}
+	m_latencyProbeStarted.reset();
+	auto const result = m_audio.latencyProbeResult();
+	if (!result) {
+		getGame().flashMessage(_("Latency measurement failed, the test sound was not heard."));
+		return;
+	}
+	auto& roundTrip = config["audio/round-trip"];
+	auto const measured = static_cast<float>(result->roundTrip.count());
+	auto const max = std::get<float>(roundTrip.m_max);
+	if (measured > max) {
+		getGame().flashMessage(fmt::format(_("Latency measurement failed, {:.0f} ms is more than the maximum of {:.0f} ms."), 1e3f * measured, 1e3f * max));
+		return;
+	}
+	roundTrip.f() = std::max(measured, 0.0f);
+	writeConfig(getGame(), false);
+	getGame().flashMessage(fmt::format(_("Round-trip latency: {:.0f} ms"), 1e3f * roundTrip.f()));
+}
+
 void ScreenAudioDevices::draw() {
 	auto& window = getGame().getWindow();
 
@@ -196,7 +237,7 @@ void ScreenAudioDevices::draw() {
 	m_theme->comment_bg.dimensions.stretch(1.0f, 0.025f).middle().screenBottom(-0.054f);
 	m_theme->comment_bg.draw(window);
 	m_theme->comment.dimensions.left(-0.48f).screenBottom(-0.067f);
-	m_theme->comment.draw(window, _("Use arrow keys to configure. Hit Enter/Start to save and test or Esc/Select to cancel. Ctrl + R to reset defaults"));
+	m_theme->comment.draw(window, _("Use arrow keys to configure. Hit Enter/Start to save and test or Esc/Select to cancel. Ctrl + R to reset defaults, Ctrl + L to measure latency"));
 	// Additional info
 	m_theme->comment_bg.dimensions.middle().screenBottom(-0.01f);
 	m_theme->comment_bg.draw(window);
@@ -250,7 +291,7 @@ bool ScreenAudioDevices::save(bool skip_ui_config) {
 	}
 	writeConfig(getGame(), false); // Save the new config
 	m_audio.restart(); // Reload audio to take the new settings into use
-	m_audio.playMusic(getGame(), findFile("menu.ogg"), true); // Start music again
+	m_audio.playMusic(findFile("menu.ogg"), true); // Start music again
 	// Check that all went well
 	bool ret = verify();
 	if (!ret)
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "chrono.hh"
 #include "screen.hh"
 #include "graphic/glutil.hh"
 #include "libda/portaudio.hpp"
@@ -18,6 +19,7 @@ class ScreenAudioDevices: public Screen {
 	void exit();
 	void manageEvent(SDL_Event event);
 	void manageEvent(input::NavEvent const& event);
+	void prepare();
 	void draw();
 
   private:
@@ -30,6 +32,7 @@ class ScreenAudioDevices: public Screen {
 	bool save(bool skip_ui_config = false); ///< Save the config to disk xml and then reload
 	bool verify(); ///< Check that all were opened after audio reset
 	void assignChannels();
+	void measureLatency(); ///< Start measuring the round-trip latency with the first mic
 
 	Audio& m_audio;
 	std::unique_ptr<ThemeAudioDevices> m_theme;
@@ -39,5 +42,6 @@ class ScreenAudioDevices: public Screen {
 	std::unique_ptr<Texture> m_selector;
 	std::unique_ptr<Texture> m_mic_icon;
 	std::unique_ptr<Texture> m_pdev_icon;
+	std::optional<Time> m_latencyProbeStarted; ///< Set while measuring the latency
 };
 
@@ -19,7 +19,7 @@ ScreenIntro::ScreenIntro(Game &game, std::string const& name, Audio& audio): Scr
 void ScreenIntro::enter() {
 	getGame().showLogo();
 
-	m_audio.playMusic(getGame(), findFile("menu.ogg"), true);
+	m_audio.playMusic(findFile("menu.ogg"), true);
 	m_selAnim = AnimValue(0.0, 10.0);
 	m_submenuAnim = AnimValue(0.0, 3.0);
 	populateMenu();
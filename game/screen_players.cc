@@ -33,7 +33,7 @@ void ScreenPlayers::enter() {
 	m_emptyCover = std::make_unique<Texture>(findFile("no_player_image.svg"));
 	m_search.text.clear();
 	m_players.setFilter(m_search.text);
-	m_audio.fadeout(getGame());
+	m_audio.fadeout();
 	m_quitTimer.setValue(config["game/highscore_timeout"].ui());
 	if (m_database.scores.empty() || !m_database.reachedHiscore(m_song)) {
 		getGame().activateScreen("Playlist");
@@ -207,9 +207,9 @@ void ScreenPlayers::draw() {
 	if (music != m_playing && m_playTimer.get() > 0.4) {
 		m_songbg.reset(); m_video.reset();
 		if (music.empty())
-			m_audio.fadeout(getGame(), 1.0f);
+			m_audio.fadeout(1.0f);
 		else
-			m_audio.playMusic(getGame(), music, true, 2.0);
+			m_audio.playMusic(music, true, 2.0);
 		if (!songbg.empty()) try { m_songbg = std::make_unique<Texture>(songbg); } catch (std::exception const&) {}
 		if (!video.empty() && config["graphic/video"].b()) m_video = std::make_unique<Video>(video, videoGap);
 		m_playing = music;
@@ -14,7 +14,7 @@ ScreenPractice::ScreenPractice(Game &game, std::string const& name, Audio& audio
 {}
 
 void ScreenPractice::enter() {
-	m_audio.playMusic(getGame(), findFile("practice.ogg"));
+	m_audio.playMusic(findFile("practice.ogg"));
 	// draw vu meters
 	for (size_t i = 0, mics = m_audio.analyzers().size(); i < mics; ++i) {
 		auto progressBarPtr = std::unique_ptr<ProgressBar>(std::make_unique<ProgressBar>(findFile("vumeter_bg.svg"), findFile("vumeter_fg.svg"), ProgressBar::Mode::VERTICAL, 0.136, 0.023));
@@ -92,7 +92,7 @@ void ScreenPractice::draw_analyzers() {
 		if (freq != 0.0) {
 			Analyzer::tones_t tones = analyzer.getTones();
 
-			for (Analyzer::tones_t::const_iterator t = tones.begin(); t != tones.end(); ++t) {
+			for (auto t = tones.begin(); t != tones.end(); ++t) {
 				if (t->age < Tone::MINAGE) continue;
 				if (!scale.setFreq(t->freq).isValid()) continue;
 				double line = scale.getNoteLine() + 0.4 * scale.getNoteOffset();
@@ -72,7 +72,7 @@ void ScreenSing::enter() {
 	// Startup delay for instruments is longer than for singing only
 	double setup_delay = (!m_song->hasControllers() ? -1.0 : -5.0);
 	m_audio.pause();
-	m_audio.playMusic(getGame(), m_song->music, false, 0.0, setup_delay);
+	m_audio.playMusic(m_song->music, false, 0.0, setup_delay);
 	getGame().loading(_("Loading menu..."), 0.7f);
 	{
 		m_duet = ConfigItem(static_cast<unsigned short>(0));
@@ -205,7 +205,7 @@ void ScreenSing::exit() {
 	m_song->dropNotes();
 	m_menuTheme.reset();
 	theme.reset();
-	m_audio.fadeout(getGame(), 0);
+	m_audio.fadeout(0);
 	if (m_audio.isPaused()) m_audio.togglePause();
 	getGame().showLogo();
 }
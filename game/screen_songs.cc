@@ -14,8 +14,7 @@
 #include "playlist.hh"
 #include "graphic/video_driver.hh"
 
-#include "aubio/aubio.h"
-
+#include <cmath>
 #include <iostream>
 #include <iomanip>
 #include <mutex>
@@ -35,7 +34,7 @@ ScreenSongs::ScreenSongs(Game &game, std::string const& name, Audio& audio, Song
 void ScreenSongs::enter() {
 	m_menu.close();
 	m_songs.setFilter(m_search.text);
-	m_audio.fadeout(getGame());
+	m_audio.fadeout();
 	m_menuPos = 1;
 	m_infoPos = 0;
 	m_jukebox = false;
@@ -67,6 +66,8 @@ void ScreenSongs::exit() {
 	m_video.reset();
 	m_songbg.reset();
 	m_songbg_default.reset();
+	m_beatDetector.reset();
+	m_beatSong.reset();
 	m_songbg_ground.reset();
 	m_playing.clear();
 }
@@ -176,8 +177,18 @@ void ScreenSongs::manageEvent(SDL_Event event) {
 	if (m_songs.empty()) m_jukebox = false;
 }
 
+void ScreenSongs::updateBeats() {
+	if (!m_beatDetector) return;
+	auto const beats = m_beatDetector->beats();
+	if (!beats) return;  // Still detecting
+	if (!beats->empty()) m_songs.setDetectedBeats(*m_beatSong, *beats);
+	m_beatDetector.reset();
+	m_beatSong.reset();
+}
+
 void ScreenSongs::update() {
 	getGame().showLogo(!m_jukebox);
+	updateBeats();
 	if (m_idleTimer.get() < 0.3) return;  // Only update when the user gives us a break
 	m_songs.update(); // Poll for new songs
 	bool songChange = false;  // Do we need to switch songs?
@@ -200,17 +211,22 @@ void ScreenSongs::update() {
 	if (m_playing != music) songChange = true;
 	// Switch songs if needed, only when the user is not browsing for a moment
 	if (!songChange) return;
-	ScreenSongs::previewBeatsBuffer.reset(new_fvec(1));
-	{
-	std::lock_guard<std::recursive_mutex> l(Audio::aubio_mutex);
-	Audio::aubioTempo.reset(new_aubio_tempo("default", Audio::aubio_win_size, Audio::aubio_hop_size, static_cast<uint_t>(Audio::getSR())));
-	}
 	if (song && song->hasControllers()) { song->loadNotes(); } // Needed for BPM info.
 	m_playing = music;
 	// Clear the old content and load new content if available
 	m_songbg.reset(); m_video.reset();
 	double pstart = (!m_jukebox && song ? song->getPreviewStart() : 0.0);
-	m_audio.playMusic(getGame(), music, true, 1.0, pstart);
+	// Songs with notes for instruments or dance have beats, find them for the rest (once, they are cached)
+	m_beatDetector.reset();
+	m_beatSong.reset();
+	Audio::Listeners listeners;
+	auto const bgmusic = music.find(TrackName::BGMUSIC);
+	if (song && !song->hasControllers() && song->beats.empty() && bgmusic != music.end() && !bgmusic->second.empty()) {
+		m_beatDetector = std::make_unique<BeatDetector>(bgmusic->second, std::isnan(pstart) ? 0.0 : pstart, m_audio.getSR());
+		m_beatSong = song;
+		listeners[TrackName::BGMUSIC] = m_beatDetector->listener();  // Analysed as decoded for the preview
+	}
+	m_audio.playMusic(music, true, 1.0, pstart, listeners);
 	if (song) {
 		fs::path const& background = song->background.empty() ? song->cover : song->background;
 		if (!background.empty()) try { m_songbg = std::make_unique<Texture>(background); } catch (std::exception const&) {}
@@ -604,8 +620,6 @@ void ScreenSongs::drawMenu() {
 	m_menu.dimensions.stretch(w, h);
 }
 
-std::unique_ptr<fvec_t, void(*)(fvec_t*)> ScreenSongs::previewBeatsBuffer = std::unique_ptr<fvec_t, void(*)(fvec_t*)>(new_fvec(1), [](fvec_t* p){del_fvec(p);});
-
 void ScreenSongs::createPlaylistMenu() {
 	m_menu.clear();
 	m_menu.add(MenuOption(_("Play"), "")).call([this]() {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "animvalue.hh"
+#include "beatdetector.hh"
 #include "controllers.hh"
 #include "screen.hh"
 #include "theme.hh"
@@ -10,7 +11,6 @@
 #include "video.hh"
 #include "playlist.hh"
 #include "menu.hh"
-#include "aubio/aubio.h"
 #include <unordered_map>
 
 class Audio;
@@ -39,12 +39,12 @@ public:
 	void drawCovers(); ///< draw the cover browser
 	Texture& getCover(Song const& song); ///< get appropriate cover image for the song (incl. no cover)
 	void drawJukebox(); ///< draw the songbrowser in jukebox mode (fullscreen, full previews, ...)
-	static std::unique_ptr<fvec_t, void(*)(fvec_t*)> previewBeatsBuffer;
 private:
 	void manageSharedKey(input::NavEvent const& event); ///< same behaviour for jukebox and normal mode
 	void drawInstruments(Dimensions dim) const;
 	void drawMultimedia();
 	void update();
+	void updateBeats();
 	void drawMenu();
 	bool addSong(); ///< Add current song to playlist. Returns true if the playlist was empty.
 	void sing(); ///< Enter singing screen with current playlist.
@@ -59,6 +59,8 @@ private:
 	std::unique_ptr<Video> m_video;
 	std::unique_ptr<ThemeSongs> theme;
 	Song::MusicFiles m_playing;
+	std::unique_ptr<BeatDetector> m_beatDetector;  ///< Beats of the song previewed, for songs without notes that have them
+	std::shared_ptr<Song> m_beatSong;  ///< The song that m_beatDetector analyses
 	AnimValue m_clock;
 	AnimValue m_idleTimer;
 	TextInput m_search;
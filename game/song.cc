@@ -91,6 +91,9 @@ Song::Song(nlohmann::json const& song) : dummyVocal(TrackName::VOCAL_LEAD), rand
 	if (song.contains("bpm")) {
 		m_bpms.push_back(BPM(0, 0, song.at("bpm").get<float>()));
 	}
+	if (song.contains("detectedBeats")) {
+		beats = song.at("detectedBeats").get<Beats>();
+	}
 	collateUpdate();
 }
 
@@ -63,6 +63,7 @@ Songs::Songs(Database & database, std::string const& songlist)
 Songs::~Songs() {
 	m_loading = false; // Terminate song loading if currently in progress
 	m_thread->join();
+	if (m_beatsChanged && doneLoading) CacheSonglist();
 }
 
 void Songs::reload() {
@@ -137,6 +138,12 @@ Songs::Cache Songs::loadCache() {
 	return cache;
 }
 
+void Songs::setDetectedBeats(Song& song, Song::Beats beats) {
+	std::unique_lock<std::shared_mutex> l(m_mutex);  // CacheSonglist may be reading the beats
+	song.beats = std::move(beats);
+	m_beatsChanged = true;
+}
+
 void Songs::CacheSonglist() {
 	auto jsonRoot = nlohmann::json::array();
 	std::shared_lock<std::shared_mutex> l(m_mutex);
@@ -254,6 +261,9 @@ void Songs::CacheSonglist() {
 		if (!song->m_bpms.empty()) {
 			songObject["bpm"] = 15 / song->m_bpms.front().step;
 		}
+		if (!song->hasControllers() && !song->beats.empty()) {
+			songObject["detectedBeats"] = song->beats;  // Detection is slow, keep the result
+		}
 
 		// Cache songtype also.
 		if(song->hasVocals()) {
@@ -81,6 +81,8 @@ class Songs {
 	std::atomic<bool> displayedAlert{ false };
 	size_t loadedSongs() const { std::shared_lock<std::shared_mutex> l(m_mutex); return m_songs.size(); }
 	void addSongOrder(SongOrderPtr);
+	/// Set beats detected from the music of a song that has none from its notes (kept in the song cache)
+	void setDetectedBeats(Song& song, Song::Beats beats);
 
   private:
 	Cache loadCache();
@@ -107,6 +109,7 @@ class Songs {
 	Cycle<unsigned short> m_order;  // Set by constructor
 	std::atomic<bool> m_dirty{ false };
 	std::atomic<bool> m_loading{ false };
+	std::atomic<bool> m_beatsChanged{ false };  ///< The song cache needs to be written again
 	std::unique_ptr<std::thread> m_thread;
 	mutable std::shared_mutex m_mutex;
 	std::vector<SongOrderPtr> m_songOrders;
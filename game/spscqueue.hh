@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+/**
+* Wait-free queue of fixed capacity for passing messages from one producer thread to one consumer thread
+* (e.g. commands to the audio callback). Neither side ever blocks or allocates: push() fails when the queue is
+* full. The consumer may look at the oldest item with front() before deciding to pop() it.
+**/
+template <typename T, std::size_t SIZE> class SpscQueue {
+	static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "SpscQueue capacity must be a power of two");
+	static_assert(std::is_trivially_copyable<T>::value, "SpscQueue items are copied around without destruction");
+  public:
+	constexpr static std::size_t capacity = SIZE;
+
+	/// Add an item at the end of the queue (producer only). Returns false if the queue is full.
+	bool push(T const& item) {
+		std::size_t const w = m_write.load(std::memory_order_relaxed);
+		if (w - m_read.load(std::memory_order_acquire) == SIZE) return false;
+		m_items[w & MASK] = item;
+		m_write.store(w + 1, std::memory_order_release);
+		return true;
+	}
+	/// The oldest item, or nullptr if the queue is empty (consumer only). Valid until pop().
+	T const* front() const {
+		std::size_t const r = m_read.load(std::memory_order_relaxed);
+		if (r == m_write.load(std::memory_order_acquire)) return nullptr;
+		return &m_items[r & MASK];
+	}
+	/// Remove the oldest item (consumer only, the queue must not be empty)
+	void pop() { m_read.store(m_read.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+	/// The number of items queued (exact only when called from either end while the other is idle)
+	std::size_t size() const { return m_write.load(std::memory_order_acquire) - m_read.load(std::memory_order_acquire); }
+	bool empty() const { return size() == 0; }
+
+  private:
+	constexpr static std::size_t MASK = SIZE - 1;
+	T m_items[SIZE];
+	std::atomic<std::size_t> m_write{ 0 };  ///< Items pushed
+	std::atomic<std::size_t> m_read{ 0 };  ///< Items popped
+};
@@ -0,0 +1,28 @@
+#include "synth.hh"
+
+#include "musicalscale.hh"
+#include "util.hh"
+
+#include <cmath>
+
+void Synth::operator()(float* begin, float* end, double position) {
+	for (float *i = begin; i < end; ++i) *i *= 0.3f; // Decrease music volume
+	std::int64_t size = end - begin;
+	if (end <= begin) return;
+	Notes::const_iterator it = m_notes.begin();
+
+	while (it != m_notes.end() && it->end < position) ++it;
+	if (it == m_notes.end() || it->type == Note::Type::SLEEP || it->begin > position) { m_phase = 0.0; return; }
+	float note = std::fmod(it->note, 12.0f);
+	double d = (note + 1.0) / 13.0;
+	double freq = MusicalScale().setNote(note + 4.0 * 12.0).getFreq();
+	double value = 0.0;
+	// Synthesize tones
+	for (std::int64_t i = 0; i != size; ++i) {
+		if (i % 2 == 0) {
+			value = d * 0.2 * std::sin(m_phase) + 0.2 * std::sin(2 * m_phase) + (1.0 - d) * 0.2 * std::sin(4 * m_phase);
+			m_phase += TAU * freq / srate;
+		}
+		begin[i] += static_cast<float>(value);
+	}
+}
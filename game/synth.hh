@@ -0,0 +1,18 @@
+#pragma once
+
+#include "notes.hh"
+
+#include <cstdint>
+
+/// Plays the notes of a vocal track as simple tones over the music (for checking note timing), at the output rate
+class Synth {
+  public:
+	Synth(Notes const& notes, unsigned int sr) : m_notes(notes), srate(sr) {}
+	/// Mix into interleaved stereo output, position being the song time (in seconds) at begin
+	void operator()(float* begin, float* end, double position);
+
+  private:
+	Notes m_notes;
+	double srate; ///< Sample rate
+	double m_phase = 0.0;
+};
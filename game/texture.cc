@@ -2,6 +2,7 @@
 
 #include "configuration.hh"
 #include "game.hh"
+#include "graphic/upload_ring.hh"
 #include "graphic/video_driver.hh"
 #include "log.hh"
 #include "screen.hh"
@@ -212,7 +213,8 @@ void Texture::load(Bitmap const& bitmap, bool isText) {
 	// Load the data into texture
 	PixFmt const& f = getPixFmt(bitmap.fmt);
 	glPixelStorei(GL_UNPACK_SWAP_BYTES, f.swap);
-	glTexImage2D(type(), 0, internalFormat(bitmap.linearPremul), bitmap.width, bitmap.height, 0, f.format, f.type, bitmap.data());
+	UploadTransfer transfer(bitmap);
+	glTexImage2D(type(), 0, internalFormat(bitmap.linearPremul), bitmap.width, bitmap.height, 0, f.format, f.type, transfer.source(bitmap.data()));
 	if (!isText) glGenerateMipmap(type());
 }
 
@@ -231,3 +233,67 @@ void Texture::draw(Window& window, glmath::mat3 const& matrix) const {
 	glBlendFunc(m_premultiplied ? GL_ONE : GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	draw(window, dimensions, TexCoords(tex.x1, tex.y1, tex.x2, tex.y2), matrix);
 }
+
+void YuvTexture::load(Bitmap const& bitmap) {
+	if (bitmap.fmt != pix::Format::YUV420P) throw std::logic_error("YuvTexture::load: not a YUV420P bitmap");
+	glutil::GLErrorChecker glerror("YuvTexture::load");
+	bool const resize = bitmap.width != m_width || bitmap.height != m_height;
+	if (resize) {
+		m_width = bitmap.width;
+		m_height = bitmap.height;
+		dimensions = Dimensions(bitmap.ar).fixedWidth(1.0f);
+	}
+	m_encoding = bitmap.yuvEncoding;
+	yuv::Planes420 const planes{ bitmap.width, bitmap.height };
+	glActiveTexture(GL_TEXTURE0);
+	glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // Rows of odd widths are not padded
+	UploadTransfer transfer(bitmap);
+	for (unsigned i = 0; i < m_planes.size(); ++i) {
+		auto const w = static_cast<GLsizei>(planes.planeWidth(i));
+		auto const h = static_cast<GLsizei>(planes.planeHeight(i));
+		void const* data = transfer.source(bitmap.data() + planes.offset(i));
+		glBindTexture(GL_TEXTURE_2D, m_planes[i].id());
+		if (resize) {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, data);
+		} else {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RED, GL_UNSIGNED_BYTE, data);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glerror.check("upload");
+}
+
+void YuvTexture::draw(Window& window) const {
+	if (empty()) return;
+	glutil::GLErrorChecker glerror("YuvTexture::draw");
+	for (unsigned i = 0; i < m_planes.size(); ++i) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, m_planes[i].id());
+	}
+	glActiveTexture(GL_TEXTURE0);
+	UseShader shader(getShader(window, "video"));
+	shader()["texY"].set(0);
+	shader()["texU"].set(1);
+	shader()["texV"].set(2);
+	// The affine conversion as a matrix for homogeneous (y, u, v, 1), column by column
+	auto const c = yuv::toRgb(m_encoding);
+	shader()["yuvToRgb"].setMat4(glmath::mat4(
+	  c[0][0], c[1][0], c[2][0], 0.0f,
+	  c[0][1], c[1][1], c[2][1], 0.0f,
+	  c[0][2], c[1][2], c[2][2], 0.0f,
+	  c[0][3], c[1][3], c[2][3], 1.0f));
+	glerror.check("uniforms");
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glutil::VertexArray va;
+	va.texCoord(0.0f, 0.0f).vertex(dimensions.x1(), dimensions.y1());
+	va.texCoord(1.0f, 0.0f).vertex(dimensions.x2(), dimensions.y1());
+	va.texCoord(0.0f, 1.0f).vertex(dimensions.x1(), dimensions.y2());
+	va.texCoord(1.0f, 1.0f).vertex(dimensions.x2(), dimensions.y2());
+	va.draw();
+}
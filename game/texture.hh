@@ -7,6 +7,7 @@
 #include <cairo.h>
 
 #include <algorithm>
+#include <array>
 #include <memory>
 #include <stdexcept>
 #include <string>
@@ -238,6 +239,26 @@ private:
 	OpenGLTexture<GL_TEXTURE_2D> m_texture;
 };
 
+/**
+* @short Video frame in textures: the planes of pix::Format::YUV420P bitmaps, converted to RGB by the "video" shader.
+* Frames of the same size are uploaded into the same textures, and there are no mipmaps to update.
+**/
+class YuvTexture {
+  public:
+	/// dimensions
+	Dimensions dimensions;
+	bool empty() const { return m_width * m_height == 0; }
+	/// loads a YUV420P frame
+	void load(Bitmap const& bitmap);
+	/// draws the latest frame
+	void draw(Window&) const;
+  private:
+	std::array<OpenGLTexture<GL_TEXTURE_2D>, 3> m_planes;  ///< Y, U and V
+	unsigned m_width = 0;
+	unsigned m_height = 0;
+	yuv::Encoding m_encoding;
+};
+
 /// A RAII wrapper for texture loading worker thread. There must be exactly one (global) instance whenever any Textures exist.
 class TextureLoader {
 public:
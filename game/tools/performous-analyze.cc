@@ -0,0 +1,360 @@
+// Offline analysis and scoring of recorded vocal takes against a song, without audio hardware.
+// The takes are pushed through Analyzer and Player exactly as the engine thread does during a song,
+// only as fast as the CPU allows, so the tool also serves as a reproducible benchmark of the engine.
+
+#include "analyzer.hh"
+#include "audioring.hh"
+#include "configuration.hh"
+#include "engine.hh"
+#include "ffmpeg.hh"
+#include "fs.hh"
+#include "log.hh"
+#include "musicalscale.hh"
+#include "pcmcache.hh"
+#include "platform.hh"
+#include "player.hh"
+#include "song.hh"
+#include "unicode.hh"
+
+#include <boost/program_options.hpp>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+	constexpr unsigned CHANNELS = 2;  ///< AudioFFmpeg always produces interleaved stereo
+	constexpr unsigned firstSampleRuns = 10;
+	constexpr unsigned decodeRuns = 3;
+
+	/// Accumulated wall clock time of one processing stage
+	struct StageTimer {
+		std::string name;
+		Clock::duration total{};
+		template <typename F> void operator()(F&& f) {
+			auto const begin = Clock::now();
+			f();
+			total += Clock::now() - begin;
+		}
+		double seconds() const { return std::chrono::duration<double>(total).count(); }
+	};
+
+	/// One recorded take and the state used for analyzing it
+	struct Take {
+		fs::path file;
+		std::vector<float> pcm;  ///< Mono samples at the analysis rate
+		std::int64_t skip = 0;  ///< Samples to skip at the start (negative to prepend silence)
+		std::unique_ptr<Analyzer> analyzer;
+		/// Feed the take's samples [begin, end) (relative to the song) to the analyzer, with silence outside of the recording
+		void feed(std::int64_t begin, std::int64_t end, std::vector<float> const& silence) {
+			auto const size = static_cast<std::int64_t>(pcm.size());
+			for (std::int64_t pos = begin + skip; pos < end + skip; ) {
+				std::int64_t n = end + skip - pos;
+				if (pos >= 0 && pos < size) {
+					n = std::min(n, size - pos);
+					analyzer->input(pcm.begin() + pos, pcm.begin() + pos + n);
+				} else {
+					if (pos < 0) n = std::min(n, -pos);
+					n = std::min(n, static_cast<std::int64_t>(silence.size()));
+					analyzer->input(silence.begin(), silence.begin() + n);
+				}
+				pos += n;
+			}
+		}
+	};
+
+	/// Decode an audio file into mono float samples at the given rate
+	std::vector<float> decode(fs::path const& file, int rate) {
+		std::vector<float> pcm;
+		AudioFFmpeg decoder(file, rate, [&pcm](std::int16_t const* data, std::int64_t count, std::int64_t) {
+			for (std::int64_t i = 0; i + CHANNELS <= count; i += CHANNELS) {
+				float sum = 0.0f;
+				for (unsigned ch = 0; ch < CHANNELS; ++ch) sum += data[i + ch];
+				pcm.push_back(sum / (32768.0f * CHANNELS));
+			}
+		});
+		try {
+			while (true) decoder.handleOneFrame();
+		} catch (FFmpeg::Eof const&) {}
+		return pcm;
+	}
+
+	/// Milliseconds from opening a music file to its first sample at time, decoded with FFmpeg and mapped from a PcmCache
+	struct FirstSample {
+		double decoded = 0.0;
+		double cached = 0.0;
+	};
+
+	/// A directory removed with its contents when done
+	struct TempDir {
+		fs::path path;
+		~TempDir() {
+			std::error_code ec;
+			fs::remove_all(path, ec);
+		}
+	};
+
+	FirstSample measureFirstSample(fs::path const& file, unsigned rate, double time, unsigned runs) {
+		auto const ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+		auto const pos = static_cast<std::int64_t>(time * rate) * CHANNELS;
+		FirstSample result;
+		// Like AudioBuffer without the cache: open the file, seek and decode until a frame is output
+		for (unsigned run = 0; run < runs; ++run) {
+			auto const begin = Clock::now();
+			bool done = false;
+			AudioFFmpeg decoder(file, static_cast<int>(rate), [&done](std::int16_t const*, std::int64_t, std::int64_t) { done = true; });
+			decoder.seek(time);
+			try {
+				while (!done) decoder.handleOneFrame();
+			} catch (FFmpeg::Eof const&) {}
+			result.decoded += ms(Clock::now() - begin) / runs;
+		}
+		// Like AudioBuffer with the cache: map the file and read the first block, here from a cache of our own
+		TempDir const dir{ fs::temp_directory_path() / ("performous-analyze-" + std::to_string(std::random_device()())) };
+		PcmCache cache(dir.path, std::numeric_limits<std::uintmax_t>::max());
+		std::string const format = AudioBuffer::cacheFormat(rate);
+		cache.store(file, format, AudioBuffer::cacheJob(file, rate));
+		cache.flush();
+		std::vector<float> block(4096);
+		for (unsigned run = 0; run < runs; ++run) {
+			auto const begin = Clock::now();
+			auto const entry = cache.load(file, format);
+			if (!entry) throw std::runtime_error("Could not cache " + file.string());
+			auto const first = std::clamp<std::int64_t>(pos, 0, entry->size());
+			auto const count = std::min<std::int64_t>(entry->size() - first, static_cast<std::int64_t>(block.size()));
+			for (std::int64_t i = 0; i < count; ++i) block[static_cast<std::size_t>(i)] = entry->data()[first + i] / 32767.0f;
+			result.cached += ms(Clock::now() - begin) / runs;
+		}
+		return result;
+	}
+
+	/// Decode all of file into an AudioRing that is drained in blocks, as AudioBuffer and the audio callback do, and
+	/// return the seconds of audio. With direct, frames are resampled straight into the ring, otherwise they are
+	/// written to it from the decoder's callback.
+	double decodeIntoRing(fs::path const& file, unsigned rate, bool direct) {
+		AudioRing ring(4320256);
+		auto const write = [&ring](std::int16_t const* data, std::int64_t count, std::int64_t pos) { ring.write(data, count, pos); };
+		AudioFFmpeg decoder(file, static_cast<int>(rate), write, direct ? &ring : nullptr);
+		std::vector<float> block(4096);
+		std::int64_t pos = 0;
+		auto const drain = [&] {
+			auto const count = std::min<std::int64_t>(ring.writePos() - pos, static_cast<std::int64_t>(block.size()));
+			ring.read(block.data(), count, pos, 1.0f);
+			pos += count;
+		};
+		try {
+			while (true) {
+				if (ring.wantMore()) decoder.handleOneFrame();
+				else drain();
+			}
+		} catch (FFmpeg::Eof const&) {}
+		while (pos < ring.writePos()) drain();
+		return static_cast<double>(pos) / (rate * CHANNELS);
+	}
+
+	/// Decoding speed of a music file in times realtime, straight into the ring and through the callback
+	struct DecodeThroughput {
+		double ring = 0.0;
+		double callback = 0.0;
+	};
+
+	DecodeThroughput measureDecodeThroughput(fs::path const& file, unsigned rate, unsigned runs) {
+		DecodeThroughput result;
+		for (bool direct: { true, false }) {
+			double audio = 0.0;
+			auto const begin = Clock::now();
+			for (unsigned run = 0; run < runs; ++run) audio += decodeIntoRing(file, rate, direct);
+			double const seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+			(direct ? result.ring : result.callback) = audio / std::max(seconds, 1e-9);
+		}
+		return result;
+	}
+
+	std::string noteStr(double note) {
+		if (note != note) return "-";
+		return MusicalScale().setNote(note).getStr();
+	}
+
+	/// Print the score and timing of each note, recomputed from the pitch the player recorded
+	void printNotes(Player const& player) {
+		VocalTrack const& vocal = player.m_vocal;
+		std::cout << fmt::format("  {:>9} {:>7} {:<12} {:>6} {:>6} {:>7} {:>8}\n", "begin", "length", "syllable", "target", "sung", "score", "onset");
+		for (Note const& n: vocal.notes) {
+			if (n.type == Note::Type::SLEEP) continue;
+			double score = 0.0, noteSum = 0.0, onset = getNaN();
+			unsigned voiced = 0;
+			auto first = static_cast<std::size_t>(std::max(0.0, n.begin / Engine::TIMESTEP));
+			for (std::size_t i = first; i < player.m_pos; ++i) {
+				double const b = Engine::TIMESTEP * static_cast<double>(i);
+				double const e = b + Engine::TIMESTEP;
+				if (b >= n.end) break;
+				double const freq = player.m_pitch[i].first;
+				if (freq != freq) continue;
+				double const note = MusicalScale(vocal.scale).setFreq(freq).getNote();
+				score += n.score(note, b, e);
+				noteSum += n.note + n.diff(note);
+				++voiced;
+				if (onset != onset && n.powerFactor(note) > 0.0f) onset = std::max(0.0, b - n.begin);
+			}
+			double const maxScore = n.maxScore();
+			std::cout << fmt::format("  {:9.3f} {:7.3f} {:<12} {:>6} {:>6} {:6.1f}% {:>8}\n",
+			  n.begin, n.end - n.begin, n.syllable.substr(0, 12), noteStr(n.note), noteStr(voiced ? noteSum / voiced : getNaN()),
+			  maxScore > 0.0 ? 100.0 * score / maxScore : 0.0, onset == onset ? fmt::format("{:.0f} ms", 1000.0 * onset) : "miss");
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	Platform platform;
+	namespace po = boost::program_options;
+	std::string songFile;
+	std::vector<std::string> takeFiles;
+	std::vector<std::string> tracks;
+	std::vector<std::string> pitch;
+	std::vector<double> offsets;
+	std::string preset = "balanced";
+	std::string logLevel = "error";
+	double rate = 48000.0;
+	po::options_description opts("Options", 160, 80);
+	opts.add_options()
+	  ("help,h", "Print this message.")
+	  ("song,s", po::value<std::string>(&songFile)->value_name("<file>"), "Song file (txt, ini, xml, sm or mid) to score against.")
+	  ("take,t", po::value<std::vector<std::string>>(&takeFiles)->value_name("<file>")->composing(), "Recorded vocals (WAV, FLAC or anything FFmpeg decodes), aligned with the start of the song. One per singer.")
+	  ("track", po::value<std::vector<std::string>>(&tracks)->value_name("<name>")->composing(), "Vocal track for each take (default: the song's tracks in order).")
+	  ("offset", po::value<std::vector<double>>(&offsets)->value_name("<seconds>")->composing(), "Audio to skip at the start of each take (negative to delay the take).")
+	  ("pitch", po::value<std::vector<std::string>>(&pitch)->value_name("<method>")->composing(), "Pitch detection for each take: fft or yin (default: config audio/pitch_detector).")
+	  ("preset", po::value<std::string>(&preset)->value_name("<preset>"), "Analysis window: low-latency, balanced or accurate.")
+	  ("rate", po::value<double>(&rate)->value_name("<Hz>"), "Analysis sample rate; takes are resampled to it.")
+	  ("notes,n", "Print the score and timing of each note.")
+	  ("first-sample", "Also time how long the song's music takes to start at the preview position, with and without the PCM cache.")
+	  ("decode-throughput", "Also time decoding the song's music into the audio ring, resampled straight into it and through the decoder callback.")
+	  ("log,l", po::value<std::string>(&logLevel)->value_name("<level>"), "Minimum level to log to console (default: error).");
+	po::positional_options_description positional;
+	positional.add("song", 1).add("take", -1);
+	po::variables_map vm;
+	try {
+		po::store(po::command_line_parser(argc, argv).options(opts).positional(positional).run(), vm);
+		po::notify(vm);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (vm.count("help") || songFile.empty() || takeFiles.empty()) {
+		std::cout << "Usage: performous-analyze [options] <song> <take>...\n\n" << opts << std::endl;
+		return vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	PathCache::pathBootstrap();
+	SpdLogger spdLogger(spdlog::level::from_str(UnicodeUtil::toUpper(logLevel)));
+	try {
+		readConfig();
+		AnalyzerPreset analyzerPreset;
+		if (preset == "low-latency") analyzerPreset = AnalyzerPreset::LOW_LATENCY;
+		else if (preset == "balanced") analyzerPreset = AnalyzerPreset::BALANCED;
+		else if (preset == "accurate") analyzerPreset = AnalyzerPreset::ACCURATE;
+		else throw std::runtime_error("Unknown preset " + preset);
+		StageTimer load{"load song"}, decoding{"decode"}, analysis{"analyze"}, scoring{"score"};
+		std::unique_ptr<Song> songPtr;
+		load([&] {
+			songPtr = std::make_unique<Song>(fs::path(songFile));
+			songPtr->loadNotes(false);
+		});
+		Song& song = *songPtr;
+		if (song.vocalTracks.empty()) throw std::runtime_error("The song has no vocal tracks");
+		std::vector<std::string> micNames{"blue", "red", "green", "yellow", "fuchsia", "orange", "purple", "aqua"};
+		std::vector<Take> takes(takeFiles.size());
+		std::vector<Player> players;
+		players.reserve(takes.size());
+		for (std::size_t i = 0; i < takes.size(); ++i) {
+			Take& take = takes[i];
+			take.file = takeFiles[i];
+			if (i < offsets.size()) take.skip = std::llround(offsets[i] * rate);
+			decoding([&] { take.pcm = decode(take.file, static_cast<int>(rate)); });
+			PitchMethod method = config["audio/pitch_detector"].ui() == 1 ? PitchMethod::YIN : PitchMethod::FFT;
+			if (i < pitch.size()) method = parsePitchMethod(pitch[i]);
+			std::string id = micNames[i % micNames.size()];
+			take.analyzer = std::make_unique<Analyzer>(rate, id, analyzerTiming(rate, analyzerPreset), method);
+			VocalTrack& vocal = i < tracks.size() ? song.getVocalTrack(tracks[i]) : song.getVocalTrack(static_cast<unsigned>(i % song.vocalTracks.size()));
+			players.emplace_back(vocal, *take.analyzer, static_cast<std::size_t>(vocal.endTime / Engine::TIMESTEP));
+		}
+		// Analyze all takes together, like the microphones of one capture device
+		std::vector<Analyzer*> analyzers;
+		for (Take& take: takes) analyzers.push_back(take.analyzer.get());
+		AnalyzerBatch batch(analyzers);
+		// Run the engine loop: feed one time step of audio, analyze and let each player score it
+		double const round_trip = config["audio/round-trip"].f();
+		std::size_t steps = 0;
+		for (Player const& p: players) steps = std::max(steps, p.m_pitch.size());
+		std::vector<float> const silence(static_cast<std::size_t>(std::ceil(rate * Engine::TIMESTEP)) + 1);
+		std::int64_t fed = 0;
+		for (std::size_t step = 0; step < steps; ++step) {
+			// The engine scores time t once the audio of t + round-trip has been captured
+			auto const target = static_cast<std::int64_t>(std::llround((Engine::TIMESTEP * static_cast<double>(step + 1) + round_trip) * rate));
+			analysis([&] {
+				// At most one time step per process(), as the engine gets it: the round-trip offset of the first step
+				// alone could be more than the input buffers of the analyzers hold
+				for (std::int64_t end; fed < target; fed = end) {
+					end = std::min(target, fed + static_cast<std::int64_t>(silence.size()));
+					for (Take& take: takes) take.feed(fed, end, silence);
+					batch.process();
+				}
+			});
+			scoring([&] { for (Player& player: players) player.update(); });
+		}
+		// Report
+		double const audioSeconds = Engine::TIMESTEP * static_cast<double>(steps);
+		double decodedSeconds = 0.0;
+		for (Take const& take: takes) decodedSeconds += static_cast<double>(take.pcm.size()) / rate;
+		std::cout << song.artist << " - " << song.title << "\n";
+		for (std::size_t i = 0; i < takes.size(); ++i) {
+			Player const& player = players[i];
+			Analyzer const& analyzer = *takes[i].analyzer;
+			std::cout << fmt::format("\n{} ({}): track {}, {} samples window, {} samples hop, {}\n  score {}\n",
+			  takes[i].file.string(), analyzer.getId(), player.m_vocal.name, analyzer.getFFTSize(), analyzer.getStep(),
+			  analyzer.getPitchMethod() == PitchMethod::YIN ? "YIN" : "FFT", player.getScore());
+			if (vm.count("notes")) printNotes(player);
+		}
+		std::cout << fmt::format("\nTiming for {:.1f} s of audio, {} takes, {} engine steps:\n", audioSeconds, takes.size(), steps);
+		for (StageTimer const* t: {&load, &decoding, &analysis, &scoring}) {
+			std::cout << fmt::format("  {:<10} {:9.3f} s", t->name, t->seconds());
+			if (t == &decoding) {
+				std::cout << fmt::format("  {:8.1f} s of audio {:9.1f}x realtime", decodedSeconds, decodedSeconds / std::max(t->seconds(), 1e-9));
+			}
+			if (t == &analysis || t == &scoring) {
+				std::cout << fmt::format("  {:8.2f} us/step  {:8.1f}x realtime", 1e6 * t->seconds() / static_cast<double>(std::max<std::size_t>(steps, 1)), audioSeconds / std::max(t->seconds(), 1e-9));
+			}
+			std::cout << '\n';
+		}
+		double const engine = analysis.seconds() + scoring.seconds();
+		std::cout << fmt::format("  {:<10} {:9.3f} s  {:8.2f} us/step  {:8.1f}x realtime\n", "engine", engine,
+		  1e6 * engine / static_cast<double>(std::max<std::size_t>(steps, 1)), audioSeconds / std::max(engine, 1e-9));
+		if (vm.count("first-sample")) {
+			double const preview = song.getPreviewStart();
+			std::cout << fmt::format("\nTime to first sample at {:.1f} s (mean of {} runs):\n", preview, firstSampleRuns);
+			for (auto const& [name, file]: song.music) {
+				FirstSample const t = measureFirstSample(file, static_cast<unsigned>(rate), preview, firstSampleRuns);
+				std::cout << fmt::format("  {:<10} {:9.3f} ms decoded  {:9.3f} ms cached\n", name, t.decoded, t.cached);
+			}
+		}
+		if (vm.count("decode-throughput")) {
+			std::cout << fmt::format("\nDecoding into the audio ring ({} runs):\n", decodeRuns);
+			for (auto const& [name, file]: song.music) {
+				DecodeThroughput const t = measureDecodeThroughput(file, static_cast<unsigned>(rate), decodeRuns);
+				std::cout << fmt::format("  {:<10} {:9.1f}x realtime direct  {:9.1f}x realtime callback\n", name, t.ring, t.callback);
+			}
+		}
+	}
+	catch (std::exception& e) {
+		std::cerr << "performous-analyze: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -4,6 +4,7 @@
 #include "log.hh"
 #include "util.hh"
 #include "graphic/color_trans.hh"
+#include "graphic/window.hh"
 
 #include <cmath>
 
@@ -24,20 +25,34 @@ bool Video::tryPop(Bitmap& f, double timestamp) {
 	if (m_seek_asked) return false;
 
 	// discard outdated frames retaining only the most recent frame that is _before_ timestamp
-	while (!m_queue.empty() && std::next(m_queue.begin()) != m_queue.end() && std::next(m_queue.begin())->timestamp < timestamp) m_queue.pop_front();
+	while (m_queue.size() > 1 && m_queue[1].timestamp < timestamp) m_queue.recycle(m_queue.pop());
 
 	if (m_queue.empty() || m_queue.front().timestamp > timestamp) return false; // Nothing to deliver
 
-	f = std::move(m_queue.front());
-	m_queue.pop_front();
+	f = m_queue.pop();
 	return true;
 }
 
 void Video::push(Bitmap&& f) {
 	std::unique_lock<std::mutex> l(m_mutex);
-	m_cond.wait(l, [this]{ return m_quit || m_seek_asked || m_queue.size() < m_max; });
-	if (m_quit || m_seek_asked) return; // Drop frame when seek/quit asked
-	m_queue.emplace_back(std::move(f));
+	m_cond.wait(l, [&]{ return m_quit || m_seek_asked || m_queue.hasRoom(f); });
+	if (m_quit || m_seek_asked) { // Drop frame when seek/quit asked
+		m_queue.recycle(std::move(f));
+		return;
+	}
+	m_queue.push(std::move(f));
+}
+
+Bitmap Video::newFrame(std::size_t size) {
+	Bitmap f;
+	if (auto slot = m_upload.acquire(size)) {
+		f.ptr = slot->data();
+		f.staged = std::move(slot);
+		return f;
+	}
+	std::lock_guard<std::mutex> l(m_mutex);
+	f.buf = m_queue.take();
+	return f;
 }
 
 Video::~Video() {
@@ -50,9 +65,17 @@ Video::~Video() {
 }
 
 Video::Video(fs::path const& _videoFile, double videoGap): m_videoGap(videoGap), m_textureTime(), m_alpha(-0.5f, 1.5f) {
-	m_grabber = std::async(std::launch::async, [this, file = _videoFile] {
+	// Videos are drawn across the window, so there is no need to decode them at a higher resolution
+	auto const width = static_cast<unsigned>(screenW());
+	auto const height = static_cast<unsigned>(screenH());
+	m_grabber = std::async(std::launch::async, [this, file = _videoFile, width, height] {
 		try {
-			auto ffmpeg = std::make_unique<VideoFFmpeg>(file, [this](auto f) { this->push(std::move(f)); });
+			VideoFFmpeg::Params params;
+			params.frameAlloc = [this](std::size_t size) { return newFrame(size); };
+			params.coverWidth = width;
+			params.coverHeight = height;
+			params.clock = [this] { return m_playPosition.load(std::memory_order_relaxed); };
+			auto ffmpeg = std::make_unique<VideoFFmpeg>(file, [this](auto f) { this->push(std::move(f)); }, std::move(params));
 			int errors = 0;
 			std::unique_lock<std::mutex> l(m_mutex);
 			while (!m_quit) {
@@ -100,10 +123,14 @@ void Video::prepare(double time) {
 	// shift video timestamp if gap is declared in song config
 	time += m_videoGap;
 
+	m_playPosition.store(time, std::memory_order_relaxed);
+	m_upload.update();
 	Bitmap videoFrame;
-	if (tryPop(videoFrame, time) && !videoFrame.buf.empty()) {
+	if (tryPop(videoFrame, time) && videoFrame.width > 0) {
 		m_texture.load(videoFrame);
 		m_textureTime = videoFrame.timestamp;
+		std::lock_guard<std::mutex> l(m_mutex);
+		m_queue.recycle(std::move(videoFrame));
 	}
 }
 
@@ -1,9 +1,12 @@
 #pragma once
 
 #include "animvalue.hh"
+#include "framequeue.hh"
 #include "texture.hh"
-#include <deque>
+#include "graphic/upload_ring.hh"
+#include <atomic>
 #include <future>
+#include <limits>
 #include <string>
 
 /// class for playing videos
@@ -19,17 +22,21 @@ class Video {
 
   private:
 	const double m_videoGap;
-	Texture m_texture;
+	UploadRing m_upload{ 8 };  ///< Declared first to outlive the frames that use it
+	YuvTexture m_texture;
 	double m_textureTime;
 	double m_readPosition = 0.0;
 	AnimValue m_alpha;
 	bool m_quit{false};
+	std::atomic<double> m_playPosition{ std::numeric_limits<double>::quiet_NaN() };  ///< Set by prepare() for the decoder to keep up with
 	std::future<void> m_grabber;
 
 	/// trys to pop a video frame from queue
 	bool tryPop(Bitmap& f, double timestamp);
 	/// Add frame to queue
 	void push(Bitmap&& f);
+	/// Memory for a decoded frame, in a pixel buffer if one is free (decoder thread)
+	Bitmap newFrame(std::size_t size);
 	/// Clear and unlock the queue
 	void reset();
 	/// return timestamp of next frame to read
@@ -37,10 +44,9 @@ class Video {
 	/// return timestamp of next frame to read
 	double backPosition() const { return m_queue.back().timestamp; }
 
-	std::deque<Bitmap> m_queue;
+	FrameQueue m_queue{ 64 << 20, 20 };  ///< At most 64 MiB or 20 frames, with recycled memory for newFrame
 	mutable std::mutex m_mutex;
 	std::condition_variable m_cond;
-	static const unsigned m_max = 20;
 	bool m_seek_asked{false};
 };
 
@@ -5,9 +5,11 @@
 #include "graphic/transform.hh"
 #include "log.hh"
 
+#include <algorithm>
 #include <cstdint>
 #include <stdexcept>
 #include <thread>
+#include <utility>
 
 #ifdef USE_OPENCV
 #include <opencv2/videoio.hpp>
@@ -80,11 +82,23 @@ void Webcam::operator()() {
 				cv::Mat frame;
 				*m_capture >> frame;
 				if (m_writer) *m_writer << frame;
+				auto const size = static_cast<std::size_t>(frame.cols) * static_cast<std::size_t>(frame.rows) * 3;
+				// Copy the frame straight into a pixel buffer if there is one, so that render() only starts the transfer
+				Bitmap bitmap;
+				bitmap.fmt = pix::Format::BGR;
+				if (auto slot = m_upload.acquire(size)) {
+					bitmap.ptr = slot->data();
+					bitmap.staged = std::move(slot);
+				} else {
+					std::lock_guard<std::mutex> l(m_mutex);
+					bitmap.buf.swap(m_spare);
+				}
+				bitmap.resize(static_cast<unsigned>(frame.cols), static_cast<unsigned>(frame.rows));
+				std::copy(frame.data, frame.data + size, bitmap.data());
 				std::lock_guard<std::mutex> l(m_mutex);
-				// Copy the frame to storage
-				m_frame.width = frame.cols;
-				m_frame.height = frame.rows;
-				m_frame.data.assign(frame.data, frame.data + (m_frame.width * m_frame.height * 3));
+				// Replace any frame that was not rendered (its pixel buffer is released)
+				if (!m_frame.ptr) m_spare.swap(m_frame.buf);
+				m_frame = std::move(bitmap);
 				// Notify renderer
 				m_frameAvailable = true;
 			}
@@ -104,23 +118,25 @@ void Webcam::pause(bool do_pause) {
 	#endif
 	m_running = !do_pause;
 	m_frameAvailable = false;
+	m_frame = Bitmap();  // Releases its pixel buffer
 }
 
 void Webcam::render() {
 	#ifdef USE_OPENCV
 	if (!m_capture || !m_running) return;
+	m_upload.update();
 	// Do we have a new frame available?
-	if (m_frameAvailable && !m_frame.data.empty()) {
+	Bitmap bitmap;
+	{
 		std::lock_guard<std::mutex> l(m_mutex);
-		// Load the image
-		Bitmap bitmap;
-		bitmap.fmt = pix::Format::BGR;
-		bitmap.buf.swap(m_frame.data);
-		bitmap.resize(static_cast<unsigned>(m_frame.width), static_cast<unsigned>(m_frame.height));
-		m_texture.load(bitmap);
-		bitmap.buf.swap(m_frame.data);  // Get back our buffer (FIXME: do we need to?)
+		if (m_frameAvailable) bitmap = std::exchange(m_frame, Bitmap());
 		m_frameAvailable = false;
 	}
+	if (bitmap.width > 0) {
+		m_texture.load(bitmap);
+		std::lock_guard<std::mutex> l(m_mutex);
+		if (!bitmap.ptr) m_spare.swap(bitmap.buf);  // Get back our buffer
+	}
 	using namespace glmath;
 	Transform trans(m_window, scale(vec3(-1.0f, 1.0f, 1.0f)));
 	m_texture.draw(m_window); // Draw
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "texture.hh"
+#include "graphic/upload_ring.hh"
 #include <cstdint>
 #include <atomic>
 #include <mutex>
@@ -13,12 +14,6 @@ namespace cv {
 	class VideoWriter;
 }
 
-struct CamFrame {
-	int width = 0;
-	int height = 0;
-	std::vector<std::uint8_t> data;
-};
-
 class Webcam {
   public:
 	Webcam(Window&, int cam_id = 0);
@@ -46,7 +41,9 @@ class Webcam {
 	mutable std::mutex m_mutex;
 	std::unique_ptr<cv::VideoCapture> m_capture;
 	std::unique_ptr<cv::VideoWriter> m_writer;
-	CamFrame m_frame;
+	UploadRing m_upload{ 3 };  ///< Declared before the frames that use it
+	Bitmap m_frame;  ///< The latest captured frame, in a pixel buffer if one was free
+	std::vector<unsigned char> m_spare;  ///< Memory of a rendered frame, reused for capturing if there is no pixel buffer
 	Texture m_texture;
 	bool m_frameAvailable = false;
 	std::atomic<bool> m_running{ false };
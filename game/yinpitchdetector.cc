@@ -0,0 +1,97 @@
+#include "yinpitchdetector.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace {
+	/// The smallest power of two exponent p >= YinPitchDetector::FFT_P_MIN for which 2^p >= size
+	unsigned fftPower(std::size_t size) {
+		unsigned p = YinPitchDetector::FFT_P_MIN;
+		while ((std::size_t(1) << p) < size) ++p;
+		return p;
+	}
+}
+
+YinPitchDetector::YinPitchDetector(double rate, double minFreq, double maxFreq, double threshold):
+  m_rate(rate),
+  m_threshold(threshold),
+  m_window(static_cast<std::size_t>(rate * 0.010)),  // 10 ms integration window
+  m_tauMin(std::max<std::size_t>(2, static_cast<std::size_t>(rate / maxFreq))),
+  m_tauMax(static_cast<std::size_t>(std::ceil(rate / minFreq))),
+  m_fftSize(std::size_t(1) << fftPower(m_window + m_tauMax))
+{
+	switch (fftPower(frameSize())) {
+		case 11: m_fft.emplace<da::RealFFT<11>>(); break;
+		case 12: m_fft.emplace<da::RealFFT<12>>(); break;
+		case 13: m_fft.emplace<da::RealFFT<13>>(); break;
+		default: throw std::invalid_argument("YIN frames of " + std::to_string(frameSize()) + " samples (" + std::to_string(minFreq) + " Hz at " + std::to_string(rate) + " Hz) are too long");
+	}
+	m_padded.resize(m_fftSize);
+	m_spectrum.resize(m_fftSize / 2 + 1);
+	m_windowSpectrum.resize(m_fftSize / 2 + 1);
+	m_correlation.resize(m_fftSize);
+	m_reversed.resize(m_fftSize);
+	m_cmnd.resize(m_tauMax + 1);
+	m_ones.resize(m_fftSize, 1.0f);
+}
+
+void YinPitchDetector::difference(float const* input) {
+	std::size_t const frame = frameSize();
+	// Work backwards in time, so that the window is the most recent audio and short periods only need recent input
+	std::reverse_copy(input, input + frame, m_reversed.begin());
+	float const* pcm = m_reversed.data();
+	// Cross-correlation r(tau) = sum of pcm[j] * pcm[j + tau] over the window, via FFT
+	std::visit([&](auto& fft) {
+		std::fill(std::copy(pcm, pcm + m_window, m_padded.begin()), m_padded.end(), 0.0f);
+		fft(m_padded.begin(), m_ones, m_windowSpectrum.data());
+		std::fill(std::copy(pcm, pcm + frame, m_padded.begin()), m_padded.end(), 0.0f);
+		fft(m_padded.begin(), m_ones, m_spectrum.data());
+		for (std::size_t k = 0; k < m_spectrum.size(); ++k) m_spectrum[k] *= std::conj(m_windowSpectrum[k]);
+		fft.inverse(m_spectrum.data(), m_correlation.data());
+	}, m_fft);
+	// d(tau) = energy of the window + energy of the window shifted by tau - 2 r(tau), then normalized by its running mean
+	double energy = 0.0;
+	for (std::size_t j = 0; j < m_window; ++j) energy += double(pcm[j]) * pcm[j];
+	double const energy0 = energy;
+	double sum = 0.0;
+	m_cmnd[0] = 1.0f;
+	for (std::size_t tau = 1; tau <= m_tauMax; ++tau) {
+		energy += double(pcm[tau + m_window - 1]) * pcm[tau + m_window - 1] - double(pcm[tau - 1]) * pcm[tau - 1];
+		double const d = std::max(0.0, energy0 + energy - 2.0 * m_correlation[tau]);
+		sum += d;
+		m_cmnd[tau] = sum > 0.0 ? static_cast<float>(d * static_cast<double>(tau) / sum) : 1.0f;
+	}
+}
+
+double YinPitchDetector::bestLag() const {
+	std::size_t tau = m_tauMin;
+	// The first dip below the threshold, followed down to its minimum (avoids picking multiples of the period)
+	while (tau < m_tauMax && m_cmnd[tau] >= m_threshold) ++tau;
+	if (tau >= m_tauMax) return 0.0;
+	while (tau + 1 < m_tauMax && m_cmnd[tau + 1] < m_cmnd[tau]) ++tau;
+	// Parabolic interpolation around the minimum
+	double const s0 = m_cmnd[tau - 1], s1 = m_cmnd[tau], s2 = m_cmnd[tau + 1];
+	double const denom = s0 - 2.0 * s1 + s2;
+	double const shift = denom > 0.0 ? 0.5 * (s0 - s2) / denom : 0.0;
+	return static_cast<double>(tau) + std::clamp(shift, -1.0, 1.0);
+}
+
+void YinPitchDetector::analyze(float const* pcm, std::vector<Tone>& tones) {
+	// Level of the most recent window, scaled the way the FFT detector sees a pure tone of the same power
+	// (Hamming window gain 0.54, one-sided spectrum)
+	double power = 0.0;
+	for (std::size_t j = frameSize() - m_window; j < frameSize(); ++j) power += double(pcm[j]) * pcm[j];
+	double const db = 10.0 * std::log10(power / static_cast<double>(m_window)) + 20.0 * std::log10(0.53836 / std::sqrt(2.0));
+	if (!(db > -43.0)) return;  // Silence (same limit as for a single-harmonic FFT tone)
+	difference(pcm);
+	double const lag = bestLag();
+	if (lag == 0.0) return;  // Unvoiced
+	Tone t;
+	t.freq = m_rate / lag;
+	t.db = db;
+	t.stabledb = db;
+	t.harmonics[0] = db;
+	tones.push_back(t);
+}
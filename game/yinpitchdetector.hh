@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ipitchdetector.hh"
+#include "libda/fft.hpp"
+
+#include <variant>
+
+/**
+* YIN fundamental frequency estimator (de Cheveigné & Kawahara 2002).
+*
+* The frame is a short integration window preceded by one longest period worth of lag. The window is the most
+* recent audio, so a voice becomes detectable as soon as the window and one of its periods have arrived. The difference
+* function is computed from an FFT cross-correlation of the window against the whole frame plus running
+* energy sums, instead of the O(W * tauMax) direct sum. One tone is reported per voiced frame, with its level
+* on the same scale as the FFT detector uses for a pure tone.
+* The FFT is the smallest one that fits the frame, so that higher sample rates keep the same lowest pitch.
+* All buffers are allocated on construction; analyze() does not allocate.
+**/
+class YinPitchDetector : public IPitchDetector {
+public:
+	static constexpr unsigned FFT_P_MIN = 11;
+	static constexpr unsigned FFT_P_MAX = 13;  ///< Frames up to 8192 samples (minFreq 65 Hz up to about 340 kHz)
+
+	/// Throws std::invalid_argument if a frame for minFreq at rate does not fit the largest FFT
+	YinPitchDetector(double rate, double minFreq = 65.0, double maxFreq = 1500.0, double threshold = 0.15);
+
+	std::size_t frameSize() const override { return m_window + m_tauMax; }
+	void analyze(float const* pcm, std::vector<Tone>& tones) override;
+
+private:
+	/// Cumulative mean normalized difference function of input into m_cmnd, for lags up to m_tauMax
+	void difference(float const* input);
+	/// The lag of the first dip below the threshold, refined by parabolic interpolation; 0 if unvoiced
+	double bestLag() const;
+
+	double m_rate;
+	double m_threshold;
+	std::size_t m_window;  ///< Integration window W
+	std::size_t m_tauMin, m_tauMax;
+	std::size_t m_fftSize;
+	std::variant<da::RealFFT<11>, da::RealFFT<12>, da::RealFFT<13>> m_fft;  ///< The alternative of m_fftSize
+	std::vector<float> m_padded;  ///< FFT input with zero padding
+	std::vector<std::complex<float>> m_spectrum, m_windowSpectrum;
+	std::vector<float> m_correlation;
+	std::vector<float> m_reversed;  ///< The frame backwards in time
+	std::vector<float> m_cmnd;
+	std::vector<float> m_ones;  ///< Rectangular window for the FFT
+};
@@ -0,0 +1,48 @@
+#include "yuv.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+yuv::Coefficients yuv::toRgb(Encoding encoding) {
+	// Luma weights of red and blue (green gets the rest)
+	double const kr = encoding.matrix == Matrix::BT709 ? 0.2126 : 0.2990;
+	double const kb = encoding.matrix == Matrix::BT709 ? 0.0722 : 0.1140;
+	double const kg = 1.0 - kr - kb;
+	// Scale and offset of luma to 0..1 and of chroma to -0.5..0.5, from sampled values 0..1 (that is, n / 255)
+	double const ys = encoding.fullRange ? 1.0 : 255.0 / 219.0;
+	double const yo = encoding.fullRange ? 0.0 : -16.0 / 219.0;
+	double const cs = encoding.fullRange ? 1.0 : 255.0 / 224.0;
+	double const co = encoding.fullRange ? -128.0 / 255.0 : -128.0 / 224.0;
+	double const rv = 2.0 * (1.0 - kr);
+	double const bu = 2.0 * (1.0 - kb);
+	double const gu = -bu * kb / kg;
+	double const gv = -rv * kr / kg;
+	auto const row = [&](double u, double v) {
+		return std::array<float, 4>{ float(ys), float(u * cs), float(v * cs), float(yo + (u + v) * co) };
+	};
+	return { row(0.0, rv), row(gu, gv), row(bu, 0.0) };
+}
+
+std::size_t yuv::Planes420::offset(unsigned plane) const {
+	std::size_t result = 0;
+	for (unsigned i = 0; i < plane; ++i) result += std::size_t{ planeWidth(i) } * planeHeight(i);
+	return result;
+}
+
+yuv::Planes420 yuv::scaleToCover(Planes420 frame, unsigned width, unsigned height) {
+	if (width == 0 || height == 0 || frame.width <= width || frame.height <= height) return frame;
+	// Scale to the relatively larger dimension of the area, the other one then covers it too (in integers to round exactly)
+	bool const byWidth = std::uint64_t{ width } * frame.height >= std::uint64_t{ height } * frame.width;
+	std::uint64_t const num = byWidth ? width : height;
+	std::uint64_t const den = byWidth ? frame.width : frame.height;
+	auto const scale = [&](unsigned size) {
+		auto const scaled = static_cast<unsigned>((size * num + den - 1) / den);  // Rounded up
+		return std::min(size, (scaled + 1) / 2 * 2);
+	};
+	return { scale(frame.width), scale(frame.height) };
+}
+
+void yuv::copyPlane(unsigned char* dst, unsigned char const* src, int stride, unsigned width, unsigned height) {
+	for (unsigned y = 0; y < height; ++y, dst += width, src += stride) std::memcpy(dst, src, width);
+}
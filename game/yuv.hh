@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+/// 8-bit YUV 4:2:0 video frames, as decoded by FFmpeg and converted to RGB by the "video" shader
+namespace yuv {
+	/// Matrix of the YUV encoding (BT.601 for SD video, BT.709 for HD)
+	enum class Matrix { BT601, BT709 };
+
+	struct Encoding {
+		Matrix matrix = Matrix::BT601;
+		bool fullRange = false;  ///< Full 0 to 255 values (JPEG) as opposed to 16 to 235 (TV)
+	};
+
+	/// Affine conversion to non-linear RGB: rgb[i] = c[i][0] * y + c[i][1] * u + c[i][2] * v + c[i][3], with values from 0 to 1
+	using Coefficients = std::array<std::array<float, 4>, 3>;
+	Coefficients toRgb(Encoding encoding);
+
+	/// Layout of frames stored without padding: full resolution luma, then the two chroma planes at half resolution (rounded up)
+	struct Planes420 {
+		unsigned width = 0;
+		unsigned height = 0;
+		unsigned planeWidth(unsigned plane) const { return plane ? (width + 1) / 2 : width; }
+		unsigned planeHeight(unsigned plane) const { return plane ? (height + 1) / 2 : height; }
+		/// Where a plane starts (plane 3 gives the size of the frame)
+		std::size_t offset(unsigned plane) const;
+		std::size_t size() const { return offset(3); }
+	};
+
+	/**
+	* The size to decode a frame at to cover an area of width x height pixels: scaled down, keeping the aspect ratio,
+	* to the smallest even size that still covers it. Frames that are not larger are kept as they are.
+	**/
+	Planes420 scaleToCover(Planes420 frame, unsigned width, unsigned height);
+
+	/// Copy rows of width bytes from a plane of the given stride (in bytes), such as those of an AVFrame
+	void copyPlane(unsigned char* dst, unsigned char const* src, int stride, unsigned width, unsigned height);
+}
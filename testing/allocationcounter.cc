@@ -0,0 +1,54 @@
+#include "allocationcounter.hh"
+
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include <new>
+
+namespace {
+	thread_local std::size_t allocations = 0;
+
+	void* allocate(std::size_t size) {
+		++allocations;
+		if (void* ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+		throw std::bad_alloc();
+	}
+
+	void* allocate(std::size_t size, std::align_val_t alignment) {
+		++allocations;
+		auto const align = static_cast<std::size_t>(alignment);
+#ifdef _WIN32
+		if (void* ptr = _aligned_malloc(size == 0 ? 1 : size, align)) return ptr;
+#else
+		// aligned_alloc wants the size to be a nonzero multiple of the alignment
+		if (void* ptr = std::aligned_alloc(align, (size + align) / align * align)) return ptr;
+#endif
+		throw std::bad_alloc();
+	}
+
+	void deallocateAligned(void* ptr) {
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		std::free(ptr);
+#endif
+	}
+}
+
+AllocationCounter::AllocationCounter(): m_start(allocations) {}
+
+std::size_t AllocationCounter::count() const { return allocations - m_start; }
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return allocate(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return allocate(size, alignment); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { deallocateAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { deallocateAligned(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { deallocateAligned(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { deallocateAligned(ptr); }
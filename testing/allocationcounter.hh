@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+* Counts the heap allocations made by the calling thread during its lifetime.
+* The global operator new is replaced in allocationcounter.cc to keep count; use this to assert that code
+* meant for realtime or per-frame use does not allocate once warmed up.
+**/
+class AllocationCounter {
+  public:
+	AllocationCounter();
+	/** Number of allocations since construction **/
+	std::size_t count() const;
+
+  private:
+	std::size_t m_start;
+};
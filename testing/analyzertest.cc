@@ -1,7 +1,10 @@
 #include "common.hh"
 #include "printer.hh"
+#include "allocationcounter.hh"
+#include "benchmark.hh"
 
 #include "game/analyzer.hh"
+#include "game/libda/fft.hpp"
 
 struct UnitTest_Analyzer : public testing::Test {
 	float makeWave(float n, float frequency) {
@@ -203,3 +206,324 @@ TEST_F(UnitTest_Analyzer, findTone_1760_A) {
 
 	EXPECT_THAT(result, IsNull()); // 1760 is outside used ranged
 }
+
+TEST_F(UnitTest_Analyzer, getTones_sorted_and_bounded_with_noise) {
+	auto seed = 12345u;
+	for (auto& s : input) {
+		seed = seed * 1103515245u + 12345u;
+		s = static_cast<float>((seed >> 8) & 0xFFFF) / 65536.f - 0.5f;
+	}
+
+	for (auto i = 0; i < 8; ++i) {
+		analyzer.input(input.begin(), input.end());
+		analyzer.process();
+
+		auto const result = analyzer.getTones();
+
+		EXPECT_THAT(result.size(), Le(Analyzer::MAXTONES));
+		EXPECT_TRUE(std::is_sorted(result.begin(), result.end(), [](Tone const& l, Tone const& r) { return l.freq < r.freq; }));
+	}
+}
+
+TEST_F(UnitTest_Analyzer, low_tone_survives_loud_noise) {
+	// The larger window leaves many noise peaks, but the sung tone below them must still be found
+	auto accurate = Analyzer(48000, "id", analyzerTiming(48000, AnalyzerPreset::ACCURATE));
+	auto seed = 12345u;
+	for (auto i = 0; i < 8; ++i) {
+		for (auto n = 0u; n < input.size(); ++n) {
+			seed = seed * 1103515245u + 12345u;
+			auto const noise = static_cast<float>((seed >> 8) & 0xFFFF) / 65536.f - 0.5f;
+			input[n] = 0.3f * makeWave(static_cast<float>(n), 110.f) + 2.f * noise;
+		}
+		accurate.input(input.begin(), input.end());
+		accurate.process();
+
+		EXPECT_THAT(accurate.getTones(), Contains(110.0)) << "round " << i;
+	}
+}
+
+TEST(UnitTest_AnalyzerTones, addStrongest_keeps_strongest_on_overflow) {
+	auto const max = std::size_t(Analyzer::MAXTONES);
+	auto tones = std::vector<Tone>();
+	for (auto i = 0u; i < max; ++i) {
+		Tone t;
+		t.freq = 4000.0 - 50.0 * i;  // Found from the highest frequency down
+		t.db = -30.0 - 0.1 * i;
+		addStrongest(tones, t, max);
+	}
+	Tone weak, sung;
+	weak.freq = 90.0;
+	weak.db = -50.0;
+	sung.freq = 110.0;
+	sung.db = -10.0;
+
+	addStrongest(tones, sung, max);
+	addStrongest(tones, weak, max);
+
+	EXPECT_EQ(max, tones.size());
+	EXPECT_THAT(tones, Contains(110.0));
+	EXPECT_THAT(tones, Not(Contains(90.0)));
+	EXPECT_THAT(tones, Not(Contains(4000.0 - 50.0 * (max - 1))));  // The weakest gave way
+}
+
+TEST_F(UnitTest_Analyzer, process_does_not_allocate_after_warm_up) {
+	fill({110, 220, 330});
+	analyzer.process();
+
+	for (auto i = 0; i < 4; ++i) {
+		auto const data = std::vector<float>(4000 + 100 * i, 0.1f * static_cast<float>(i));
+		analyzer.input(data.begin(), data.end());
+		fill({110 * (i + 1.f), 523});
+
+		AllocationCounter allocations;
+		analyzer.process();
+
+		EXPECT_THAT(allocations.count(), 0) << "round " << i;
+		EXPECT_THAT(analyzer.getTones(), Not(IsEmpty()));
+	}
+}
+
+TEST(UnitTest_AnalyzerTiming, balanced_matches_the_classic_setup_at_48k) {
+	auto const timing = analyzerTiming(48000, AnalyzerPreset::BALANCED);
+
+	EXPECT_EQ(1024u, timing.fftSize);
+	EXPECT_EQ(200u, timing.step);
+}
+
+TEST(UnitTest_AnalyzerTiming, window_follows_the_rate) {
+	EXPECT_EQ(1024u, analyzerTiming(44100, AnalyzerPreset::BALANCED).fftSize);
+	EXPECT_EQ(184u, analyzerTiming(44100, AnalyzerPreset::BALANCED).step);
+	EXPECT_EQ(2048u, analyzerTiming(96000, AnalyzerPreset::BALANCED).fftSize);
+	EXPECT_EQ(400u, analyzerTiming(96000, AnalyzerPreset::BALANCED).step);
+	EXPECT_EQ(512u, analyzerTiming(48000, AnalyzerPreset::LOW_LATENCY).fftSize);
+	EXPECT_EQ(120u, analyzerTiming(48000, AnalyzerPreset::LOW_LATENCY).step);
+	EXPECT_EQ(2048u, analyzerTiming(48000, AnalyzerPreset::ACCURATE).fftSize);
+	EXPECT_EQ(4096u, analyzerTiming(96000, AnalyzerPreset::ACCURATE).fftSize);
+	EXPECT_EQ(4096u, analyzerTiming(192000, AnalyzerPreset::ACCURATE).fftSize);  // Largest supported
+	EXPECT_EQ(512u, analyzerTiming(8000, AnalyzerPreset::LOW_LATENCY).fftSize);  // Smallest supported
+}
+
+TEST(UnitTest_AnalyzerTiming, unsupported_fft_size) {
+	EXPECT_THROW(Analyzer(48000, "id", 200, PitchMethod::FFT, 1000), std::logic_error);
+	EXPECT_THROW(Analyzer(48000, "id", 200, PitchMethod::FFT, 8192), std::logic_error);
+}
+
+TEST(UnitTest_AnalyzerTiming, tones_at_every_rate_and_preset) {
+	for (auto const rate : {44100.0, 48000.0, 96000.0}) {
+		for (auto const preset : {AnalyzerPreset::LOW_LATENCY, AnalyzerPreset::BALANCED, AnalyzerPreset::ACCURATE}) {
+			auto analyzer = Analyzer(rate, "id", analyzerTiming(rate, preset));
+			auto data = std::vector<float>(static_cast<std::size_t>(rate / 4));
+			for (auto n = 0u; n < data.size(); ++n)
+				data[n] = 0.25f * static_cast<float>(std::sin(n * 220.0 * pi2 / rate));
+
+			analyzer.input(data.begin(), data.end());
+			analyzer.process();
+
+			EXPECT_THAT(analyzer.getTones(), Contains(220)) << rate << " Hz, size " << analyzer.getFFTSize();
+			ASSERT_THAT(analyzer.findTone(), NotNull()) << rate << " Hz, size " << analyzer.getFFTSize();
+			EXPECT_NEAR(220.0, analyzer.findTone()->freq, 1.0) << rate << " Hz, size " << analyzer.getFFTSize();
+		}
+	}
+}
+
+namespace {
+	template <unsigned P> void expectRealFFTMatchesComplexFFT(std::vector<float> const& samples) {
+		constexpr auto N = std::size_t(1) << P;
+		auto window = std::vector<float>(N);
+		for (auto i = 0u; i < N; ++i)
+			window[i] = static_cast<float>(0.53836 - 0.46164 * std::cos(pi2 * i / (N - 1)));
+
+		auto const expected = da::fft<P>(samples.begin(), window);
+		auto result = std::vector<std::complex<float>>(N / 2 + 1);
+		da::RealFFT<P>()(samples.begin(), window, result.data());
+
+		auto peak = 0.f;
+		for (auto const& c : expected)
+			peak = std::max(peak, std::abs(c));
+		for (auto k = 0u; k <= N / 2; ++k) {
+			EXPECT_NEAR(expected[k].real(), result[k].real(), 1e-4f * peak) << "bin " << k;
+			EXPECT_NEAR(expected[k].imag(), result[k].imag(), 1e-4f * peak) << "bin " << k;
+		}
+	}
+}
+
+TEST(UnitTest_RealFFT, matches_complex_fft_sine) {
+	auto samples = std::vector<float>(1024);
+	for (auto n = 0u; n < samples.size(); ++n)
+		samples[n] = 0.5f * sin(n * 440.f * pi2 / 48000.f) + 0.25f * sin(n * 1320.f * pi2 / 48000.f);
+
+	expectRealFFTMatchesComplexFFT<10>(samples);
+}
+
+TEST(UnitTest_RealFFT, matches_complex_fft_noise) {
+	auto samples = std::vector<float>(4096);
+	auto seed = 12345u;
+	for (auto& s : samples) {
+		seed = seed * 1103515245u + 12345u;
+		s = static_cast<float>((seed >> 8) & 0xFFFF) / 32768.f - 1.f;
+	}
+
+	expectRealFFTMatchesComplexFFT<2>(samples);
+	expectRealFFTMatchesComplexFFT<5>(samples);
+	expectRealFFTMatchesComplexFFT<10>(samples);
+	expectRealFFTMatchesComplexFFT<12>(samples);
+}
+
+TEST(UnitTest_RealFFT, dc_and_nyquist_are_real) {
+	auto samples = std::vector<float>(256);
+	for (auto n = 0u; n < samples.size(); ++n)
+		samples[n] = n % 2 == 0 ? 1.f : -0.5f;
+	auto const window = std::vector<float>(256, 1.f);
+	auto result = std::vector<std::complex<float>>(129);
+
+	da::RealFFT<8>()(samples.begin(), window, result.data());
+
+	EXPECT_THAT(result[0].real(), FloatNear(64.f, 1e-3f));
+	EXPECT_THAT(result[0].imag(), FloatEq(0.f));
+	EXPECT_THAT(result[128].real(), FloatNear(192.f, 1e-3f));
+	EXPECT_THAT(result[128].imag(), FloatEq(0.f));
+	for (auto k = 1u; k < 128; ++k)
+		EXPECT_THAT(std::abs(result[k]), FloatNear(0.f, 1e-3f)) << "bin " << k;
+}
+
+TEST(UnitTest_RealFFT, inverse_restores_samples) {
+	auto samples = std::vector<float>(2048);
+	auto seed = 54321u;
+	for (auto& s : samples) {
+		seed = seed * 1103515245u + 12345u;
+		s = static_cast<float>((seed >> 8) & 0xFFFF) / 32768.f - 1.f;
+	}
+	auto const window = std::vector<float>(2048, 1.f);
+	auto spectrum = std::vector<std::complex<float>>(1025);
+	auto result = std::vector<float>(2048);
+	auto fft = da::RealFFT<11>();
+
+	fft(samples.begin(), window, spectrum.data());
+	fft.inverse(spectrum.data(), result.data());
+
+	for (auto n = 0u; n < samples.size(); ++n)
+		EXPECT_NEAR(samples[n], result[n], 1e-4f) << "sample " << n;
+}
+
+namespace {
+	std::vector<float> makeSignal(float frequency, std::size_t size) {
+		auto data = std::vector<float>(size);
+		for (auto n = 0u; n < size; ++n)
+			data[n] = 0.25f * sin(n * frequency * pi2 / 48000.f) + 0.1f * sin(n * 2.f * frequency * pi2 / 48000.f);
+		return data;
+	}
+
+	std::vector<std::unique_ptr<Analyzer>> makeAnalyzers(std::size_t count) {
+		auto analyzers = std::vector<std::unique_ptr<Analyzer>>();
+		for (auto i = 0u; i < count; ++i)
+			analyzers.emplace_back(std::make_unique<Analyzer>(48000, "mic" + std::to_string(i)));
+		return analyzers;
+	}
+
+	std::vector<Analyzer*> pointers(std::vector<std::unique_ptr<Analyzer>> const& analyzers) {
+		auto result = std::vector<Analyzer*>();
+		for (auto const& a : analyzers)
+			result.push_back(a.get());
+		return result;
+	}
+}
+
+TEST(UnitTest_AnalyzerBatch, same_tones_as_separate_analyzers) {
+	auto const frequencies = std::vector<float>{110.f, 220.f, 196.f, 440.f, 0.f, 82.4f, 330.f, 523.f, 261.6f, 147.f, 98.f};
+	auto separate = makeAnalyzers(frequencies.size());
+	auto batched = makeAnalyzers(frequencies.size());
+	auto batch = AnalyzerBatch(pointers(batched));
+
+	for (auto chunk = 0u; chunk < 4; ++chunk) {
+		for (auto i = 0u; i < frequencies.size(); ++i) {
+			auto const data = makeSignal(frequencies[i], 1000 + 500 * chunk);
+			separate[i]->input(data.begin(), data.end());
+			batched[i]->input(data.begin(), data.end());
+			separate[i]->process();
+		}
+		batch.process();
+
+		for (auto i = 0u; i < frequencies.size(); ++i) {
+			auto const& expected = separate[i]->getTones();
+			auto const& result = batched[i]->getTones();
+			ASSERT_EQ(expected.size(), result.size()) << "channel " << i;
+			for (auto e = expected.begin(), r = result.begin(); e != expected.end(); ++e, ++r) {
+				EXPECT_NEAR(e->freq, r->freq, 1e-6 * e->freq) << "channel " << i;
+				EXPECT_NEAR(e->db, r->db, 1e-4) << "channel " << i;
+				EXPECT_EQ(e->age, r->age) << "channel " << i;
+			}
+			EXPECT_DOUBLE_EQ(separate[i]->getPeak(), batched[i]->getPeak()) << "channel " << i;
+		}
+	}
+}
+
+TEST(UnitTest_AnalyzerBatch, channels_with_uneven_input) {
+	auto analyzers = makeAnalyzers(3);
+	auto batch = AnalyzerBatch(pointers(analyzers));
+	auto const data = makeSignal(220.f, 8192);
+
+	analyzers[1]->input(data.begin(), data.end());
+	batch.process();
+
+	EXPECT_THAT(analyzers[0]->getTones(), ElementsAre());
+	EXPECT_THAT(analyzers[1]->getTones(), Contains(220));
+	EXPECT_THAT(analyzers[2]->getTones(), ElementsAre());
+}
+
+TEST(UnitTest_AnalyzerBatch, process_does_not_allocate_after_warm_up) {
+	auto analyzers = makeAnalyzers(6);
+	auto batch = AnalyzerBatch(pointers(analyzers));
+	auto const data = makeSignal(220.f, 8192);
+
+	for (auto i = 0; i < 4; ++i) {
+		for (auto& a : analyzers)
+			a->input(data.begin(), data.end());
+
+		AllocationCounter allocations;
+		batch.process();
+
+		if (i > 0)
+			EXPECT_THAT(allocations.count(), 0) << "round " << i;
+	}
+}
+
+TEST(UnitTest_AnalyzerBatch, mixed_window_sizes) {
+	auto analyzers = std::vector<std::unique_ptr<Analyzer>>();
+	analyzers.emplace_back(std::make_unique<Analyzer>(48000, "blue", 200, PitchMethod::FFT, 2048));
+	analyzers.emplace_back(std::make_unique<Analyzer>(48000, "red", 200, PitchMethod::FFT, 512));
+	analyzers.emplace_back(std::make_unique<Analyzer>(48000, "green", 200, PitchMethod::FFT, 2048));
+	auto batch = AnalyzerBatch(pointers(analyzers));
+	auto const data = makeSignal(330.f, 12000);
+
+	for (auto& a : analyzers)
+		a->input(data.begin(), data.end());
+	batch.process();
+
+	for (auto& a : analyzers)
+		EXPECT_THAT(a->getTones(), Contains(330)) << a->getId();
+}
+
+TEST(UnitTest_AnalyzerBatch, DISABLED_Benchmark_per_mic_cost) {
+	auto const data = makeSignal(220.f, 4096);
+
+	for (auto const channels : {1u, 2u, 4u, 8u, 11u}) {
+		auto separate = makeAnalyzers(channels);
+		auto batched = makeAnalyzers(channels);
+		auto batch = AnalyzerBatch(pointers(batched));
+
+		auto const separateTime = benchmark([&] {
+			for (auto& a : separate) {
+				a->input(data.begin(), data.end());
+				a->process();
+			}
+		}, 200);
+		auto const batchTime = benchmark([&] {
+			for (auto& a : batched)
+				a->input(data.begin(), data.end());
+			batch.process();
+		}, 200);
+
+		report("separate, " + std::to_string(channels) + " mics, per mic", separateTime / channels);
+		report("batched, " + std::to_string(channels) + " mics, per mic", batchTime / channels);
+	}
+}
@@ -0,0 +1,139 @@
+#include "common.hh"
+
+#include "game/audioclock.hh"
+
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace {
+	Time const start = Clock::now();
+	Time at(Seconds t) { return start + clockDur(t); }
+}
+
+TEST(UnitTest_AudioClock, extrapolates_within_block) {
+	AudioClock clock;
+	clock.timeSync(10.0s, 0.1s, at(0.0s));
+
+	EXPECT_NEAR(10.0, clock.pos(at(0.0s)).count(), 1e-6);
+	EXPECT_NEAR(10.05, clock.pos(at(0.05s)).count(), 1e-6);
+}
+
+TEST(UnitTest_AudioClock, stops_at_end_of_block) {
+	AudioClock clock;
+	clock.timeSync(10.0s, 0.1s, at(0.0s));
+
+	EXPECT_NEAR(10.1, clock.pos(at(1.0s)).count(), 1e-6);  // Output paused or the callback is late
+}
+
+TEST(UnitTest_AudioClock, steps_when_far_off) {
+	AudioClock clock;
+	clock.timeSync(10.0s, 0.1s, at(0.0s));
+	clock.timeSync(42.0s, 0.1s, at(0.1s));  // Seek
+
+	EXPECT_NEAR(42.0, clock.pos(at(0.1s)).count(), 1e-6);
+	EXPECT_NEAR(42.05, clock.pos(at(0.15s)).count(), 1e-6);
+}
+
+TEST(UnitTest_AudioClock, skews_towards_audio) {
+	AudioClock clock;
+	Seconds const block = 0.01s;
+	double const rate = 1.002;  // The audio runs slightly fast compared to the system clock
+	for (int i = 0; i < 2000; ++i) clock.timeSync(rate * i * block, block, at(i * block));
+
+	Seconds const now = 2000 * block;
+	EXPECT_NEAR(rate * now.count(), clock.pos(at(now)).count(), 0.01);
+	// Without skew, the clock would have kept stepping or fallen behind by a whole block
+	EXPECT_GT(clock.pos(at(now - block / 2)).count(), rate * (now - block).count());
+}
+
+TEST(UnitTest_AudioClock, records_corrections) {
+	AudioClock clock;
+	clock.timeSync(0.0s, 0.1s, at(0.0s));
+	clock.timeSync(0.1s + 3e-3s, 0.1s, at(0.1s));  // 3 ms ahead of the clock
+
+	auto const stats = clock.corrections().take();
+	EXPECT_EQ(2u, stats.total());
+	EXPECT_NEAR(3e-3, stats.max.count(), 0.2e-3);  // Give or take the skew applied by the first sync
+}
+
+TEST(UnitTest_AudioClock, clear_until_next_sync) {
+	AudioClock clock;
+	clock.timeSync(10.0s, 0.1s, at(0.0s));
+	clock.corrections().take();
+	clock.clear();
+	EXPECT_TRUE(std::isnan(clock.pos(at(0.05s)).count()));
+
+	clock.timeSync(20.0s, 0.1s, at(0.1s));
+	EXPECT_NEAR(20.05, clock.pos(at(0.15s)).count(), 1e-6);
+	EXPECT_EQ(0u, clock.corrections().take().total());  // Nothing to correct against after clear
+}
+
+TEST(UnitTest_AudioClock, follows_another_clock) {
+	AudioClock source, clock;
+	clock.clear();
+	source.timeSync(10.0s, 0.1s, at(0.0s));
+	source.timeSync(10.1s, 0.1s, at(0.1s));
+	clock.follow(source);
+
+	EXPECT_DOUBLE_EQ(source.pos(at(0.15s)).count(), clock.pos(at(0.15s)).count());
+	EXPECT_DOUBLE_EQ(source.pos(at(1.0s)).count(), clock.pos(at(1.0s)).count());
+}
+
+TEST(UnitTest_AudioClock, readers_never_see_torn_state) {
+	AudioClock clock;
+	std::atomic<bool> done{ false };
+	std::atomic<unsigned> bad{ 0 };
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 2; ++r) {
+		readers.emplace_back([&] {
+			while (!done) {
+				// Every published state has its position within the block that it was synced to
+				double const pos = clock.pos(at(0.0s)).count();
+				if (pos != 0.0 && std::abs(pos - std::round(pos)) > 1e-9) ++bad;
+				std::this_thread::yield();
+			}
+		});
+	}
+	for (int i = 1; i <= 20000; ++i) {
+		clock.timeSync(Seconds(i), 1.0s, at(0.0s));  // Always a step, as each is a second off
+		if (i % 16 == 0) std::this_thread::yield();
+	}
+	done = true;
+	for (auto& t: readers) t.join();
+
+	EXPECT_EQ(0u, bad.load());
+}
+
+TEST(UnitTest_DurationHistogram, percentile) {
+	DurationHistogram histogram;
+	for (int i = 0; i < 98; ++i) histogram.record(30e-6s);
+	histogram.record(-3e-3s);  // Negative deviations count by their magnitude
+	histogram.record(0.5s);
+
+	auto const stats = histogram.take();
+	EXPECT_EQ(100u, stats.total());
+	EXPECT_DOUBLE_EQ(50e-6, stats.percentile(0.5).count());
+	EXPECT_DOUBLE_EQ(5e-3, stats.percentile(0.99).count());
+	EXPECT_DOUBLE_EQ(0.5, stats.percentile(1.0).count());
+	EXPECT_DOUBLE_EQ(0.5, stats.max.count());
+}
+
+TEST(UnitTest_DurationHistogram, percentile_is_at_most_max) {
+	DurationHistogram histogram;
+	histogram.record(1.5e-3s);
+
+	EXPECT_DOUBLE_EQ(1.5e-3, histogram.take().percentile(0.99).count());
+}
+
+TEST(UnitTest_DurationHistogram, take_starts_new_window) {
+	DurationHistogram histogram;
+	histogram.record(1e-3s);
+	histogram.take();
+
+	auto const stats = histogram.take();
+	EXPECT_EQ(0u, stats.total());
+	EXPECT_DOUBLE_EQ(0.0, stats.max.count());
+	EXPECT_DOUBLE_EQ(0.0, stats.percentile(0.99).count());
+}
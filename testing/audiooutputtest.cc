@@ -0,0 +1,76 @@
+#include "common.hh"
+
+#include "game/audio.hh"
+#include "game/configuration.hh"
+#include "game/libda/wavfile.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+	constexpr double toneRate = 44100.0;  ///< Of the music file (the device rates below resample it or not)
+	constexpr double toneFrequency = 1000.0;
+	constexpr double toneSeconds = 1.0;
+
+	/// Plays music through Audio on a virtual device with a manual clock, at the sample rate of the parameter
+	class UnitTest_AudioOutput : public ::testing::TestWithParam<unsigned> {
+	  protected:
+		static void SetUpTestSuite() {
+			if (config.empty()) readConfigSchema(PERFORMOUS_SCHEMA);
+		}
+
+		std::string file(std::string const& name) const { return (m_root / name).string(); }
+
+		/// Write a stereo sine tone of toneSeconds
+		void writeTone(std::string const& filename) const {
+			auto const frames = static_cast<std::size_t>(toneSeconds * toneRate);
+			std::vector<float> samples(2 * frames);
+			for (std::size_t i = 0; i < frames; ++i)
+				samples[2 * i] = samples[2 * i + 1] = 0.5f * static_cast<float>(std::sin(static_cast<double>(pi2) * toneFrequency * static_cast<double>(i) / toneRate));
+			da::WavWriter(filename, 2, toneRate).write(samples.data(), frames);
+		}
+
+	  private:
+		TempDir m_root{ "audiooutput" };
+	};
+}
+
+TEST_P(UnitTest_AudioOutput, plays_music_at_the_device_rate) {
+	unsigned const rate = GetParam();
+	writeTone(file("tone.wav"));
+	config["audio/devices"].sl() = { "dev=virtual out=2 rate=" + std::to_string(rate) + " clock=manual record=\"" + file("out.wav") + "\"" };
+	{
+		Audio audio;
+		ASSERT_TRUE(audio.hasPlayback());
+		EXPECT_EQ(rate, audio.getSR());
+		audio.playMusic(file("tone.wav"), false, 0.0);
+		// Let the decoder keep up with the manual clock, which runs silence until the music has been buffered
+		for (unsigned i = 0; i < 1000 && audio.isPlaying(); ++i) {
+			audio.runManualDevices(0.01);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		EXPECT_FALSE(audio.isPlaying());
+	}
+	da::WavReader reader(file("out.wav"));
+	ASSERT_EQ(2u, reader.channels());
+	EXPECT_EQ(static_cast<double>(rate), reader.rate());
+	// Measure the left channel between the first and the last sample of the tone
+	std::vector<float> const& samples = reader.samples();
+	std::size_t const frames = samples.size() / 2;
+	std::size_t begin = 0, end = frames;
+	while (begin < end && std::abs(samples[2 * begin]) < 0.01f) ++begin;
+	while (end > begin && std::abs(samples[2 * (end - 1)]) < 0.01f) --end;
+	ASSERT_LT(begin, end);
+	double const seconds = static_cast<double>(end - begin) / rate;
+	unsigned crossings = 0;
+	for (std::size_t i = begin + 1; i < end; ++i)
+		if (samples[2 * (i - 1)] < 0.0f && samples[2 * i] >= 0.0f) ++crossings;
+
+	EXPECT_NEAR(toneSeconds, seconds, 0.01);
+	EXPECT_NEAR(toneFrequency, crossings / seconds, 0.01 * toneFrequency);
+}
+
+INSTANTIATE_TEST_SUITE_P(Rates, UnitTest_AudioOutput, ::testing::Values(44100u, 48000u, 96000u));
@@ -0,0 +1,328 @@
+#include "common.hh"
+#include "allocationcounter.hh"
+#include "benchmark.hh"
+
+#include "game/audioring.hh"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+	/// The test signal: a distinct nonzero value for each position (so that silence can be told apart)
+	std::int16_t valueAt(std::int64_t pos) { return static_cast<std::int16_t>(1 + pos % 30000); }
+	float expectedAt(std::int64_t pos) { return static_cast<float>(valueAt(pos)) / 32767.0f; }
+
+	std::vector<std::int16_t> signal(std::int64_t pos, std::int64_t count) {
+		auto result = std::vector<std::int16_t>(static_cast<std::size_t>(count));
+		for (auto i = 0; i < count; ++i) result[static_cast<std::size_t>(i)] = valueAt(pos + i);
+		return result;
+	}
+
+	void write(AudioRing& ring, std::int64_t pos, std::int64_t count) {
+		auto const data = signal(pos, count);
+		ring.write(data.data(), count, pos);
+	}
+
+	/// Write in place, as the decoder does: fill the reserved space and commit it
+	void writeInPlace(AudioRing& ring, std::int64_t count) {
+		auto const span = ring.reserve(count);
+		auto const pos = ring.writePos();
+		for (std::int64_t i = 0; i < span.firstSize; ++i) span.first[i] = valueAt(pos + i);
+		for (std::int64_t i = 0; i < span.secondSize; ++i) span.second[i] = valueAt(pos + span.firstSize + i);
+		ring.commit(span.size());
+	}
+}
+
+TEST(UnitTest_AudioRing, reads_what_was_written) {
+	auto ring = AudioRing(1024);
+	write(ring, 0, 256);
+	auto out = std::vector<float>(100, 0.5f);
+
+	ring.read(out.data(), 100, 10, 1.0f);
+
+	for (auto i = 0; i < 100; ++i) EXPECT_FLOAT_EQ(0.5f + expectedAt(10 + i), out[i]) << i;
+	EXPECT_EQ(0u, ring.underruns());
+}
+
+TEST(UnitTest_AudioRing, applies_volume) {
+	auto ring = AudioRing(1024);
+	write(ring, 0, 16);
+	auto out = std::vector<float>(16);
+
+	ring.read(out.data(), 16, 0, 0.5f);
+
+	for (auto i = 0; i < 16; ++i) EXPECT_FLOAT_EQ(0.5f * expectedAt(i), out[i]) << i;
+}
+
+TEST(UnitTest_AudioRing, wraps_around) {
+	auto ring = AudioRing(64);
+	auto out = std::vector<float>(24);
+
+	for (auto pos = 0; pos < 1000; pos += 24) {
+		write(ring, pos, 24);
+		std::fill(out.begin(), out.end(), 0.0f);
+		ring.read(out.data(), 24, pos, 1.0f);
+		for (auto i = 0; i < 24; ++i) ASSERT_FLOAT_EQ(expectedAt(pos + i), out[i]) << pos + i;
+	}
+	EXPECT_EQ(0u, ring.underruns());
+}
+
+TEST(UnitTest_AudioRing, underrun_plays_silence_and_is_counted) {
+	auto ring = AudioRing(1024);
+	write(ring, 0, 50);
+	auto out = std::vector<float>(100);
+
+	ring.read(out.data(), 100, 0, 1.0f);
+
+	for (auto i = 0; i < 50; ++i) EXPECT_FLOAT_EQ(expectedAt(i), out[i]) << i;
+	for (auto i = 50; i < 100; ++i) EXPECT_EQ(0.0f, out[i]) << i;
+	EXPECT_EQ(1u, ring.underruns());
+	EXPECT_FALSE(ring.seekPending());
+}
+
+TEST(UnitTest_AudioRing, writer_keeps_within_half_the_ring) {
+	auto ring = AudioRing(1024);
+
+	write(ring, 0, 500);
+	EXPECT_TRUE(ring.wantMore());
+	write(ring, 500, 12);
+	EXPECT_FALSE(ring.wantMore());
+
+	auto out = std::vector<float>(100);
+	ring.read(out.data(), 100, 0, 1.0f);
+	EXPECT_TRUE(ring.wantMore());
+}
+
+TEST(UnitTest_AudioRing, reading_elsewhere_requests_a_seek) {
+	auto ring = AudioRing(1024);
+	write(ring, 0, 256);
+	auto out = std::vector<float>(100);
+
+	ring.read(out.data(), 100, 5000, 1.0f);
+
+	EXPECT_THAT(out, ::testing::Each(0.0f));
+	ASSERT_TRUE(ring.seekPending());
+	EXPECT_EQ(0u, ring.underruns());  // Seeking is not an underrun
+
+	// Data decoded for the old position is dropped until the writer takes the seek
+	auto const old = signal(256, 100);
+	EXPECT_FALSE(ring.write(old.data(), 100, 256));
+
+	std::int64_t pos = -1;
+	ASSERT_TRUE(ring.takeSeek(pos));
+	EXPECT_EQ(5000, pos);
+	EXPECT_FALSE(ring.seekPending());
+	EXPECT_FALSE(ring.takeSeek(pos));
+
+	write(ring, 4990, 300);  // Decoding resumes a bit earlier (e.g. at a keyframe)
+	EXPECT_EQ(5290, ring.writePos());
+	ring.read(out.data(), 100, 5100, 1.0f);
+	for (auto i = 0; i < 100; ++i) EXPECT_FLOAT_EQ(expectedAt(5100 + i), out[i]) << i;
+}
+
+TEST(UnitTest_AudioRing, recent_history_is_read_without_seeking) {
+	auto ring = AudioRing(1024);
+	auto out = std::vector<float>(100);
+	for (auto pos = 0; pos < 400; pos += 100) {
+		write(ring, pos, 100);
+		ring.read(out.data(), 100, pos, 1.0f);
+	}
+
+	std::fill(out.begin(), out.end(), 0.0f);
+	ring.read(out.data(), 100, 200, 1.0f);
+
+	EXPECT_FALSE(ring.seekPending());
+	for (auto i = 0; i < 100; ++i) EXPECT_FLOAT_EQ(expectedAt(200 + i), out[i]) << i;
+}
+
+TEST(UnitTest_AudioRing, writes_in_place_around_the_end) {
+	auto ring = AudioRing(64);
+	write(ring, 0, 40);
+	auto out = std::vector<float>(40);
+	ring.read(out.data(), 40, 0, 1.0f);
+
+	auto const span = ring.reserve(30);
+	EXPECT_EQ(ring.data().data() + 40, span.first);
+	EXPECT_EQ(24, span.firstSize);
+	EXPECT_EQ(ring.data().data(), span.second);
+	EXPECT_EQ(6, span.secondSize);
+	EXPECT_EQ(40, ring.writePos());  // Nothing is readable before commit()
+
+	writeInPlace(ring, 30);
+	EXPECT_EQ(70, ring.writePos());
+	std::fill(out.begin(), out.end(), 0.0f);
+	ring.read(out.data(), 30, 40, 1.0f);
+	for (auto i = 0; i < 30; ++i) EXPECT_FLOAT_EQ(expectedAt(40 + i), out[i]) << i;
+	EXPECT_EQ(0u, ring.underruns());
+}
+
+TEST(UnitTest_AudioRing, passes_back_what_was_written) {
+	auto ring = AudioRing(64);
+	write(ring, 0, 40);
+	auto out = std::vector<float>(40);
+	ring.read(out.data(), 40, 0, 1.0f);
+	writeInPlace(ring, 30);
+
+	std::vector<std::int16_t> data;
+	std::vector<std::int64_t> parts;
+	ring.written(20, [&](std::int16_t const* d, std::int64_t count, std::int64_t pos) {
+		EXPECT_EQ(20 + static_cast<std::int64_t>(data.size()), pos);
+		data.insert(data.end(), d, d + count);
+		parts.push_back(count);
+	});
+
+	EXPECT_EQ(signal(20, 50), data);
+	EXPECT_EQ((std::vector<std::int64_t>{ 44, 6 }), parts);  // Around the end of the ring
+	parts.clear();
+	ring.written(0, [&](std::int16_t const*, std::int64_t count, std::int64_t pos) { parts.push_back(pos); parts.push_back(count); });
+	EXPECT_EQ((std::vector<std::int64_t>{ 6, 58, 64, 6 }), parts);  // Only what is still in the ring
+}
+
+TEST(UnitTest_AudioRing, commits_only_what_was_produced) {
+	auto ring = AudioRing(1024);
+	auto const span = ring.reserve(2000);
+	EXPECT_EQ(1024, span.size());  // No more than the ring
+	EXPECT_EQ(0, span.secondSize);
+
+	ring.commit(100);
+	EXPECT_EQ(100, ring.writePos());
+	EXPECT_EQ(ring.data().data() + 100, ring.reserve(10).first);
+}
+
+TEST(UnitTest_AudioRing, no_space_while_seeking) {
+	auto ring = AudioRing(1024);
+	write(ring, 0, 256);
+	auto out = std::vector<float>(100);
+	ring.read(out.data(), 100, 5000, 1.0f);
+	ASSERT_TRUE(ring.seekPending());
+
+	EXPECT_EQ(0, ring.reserve(100).size());
+
+	std::int64_t pos;
+	ASSERT_TRUE(ring.takeSeek(pos));
+	writeInPlace(ring, 100);
+	EXPECT_EQ(5100, ring.writePos());
+	ring.read(out.data(), 100, 5000, 1.0f);
+	for (auto i = 0; i < 100; ++i) EXPECT_FLOAT_EQ(expectedAt(5000 + i), out[i]) << i;
+}
+
+TEST(UnitTest_AudioRing, read_does_not_allocate) {
+	auto ring = AudioRing(1024);
+	write(ring, 0, 512);
+	auto out = std::vector<float>(256);
+	AllocationCounter allocations;
+
+	ring.read(out.data(), 256, 0, 1.0f);
+	ring.read(out.data(), 256, 10000, 1.0f);  // Seek request
+
+	EXPECT_EQ(0u, allocations.count());
+}
+
+TEST(UnitTest_AudioRing, stress_concurrent_write_read_and_seek) {
+	auto ring = AudioRing(4096);
+	auto done = std::atomic<bool>(false);
+
+	// Decoder: writes frames of varying size, restarting somewhat before each seek target
+	auto writer = std::thread([&] {
+		std::int64_t pos = 0;
+		for (std::int64_t n = 1; !done; n = n % 293 + 7) {
+			std::int64_t target;
+			if (ring.takeSeek(target)) pos = std::max<std::int64_t>(0, target - 100);
+			if (!ring.wantMore()) {
+				std::this_thread::yield();
+				continue;
+			}
+			auto const data = signal(pos, n);
+			if (ring.write(data.data(), n, pos)) pos += n;
+		}
+	});
+
+	// Callback: plays blocks and now and then jumps elsewhere
+	auto out = std::vector<float>(128);
+	auto wrong = 0, silent = 0, heard = 0;
+	std::int64_t pos = 0;
+	for (auto block = 0; block < 20000; ++block) {
+		if (block % 1000 == 999) pos = (pos * 7 + 12345) % 1000000;
+		std::fill(out.begin(), out.end(), 0.0f);
+		ring.read(out.data(), 128, pos, 1.0f);
+		for (auto i = 0; i < 128; ++i) {
+			if (out[i] == 0.0f) ++silent;
+			else if (std::abs(out[i] - expectedAt(pos + i)) < 1e-6f) ++heard;
+			else ++wrong;
+		}
+		pos += 128;
+		if (block % 16 == 0) std::this_thread::yield();
+	}
+	done = true;
+	writer.join();
+
+	EXPECT_EQ(0, wrong);
+	EXPECT_GT(heard, silent);
+}
+
+TEST(UnitTest_AudioRing, pool_reuses_storage_zeroed) {
+	auto pool = AudioRing::Pool(2);
+	std::int16_t const* storage = nullptr;
+	{
+		auto ring = AudioRing(1024, &pool);
+		write(ring, 0, 512);
+		storage = ring.data().data();
+	}
+	EXPECT_EQ(1u, pool.idle());
+
+	auto ring = AudioRing(1024, &pool);
+	EXPECT_EQ(storage, ring.data().data());
+	EXPECT_THAT(ring.data(), ::testing::Each(0));
+	EXPECT_EQ(0u, pool.idle());
+}
+
+TEST(UnitTest_AudioRing, pool_keeps_limited_storage_of_matching_size) {
+	auto pool = AudioRing::Pool(2);
+	{
+		auto a = AudioRing(1024, &pool);
+		auto b = AudioRing(1024, &pool);
+		auto c = AudioRing(2048, &pool);
+	}
+	EXPECT_EQ(2u, pool.idle());
+
+	AllocationCounter allocations;
+	auto const ring = AudioRing(1024, &pool);
+	EXPECT_EQ(0u, allocations.count());
+	EXPECT_EQ(1024u, ring.data().size());
+}
+
+TEST(UnitTest_AudioRing, DISABLED_Benchmark_decoder_writes) {
+	// A second of 48 kHz stereo in frames of 1152 samples per channel (as MP3), produced by a stand-in resampler
+	constexpr std::int64_t frame = 2 * 1152, total = 2 * 48000;
+	auto const produce = [](std::int16_t* out, std::int64_t count, std::int64_t pos) {
+		for (std::int64_t i = 0; i < count; ++i) out[i] = valueAt(pos + i);
+	};
+	auto ring = AudioRing(4320256);
+	auto out = std::vector<float>(static_cast<std::size_t>(frame));
+	// Keep the reader along so that the writer never runs ahead
+	auto const play = [&] { ring.read(out.data(), frame, ring.writePos() - frame, 1.0f); };
+
+	report("allocate and copy per frame", benchmark([&] {
+		for (std::int64_t n = 0; n < total; n += frame) {
+			auto const pos = ring.writePos();
+			auto const buffer = std::make_unique<std::int16_t[]>(static_cast<std::size_t>(frame));
+			produce(buffer.get(), frame, pos);
+			ring.write(buffer.get(), frame, pos);
+			play();
+		}
+	}, 100), "us/s of audio");
+	report("in place", benchmark([&] {
+		for (std::int64_t n = 0; n < total; n += frame) {
+			auto const pos = ring.writePos();
+			auto const span = ring.reserve(frame);
+			produce(span.first, span.firstSize, pos);
+			produce(span.second, span.secondSize, pos + span.firstSize);
+			ring.commit(span.size());
+			play();
+		}
+	}, 100), "us/s of audio");
+}
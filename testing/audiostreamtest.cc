@@ -0,0 +1,159 @@
+#include "common.hh"
+
+#include "game/chrono.hh"
+#include "game/libda/audiostream.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+namespace {
+	/// Provides a fresh directory for WAV files, removed afterwards
+	class UnitTest_AudioStream : public ::testing::Test {
+	  protected:
+		std::string file(std::string const& name) const { return (m_root / name).string(); }
+
+		/// Write a mono 16 bit PCM file byte by byte, as other programs would
+		void writePcm16(std::string const& filename, std::vector<std::int16_t> const& samples, std::uint32_t rate) const {
+			std::ofstream out(filename, std::ios::binary);
+			auto const put = [&out](std::uint32_t value, unsigned bytes) {
+				for (unsigned i = 0; i < bytes; ++i) out.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+			};
+			auto const dataSize = static_cast<std::uint32_t>(2 * samples.size());
+			out.write("RIFF", 4); put(36 + dataSize, 4); out.write("WAVEfmt ", 8);
+			put(16, 4); put(1, 2); put(1, 2); put(rate, 4); put(2 * rate, 4); put(2, 2); put(16, 2);
+			out.write("data", 4); put(dataSize, 4);
+			for (auto s: samples) put(static_cast<std::uint16_t>(s), 2);
+		}
+
+	  private:
+		TempDir m_root{ "audiostream" };
+	};
+}
+
+TEST_F(UnitTest_AudioStream, wav_round_trip) {
+	std::vector<float> const samples{ 0.0f, 0.5f, -0.25f, 1.0f, -1.0f, 0.125f };
+	{
+		da::WavWriter writer(file("out.wav"), 2, 44100.0);
+		writer.write(samples.data(), 2);
+		writer.write(samples.data() + 4, 1);
+	}
+	da::WavReader reader(file("out.wav"));
+
+	EXPECT_EQ(2u, reader.channels());
+	EXPECT_EQ(44100.0, reader.rate());
+	EXPECT_EQ(3u, reader.frames());
+	EXPECT_EQ(samples, reader.samples());
+}
+
+TEST_F(UnitTest_AudioStream, reads_pcm16) {
+	writePcm16(file("in.wav"), { 0, 32767, -32768, 16384 }, 22050);
+	da::WavReader reader(file("in.wav"));
+
+	EXPECT_EQ(1u, reader.channels());
+	EXPECT_EQ(22050.0, reader.rate());
+	EXPECT_THAT(reader.samples(), ElementsAre(0.0f, 1.0f, FloatEq(-32768.0f / 32767.0f), FloatEq(16384.0f / 32767.0f)));
+}
+
+TEST_F(UnitTest_AudioStream, rejects_other_files) {
+	std::ofstream(file("text.wav")) << "not really a WAV file";
+
+	EXPECT_THROW(da::WavReader(file("text.wav")), std::runtime_error);
+	EXPECT_THROW(da::WavReader(file("missing.wav")), std::runtime_error);
+}
+
+TEST_F(UnitTest_AudioStream, manual_clock_runs_blocks_with_file_input_and_output) {
+	std::vector<std::int16_t> input(1000);
+	for (std::size_t i = 0; i < input.size(); ++i) input[i] = static_cast<std::int16_t>(i);
+	writePcm16(file("mic.wav"), input, 8000);
+	da::VirtualStream::Params params;
+	params.in = 2;  // The file only has one channel, the other is silent
+	params.out = 2;
+	params.manualClock = true;
+	params.inputFile = file("mic.wav");
+	params.outputFile = file("out.wav");
+	std::vector<std::int64_t> blocks;
+	std::vector<float> captured;
+	da::VirtualStream stream([&](float const* in, float* out, std::int64_t frames) {
+		blocks.push_back(frames);
+		for (std::int64_t i = 0; i < frames; ++i) {
+			captured.push_back(in[2 * i]);
+			EXPECT_EQ(0.0f, in[2 * i + 1]);
+			out[2 * i] = in[2 * i];  // Loop the mic back to the left channel
+		}
+		return 0;
+	}, params);
+
+	EXPECT_EQ(8000.0, stream.sampleRate());  // From the input file
+	stream.start();  // Does nothing with a manual clock
+	EXPECT_EQ(0, stream.position());
+	EXPECT_TRUE(stream.run(1200));
+	EXPECT_THAT(blocks, ElementsAre(256, 256, 256, 256, 176));
+	EXPECT_TRUE(stream.inputDone());
+	stream.stop();
+
+	ASSERT_EQ(1200u, captured.size());
+	for (std::size_t i = 0; i < input.size(); ++i) ASSERT_FLOAT_EQ(da::conv_from_s16(input[i]), captured[i]);
+	EXPECT_EQ(0.0f, captured.back());  // Silence after the end of the file
+	da::WavReader recorded(file("out.wav"));
+	EXPECT_EQ(1200u, recorded.frames());
+	EXPECT_FLOAT_EQ(captured[500], recorded.samples()[2 * 500]);
+}
+
+TEST_F(UnitTest_AudioStream, keeps_recording_after_a_restart) {
+	da::VirtualStream::Params params;
+	params.out = 2;
+	params.manualClock = true;
+	params.outputFile = file("out.wav");
+	float level = 0.25f;
+	da::VirtualStream stream([&](float const*, float* out, std::int64_t frames) {
+		std::fill(out, out + 2 * frames, level);
+		return 0;
+	}, params);
+
+	stream.run(300);
+	stream.stop();
+	EXPECT_EQ(300u, da::WavReader(file("out.wav")).frames());  // Readable when stopped
+	stream.start();
+	level = 0.5f;
+	stream.run(200);
+	stream.stop();
+
+	da::WavReader recorded(file("out.wav"));
+	ASSERT_EQ(500u, recorded.frames());
+	EXPECT_EQ(0.25f, recorded.samples()[2 * 299]);
+	EXPECT_EQ(0.5f, recorded.samples()[2 * 300]);
+}
+
+TEST_F(UnitTest_AudioStream, callback_can_stop) {
+	da::VirtualStream::Params params;
+	params.out = 2;
+	params.manualClock = true;
+	int calls = 0;
+	da::VirtualStream stream([&](float const*, float*, std::int64_t) { return ++calls == 2 ? 1 : 0; }, params);
+
+	EXPECT_FALSE(stream.run(10000));
+	EXPECT_EQ(2, calls);
+	EXPECT_EQ(512, stream.position());
+}
+
+TEST_F(UnitTest_AudioStream, realtime_clock_runs_on_its_own) {
+	da::VirtualStream::Params params;
+	params.out = 2;
+	params.rate = 48000.0;
+	std::atomic<std::int64_t> frames{ 0 };
+	da::VirtualStream stream([&](float const*, float*, std::int64_t n) { frames += n; return 0; }, params);
+
+	auto const begin = Clock::now();
+	stream.start();
+	while (frames == 0 && Clock::now() - begin < 5s) std::this_thread::sleep_for(1ms);
+	std::this_thread::sleep_for(50ms);
+	stream.stop();
+	Seconds const elapsed = Clock::now() - begin;
+
+	EXPECT_GT(frames.load(), 0);
+	EXPECT_LE(frames.load(), static_cast<std::int64_t>(elapsed.count() * 48000.0) + 256);  // Never ahead of the wall clock
+	EXPECT_EQ(frames.load(), stream.position());
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Benchmarks are regular test cases prefixed with DISABLED_ so that they stay out of the normal test run.
+// Run them with: performous_test --gtest_also_run_disabled_tests --gtest_filter='*Benchmark*'
+
+/// Run f the given number of times and return the average duration of one run in microseconds.
+template <typename F> double benchmark(F&& f, unsigned iterations) {
+	f();  // Warm-up
+	auto const begin = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < iterations; ++i) f();
+	auto const end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::micro>(end - begin).count() / iterations;
+}
+
+/// Print a benchmark result line.
+inline void report(std::string const& name, double microseconds, std::string const& unit = "us") {
+	std::cout << "[ BENCHMARK] " << name << ": " << microseconds << " " << unit << std::endl;
+}
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <cmath>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <system_error>
 
 #ifdef WIN32
 static constexpr float pi = 3.14159265359f;
@@ -29,3 +33,24 @@ using ::testing::Not;
 using ::testing::NotNull;
 using ::testing::Pointee;
 
+/// A fresh directory under the system temp directory, removed with its contents afterwards
+class TempDir {
+  public:
+	/// The name appears in the directory name, to tell the tests apart
+	explicit TempDir(std::string const& name):
+	  m_path(std::filesystem::temp_directory_path() / ("performous-" + name + "-" + std::to_string(std::random_device()()))) {
+		std::filesystem::create_directories(m_path);
+	}
+	~TempDir() {
+		std::error_code ec;
+		std::filesystem::remove_all(m_path, ec);
+	}
+	TempDir(TempDir const&) = delete;
+	TempDir& operator=(TempDir const&) = delete;
+
+	std::filesystem::path const& path() const { return m_path; }
+	std::filesystem::path operator/(std::filesystem::path const& name) const { return m_path / name; }
+
+  private:
+	std::filesystem::path m_path;
+};
@@ -0,0 +1,78 @@
+#include "common.hh"
+
+#include "game/decodepacer.hh"
+
+#include <cmath>
+
+namespace {
+	/// Decode frames at 25 fps from the given timestamp on, with playback at timestamp + lag(timestamp)
+	template <typename Lag> unsigned decode(DecodePacer& pacer, double& timestamp, int frames, Lag lag) {
+		unsigned passed = 0;
+		for (int i = 0; i < frames; ++i, timestamp += 0.04) passed += pacer.frame(timestamp, timestamp + lag(timestamp));
+		return passed;
+	}
+}
+
+TEST(UnitTest_DecodePacer, passes_frames_ahead_of_playback) {
+	DecodePacer pacer;
+	double t = 0.0;
+
+	EXPECT_EQ(100u, decode(pacer, t, 100, [](double) { return -0.5; }));
+	EXPECT_EQ(DecodePacer::Skip::NONE, pacer.skip());
+	EXPECT_DOUBLE_EQ(-0.5, pacer.lag());
+}
+
+TEST(UnitTest_DecodePacer, passes_all_frames_before_playback) {
+	DecodePacer pacer;
+	for (int i = 0; i < 10; ++i) EXPECT_TRUE(pacer.frame(0.04 * i, std::nan("")));
+	EXPECT_EQ(DecodePacer::Skip::NONE, pacer.skip());
+}
+
+TEST(UnitTest_DecodePacer, skips_more_when_behind) {
+	DecodePacer pacer;
+	double t = 0.0;
+	decode(pacer, t, 1, [](double) { return 0.05; });
+	EXPECT_EQ(DecodePacer::Skip::NONE, pacer.skip());
+	decode(pacer, t, 1, [](double) { return 0.2; });
+	EXPECT_EQ(DecodePacer::Skip::NONREF, pacer.skip());
+	decode(pacer, t, 1, [](double) { return 1.0; });
+	EXPECT_EQ(DecodePacer::Skip::NONKEY, pacer.skip());
+}
+
+TEST(UnitTest_DecodePacer, drops_late_frames_but_keeps_showing_some) {
+	DecodePacer pacer;
+	double t = 0.0;
+	// Four seconds of 25 fps, passed on at about 1 / minInterval fps
+	unsigned const passed = decode(pacer, t, 100, [](double) { return 0.3; });
+
+	EXPECT_GE(passed, 13u);
+	EXPECT_LE(passed, 17u);
+}
+
+TEST(UnitTest_DecodePacer, recovers_step_by_step) {
+	DecodePacer pacer;
+	double t = 0.0;
+	decode(pacer, t, 1, [](double) { return 1.0; });
+	ASSERT_EQ(DecodePacer::Skip::NONKEY, pacer.skip());
+	// Ahead again: the skipping is reduced once per holdTime
+	decode(pacer, t, 10, [](double) { return -0.2; });
+	EXPECT_EQ(DecodePacer::Skip::NONKEY, pacer.skip());
+	decode(pacer, t, 20, [](double) { return -0.2; });
+	EXPECT_EQ(DecodePacer::Skip::NONREF, pacer.skip());
+	decode(pacer, t, 25, [](double) { return -0.2; });
+	EXPECT_EQ(DecodePacer::Skip::NONE, pacer.skip());
+}
+
+TEST(UnitTest_DecodePacer, drops_frames_before_seek_position) {
+	DecodePacer pacer;
+	double t = 0.0;
+	decode(pacer, t, 1, [](double) { return 1.0; });
+	pacer.seek(10.0);
+	EXPECT_EQ(DecodePacer::Skip::NONREF, pacer.skip());  // Keyframes only might never get there
+
+	// Decoding restarts from a keyframe before the position, while playback goes on
+	t = 9.0;
+	EXPECT_EQ(0u, decode(pacer, t, 25, [](double) { return 1.05; }));
+	EXPECT_DOUBLE_EQ(0.0, pacer.lag());  // Not late, just not there yet
+	EXPECT_TRUE(pacer.frame(10.0, 10.05));
+}
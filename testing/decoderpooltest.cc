@@ -0,0 +1,154 @@
+#include "common.hh"
+
+#include "game/decoderpool.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+	/// Wait until the condition is true (or give up after a few seconds)
+	template <typename F> bool eventually(F&& condition) {
+		for (auto i = 0; i < 3000; ++i) {
+			if (condition()) return true;
+			std::this_thread::sleep_for(1ms);
+		}
+		return condition();
+	}
+}
+
+TEST(UnitTest_DecoderPool, runs_job_while_it_has_work) {
+	DecoderPool pool(2);
+	std::atomic<int> done{ 0 };
+
+	auto const id = pool.add([&] {
+		if (done == 100) return false;
+		return ++done < 100;
+	});
+
+	EXPECT_TRUE(eventually([&] { return done == 100; }));
+	pool.remove(id);
+	EXPECT_EQ(100, done);
+	EXPECT_EQ(0u, pool.size());
+}
+
+TEST(UnitTest_DecoderPool, jobs_take_turns) {
+	DecoderPool pool(1);
+	std::mutex mutex;
+	std::vector<char> order;
+	auto job = [&](char name) {
+		return [&, name] {
+			std::lock_guard<std::mutex> l(mutex);
+			order.push_back(name);
+			return std::count(order.begin(), order.end(), name) < 5;
+		};
+	};
+
+	// Hold the only thread busy while adding, so that both jobs are there when they start
+	std::atomic<bool> blocked{ true };
+	std::atomic<bool> started{ false };
+	auto const blocker = pool.add([&] {
+		started = true;
+		while (blocked) std::this_thread::yield();
+		return false;
+	});
+	ASSERT_TRUE(eventually([&] { return started.load(); }));
+	auto const a = pool.add(job('a'));
+	auto const b = pool.add(job('b'));
+	blocked = false;
+
+	EXPECT_TRUE(eventually([&] { std::lock_guard<std::mutex> l(mutex); return order.size() >= 10; }));
+	pool.remove(a);
+	pool.remove(b);
+	pool.remove(blocker);
+	std::lock_guard<std::mutex> l(mutex);
+	EXPECT_THAT(std::vector<char>(order.begin(), order.begin() + 10), ElementsAre('a', 'b', 'a', 'b', 'a', 'b', 'a', 'b', 'a', 'b'));
+}
+
+TEST(UnitTest_DecoderPool, idle_jobs_are_polled_again) {
+	DecoderPool pool(1, 2ms);
+	std::atomic<int> calls{ 0 };
+
+	auto const id = pool.add([&] {
+		++calls;
+		return false;
+	});
+
+	EXPECT_TRUE(eventually([&] { return calls >= 5; }));
+	pool.remove(id);
+}
+
+TEST(UnitTest_DecoderPool, remove_waits_for_running_job_and_destroys_it) {
+	DecoderPool pool(2, 1ms);
+	std::atomic<int> calls{ 0 };
+	std::atomic<bool> proceed{ false };
+	std::atomic<bool> finished{ false };
+	auto const resource = std::make_shared<int>(42);
+
+	auto const id = pool.add([&, resource] {
+		if (++calls == 1) {
+			while (!proceed) std::this_thread::yield();
+			finished = true;
+		}
+		return false;
+	});
+	ASSERT_TRUE(eventually([&] { return calls > 0; }));
+	auto release = std::thread([&] {
+		std::this_thread::sleep_for(20ms);
+		proceed = true;
+	});
+	pool.remove(id);
+	release.join();
+
+	EXPECT_TRUE(finished);  // The call in progress completed before remove returned
+	auto const callsAtRemoval = calls.load();
+	std::this_thread::sleep_for(20ms);
+	EXPECT_EQ(callsAtRemoval, calls);  // And the job was not called again
+	EXPECT_EQ(1, resource.use_count());
+}
+
+TEST(UnitTest_DecoderPool, job_added_during_remove_runs) {
+	DecoderPool pool(2);
+	std::atomic<bool> started{ false };
+	std::atomic<bool> proceed{ false };
+
+	// The job being removed waits for the one added meanwhile, which the idle worker must pick up
+	auto const id = pool.add([&] {
+		started = true;
+		while (!proceed) std::this_thread::yield();
+		return false;
+	});
+	ASSERT_TRUE(eventually([&] { return started.load(); }));
+	auto remover = std::thread([&] { pool.remove(id); });
+	std::this_thread::sleep_for(20ms);  // Let remove() wait for the running job
+	auto const other = pool.add([&] {
+		proceed = true;
+		return false;
+	});
+
+	EXPECT_TRUE(eventually([&] { return proceed.load(); }));
+	proceed = true;
+	remover.join();
+	pool.remove(other);
+	EXPECT_EQ(0u, pool.size());
+}
+
+TEST(UnitTest_DecoderPool, job_keeps_running_after_exception) {
+	DecoderPool pool(1, 1ms);
+	std::atomic<int> calls{ 0 };
+
+	auto const id = pool.add([&]() -> bool {
+		if (++calls == 1) throw std::runtime_error("Broken frame");
+		return false;
+	});
+
+	EXPECT_TRUE(eventually([&] { return calls >= 3; }));
+	pool.remove(id);
+}
@@ -0,0 +1,81 @@
+#include "common.hh"
+
+#include "game/framequeue.hh"
+
+namespace {
+	Bitmap frame(unsigned width, unsigned height, double timestamp, std::vector<unsigned char> buf = {}) {
+		Bitmap f;
+		f.buf = std::move(buf);
+		f.fmt = pix::Format::YUV420P;
+		f.timestamp = timestamp;
+		f.resize(width, height);
+		return f;
+	}
+}
+
+TEST(UnitTest_FrameQueue, bounded_by_bytes) {
+	FrameQueue queue(4 * 96, 20);  // Four frames of 8x8 pixels (96 bytes)
+	for (int i = 0; i < 4; ++i) {
+		Bitmap f = frame(8, 8, i);
+		ASSERT_TRUE(queue.hasRoom(f));
+		queue.push(std::move(f));
+	}
+	EXPECT_EQ(4u * 96u, queue.bytes());
+	EXPECT_FALSE(queue.hasRoom(frame(8, 8, 4)));
+	EXPECT_TRUE(queue.hasRoom(Bitmap()));  // An empty EOF marker takes no memory
+
+	EXPECT_EQ(0.0, queue.pop().timestamp);
+	EXPECT_EQ(3u * 96u, queue.bytes());
+	EXPECT_TRUE(queue.hasRoom(frame(8, 8, 4)));
+	EXPECT_FALSE(queue.hasRoom(frame(16, 16, 4)));
+}
+
+TEST(UnitTest_FrameQueue, bounded_by_frames) {
+	FrameQueue queue(1 << 20, 2);
+	queue.push(frame(8, 8, 0));
+	queue.push(frame(8, 8, 1));
+
+	EXPECT_FALSE(queue.hasRoom(frame(2, 2, 2)));
+	EXPECT_EQ(1.0, queue[1].timestamp);
+	EXPECT_EQ(1.0, queue.back().timestamp);
+}
+
+TEST(UnitTest_FrameQueue, large_frame_fits_in_empty_queue) {
+	FrameQueue queue(100, 20);
+	Bitmap const f = frame(64, 64, 0);
+
+	EXPECT_TRUE(queue.hasRoom(f));
+}
+
+TEST(UnitTest_FrameQueue, recycles_memory) {
+	FrameQueue queue(1 << 20, 20);
+	EXPECT_TRUE(queue.take().empty());
+	queue.push(frame(8, 8, 0));
+	queue.push(frame(8, 8, 1));
+	Bitmap shown = queue.pop();
+	unsigned char const* const memory = shown.data();
+	queue.recycle(std::move(shown));
+	EXPECT_EQ(1u, queue.pooled());
+
+	// The next frame is decoded into the same memory
+	Bitmap f = frame(8, 8, 2, queue.take());
+	EXPECT_EQ(memory, f.data());
+	EXPECT_EQ(0u, queue.pooled());
+
+	queue.clear();  // As for seeking
+	EXPECT_TRUE(queue.empty());
+	EXPECT_EQ(0u, queue.bytes());
+	EXPECT_EQ(1u, queue.pooled());
+}
+
+TEST(UnitTest_FrameQueue, pool_is_bounded) {
+	FrameQueue queue(2 * 96, 20);
+	for (int i = 0; i < 3; ++i) queue.recycle(frame(8, 8, i));
+	EXPECT_EQ(2u, queue.pooled());
+
+	unsigned char pixels[96];
+	Bitmap foreign(pixels);  // Memory owned elsewhere (such as a pixel buffer) is never pooled
+	queue.take();
+	queue.recycle(std::move(foreign));
+	EXPECT_EQ(1u, queue.pooled());
+}
@@ -0,0 +1,139 @@
+#include "common.hh"
+
+#include "game/keyframeindex.hh"
+
+#include <vector>
+
+namespace {
+	/**
+	* Provides a fresh cache directory and generates a stand-in for a media file: packets of 188 bytes (as in MPEG-TS)
+	* at 25 per second, with a keyframe every second, removing both afterwards
+	**/
+	class UnitTest_KeyframeIndex : public ::testing::Test {
+	  protected:
+		static constexpr std::size_t packetSize = 188;
+		static constexpr double packetDuration = 0.04;
+
+		UnitTest_KeyframeIndex() { m_media = generate("video.ts", 250); }
+		fs::path dir() const { return m_root / "cache"; }
+
+		fs::path generate(std::string const& name, std::size_t packets) const {
+			auto const path = m_root / name;
+			fs::ofstream out(path, std::ios::binary);
+			std::vector<char> packet(packetSize);
+			for (std::size_t i = 0; i < packets; ++i) {
+				packet[0] = 0x47;  // Sync byte
+				packet[1] = i % 25 == 0 ? 'K' : 'P';
+				out.write(packet.data(), static_cast<std::streamsize>(packet.size()));
+			}
+			return path;
+		}
+		/// Reads the packets of a file for keyframes, as the FFmpeg builder does with real media
+		static KeyframeIndexCache::Builder scan(fs::path const& file, unsigned* calls = nullptr) {
+			return [file, calls](std::atomic<bool> const& cancel) -> std::optional<KeyframeIndex> {
+				if (calls) ++*calls;
+				fs::ifstream in(file, std::ios::binary);
+				std::vector<char> packet(packetSize);
+				KeyframeIndex index;
+				for (std::int64_t i = 0; in.read(packet.data(), static_cast<std::streamsize>(packet.size())) && !cancel; ++i) {
+					if (packet[0] != 0x47) return std::nullopt;
+					if (packet[1] == 'K') index.add(static_cast<double>(i) * packetDuration, i * static_cast<std::int64_t>(packetSize));
+				}
+				return index;
+			};
+		}
+		char packetTypeAt(std::int64_t pos) const {
+			fs::ifstream in(m_media, std::ios::binary);
+			in.seekg(pos + 1);
+			return static_cast<char>(in.get());
+		}
+
+		TempDir m_root{ "keyframes" };
+		fs::path m_media;
+	};
+}
+
+TEST_F(UnitTest_KeyframeIndex, finds_keyframe_before) {
+	KeyframeIndex index;
+	index.add(0.0, 0);
+	index.add(0.2, 100);  // Too close to the previous one
+	index.add(2.0, 2000);
+	index.add(1.0, 1000);  // Out of order
+	index.add(4.0, -1);  // Position not known
+
+	EXPECT_EQ(2u, index.keyframes().size());
+	EXPECT_EQ(nullptr, index.before(-0.1));
+	EXPECT_EQ(0, index.before(0.0)->pos);
+	EXPECT_EQ(0, index.before(1.99)->pos);
+	EXPECT_EQ(2000, index.before(2.0)->pos);
+	EXPECT_EQ(2000, index.before(100.0)->pos);
+}
+
+TEST_F(UnitTest_KeyframeIndex, builds_in_background_and_persists) {
+	{
+		KeyframeIndexCache cache(dir());
+		EXPECT_EQ(nullptr, cache.load(m_media, "video"));
+		cache.build(m_media, "video", scan(m_media));
+		cache.flush();
+	}
+	// Another run of the game
+	KeyframeIndexCache cache(dir());
+	auto const index = cache.load(m_media, "video");
+	ASSERT_NE(nullptr, index);
+	EXPECT_EQ(10u, index->keyframes().size());
+	auto const keyframe = index->before(5.5);
+	ASSERT_NE(nullptr, keyframe);
+	EXPECT_DOUBLE_EQ(5.0, keyframe->time);
+	EXPECT_EQ('K', packetTypeAt(keyframe->pos));
+	EXPECT_EQ(nullptr, cache.load(m_media, "audio"));  // Streams are indexed separately
+}
+
+TEST_F(UnitTest_KeyframeIndex, edited_file_is_indexed_again) {
+	KeyframeIndexCache cache(dir());
+	cache.build(m_media, "video", scan(m_media));
+	cache.flush();
+	generate("video.ts", 100);  // Different size
+
+	EXPECT_EQ(nullptr, cache.load(m_media, "video"));
+	cache.build(m_media, "video", scan(m_media));
+	cache.flush();
+	auto const index = cache.load(m_media, "video");
+	ASSERT_NE(nullptr, index);
+	EXPECT_EQ(4u, index->keyframes().size());
+}
+
+TEST_F(UnitTest_KeyframeIndex, builds_once) {
+	KeyframeIndexCache cache(dir());
+	unsigned calls = 0;
+	cache.build(m_media, "video", scan(m_media, &calls));
+	cache.flush();
+	cache.build(m_media, "video", scan(m_media, &calls));
+	cache.flush();
+	EXPECT_EQ(1u, calls);
+
+	// Nor is a file that cannot be indexed tried again
+	auto const text = m_root / "notes.txt";
+	fs::ofstream(text) << std::string(1000, 'x');
+	cache.build(text, "video", scan(text, &calls));
+	cache.flush();
+	cache.build(text, "video", scan(text, &calls));
+	cache.flush();
+	EXPECT_EQ(2u, calls);
+	EXPECT_EQ(nullptr, cache.load(text, "video"));
+}
+
+TEST_F(UnitTest_KeyframeIndex, rejects_other_and_corrupt_files) {
+	KeyframeIndex index;
+	index.add(0.0, 0);
+	index.add(1.0, 188);
+	auto const file = m_root / "index.keys";
+	index.save(file, "id");
+
+	ASSERT_TRUE(KeyframeIndex::load(file, "id").has_value());
+	EXPECT_EQ(2u, KeyframeIndex::load(file, "id")->keyframes().size());
+	EXPECT_FALSE(KeyframeIndex::load(file, "other").has_value());
+	fs::resize_file(file, fs::file_size(file) - 1);  // Truncated
+	EXPECT_FALSE(KeyframeIndex::load(file, "id").has_value());
+	EXPECT_FALSE(KeyframeIndex::load(m_media, "id").has_value());
+	EXPECT_FALSE(KeyframeIndex::load(m_root / "missing.keys", "id").has_value());
+}
@@ -0,0 +1,138 @@
+#include "common.hh"
+
+#include "game/latencyprobe.hh"
+
+#include <random>
+#include <vector>
+
+namespace {
+	std::vector<float> chirpAt(double rate) {
+		std::vector<float> chirp(static_cast<std::size_t>(LatencyProbe::chirpDuration.count() * rate));
+		for (std::size_t i = 0; i < chirp.size(); ++i) chirp[i] = LatencyProbe::chirp(Seconds(static_cast<double>(i) / rate));
+		return chirp;
+	}
+
+	/**
+	* Stand-in for a speaker and a mic next to it, on devices with their own rates and block sizes.
+	* Whatever the playback callbacks output is heard by the capture callbacks after the given delay.
+	**/
+	struct Loopback {
+		double outRate, inRate;
+		std::size_t outFrames, inFrames;
+		Seconds delay;
+		float gain = 0.3f;
+		float noise = 0.01f;
+		Time start = Clock::now();
+		std::vector<float> played;  ///< Left channel of everything played, from start on
+		std::mt19937 gen{ 42 };
+
+		/// Run the callbacks in time order until the probe is done, return false if that does not happen
+		bool run(LatencyProbe& probe) {
+			std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+			std::vector<float> out(2 * outFrames), in(inFrames);
+			std::size_t outBlocks = 0, inBlocks = 0;
+			while (!probe.done()) {
+				Seconds const outTime = Seconds(static_cast<double>(outBlocks * outFrames) / outRate);
+				Seconds const inTime = Seconds(static_cast<double>(inBlocks * inFrames) / inRate);
+				if (std::min(outTime, inTime) > 10.0s) return false;
+				if (outTime <= inTime) {
+					std::fill(out.begin(), out.end(), 0.0f);
+					probe.output(out.data(), out.data() + out.size(), outRate, start + clockDur(outTime));
+					for (std::size_t i = 0; i < outFrames; ++i) played.push_back(out[2 * i]);
+					++outBlocks;
+				} else {
+					for (std::size_t i = 0; i < inFrames; ++i) {
+						// Linear interpolation of what was played at the time of this sample minus the delay
+						double const pos = ((inTime - delay).count() + static_cast<double>(i) / inRate) * outRate;
+						float value = 0.0f;
+						if (pos >= 0.0 && pos + 1.0 < static_cast<double>(played.size())) {
+							auto const j = static_cast<std::size_t>(pos);
+							float const frac = static_cast<float>(pos - static_cast<double>(j));
+							value = played[j] + (played[j + 1] - played[j]) * frac;
+						}
+						in[i] = gain * value + noise * dist(gen);
+					}
+					probe.input(in.begin(), in.end(), start + clockDur(inTime));
+					++inBlocks;
+				}
+			}
+			return true;
+		}
+	};
+}
+
+TEST(UnitTest_LatencyProbe, finds_delayed_signal) {
+	auto const chirp = chirpAt(48000.0);
+	std::vector<float> signal(48000, 0.0f);
+	for (std::size_t i = 0; i < chirp.size(); ++i) signal[1234 + i] = -0.5f * chirp[i];  // Quieter and inverted
+
+	auto const match = findSignal(signal, chirp);
+
+	EXPECT_NEAR(1234.0, match.lag, 0.01);
+	EXPECT_NEAR(1.0, match.score, 1e-3);
+}
+
+TEST(UnitTest_LatencyProbe, finds_nothing_in_noise) {
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+	std::vector<float> signal(48000);
+	for (auto& x: signal) x = dist(gen);
+
+	EXPECT_LT(findSignal(signal, chirpAt(48000.0)).score, LatencyProbe::minScore);
+}
+
+TEST(UnitTest_LatencyProbe, measures_loopback_round_trip) {
+	for (auto const outRate: { 44100.0, 48000.0 }) {
+		for (auto const inRate: { 44100.0, 48000.0, 96000.0 }) {
+			LatencyProbe probe;
+			Loopback loopback{ outRate, inRate, 256, 441, 0.0873s };
+			ASSERT_TRUE(probe.start(nullptr, inRate));
+			ASSERT_TRUE(loopback.run(probe));
+
+			auto const result = probe.result();
+			ASSERT_TRUE(result.has_value()) << "out " << outRate << " Hz, in " << inRate << " Hz";
+			EXPECT_NEAR(0.0873, result->roundTrip.count(), 0.2e-3) << "out " << outRate << " Hz, in " << inRate << " Hz";
+			EXPECT_GT(result->score, 0.9);
+		}
+	}
+}
+
+TEST(UnitTest_LatencyProbe, fails_without_loopback) {
+	LatencyProbe probe;
+	Loopback loopback{ 48000.0, 48000.0, 256, 256, 0.05s };
+	loopback.gain = 0.0f;  // Mic unplugged
+	ASSERT_TRUE(probe.start(nullptr, 48000.0));
+	ASSERT_TRUE(loopback.run(probe));
+
+	EXPECT_FALSE(probe.result().has_value());
+}
+
+TEST(UnitTest_LatencyProbe, one_measurement_at_a_time) {
+	LatencyProbe probe;
+	EXPECT_TRUE(probe.done());
+	EXPECT_FALSE(probe.result().has_value());  // Nothing measured yet
+	ASSERT_TRUE(probe.start(nullptr, 48000.0));
+	EXPECT_FALSE(probe.done());
+	EXPECT_FALSE(probe.start(nullptr, 48000.0));
+
+	Loopback loopback{ 48000.0, 48000.0, 256, 256, 0.05s };
+	ASSERT_TRUE(loopback.run(probe));
+	EXPECT_TRUE(probe.start(nullptr, 48000.0));  // Can be repeated once done
+}
+
+TEST(UnitTest_LatencyProbe, cancelled_measurement_can_be_retried) {
+	LatencyProbe probe;
+	ASSERT_TRUE(probe.start(nullptr, 48000.0));
+	probe.cancel();  // As if the devices stopped before it was done
+	EXPECT_TRUE(probe.done());
+	EXPECT_FALSE(probe.result().has_value());
+
+	ASSERT_TRUE(probe.start(nullptr, 48000.0));
+	EXPECT_FALSE(probe.done());
+	Loopback loopback{ 48000.0, 48000.0, 256, 256, 0.05s };
+	ASSERT_TRUE(loopback.run(probe));
+	probe.cancel();  // Too late, the result is kept
+	auto const result = probe.result();
+	ASSERT_TRUE(result.has_value());
+	EXPECT_NEAR(0.05, result->roundTrip.count(), 0.2e-3);
+}
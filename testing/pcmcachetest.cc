@@ -0,0 +1,204 @@
+#include "common.hh"
+#include "benchmark.hh"
+
+#include "game/pcmcache.hh"
+
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+	/// Creates a fresh cache directory and a source "song" file, removing both afterwards
+	class UnitTest_PcmCache : public ::testing::Test {
+	  protected:
+		UnitTest_PcmCache() { m_song = source("song.ogg"); }
+
+		fs::path source(std::string const& name) {
+			auto const path = m_root / name;
+			fs::ofstream(path) << "not really " << name;
+			return path;
+		}
+		fs::path dir() const { return m_root / "cache"; }
+
+		static std::int16_t valueAt(std::int64_t pos) { return static_cast<std::int16_t>(pos % 20000 - 10000); }
+		/// A job that "decodes" samples in frames of 1000
+		static PcmCache::Job decode(std::int64_t samples, PcmInfo info = PcmInfo{ 12.5, -3.0, 0.7 }) {
+			return [samples, info](PcmCache::Writer& writer) {
+				std::vector<std::int16_t> frame(1000);
+				for (std::int64_t pos = 0; pos < samples && !writer.cancelled(); pos += 1000) {
+					for (std::int64_t i = 0; i < 1000; ++i) frame[static_cast<std::size_t>(i)] = valueAt(pos + i);
+					writer(frame.data(), std::min<std::int64_t>(1000, samples - pos), pos);
+				}
+				return info;
+			};
+		}
+		std::size_t filesInCache() const {
+			std::size_t count = 0;
+			std::error_code ec;
+			for (auto it = fs::directory_iterator(dir(), ec); !ec && it != fs::directory_iterator(); it.increment(ec)) ++count;
+			return count;
+		}
+
+		TempDir m_root{ "pcmcache" };
+		fs::path m_song;
+	};
+}
+
+TEST_F(UnitTest_PcmCache, stores_in_background_and_loads_mapped) {
+	PcmCache cache(dir(), 100000000);
+	EXPECT_EQ(nullptr, cache.load(m_song, "48000"));
+
+	cache.store(m_song, "48000", decode(4500));
+	cache.flush();
+	auto const entry = cache.load(m_song, "48000");
+
+	ASSERT_NE(nullptr, entry);
+	ASSERT_EQ(4500, entry->size());
+	for (std::int64_t i = 0; i < 4500; ++i) ASSERT_EQ(valueAt(i), entry->data()[i]) << i;
+	EXPECT_DOUBLE_EQ(12.5, entry->info().duration);
+	EXPECT_DOUBLE_EQ(-3.0, entry->info().replayGainDecibels);
+	EXPECT_DOUBLE_EQ(0.7, entry->info().replayGainFactor);
+}
+
+TEST_F(UnitTest_PcmCache, writer_fills_gaps_and_skips_overlap) {
+	PcmCache cache(dir(), 100000000);
+	cache.store(m_song, "48000", [](PcmCache::Writer& writer) {
+		std::int16_t const a[] = { 1, 2, 3, 4 };
+		std::int16_t const b[] = { 3, 4, 5, 6 };
+		std::int16_t const c[] = { 9, 9 };
+		writer(a, 4, 2);  // Stream starting later: silence before
+		writer(b, 4, 4);  // Overlaps two samples already written
+		writer(c, 2, 10);  // Gap of two samples
+		return PcmInfo();
+	});
+	cache.flush();
+	auto const entry = cache.load(m_song, "48000");
+
+	ASSERT_NE(nullptr, entry);
+	EXPECT_THAT(std::vector<std::int16_t>(entry->data(), entry->data() + entry->size()), ElementsAre(0, 0, 1, 2, 3, 4, 5, 6, 0, 0, 9, 9));
+}
+
+TEST_F(UnitTest_PcmCache, format_and_source_changes_are_cached_separately) {
+	PcmCache cache(dir(), 100000000);
+	cache.store(m_song, "48000", decode(100));
+	cache.flush();
+
+	EXPECT_EQ(nullptr, cache.load(m_song, "44100"));
+	EXPECT_EQ(nullptr, cache.load(source("other.ogg"), "48000"));
+	fs::ofstream(m_song, std::ios::app) << "edited";
+	EXPECT_EQ(nullptr, cache.load(m_song, "48000"));
+}
+
+TEST_F(UnitTest_PcmCache, failed_job_leaves_nothing_behind) {
+	PcmCache cache(dir(), 100000000);
+	cache.store(m_song, "48000", [](PcmCache::Writer& writer) -> PcmInfo {
+		std::int16_t const data[100] = {};
+		writer(data, 100, 0);
+		throw std::runtime_error("Decoding failed");
+	});
+	cache.flush();
+
+	EXPECT_EQ(nullptr, cache.load(m_song, "48000"));
+	EXPECT_EQ(0u, filesInCache());
+}
+
+TEST_F(UnitTest_PcmCache, evicts_least_recently_used) {
+	// Room for two tracks of 10000 samples (20 kB each) but not three
+	PcmCache cache(dir(), 50000);
+	auto const songs = std::vector<fs::path>{ source("a.ogg"), source("b.ogg"), source("c.ogg") };
+	cache.store(songs[0], "48000", decode(10000));
+	cache.flush();
+	cache.store(songs[1], "48000", decode(10000));
+	cache.flush();
+	// Both were used an hour ago, then a is played again
+	for (auto const& entry: fs::directory_iterator(dir())) fs::last_write_time(entry.path(), fs::file_time_type::clock::now() - std::chrono::hours(1));
+	EXPECT_NE(nullptr, cache.load(songs[0], "48000"));
+
+	cache.store(songs[2], "48000", decode(10000));
+	cache.flush();
+
+	EXPECT_NE(nullptr, cache.load(songs[0], "48000"));
+	EXPECT_EQ(nullptr, cache.load(songs[1], "48000"));
+	EXPECT_NE(nullptr, cache.load(songs[2], "48000"));
+}
+
+TEST_F(UnitTest_PcmCache, records_a_complete_playback) {
+	PcmCache cache(dir(), 100000000);
+	auto recorder = cache.record(m_song, "48000");
+	ASSERT_NE(nullptr, recorder);
+	EXPECT_EQ(nullptr, cache.record(m_song, "48000"));  // Already being recorded
+
+	std::vector<std::int16_t> frame(1000);
+	for (std::int64_t pos = 0; pos < 4500; pos += 1000) {
+		for (std::int64_t i = 0; i < 1000; ++i) frame[static_cast<std::size_t>(i)] = valueAt(pos + i);
+		(*recorder)(frame.data(), std::min<std::int64_t>(1000, 4500 - pos), pos);
+	}
+	EXPECT_EQ(nullptr, cache.load(m_song, "48000"));
+	recorder->finish(PcmInfo{ 12.5, -3.0, 0.7 });
+	EXPECT_TRUE(recorder->done());
+	recorder.reset();
+
+	auto const entry = cache.load(m_song, "48000");
+	ASSERT_NE(nullptr, entry);
+	ASSERT_EQ(4500, entry->size());
+	for (std::int64_t i = 0; i < 4500; ++i) ASSERT_EQ(valueAt(i), entry->data()[i]) << i;
+	EXPECT_DOUBLE_EQ(12.5, entry->info().duration);
+	EXPECT_EQ(nullptr, cache.record(m_song, "48000"));  // Cached already
+	EXPECT_EQ(1u, filesInCache());
+}
+
+TEST_F(UnitTest_PcmCache, recording_is_abandoned_by_seeking) {
+	PcmCache cache(dir(), 100000000);
+	std::vector<std::int16_t> const frame(1000);
+	{
+		// A preview, starting in the middle of the song
+		auto recorder = cache.record(m_song, "48000");
+		(*recorder)(frame.data(), 1000, 30000);
+		EXPECT_TRUE(recorder->done());
+	}
+	EXPECT_EQ(0u, filesInCache());
+	auto recorder = cache.record(m_song, "48000");
+	(*recorder)(frame.data(), 1000, 0);
+	(*recorder)(frame.data(), 1000, 1000);
+	EXPECT_FALSE(recorder->done());
+	(*recorder)(frame.data(), 1000, 500);
+	EXPECT_TRUE(recorder->done());
+	EXPECT_EQ(0u, filesInCache());
+
+	recorder->finish(PcmInfo());
+	EXPECT_EQ(nullptr, cache.load(m_song, "48000"));
+}
+
+TEST_F(UnitTest_PcmCache, shares_the_worker_with_other_caches) {
+	PcmCache cache(dir(), 100000000);
+	{
+		// Destroying a cache while it is writing does not stop the others
+		PcmCache other(m_root / "other", 100000000);
+		other.store(m_song, "48000", decode(100000000));
+		cache.store(m_song, "48000", decode(4500));
+	}
+	cache.flush();
+
+	auto const entry = cache.load(m_song, "48000");
+	ASSERT_NE(nullptr, entry);
+	EXPECT_EQ(4500, entry->size());
+}
+
+TEST_F(UnitTest_PcmCache, DISABLED_Benchmark_time_to_first_sample) {
+	// A four minute stereo song at 48 kHz
+	std::int64_t const samples = 4 * 60 * 48000 * 2;
+	PcmCache cache(dir(), 1000000000);
+	cache.store(m_song, "48000", decode(samples));
+	cache.flush();
+
+	std::vector<float> out(1024);
+	auto const us = benchmark([&] {
+		auto const entry = cache.load(m_song, "48000");
+		if (!entry) throw std::logic_error("Benchmark song not cached");
+		// Like AudioBuffer: first block from the middle of the song (e.g. a preview)
+		std::int16_t const* data = entry->data() + samples / 2;
+		for (std::size_t i = 0; i < out.size(); ++i) out[i] = data[i] / 32767.0f;
+	}, 100);
+	report("PcmCache time to first sample (cached, mapped)", us);
+	// For real songs, with and without the cache: performous-analyze --first-sample
+}
@@ -0,0 +1,164 @@
+#include "common.hh"
+#include "allocationcounter.hh"
+#include "benchmark.hh"
+
+#include "game/analyzer.hh"
+#include "game/libda/resample.hpp"
+
+#include <cmath>
+#include <vector>
+
+namespace {
+	std::vector<float> sine(double frequency, double rate, std::size_t size, float amplitude = 0.5f) {
+		auto result = std::vector<float>(size);
+		for (auto i = 0u; i < size; ++i)
+			result[i] = amplitude * static_cast<float>(std::sin(da::tau * frequency * i / rate));
+		return result;
+	}
+
+	/// Amplitude of frequency within samples (single bin DFT)
+	double amplitudeAt(std::vector<float> const& samples, double frequency, double rate) {
+		double re = 0.0, im = 0.0;
+		for (auto i = 0u; i < samples.size(); ++i) {
+			re += samples[i] * std::cos(da::tau * frequency * i / rate);
+			im += samples[i] * std::sin(da::tau * frequency * i / rate);
+		}
+		return 2.0 * std::hypot(re, im) / static_cast<double>(samples.size());
+	}
+}
+
+TEST(UnitTest_LanczosResampler, integer_positions_return_the_input) {
+	auto const resampler = da::LanczosResampler<>();
+	auto const in = sine(1000.0, 48000.0, 64);
+	auto out = std::vector<float>(32);
+
+	resampler.process(in.data(), 1.0, 1.0, out.size(), [&](std::size_t i, float s) { out[i] = s; });
+
+	for (auto i = 0u; i < out.size(); ++i)
+		EXPECT_NEAR(in[i + 1], out[i], 1e-6) << i;
+}
+
+TEST(UnitTest_LanczosResampler, position_just_below_an_integer) {
+	auto const resampler = da::LanczosResampler<>();
+	auto const in = sine(1000.0, 48000.0, 16);
+	auto out = 0.0f;
+
+	// The fraction is so close to one that it rounds up to the last phase of the table
+	resampler.process(in.data(), 5.0 - 1e-9, 1.0, 1, [&](std::size_t, float s) { out = s; });
+
+	EXPECT_NEAR(in[5], out, 1e-6);
+}
+
+TEST(UnitTest_LanczosResampler, matches_the_direct_kernel_evaluation) {
+	auto const resampler = da::LanczosResampler<>();
+	auto const in = sine(3000.0, 48000.0, 512);
+	auto const step = 48000.0 / 44100.0;
+	auto const n = std::size_t(400);
+	auto out = std::vector<float>(n);
+
+	auto const end = resampler.process(in.data(), 1.25, step, n, [&](std::size_t i, float s) { out[i] = s; });
+
+	EXPECT_NEAR(1.25 + step * n, end, 1e-9);
+	EXPECT_LE(da::LanczosResampler<>::inputSize(1.25, step, n), in.size());
+	for (auto i = 0u; i < n; ++i) {
+		auto const pos = 1.25 + step * i;
+		auto const k = static_cast<std::size_t>(pos);
+		auto expected = 0.0, sum = 0.0;
+		for (auto j = 0u; j < 4; ++j) {
+			auto const w = da::lanc<2>(pos - static_cast<double>(k - 1 + j));
+			expected += w * in[k - 1 + j];
+			sum += w;
+		}
+		EXPECT_NEAR(expected / sum, out[i], 2e-4) << i;
+	}
+}
+
+TEST(UnitTest_LanczosResampler, is_centred_on_the_position) {
+	auto const resampler = da::LanczosResampler<>();
+	auto const in = sine(1000.0, 48000.0, 64);
+	auto const step = 48000.0 / 44100.0;
+	auto out = std::vector<float>(32);
+
+	resampler.process(in.data(), 3.5, step, out.size(), [&](std::size_t i, float s) { out[i] = s; });
+
+	// The tone itself at the positions, not delayed by the taps
+	for (auto i = 0u; i < out.size(); ++i)
+		EXPECT_NEAR(0.5 * std::sin(da::tau * 1000.0 * (3.5 + step * i) / 48000.0), out[i], 2e-3) << i;
+}
+
+TEST(UnitTest_LanczosResampler, resampled_tone_keeps_its_pitch) {
+	auto const resampler = da::LanczosResampler<>();
+	auto const in = sine(440.0, 48000.0, 48000);
+	auto out = std::vector<float>(40000);
+
+	resampler.process(in.data(), 1.0, 48000.0 / 44100.0, out.size(), [&](std::size_t i, float s) { out[i] = s; });
+
+	EXPECT_NEAR(0.5, amplitudeAt(out, 440.0, 44100.0), 0.01);
+	EXPECT_NEAR(0.0, amplitudeAt(out, 440.0 * 48000.0 / 44100.0, 44100.0), 0.01);
+}
+
+TEST(UnitTest_AnalyzerPassthrough, mixes_input_into_both_channels) {
+	auto analyzer = Analyzer(48000, "id");
+	auto const in = sine(440.0, 48000.0, 1024, 0.1f);
+	analyzer.input(in.begin(), in.end());
+	auto out = std::vector<float>(2 * 256, 0.25f);
+
+	analyzer.output(out.data(), out.data() + out.size(), 48000);
+
+	for (auto i = 0u; i < 256; ++i) {
+		EXPECT_FLOAT_EQ(out[2 * i], out[2 * i + 1]) << i;
+		EXPECT_NEAR(0.25f + 5.0f * in[i + 1], out[2 * i], 1e-4) << i;
+	}
+}
+
+TEST(UnitTest_AnalyzerPassthrough, keeps_the_pitch_at_every_output_rate) {
+	for (auto const rate : {44100.0, 48000.0, 96000.0}) {
+		auto analyzer = Analyzer(48000, "id");
+		auto const in = sine(440.0, 48000.0, 2048, 0.1f);
+		analyzer.input(in.begin(), in.end());
+		auto const frames = static_cast<std::size_t>(rate / 48000.0 * 1024);
+		auto out = std::vector<float>(2 * frames);
+
+		analyzer.output(out.data(), out.data() + out.size(), rate);
+
+		auto left = std::vector<float>(frames);
+		for (auto i = 0u; i < frames; ++i) left[i] = out[2 * i];
+		EXPECT_NEAR(0.5, amplitudeAt(left, 440.0, rate), 0.02) << rate << " Hz";
+	}
+}
+
+TEST(UnitTest_AnalyzerPassthrough, underrun_leaves_output_untouched) {
+	auto analyzer = Analyzer(48000, "id");
+	auto const in = sine(440.0, 48000.0, 100);
+	analyzer.input(in.begin(), in.end());
+	auto out = std::vector<float>(2 * 256, 0.25f);
+
+	analyzer.output(out.data(), out.data() + out.size(), 48000);
+
+	EXPECT_THAT(out, ::testing::Each(0.25f));
+}
+
+TEST(UnitTest_AnalyzerPassthrough, output_does_not_allocate) {
+	auto analyzer = Analyzer(48000, "id");
+	auto const in = sine(440.0, 48000.0, 256);
+	auto out = std::vector<float>(2 * 240);
+
+	for (auto i = 0; i < 100; ++i) {
+		analyzer.input(in.begin(), in.end());
+		AllocationCounter allocations;
+		analyzer.output(out.data(), out.data() + out.size(), 44100);
+
+		EXPECT_THAT(allocations.count(), 0) << "round " << i;
+	}
+}
+
+TEST(UnitTest_AnalyzerPassthrough, DISABLED_Benchmark_output) {
+	auto analyzer = Analyzer(48000, "id");
+	auto const in = sine(440.0, 48000.0, 256);
+	auto out = std::vector<float>(2 * 256);
+
+	report("Analyzer::output, 256 frames at 44.1 kHz", benchmark([&] {
+		analyzer.input(in.begin(), in.end());
+		analyzer.output(out.data(), out.data() + out.size(), 44100);
+	}, 100000));
+}
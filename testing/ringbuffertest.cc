@@ -1,7 +1,12 @@
 #include "common.hh"
+#include "benchmark.hh"
 
 #include "game/ringbuffer.hh"
 
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
 TEST(UnitTest_RingBuffer, default_ctor) {
@@ -134,3 +139,170 @@ TEST(UnitTest_RingBuffer, read_underflow) {
 	EXPECT_THAT(dataOut, ElementsAre(0.f, 0.f, 0.f, 0.f));
 }
 
+
+TEST(UnitTest_RingBuffer, wraps_around) {
+	auto buffer = RingBuffer<8>();
+	auto next = 0.f;
+	auto expected = 0.f;
+
+	for (auto round = 0; round < 20; ++round) {
+		auto const dataIn = std::vector<float>{next, next + 1.f, next + 2.f};
+		next += 3.f;
+		buffer.insert(dataIn.begin(), dataIn.end());
+
+		auto dataOut = std::vector<float>(3);
+
+		ASSERT_TRUE(buffer.read(dataOut.begin(), dataOut.end()));
+		EXPECT_THAT(dataOut, ElementsAre(expected, expected + 1.f, expected + 2.f));
+		buffer.pop(3);
+		expected += 3.f;
+		EXPECT_EQ(0, buffer.size());
+	}
+	EXPECT_EQ(0, buffer.dropped());
+}
+
+TEST(UnitTest_RingBuffer, insert_more_than_capacity_at_once) {
+	auto buffer = RingBuffer<4>();
+	auto const dataIn = std::vector<float>{1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f, 9.f};
+
+	buffer.insert(dataIn.begin(), dataIn.end());
+
+	auto dataOut = std::vector<float>(4);
+
+	EXPECT_TRUE(buffer.read(dataOut.begin(), dataOut.end()));
+	EXPECT_THAT(dataOut, ElementsAre(6.f, 7.f, 8.f, 9.f));
+}
+
+TEST(UnitTest_RingBuffer, reader_counts_dropped_samples) {
+	auto buffer = RingBuffer<4>();
+	auto const dataIn = std::vector<float>{1.f, 2.f, 3.f, 4.f, 5.f, 6.f};
+
+	buffer.insert(dataIn.begin(), dataIn.end());
+
+	EXPECT_EQ(0, buffer.dropped());  // Only detected when reading
+
+	auto dataOut = std::vector<float>(1);
+
+	EXPECT_TRUE(buffer.read(dataOut.begin(), dataOut.end()));
+	EXPECT_EQ(2, buffer.dropped());
+	EXPECT_THAT(dataOut, ElementsAre(3.f));
+}
+
+TEST(UnitTest_RingBuffer, cursor_starts_at_write_position) {
+	auto buffer = RingBuffer<16>();
+	auto const dataIn = std::vector<float>{1.f, 2.f, 3.f};
+
+	buffer.insert(dataIn.begin(), dataIn.end());
+	auto cursor = buffer.cursor();
+
+	EXPECT_EQ(0, buffer.size(cursor));
+
+	buffer.insert(dataIn.begin(), dataIn.end());
+
+	EXPECT_EQ(3, buffer.size(cursor));
+	EXPECT_EQ(6, buffer.size());
+}
+
+TEST(UnitTest_RingBuffer, cursor_reads_independently) {
+	auto buffer = RingBuffer<16>();
+	auto cursor = buffer.cursor();
+	auto const dataIn = std::vector<float>{1.f, 2.f, 3.f, 4.f};
+
+	buffer.insert(dataIn.begin(), dataIn.end());
+
+	auto dataOut = std::vector<float>(2);
+
+	EXPECT_TRUE(buffer.read(cursor, dataOut.begin(), dataOut.end()));
+	buffer.pop(cursor, 2);
+	EXPECT_THAT(dataOut, ElementsAre(1.f, 2.f));
+	EXPECT_EQ(2, buffer.size(cursor));
+	EXPECT_EQ(4, buffer.size());
+
+	EXPECT_TRUE(buffer.read(cursor, dataOut.begin(), dataOut.end()));
+	EXPECT_THAT(dataOut, ElementsAre(3.f, 4.f));
+	EXPECT_TRUE(buffer.read(dataOut.begin(), dataOut.end()));
+	EXPECT_THAT(dataOut, ElementsAre(1.f, 2.f));
+}
+
+TEST(UnitTest_RingBuffer, cursor_skips_overwritten_data) {
+	auto buffer = RingBuffer<4>();
+	auto cursor = buffer.cursor();
+	auto const dataIn = std::vector<float>{1.f, 2.f, 3.f, 4.f, 5.f, 6.f};
+
+	buffer.insert(dataIn.begin(), dataIn.end());
+
+	auto dataOut = std::vector<float>(4);
+
+	EXPECT_EQ(4, buffer.size(cursor));
+	EXPECT_TRUE(buffer.read(cursor, dataOut.begin(), dataOut.end()));
+	EXPECT_THAT(dataOut, ElementsAre(3.f, 4.f, 5.f, 6.f));
+	EXPECT_EQ(0, buffer.dropped());  // The main reader has not noticed yet
+}
+
+namespace {
+	/// Read chunks of sequential numbers and check that every chunk is intact and newer than the previous one
+	template <typename Read, typename Pop> void checkSequence(std::atomic<bool> const& done, Read read, Pop pop, std::string const& name) {
+		auto chunk = std::vector<float>(48);
+		auto last = -1.f;
+		auto chunks = 0u;
+		for (auto n = std::size_t(1);; n = n % chunk.size() + 1) {
+			auto const finished = done.load();
+			if (!read(chunk.begin(), chunk.begin() + static_cast<std::ptrdiff_t>(n))) {
+				if (finished) break;
+				std::this_thread::yield();
+				continue;
+			}
+			pop(static_cast<std::ptrdiff_t>(n));
+			ASSERT_GT(chunk[0], last) << name;
+			for (auto i = std::size_t(1); i < n; ++i) ASSERT_EQ(chunk[i - 1] + 1.f, chunk[i]) << name << " at " << i;
+			last = chunk[n - 1];
+			++chunks;
+		}
+		EXPECT_GT(chunks, 0u) << name;
+	}
+}
+
+TEST(UnitTest_RingBuffer, stress_writer_and_two_readers) {
+	auto buffer = RingBuffer<256>();
+	auto cursor = buffer.cursor();
+	auto done = std::atomic<bool>(false);
+	auto constexpr total = 1 << 22;  // Exactly representable in float
+
+	auto mainReader = std::thread([&] {
+		checkSequence(done,
+			[&](auto begin, auto end) { return buffer.read(begin, end); },
+			[&](std::ptrdiff_t n) { buffer.pop(n); },
+			"main reader");
+	});
+	auto cursorReader = std::thread([&] {
+		checkSequence(done,
+			[&](auto begin, auto end) { return buffer.read(cursor, begin, end); },
+			[&](std::ptrdiff_t n) { buffer.pop(cursor, n); },
+			"cursor reader");
+	});
+	auto chunk = std::vector<float>(300);
+	auto value = 0.f;
+	for (auto written = 0, n = 1; written < total; written += n, n = n % 293 + 7) {
+		for (auto i = 0; i < n; ++i) chunk[i] = value++;
+		buffer.insert(chunk.begin(), chunk.begin() + n);
+	}
+	done = true;
+	mainReader.join();
+	cursorReader.join();
+}
+
+TEST(UnitTest_RingBuffer, DISABLED_Benchmark_throughput) {
+	auto buffer = RingBuffer<4096>();
+	auto const dataIn = std::vector<float>(256, 0.5f);
+	auto dataOut = std::vector<float>(1024);
+	// Keep a backlog like the analyzer does: read a window of 1024 and advance by 256
+	buffer.insert(dataOut.begin(), dataOut.end());
+
+	auto const us = benchmark([&] {
+		buffer.insert(dataIn.begin(), dataIn.end());
+		if (!buffer.read(dataOut.begin(), dataOut.end())) throw std::logic_error("Benchmark buffer underrun");
+		buffer.pop(256);
+	}, 100000);
+	report("RingBuffer insert 256 + read 1024 + pop 256", us);
+	report("RingBuffer throughput", (256.0 + 1024.0) / us, "Msamples/s");
+}
@@ -0,0 +1,93 @@
+#include "common.hh"
+#include "allocationcounter.hh"
+
+#include "game/spscqueue.hh"
+
+#include <cstdint>
+#include <thread>
+
+TEST(UnitTest_SpscQueue, starts_empty) {
+	auto queue = SpscQueue<int, 4>();
+
+	EXPECT_TRUE(queue.empty());
+	EXPECT_EQ(nullptr, queue.front());
+}
+
+TEST(UnitTest_SpscQueue, items_come_out_in_order) {
+	auto queue = SpscQueue<int, 4>();
+
+	EXPECT_TRUE(queue.push(1));
+	EXPECT_TRUE(queue.push(2));
+	EXPECT_EQ(2, queue.size());
+
+	ASSERT_NE(nullptr, queue.front());
+	EXPECT_EQ(1, *queue.front());
+	EXPECT_EQ(1, *queue.front());  // front() does not consume
+	queue.pop();
+	ASSERT_NE(nullptr, queue.front());
+	EXPECT_EQ(2, *queue.front());
+	queue.pop();
+	EXPECT_TRUE(queue.empty());
+}
+
+TEST(UnitTest_SpscQueue, push_fails_when_full) {
+	auto queue = SpscQueue<int, 4>();
+
+	for (auto i = 0; i < 4; ++i) EXPECT_TRUE(queue.push(i));
+	EXPECT_FALSE(queue.push(4));
+	EXPECT_EQ(0, *queue.front());
+
+	queue.pop();
+	EXPECT_TRUE(queue.push(4));
+}
+
+TEST(UnitTest_SpscQueue, wraps_around) {
+	auto queue = SpscQueue<int, 4>();
+
+	for (auto i = 0; i < 100; ++i) {
+		EXPECT_TRUE(queue.push(i));
+		EXPECT_TRUE(queue.push(-i));
+		EXPECT_EQ(i, *queue.front());
+		queue.pop();
+		EXPECT_EQ(-i, *queue.front());
+		queue.pop();
+	}
+	EXPECT_TRUE(queue.empty());
+}
+
+TEST(UnitTest_SpscQueue, does_not_allocate) {
+	auto queue = SpscQueue<std::int64_t, 64>();
+	AllocationCounter allocations;
+
+	for (auto i = 0; i < 1000; ++i) {
+		queue.push(i);
+		queue.pop();
+	}
+
+	EXPECT_EQ(0, allocations.count());
+}
+
+TEST(UnitTest_SpscQueue, stress_producer_and_consumer) {
+	auto queue = SpscQueue<std::int64_t, 16>();
+	auto constexpr total = std::int64_t(1) << 16;
+
+	auto errors = 0;
+	auto consumer = std::thread([&] {
+		for (std::int64_t expected = 0; expected < total; ++expected) {
+			auto item = queue.front();
+			while (!item) {
+				std::this_thread::yield();
+				item = queue.front();
+			}
+			if (*item != expected) ++errors;
+			queue.pop();
+		}
+	});
+	for (std::int64_t i = 0; i < total;) {
+		if (queue.push(i)) ++i;
+		else std::this_thread::yield();
+	}
+	consumer.join();
+	EXPECT_EQ(0, errors);
+	EXPECT_TRUE(queue.empty());
+}
@@ -0,0 +1,87 @@
+#include "common.hh"
+#include "benchmark.hh"
+
+#include "game/libda/stemmix.hpp"
+
+#include <random>
+#include <vector>
+
+namespace {
+	struct Stems {
+		std::vector<std::vector<float>> data;
+		std::vector<float const*> pointers;
+		std::vector<da::gain_ramp> gains;
+
+		Stems(std::size_t count, std::size_t frames, unsigned seed = 42) {
+			std::mt19937 gen(seed);
+			std::uniform_real_distribution<float> sample(-1.0f, 1.0f);
+			std::uniform_real_distribution<float> gain(0.0f, 1.0f);
+			for (std::size_t s = 0; s < count; ++s) {
+				data.emplace_back(2 * frames);
+				for (auto& x: data.back()) x = sample(gen);
+				pointers.push_back(data.back().data());
+				gains.push_back({ gain(gen), gain(gen) });
+			}
+		}
+	};
+}
+
+TEST(UnitTest_StemMix, matches_scalar_mixer) {
+	for (std::size_t count: { 0u, 1u, 2u, 5u, 8u }) {
+		for (std::size_t frames: { 1u, 3u, 4u, 7u, 256u, 511u, 512u }) {
+			Stems stems(count, frames);
+			auto expected = std::vector<float>(2 * frames, 0.25f);
+			auto actual = expected;
+			da::mix_stems_scalar(expected.data(), stems.pointers.data(), stems.gains.data(), count, frames);
+			da::mix_stems(actual.data(), stems.pointers.data(), stems.gains.data(), count, frames);
+			for (std::size_t i = 0; i < expected.size(); ++i) {
+				ASSERT_NEAR(expected[i], actual[i], 1e-6f) << "count=" << count << " frames=" << frames << " i=" << i;
+			}
+		}
+	}
+}
+
+TEST(UnitTest_StemMix, ramps_gain_per_frame) {
+	std::size_t const frames = 8;
+	auto const ones = std::vector<float>(2 * frames, 1.0f);
+	float const* stems[] = { ones.data() };
+	da::gain_ramp const gains[] = { { 0.0f, 1.0f } };
+	auto out = std::vector<float>(2 * frames, 0.0f);
+
+	da::mix_stems(out.data(), stems, gains, 1, frames);
+
+	for (std::size_t f = 0; f < frames; ++f) {
+		EXPECT_FLOAT_EQ(static_cast<float>(f) / frames, out[2 * f]);
+		EXPECT_FLOAT_EQ(out[2 * f], out[2 * f + 1]);  // Both channels of a frame get the same gain
+	}
+}
+
+TEST(UnitTest_StemMix, adds_to_output) {
+	std::size_t const frames = 5;
+	auto const a = std::vector<float>(2 * frames, 0.5f);
+	auto const b = std::vector<float>(2 * frames, -0.25f);
+	float const* stems[] = { a.data(), b.data() };
+	da::gain_ramp const gains[] = { { 1.0f, 1.0f }, { 2.0f, 2.0f } };
+	auto out = std::vector<float>(2 * frames, 1.0f);
+
+	da::mix_stems(out.data(), stems, gains, 2, frames);
+
+	EXPECT_THAT(out, ::testing::Each(FloatEq(1.0f)));
+}
+
+TEST(UnitTest_StemMix, DISABLED_Benchmark_eight_stems) {
+	std::size_t const frames = 512;
+	Stems stems(8, frames);
+	auto const count = stems.pointers.size();
+	auto out = std::vector<float>(2 * frames);
+
+	auto const scalar = benchmark([&] {
+		da::mix_stems_scalar(out.data(), stems.pointers.data(), stems.gains.data(), count, frames);
+	}, 20000);
+	auto const simd = benchmark([&] {
+		da::mix_stems(out.data(), stems.pointers.data(), stems.gains.data(), count, frames);
+	}, 20000);
+	report("Scalar mix of 8 stems x 512 frames", scalar);
+	report("SIMD mix of 8 stems x 512 frames", simd);
+	report("Speedup", scalar / simd, "x");
+}
@@ -0,0 +1,53 @@
+#include "common.hh"
+
+#include "game/synth.hh"
+#include "game/util.hh"
+
+#include <cmath>
+#include <vector>
+
+namespace {
+	/// Amplitude of frequency within the left channel of interleaved stereo samples (single bin DFT)
+	double amplitudeAt(std::vector<float> const& stereo, double frequency, double rate) {
+		double re = 0.0, im = 0.0;
+		auto const frames = stereo.size() / 2;
+		for (auto i = 0u; i < frames; ++i) {
+			re += stereo[2 * i] * std::cos(TAU * frequency * i / rate);
+			im += stereo[2 * i] * std::sin(TAU * frequency * i / rate);
+		}
+		return 2.0 * std::hypot(re, im) / static_cast<double>(frames);
+	}
+
+	Notes noteA() {
+		Note note;
+		note.begin = 0.0;
+		note.end = 10.0;
+		note.type = Note::Type::NORMAL;
+		note.note = 57.0f;  // Played as A3 (220 Hz), with overtones at 440 and 880 Hz
+		return Notes{ note };
+	}
+}
+
+TEST(UnitTest_Synth, tone_keeps_its_pitch_at_every_rate) {
+	for (auto const rate : {44100u, 48000u, 96000u}) {
+		auto synth = Synth(noteA(), rate);
+		auto out = std::vector<float>(2 * rate / 4);  // A quarter of a second
+
+		synth(out.data(), out.data() + out.size(), 1.0);
+
+		EXPECT_NEAR(0.2, amplitudeAt(out, 440.0, rate), 0.01) << rate << " Hz";
+		// Generated for 44.1 kHz but played at 48 kHz (or the other way around), the tone would be off by 9 %
+		for (auto const ratio : {44100.0 / 48000.0, 48000.0 / 44100.0}) {
+			EXPECT_NEAR(0.0, amplitudeAt(out, 440.0 * ratio, rate), 0.02) << rate << " Hz";
+		}
+	}
+}
+
+TEST(UnitTest_Synth, only_turns_the_music_down_outside_notes) {
+	auto synth = Synth(noteA(), 48000);
+	auto out = std::vector<float>(2 * 256, 1.0f);
+
+	synth(out.data(), out.data() + out.size(), 20.0);
+
+	EXPECT_THAT(out, ::testing::Each(FloatEq(0.3f)));
+}
@@ -0,0 +1,181 @@
+#include "common.hh"
+#include "allocationcounter.hh"
+#include "benchmark.hh"
+
+#include "game/analyzer.hh"
+#include "game/yinpitchdetector.hh"
+
+#include <vector>
+
+namespace {
+	/// Sine wave or, with harmonics > 1, a crude voice: a harmonic series with the first formants of an open vowel.
+	std::vector<float> makeVoice(double frequency, std::size_t size, unsigned harmonics = 1, double vibrato = 0.0, double rate = 48000.0) {
+		auto data = std::vector<float>(size);
+		auto phase = 0.0;
+		auto seed = 12345u;
+		for (auto n = 0u; n < size; ++n) {
+			auto const f = frequency * std::pow(2.0, vibrato / 1200.0 * std::sin(pi2 * 5.5 * n / rate));
+			phase += f / rate;
+			auto s = 0.0;
+			for (auto h = 1u; h <= harmonics && h * f < 5000.0; ++h) {
+				auto const hf = h * f;
+				auto const formants = harmonics == 1 ? 1.0 : 1.0 + 2.0 * std::exp(-std::pow((hf - 700.0) / 150.0, 2)) + 1.5 * std::exp(-std::pow((hf - 1200.0) / 200.0, 2));
+				s += formants / std::pow(h, 1.2) * std::sin(pi2 * h * phase);
+			}
+			seed = seed * 1103515245u + 12345u;
+			auto const noise = static_cast<float>((seed >> 8) & 0xFFFF) / 65536.f - 0.5f;
+			data[n] = static_cast<float>(0.2 * s / (harmonics == 1 ? 1.0 : 2.0)) + (harmonics == 1 ? 0.f : 0.01f * noise);
+		}
+		return data;
+	}
+
+	std::vector<Tone> detect(YinPitchDetector& yin, std::vector<float> const& pcm) {
+		auto tones = std::vector<Tone>();
+		yin.analyze(pcm.data(), tones);
+		return tones;
+	}
+}
+
+TEST(UnitTest_YinPitchDetector, frameSize) {
+	EXPECT_EQ(480u + 739u, YinPitchDetector(48000).frameSize());
+	EXPECT_EQ(441u + 679u, YinPitchDetector(44100).frameSize());
+	EXPECT_EQ(960u + 1477u, YinPitchDetector(96000).frameSize());  // Same lowest pitch, with a larger FFT
+	EXPECT_THROW(YinPitchDetector(384000), std::invalid_argument);
+}
+
+TEST(UnitTest_YinPitchDetector, silence) {
+	auto yin = YinPitchDetector(48000);
+
+	EXPECT_THAT(detect(yin, std::vector<float>(yin.frameSize())), IsEmpty());
+}
+
+TEST(UnitTest_YinPitchDetector, sines) {
+	auto yin = YinPitchDetector(48000);
+
+	for (auto const frequency : {70.0, 82.4, 110.0, 220.0, 440.0, 880.0, 1200.0}) {
+		auto const tones = detect(yin, makeVoice(frequency, yin.frameSize()));
+
+		ASSERT_EQ(1u, tones.size()) << frequency << " Hz";
+		EXPECT_NEAR(frequency, tones.front().freq, 0.002 * frequency);
+		EXPECT_NEAR(tones.front().db, 20.0 * std::log10(0.2 * 0.53836 / 2.0), 1.0);
+	}
+}
+
+TEST(UnitTest_YinPitchDetector, low_sines_at_high_rates) {
+	for (auto const rate : {96000.0, 192000.0}) {
+		auto yin = YinPitchDetector(rate);
+
+		for (auto const frequency : {66.0, 70.0, 82.4}) {
+			auto const tones = detect(yin, makeVoice(frequency, yin.frameSize(), 1, 0.0, rate));
+
+			ASSERT_EQ(1u, tones.size()) << frequency << " Hz at " << rate;
+			EXPECT_NEAR(frequency, tones.front().freq, 0.002 * frequency) << rate;
+		}
+	}
+}
+
+TEST(UnitTest_YinPitchDetector, voice_without_octave_errors) {
+	for (auto const rate : {44100.0, 48000.0, 96000.0}) {
+		auto yin = YinPitchDetector(rate);
+
+		for (auto const frequency : {98.0, 147.0, 220.0, 330.0, 494.0, 659.0}) {
+			auto const tones = detect(yin, makeVoice(frequency, yin.frameSize(), 40, 0.0, rate));
+
+			ASSERT_EQ(1u, tones.size()) << frequency << " Hz at " << rate;
+			EXPECT_NEAR(frequency, tones.front().freq, 0.005 * frequency) << rate;
+		}
+	}
+}
+
+TEST(UnitTest_YinPitchDetector, analyze_does_not_allocate) {
+	auto yin = YinPitchDetector(48000);
+	auto const pcm = makeVoice(220.0, yin.frameSize(), 20);
+	auto tones = std::vector<Tone>();
+	tones.reserve(1);
+
+	AllocationCounter allocations;
+	yin.analyze(pcm.data(), tones);
+
+	EXPECT_THAT(allocations.count(), 0);
+	EXPECT_THAT(tones, Contains(220.0));
+}
+
+TEST(UnitTest_YinPitchDetector, analyzer_with_yin) {
+	auto analyzer = Analyzer(48000, "blue", 200, PitchMethod::YIN);
+	auto const data = makeVoice(196.0, 4800, 30, 20.0);
+
+	analyzer.input(data.begin(), data.end());
+	analyzer.process();
+
+	EXPECT_EQ(PitchMethod::YIN, analyzer.getPitchMethod());
+	EXPECT_THAT(analyzer.getTones(), ElementsAre(196.0));
+	ASSERT_THAT(analyzer.findTone(), NotNull());
+	EXPECT_NEAR(196.0, analyzer.findTone()->freq, 4.0);
+	EXPECT_THAT(analyzer.findTone()->age, Gt(Tone::MINAGE));
+}
+
+TEST(UnitTest_YinPitchDetector, parsePitchMethod) {
+	EXPECT_EQ(PitchMethod::FFT, parsePitchMethod("fft"));
+	EXPECT_EQ(PitchMethod::YIN, parsePitchMethod("YIN"));
+	EXPECT_THROW(parsePitchMethod("mpm"), std::runtime_error);
+}
+
+namespace {
+	struct DetectorStats {
+		double latency = 0.0;  ///< Seconds from voice onset until findTone() reports the right note
+		double octaveErrors = 0.0;  ///< Fraction of detections more than half an octave off
+		double cpuPerFrame = 0.0;  ///< Microseconds per analysis frame
+	};
+
+	DetectorStats measure(PitchMethod method, double frequency) {
+		constexpr double rate = 48000.0;
+		constexpr std::size_t chunk = 64;  // Typical capture callback size
+		auto stats = DetectorStats();
+		auto analyzer = Analyzer(rate, "blue", 200, method);
+		auto const silence = std::vector<float>(4800);
+		auto const voice = makeVoice(frequency, 96000, 40, 30.0);
+		analyzer.input(silence.begin(), silence.end());
+		analyzer.process();
+		// Feed the voice in small chunks and look for the first correct result
+		auto errors = 0u, detections = 0u;
+		stats.latency = getNaN();
+		for (auto pos = 0u; pos + chunk <= voice.size(); pos += chunk) {
+			analyzer.input(voice.begin() + pos, voice.begin() + pos + chunk);
+			analyzer.process();
+			auto const tone = analyzer.findTone();
+			if (!tone) continue;
+			auto const cents = 1200.0 * std::log2(tone->freq / frequency);
+			if (std::isnan(stats.latency) && std::abs(cents) < 50.0) stats.latency = static_cast<double>(pos + chunk) / rate;
+			if (pos < rate / 5) continue;  // Count errors only on the steady part
+			++detections;
+			if (std::abs(cents) > 600.0) ++errors;
+		}
+		stats.octaveErrors = detections ? static_cast<double>(errors) / detections : 1.0;
+		// Processing cost on a steady stream: 10 ms of input per call
+		auto const block = std::vector<float>(voice.begin(), voice.begin() + 4800);
+		stats.cpuPerFrame = benchmark([&] {
+			analyzer.input(block.begin(), block.end());
+			analyzer.process();
+		}, 200) / (4800.0 / 200.0);
+		return stats;
+	}
+}
+
+TEST(UnitTest_YinPitchDetector, DISABLED_Benchmark_against_fft) {
+	for (auto const method : {PitchMethod::FFT, PitchMethod::YIN}) {
+		auto const name = std::string(method == PitchMethod::FFT ? "fft" : "yin");
+		auto latency = 0.0, errors = 0.0, cpu = 0.0;
+		auto const frequencies = {98.0, 147.0, 220.0, 330.0, 494.0, 659.0};
+		for (auto const frequency : frequencies) {
+			auto const stats = measure(method, frequency);
+			report(name + ", latency to stable pitch at " + std::to_string(int(frequency)) + " Hz", stats.latency * 1000.0, "ms");
+			latency += stats.latency;
+			errors += stats.octaveErrors;
+			cpu += stats.cpuPerFrame;
+		}
+		auto const count = static_cast<double>(frequencies.size());
+		report(name + ", mean latency to stable pitch", latency / count * 1000.0, "ms");
+		report(name + ", octave error rate", errors / count * 100.0, "%");
+		report(name + ", CPU per frame", cpu / count);
+	}
+}
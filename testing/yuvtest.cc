@@ -0,0 +1,141 @@
+#include "common.hh"
+#include "benchmark.hh"
+
+#include "game/yuv.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace {
+	/// Convert 8-bit YUV values as the shader does (texture values are n / 255)
+	std::array<float, 3> rgb(yuv::Encoding encoding, int y, int u, int v) {
+		auto const c = yuv::toRgb(encoding);
+		std::array<float, 3> result;
+		for (std::size_t i = 0; i < 3; ++i) result[i] = c[i][0] * float(y) / 255.0f + c[i][1] * float(u) / 255.0f + c[i][2] * float(v) / 255.0f + c[i][3];
+		return result;
+	}
+
+	/// A frame as FFmpeg gives it: planes with padded rows
+	struct Frame {
+		yuv::Planes420 planes;
+		int stride[3];
+		std::vector<unsigned char> data[3];
+		Frame(unsigned width, unsigned height): planes{ width, height } {
+			for (unsigned i = 0; i < 3; ++i) {
+				stride[i] = static_cast<int>((planes.planeWidth(i) + 63) / 64 * 64);
+				data[i].resize(static_cast<std::size_t>(stride[i]) * planes.planeHeight(i));
+				for (std::size_t j = 0; j < data[i].size(); ++j) data[i][j] = static_cast<unsigned char>(j * 7 + i);
+			}
+		}
+	};
+}
+
+TEST(UnitTest_Yuv, tv_range_black_and_white) {
+	for (auto const matrix: { yuv::Matrix::BT601, yuv::Matrix::BT709 }) {
+		yuv::Encoding const encoding{ matrix, false };
+		EXPECT_THAT(rgb(encoding, 16, 128, 128), ElementsAre(FloatNear(0.0f, 1e-5f), FloatNear(0.0f, 1e-5f), FloatNear(0.0f, 1e-5f)));
+		EXPECT_THAT(rgb(encoding, 235, 128, 128), ElementsAre(FloatNear(1.0f, 1e-5f), FloatNear(1.0f, 1e-5f), FloatNear(1.0f, 1e-5f)));
+	}
+}
+
+TEST(UnitTest_Yuv, full_range_black_and_white) {
+	yuv::Encoding const encoding{ yuv::Matrix::BT601, true };
+	EXPECT_THAT(rgb(encoding, 0, 128, 128), ElementsAre(FloatNear(0.0f, 1e-5f), FloatNear(0.0f, 1e-5f), FloatNear(0.0f, 1e-5f)));
+	EXPECT_THAT(rgb(encoding, 255, 128, 128), ElementsAre(FloatNear(1.0f, 1e-5f), FloatNear(1.0f, 1e-5f), FloatNear(1.0f, 1e-5f)));
+}
+
+TEST(UnitTest_Yuv, primary_colors) {
+	// 8-bit TV range values of the primaries, which are rounded (hence the tolerance)
+	yuv::Encoding const bt601{ yuv::Matrix::BT601, false };
+	EXPECT_THAT(rgb(bt601, 81, 90, 240), ElementsAre(FloatNear(1.0f, 0.01f), FloatNear(0.0f, 0.01f), FloatNear(0.0f, 0.01f)));
+	EXPECT_THAT(rgb(bt601, 145, 54, 34), ElementsAre(FloatNear(0.0f, 0.01f), FloatNear(1.0f, 0.01f), FloatNear(0.0f, 0.01f)));
+	EXPECT_THAT(rgb(bt601, 41, 240, 110), ElementsAre(FloatNear(0.0f, 0.01f), FloatNear(0.0f, 0.01f), FloatNear(1.0f, 0.01f)));
+	yuv::Encoding const bt709{ yuv::Matrix::BT709, false };
+	EXPECT_THAT(rgb(bt709, 63, 102, 240), ElementsAre(FloatNear(1.0f, 0.01f), FloatNear(0.0f, 0.01f), FloatNear(0.0f, 0.01f)));
+	EXPECT_THAT(rgb(bt709, 173, 42, 26), ElementsAre(FloatNear(0.0f, 0.01f), FloatNear(1.0f, 0.01f), FloatNear(0.0f, 0.01f)));
+	EXPECT_THAT(rgb(bt709, 32, 240, 118), ElementsAre(FloatNear(0.0f, 0.01f), FloatNear(0.0f, 0.01f), FloatNear(1.0f, 0.01f)));
+}
+
+TEST(UnitTest_Yuv, scale_to_cover) {
+	auto const size = [](yuv::Planes420 p) { return std::make_pair(p.width, p.height); };
+	EXPECT_EQ(std::make_pair(1280u, 720u), size(yuv::scaleToCover({ 3840, 2160 }, 1280, 720)));
+	// Wider than the area: the height covers it
+	EXPECT_EQ(std::make_pair(1728u, 720u), size(yuv::scaleToCover({ 1920, 800 }, 960, 720)));
+	// Narrower: the width does, rounded up to even sizes
+	EXPECT_EQ(std::make_pair(1000u, 1334u), size(yuv::scaleToCover({ 3000, 4001 }, 1000, 720)));
+	// Not scaled up, nor if either dimension is not larger
+	EXPECT_EQ(std::make_pair(640u, 480u), size(yuv::scaleToCover({ 640, 480 }, 1280, 720)));
+	EXPECT_EQ(std::make_pair(1280u, 2000u), size(yuv::scaleToCover({ 1280, 2000 }, 1366, 768)));
+	EXPECT_EQ(std::make_pair(1001u, 1001u), size(yuv::scaleToCover({ 1001, 1001 }, 0, 0)));
+	EXPECT_EQ(std::make_pair(100u, 100u), size(yuv::scaleToCover({ 1001, 1001 }, 100, 100)));
+}
+
+TEST(UnitTest_Yuv, planes_of_odd_size) {
+	yuv::Planes420 const planes{ 5, 3 };
+
+	EXPECT_EQ(3u, planes.planeWidth(1));
+	EXPECT_EQ(2u, planes.planeHeight(2));
+	EXPECT_EQ(0u, planes.offset(0));
+	EXPECT_EQ(15u, planes.offset(1));
+	EXPECT_EQ(21u, planes.offset(2));
+	EXPECT_EQ(27u, planes.size());
+}
+
+TEST(UnitTest_Yuv, copies_planes_without_padding) {
+	Frame const frame(5, 3);
+	std::vector<unsigned char> out(frame.planes.size());
+
+	for (unsigned i = 0; i < 3; ++i) {
+		yuv::copyPlane(out.data() + frame.planes.offset(i), frame.data[i].data(), frame.stride[i], frame.planes.planeWidth(i), frame.planes.planeHeight(i));
+	}
+
+	for (unsigned i = 0; i < 3; ++i) {
+		for (unsigned y = 0; y < frame.planes.planeHeight(i); ++y) {
+			for (unsigned x = 0; x < frame.planes.planeWidth(i); ++x) {
+				EXPECT_EQ(frame.data[i][y * static_cast<unsigned>(frame.stride[i]) + x], out[frame.planes.offset(i) + y * frame.planes.planeWidth(i) + x]);
+			}
+		}
+	}
+}
+
+TEST(UnitTest_Yuv, copies_bottom_up_planes) {
+	std::vector<unsigned char> const rows{ 1, 2, 0, 3, 4, 0 };  // Two rows of two, with a stride of three
+	std::vector<unsigned char> out(4);
+
+	yuv::copyPlane(out.data(), rows.data() + 3, -3, 2, 2);
+
+	EXPECT_THAT(out, ElementsAre(3, 4, 1, 2));
+}
+
+TEST(UnitTest_Yuv, DISABLED_Benchmark_frame_preparation) {
+	// CPU time per 1080p frame in the decoder thread: converting to packed RGB (as before, here with a scalar
+	// stand-in for sws_scale) versus copying the planes for the shader to convert
+	Frame const frame(1920, 1080);
+	auto const& planes = frame.planes;
+	std::vector<unsigned char> out(std::size_t{ planes.width } * planes.height * 3);
+	auto const c = yuv::toRgb(yuv::Encoding{ yuv::Matrix::BT709, false });
+	report("convert to RGB", benchmark([&] {
+		unsigned char* dst = out.data();
+		for (unsigned y = 0; y < planes.height; ++y) {
+			unsigned char const* row[3];
+			for (unsigned i = 0; i < 3; ++i) row[i] = frame.data[i].data() + static_cast<std::size_t>(frame.stride[i]) * (i ? y / 2 : y);
+			for (unsigned x = 0; x < planes.width; ++x) {
+				float const yuv[3] = { float(row[0][x]) / 255.0f, float(row[1][x / 2]) / 255.0f, float(row[2][x / 2]) / 255.0f };
+				for (std::size_t i = 0; i < 3; ++i) {
+					float const value = c[i][0] * yuv[0] + c[i][1] * yuv[1] + c[i][2] * yuv[2] + c[i][3];
+					*dst++ = static_cast<unsigned char>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+				}
+			}
+		}
+	}, 20), "us/frame");
+	report("copy planes", benchmark([&] {
+		for (unsigned i = 0; i < 3; ++i) {
+			yuv::copyPlane(out.data() + planes.offset(i), frame.data[i].data(), frame.stride[i], planes.planeWidth(i), planes.planeHeight(i));
+		}
+	}, 200), "us/frame");
+	std::size_t const rgbBytes = out.size(), yuvBytes = planes.size();
+	report("bytes uploaded per frame, RGB", static_cast<double>(rgbBytes), "bytes");
+	report("bytes uploaded per frame, YUV", static_cast<double>(yuvBytes), "bytes");
+}